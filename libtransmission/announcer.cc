@@ -372,6 +372,15 @@ static void tier_build_log_name(tr_tier const* tier, char* buf, size_t buflen)
     tr_snprintf(buf, buflen, "[%s---%" TR_PRIsv "]", name, TR_PRIsv_ARG(key_sv));
 }
 
+/* lets RPC clients that poll for changes know that the tier's tracker stats are different */
+static void tierMarkChanged(tr_tier* tier)
+{
+    if (tier->tor != nullptr)
+    {
+        tier->tor->markFieldsChanged(TR_FIELDS_TRACKERS);
+    }
+}
+
 static void tierIncrementTracker(tr_tier* tier)
 {
     /* move our index to the next tracker in the tier */
@@ -725,6 +734,7 @@ static void tier_announce_event_push(tr_tier* tier, tr_announce_event e, time_t
     tier->announceAt = announceAt;
     tier->announce_events[tier->announce_event_count++] = e;
     tier_update_announce_priority(tier);
+    tierMarkChanged(tier);
 
     dbgmsg_tier_announce_queue(tier);
     dbgmsg(tier, "announcing in %d seconds", (int)difftime(announceAt, tr_time()));
@@ -958,6 +968,7 @@ static void on_announce_done(tr_announce_response const* response, void* vdata)
         tier->lastAnnounceSucceeded = false;
         tier->isAnnouncing = false;
         tier->manualAnnounceAllowedAt = now + tier->announceMinIntervalSec;
+        tierMarkChanged(tier);
 
         if (!response->did_connect)
         {
@@ -1159,6 +1170,7 @@ static void tierAnnounce(tr_announcer* announcer, tr_tier* tier)
 
     tier->isAnnouncing = true;
     tier->lastAnnounceStartTime = now;
+    tierMarkChanged(tier);
 
     announce_request_delegate(announcer, req, on_announce_done, data);
 }
@@ -1311,6 +1323,7 @@ static void on_scrape_done(tr_scrape_response const* response, void* vsession)
                 tier->lastScrapeTime = now;
                 tier->lastScrapeSucceeded = false;
                 tier->lastScrapeTimedOut = response->did_timeout;
+                tierMarkChanged(tier);
 
                 if (!response->did_connect)
                 {
@@ -1422,6 +1435,7 @@ static void multiscrape(tr_announcer* announcer, std::vector<tr_tier*> const& ti
             ++req->info_hash_count;
             tier->isScraping = true;
             tier->lastScrapeStartTime = now;
+            tierMarkChanged(tier);
             found = true;
         }
 
@@ -1436,6 +1450,7 @@ static void multiscrape(tr_announcer* announcer, std::vector<tr_tier*> const& ti
             ++req->info_hash_count;
             tier->isScraping = true;
             tier->lastScrapeStartTime = now;
+            tierMarkChanged(tier);
         }
     }
 
@@ -1790,6 +1805,7 @@ void tr_announcerResetTorrent(tr_announcer* /*announcer*/, tr_torrent* tor)
 
     /* create the new tiers / trackers */
     addTorrentToTier(tt, tor);
+    tor->markFieldsChanged(TR_FIELDS_TRACKERS);
 
     /* copy the old tiers' states into their replacements */
     for (int i = 0; i < old.tier_count; ++i)
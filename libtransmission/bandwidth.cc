@@ -7,6 +7,8 @@
  */
 
 #include <algorithm>
+#include <limits>
+#include <utility>
 #include <vector>
 
 #include "transmission.h"
@@ -163,44 +165,39 @@ void Bandwidth::allocateBandwidth(
     }
 }
 
-void Bandwidth::phaseOne(std::vector<tr_peerIo*>& peerArray, tr_direction dir)
+void Bandwidth::phaseOne(std::vector<std::pair<tr_peerIo*, size_t>>& peers, tr_direction dir)
 {
     /* First phase of IO. Tries to distribute bandwidth fairly to keep faster
-     * peers from starving the others. Loop through the peers, giving each a
-     * small chunk of bandwidth. Keep looping until we run out of bandwidth
+     * peers from starving the others. Loop through the peers, giving each
+     * its quantum of bandwidth. Keep looping until we run out of bandwidth
      * and/or peers that can use it */
-    dbgmsg("%lu peers to go round-robin for %s", peerArray.size(), dir == TR_UP ? "upload" : "download");
+    dbgmsg("%zu peers to go round-robin for %s", std::size(peers), dir == TR_UP ? "upload" : "download");
 
-    size_t n = peerArray.size();
-    while (n > 0)
+    if (std::empty(peers))
     {
-        int const i = tr_rand_int_weak(n); /* pick a peer at random */
-
-        /* value of 3000 bytes chosen so that when using uTP we'll send a full-size
-         * frame right away and leave enough buffered data for the next frame to go
-         * out in a timely manner. */
-        size_t const increment = 3000;
-
-        int const bytes_used = tr_peerIoFlush(peerArray[i], dir, increment);
+        return;
+    }
 
-        dbgmsg("peer #%d of %zu used %d bytes in this pass", i, n, bytes_used);
+    auto const first = size_t(tr_rand_int_weak(std::size(peers)));
 
-        if (bytes_used != int(increment))
+    roundRobin(
+        peers,
+        first,
+        [dir](tr_peerIo* io, size_t quantum)
         {
-            /* peer is done writing for now; move it to the end of the list */
-            std::swap(peerArray[i], peerArray[n - 1]);
-            --n;
-        }
-    }
+            int const bytes_used = tr_peerIoFlush(io, dir, quantum);
+            dbgmsg("peer %p used %d of %zu bytes in this pass", (void*)io, bytes_used, quantum);
+            return bytes_used;
+        });
 }
 
 void Bandwidth::allocate(tr_direction dir, unsigned int period_msec)
 {
     TR_ASSERT(tr_isDirection(dir));
 
-    auto high = std::vector<tr_peerIo*>{};
-    auto low = std::vector<tr_peerIo*>{};
-    auto normal = std::vector<tr_peerIo*>{};
+    auto high = std::vector<std::pair<tr_peerIo*, size_t>>{};
+    auto low = std::vector<std::pair<tr_peerIo*, size_t>>{};
+    auto normal = std::vector<std::pair<tr_peerIo*, size_t>>{};
     auto tmp = std::vector<tr_peerIo*>{};
 
     /* allocateBandwidth () is a helper function with two purposes:
@@ -208,29 +205,37 @@ void Bandwidth::allocate(tr_direction dir, unsigned int period_msec)
      * 2. accumulate an array of all the peerIos from b and its subtree. */
     this->allocateBandwidth(TR_PRI_LOW, dir, period_msec, tmp);
 
+    auto const now = tr_time_msec();
+    auto const n_peers = std::max(std::size(tmp), size_t{ 1 });
+
     for (auto* io : tmp)
     {
         tr_peerIoRef(io);
         tr_peerIoFlushOutgoingProtocolMsgs(io);
 
+        // size the peer's quantum to its recent speed, capped at its share of what it's allowed to use
+        auto const allowed = io->bandwidth->clamp(dir, std::numeric_limits<unsigned int>::max());
+        auto const speed = io->bandwidth->getRawSpeedBytesPerSecond(now, dir);
+        auto const entry = std::make_pair(io, getQuantum(speed, period_msec, allowed / n_peers));
+
         switch (io->priority)
         {
         case TR_PRI_HIGH:
-            high.push_back(io);
+            high.push_back(entry);
             [[fallthrough]];
 
         case TR_PRI_NORMAL:
-            normal.push_back(io);
+            normal.push_back(entry);
             [[fallthrough]];
 
         default:
-            low.push_back(io);
+            low.push_back(entry);
         }
     }
 
     /* First phase of IO. Tries to distribute bandwidth fairly to keep faster
      * peers from starving the others. Loop through the peers, giving each a
-     * small chunk of bandwidth. Keep looping until we run out of bandwidth
+     * quantum of bandwidth. Keep looping until we run out of bandwidth
      * and/or peers that can use it */
     phaseOne(high, dir);
     phaseOne(normal, dir);
@@ -12,8 +12,11 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <algorithm>
 #include <array>
 #include <cstddef> // size_t
+#include <cstdint>
+#include <utility>
 #include <vector>
 
 #include "transmission.h"
@@ -203,6 +206,66 @@ public:
         return this->band_[direction].honor_parent_limits_;
     }
 
+    /* value of 3000 bytes chosen so that when using uTP we'll send a full-size
+     * frame right away and leave enough buffered data for the next frame to go
+     * out in a timely manner. */
+    static constexpr size_t MinQuantum = 3000U;
+    static constexpr size_t MaxQuantum = 1024U * 1024U;
+
+    /**
+     * @brief Sizes the chunk of bandwidth a peer is offered in each round of allocate()'s round robin.
+     *
+     * A peer that keeps up its recent speed gets the whole period's worth of
+     * bytes in a single flush, so fast peers don't need hundreds of small
+     * flushes per period. The quantum is capped at `fair_share` so that
+     * when bandwidth is limited, a fast peer can't take more than its share
+     * of it before the other peers get their turn.
+     */
+    [[nodiscard]] static constexpr size_t getQuantum(uint64_t speed_bps, unsigned int period_msec, size_t fair_share)
+    {
+        auto const wanted = static_cast<size_t>(speed_bps * period_msec / 1000U);
+        return std::clamp(std::min(wanted, fair_share), MinQuantum, MaxQuantum);
+    }
+
+    /**
+     * @brief Hands out bandwidth to `peers` in weighted round robin.
+     *
+     * Each round, every peer is offered its quantum via `flush(peer, quantum)`,
+     * which returns how many bytes the peer used. A peer that uses less than
+     * it was offered is done for this period and drops out. Since peers can
+     * use any number of bytes, there's never a deficit to carry over into the
+     * next round, so this is deficit round robin in its simplest form.
+     *
+     * `first` is the peer to start with, so that no peer is always served first.
+     */
+    template<typename Peer, typename FlushFunc>
+    static void roundRobin(std::vector<std::pair<Peer, size_t>>& peers, size_t first, FlushFunc flush)
+    {
+        auto n = std::size(peers);
+        auto i = first;
+
+        while (n > 0)
+        {
+            if (i >= n)
+            {
+                i = 0;
+            }
+
+            auto const& [peer, quantum] = peers[i];
+
+            if (size_t(flush(peer, quantum)) == quantum)
+            {
+                ++i;
+            }
+            else
+            {
+                /* peer is done for now; move it to the end of the list */
+                std::swap(peers[i], peers[n - 1]);
+                --n;
+            }
+        }
+    }
+
     static constexpr size_t HistoryMSec = 2000U;
     static constexpr size_t IntervalMSec = HistoryMSec;
     static constexpr size_t GranularityMSec = 200;
@@ -238,7 +301,7 @@ private:
 
     [[nodiscard]] unsigned int clamp(uint64_t now, tr_direction dir, unsigned int byte_count) const;
 
-    static void phaseOne(std::vector<tr_peerIo*>& peer_array, tr_direction dir);
+    static void phaseOne(std::vector<std::pair<tr_peerIo*, size_t>>& peers, tr_direction dir);
 
     void allocateBandwidth(
         tr_priority_t parent_priority,
@@ -7,6 +7,7 @@
  */
 
 #include <algorithm>
+#include <bitset>
 #include <vector>
 
 #include "transmission.h"
@@ -22,32 +23,72 @@
 namespace
 {
 
+auto constexpr AllOnes = ~uint64_t{};
+
 constexpr size_t getBytesNeeded(size_t bit_count)
 {
     return (bit_count >> 3) + ((bit_count & 7) != 0 ? 1 : 0);
 }
 
-void setAllTrue(uint8_t* array, size_t bit_count)
+constexpr size_t getWordsNeeded(size_t bit_count)
 {
-    uint8_t constexpr Val = 0xFF;
-    size_t const n = getBytesNeeded(bit_count);
+    return (bit_count >> 6) + ((bit_count & 63) != 0 ? 1 : 0);
+}
 
-    if (n > 0)
+// the bit's mask in its word. Bits go from high to low, like in BEP0003
+constexpr uint64_t bitMask(size_t bit)
+{
+    return uint64_t{ 1 } << (63 - (bit & 63));
+}
+
+// mask of the bits in `begin`'s word that are at or after `begin`
+constexpr uint64_t headMask(size_t begin)
+{
+    return AllOnes >> (begin & 63);
+}
+
+// mask of the bits in `end - 1`'s word that are before `end`
+constexpr uint64_t tailMask(size_t end)
+{
+    return AllOnes << (63 - ((end - 1) & 63));
+}
+
+size_t popcount(uint64_t word)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return size_t(__builtin_popcountll(word));
+#else
+    return std::bitset<64>{ word }.count();
+#endif
+}
+
+// index of the highest set bit, counting from the high end. `word` must be nonzero
+size_t countLeadingZeros(uint64_t word)
+{
+    TR_ASSERT(word != 0);
+
+#if defined(__GNUC__) || defined(__clang__)
+    return size_t(__builtin_clzll(word));
+#else
+    size_t n = 0;
+    for (auto mask = uint64_t{ 1 } << 63; (word & mask) == 0; mask >>= 1)
     {
-        std::fill_n(array, n, Val);
-        array[n - 1] = Val << (n * 8 - bit_count);
+        ++n;
     }
+    return n;
+#endif
 }
 
-constexpr int8_t const trueBitCount[256] = {
-    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 1, 2, 2, 3, 2,
-    3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3,
-    3, 4, 3, 4, 4, 5, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5,
-    6, 3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, 3, 3, 4,
-    3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 3, 4, 4, 5, 4, 5, 5, 6, 4,
-    5, 5, 6, 5, 6, 6, 7, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6,
-    6, 7, 3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, 4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8
-};
+void setAllTrue(std::vector<uint64_t>& words, size_t bit_count)
+{
+    size_t const n = getWordsNeeded(bit_count);
+
+    if (n > 0)
+    {
+        std::fill_n(std::begin(words), n, AllOnes);
+        words[n - 1] = tailMask(bit_count);
+    }
+}
 
 } // namespace
 
@@ -59,9 +100,9 @@ size_t tr_bitfield::countFlags() const
 {
     size_t ret = 0;
 
-    for (auto ch : flags_)
+    for (auto const word : flags_)
     {
-        ret += trueBitCount[ch];
+        ret += popcount(word);
     }
 
     return ret;
@@ -69,65 +110,38 @@ size_t tr_bitfield::countFlags() const
 
 size_t tr_bitfield::countFlags(size_t begin, size_t end) const
 {
-    size_t ret = 0;
-    size_t const first_byte = begin >> 3U;
-    size_t const last_byte = (end - 1) >> 3U;
-
-    if (bit_count_ == 0)
+    if (bit_count_ == 0 || begin >= end)
     {
         return 0;
     }
 
-    if (first_byte >= std::size(flags_))
+    size_t const first_word = begin >> 6;
+    size_t const last_word = (end - 1) >> 6;
+
+    if (first_word >= std::size(flags_))
     {
         return 0;
     }
 
-    TR_ASSERT(begin < end);
-    TR_ASSERT(!std::empty(flags_));
-
-    if (first_byte == last_byte)
+    if (first_word == last_word)
     {
-        uint8_t val = flags_[first_byte];
-
-        int i = begin - (first_byte * 8);
-        val <<= i;
-        val >>= i;
-        i = (last_byte + 1) * 8 - end;
-        val >>= i;
-        val <<= i;
-
-        ret += trueBitCount[val];
+        return popcount(flags_[first_word] & headMask(begin) & tailMask(end));
     }
-    else
-    {
-        size_t const walk_end = std::min(std::size(flags_), last_byte);
 
-        /* first byte */
-        size_t const first_shift = begin - (first_byte * 8);
-        uint8_t val = flags_[first_byte];
-        val <<= first_shift;
-        val >>= first_shift;
-        ret += trueBitCount[val];
+    size_t ret = popcount(flags_[first_word] & headMask(begin));
 
-        /* middle bytes */
-        for (size_t i = first_byte + 1; i < walk_end; ++i)
-        {
-            ret += trueBitCount[flags_[i]];
-        }
+    size_t const walk_end = std::min(std::size(flags_), last_word);
+    for (size_t i = first_word + 1; i < walk_end; ++i)
+    {
+        ret += popcount(flags_[i]);
+    }
 
-        /* last byte */
-        if (last_byte < std::size(flags_))
-        {
-            size_t const last_shift = (last_byte + 1) * 8 - end;
-            val = flags_[last_byte];
-            val >>= last_shift;
-            val <<= last_shift;
-            ret += trueBitCount[val];
-        }
+    if (last_word < std::size(flags_))
+    {
+        ret += popcount(flags_[last_word] & tailMask(end));
     }
 
-    TR_ASSERT(ret <= (begin - end));
+    TR_ASSERT(ret <= (end - begin));
     return ret;
 }
 
@@ -148,13 +162,12 @@ size_t tr_bitfield::count(size_t begin, size_t end) const
 
 bool tr_bitfield::testFlag(size_t n) const
 {
-    if (n >> 3U >= std::size(flags_))
+    if (n >> 6 >= std::size(flags_))
     {
         return false;
     }
 
-    bool ret = (flags_[n >> 3U] << (n & 7U) & 0x80) != 0;
-    return ret;
+    return (flags_[n >> 6] & bitMask(n)) != 0;
 }
 
 /***
@@ -168,18 +181,30 @@ bool tr_bitfield::isValid() const
 
 std::vector<uint8_t> tr_bitfield::raw() const
 {
-    auto const n = getBytesNeeded(bit_count_);
-
-    if (!std::empty(flags_))
-    {
-        return flags_;
-    }
-
+    // a bitfield whose size isn't known yet is as long as its bit array
+    auto const n = bit_count_ != 0 ? getBytesNeeded(bit_count_) : std::size(flags_) * 8;
     auto raw = std::vector<uint8_t>(n);
 
     if (hasAll())
     {
-        setAllTrue(std::data(raw), std::size(raw));
+        std::fill(std::begin(raw), std::end(raw), 0xFF);
+
+        if (auto const excess_bit_count = n * 8 - bit_count_; n > 0 && excess_bit_count != 0)
+        {
+            raw.back() <<= excess_bit_count;
+        }
+    }
+    else if (!hasNone())
+    {
+        // each word is its eight BEP0003 bytes, big-endian
+        for (size_t i = 0, n_words = std::min(std::size(flags_), getWordsNeeded(n * 8)); i < n_words; ++i)
+        {
+            auto const word = flags_[i];
+            for (size_t j = 0, byte = i * 8; j < 8 && byte < n; ++j, ++byte)
+            {
+                raw[byte] = uint8_t(word >> (56 - j * 8));
+            }
+        }
     }
 
     return raw;
@@ -189,15 +214,15 @@ void tr_bitfield::ensureBitsAlloced(size_t n)
 {
     bool const has_all = hasAll();
 
-    size_t const bytes_needed = has_all ? getBytesNeeded(std::max(n, true_count_)) : getBytesNeeded(n);
+    size_t const words_needed = has_all ? getWordsNeeded(std::max(n, true_count_)) : getWordsNeeded(n);
 
-    if (std::size(flags_) < bytes_needed)
+    if (std::size(flags_) < words_needed)
     {
-        flags_.resize(bytes_needed);
+        flags_.resize(words_needed);
 
         if (has_all)
         {
-            setAllTrue(std::data(flags_), true_count_);
+            setAllTrue(flags_, true_count_);
         }
     }
 }
@@ -216,7 +241,7 @@ bool tr_bitfield::ensureNthBitAlloced(size_t nth)
 
 void tr_bitfield::freeArray()
 {
-    flags_ = std::vector<uint8_t>{};
+    flags_ = std::vector<uint64_t>{};
 }
 
 void tr_bitfield::setTrueCount(size_t n)
@@ -288,19 +313,27 @@ void tr_bitfield::setHasAll()
 
 void tr_bitfield::setRaw(uint8_t const* raw, size_t byte_count)
 {
-    flags_ = std::vector<uint8_t>(raw, raw + byte_count);
+    flags_.assign(getWordsNeeded(byte_count * 8), 0);
+
+    // each word is its eight BEP0003 bytes, big-endian
+    for (size_t i = 0; i < byte_count; ++i)
+    {
+        flags_[i >> 3] |= uint64_t{ raw[i] } << (56 - (i & 7) * 8);
+    }
 
     // ensure any excess bits at the end of the array are set to '0'.
-    if (byte_count == getBytesNeeded(bit_count_))
+    if (bit_count_ != 0)
     {
-        int const excess_bit_count = byte_count * 8 - bit_count_;
+        auto const words_needed = getWordsNeeded(bit_count_);
 
-        TR_ASSERT(excess_bit_count >= 0);
-        TR_ASSERT(excess_bit_count <= 7);
+        if (std::size(flags_) > words_needed)
+        {
+            flags_.resize(words_needed);
+        }
 
-        if (excess_bit_count != 0)
+        if (std::size(flags_) == words_needed && (bit_count_ & 63) != 0)
         {
-            flags_.back() &= 0xff << excess_bit_count;
+            flags_.back() &= tailMask(bit_count_);
         }
     }
 
@@ -319,7 +352,7 @@ void tr_bitfield::setFromBools(bool const* flags, size_t n)
         if (flags[i])
         {
             ++trueCount;
-            flags_[i >> 3U] |= (0x80 >> (i & 7U));
+            flags_[i >> 6] |= bitMask(i);
         }
     }
 
@@ -340,12 +373,12 @@ void tr_bitfield::set(size_t nth, bool value)
 
     if (value)
     {
-        flags_[nth >> 3U] |= 0x80 >> (nth & 7U);
+        flags_[nth >> 6] |= bitMask(nth);
         incrementTrueCount(1);
     }
     else
     {
-        flags_[nth >> 3U] &= 0xff7f >> (nth & 7U);
+        flags_[nth >> 6] &= ~bitMask(nth);
         decrementTrueCount(1);
     }
 }
@@ -368,32 +401,30 @@ void tr_bitfield::setSpan(size_t begin, size_t end, bool value)
         return;
     }
 
-    --end;
-    if (!ensureNthBitAlloced(end))
+    if (!ensureNthBitAlloced(end - 1))
     {
         return;
     }
 
-    size_t walk = begin >> 3;
-    size_t const last_byte = end >> 3;
+    size_t walk = begin >> 6;
+    size_t const last_word = (end - 1) >> 6;
+    uint64_t const first_mask = headMask(begin);
+    uint64_t const last_mask = tailMask(end);
 
     if (value)
     {
-        unsigned char const first_mask = ~(0xff << (8 - (begin & 7)));
-        unsigned char const last_mask = 0xff << (7 - (end & 7));
-
-        if (walk == last_byte)
+        if (walk == last_word)
         {
             flags_[walk] |= first_mask & last_mask;
         }
         else
         {
             flags_[walk] |= first_mask;
-            flags_[last_byte] |= last_mask;
+            flags_[last_word] |= last_mask;
 
-            if (++walk < last_byte)
+            if (++walk < last_word)
             {
-                std::fill_n(std::begin(flags_) + walk, last_byte - walk, 0xff);
+                std::fill_n(std::begin(flags_) + walk, last_word - walk, AllOnes);
             }
         }
 
@@ -401,24 +432,183 @@ void tr_bitfield::setSpan(size_t begin, size_t end, bool value)
     }
     else
     {
-        unsigned char const first_mask = 0xff << (8 - (begin & 7));
-        unsigned char const last_mask = ~(0xff << (7 - (end & 7)));
-
-        if (walk == last_byte)
+        if (walk == last_word)
         {
-            flags_[walk] &= first_mask | last_mask;
+            flags_[walk] &= ~(first_mask & last_mask);
         }
         else
         {
-            flags_[walk] &= first_mask;
-            flags_[last_byte] &= last_mask;
+            flags_[walk] &= ~first_mask;
+            flags_[last_word] &= ~last_mask;
 
-            if (++walk < last_byte)
+            if (++walk < last_word)
             {
-                std::fill_n(std::begin(flags_) + walk, last_byte - walk, 0);
+                std::fill_n(std::begin(flags_) + walk, last_word - walk, 0);
             }
         }
 
         decrementTrueCount(old_count);
     }
 }
+
+/***
+****
+***/
+
+tr_bitfield& tr_bitfield::operator&=(tr_bitfield const& that)
+{
+    TR_ASSERT(bit_count_ == that.bit_count_);
+
+    if (hasNone() || that.hasAll())
+    {
+        return *this;
+    }
+
+    if (that.hasNone())
+    {
+        setHasNone();
+        return *this;
+    }
+
+    if (hasAll())
+    {
+        *this = that;
+        return *this;
+    }
+
+    auto const n = std::min(std::size(flags_), std::size(that.flags_));
+    for (size_t i = 0; i < n; ++i)
+    {
+        flags_[i] &= that.flags_[i];
+    }
+
+    std::fill(std::begin(flags_) + n, std::end(flags_), 0);
+
+    rebuildTrueCount();
+    return *this;
+}
+
+tr_bitfield& tr_bitfield::andNot(tr_bitfield const& that)
+{
+    TR_ASSERT(bit_count_ == that.bit_count_);
+
+    if (hasNone() || that.hasNone())
+    {
+        return *this;
+    }
+
+    if (that.hasAll())
+    {
+        setHasNone();
+        return *this;
+    }
+
+    // can't clear bits from "have all" until we know how many bits there are
+    if (bit_count_ == 0)
+    {
+        return *this;
+    }
+
+    ensureBitsAlloced(bit_count_);
+
+    auto const n = std::min(std::size(flags_), std::size(that.flags_));
+    for (size_t i = 0; i < n; ++i)
+    {
+        flags_[i] &= ~that.flags_[i];
+    }
+
+    rebuildTrueCount();
+    return *this;
+}
+
+bool tr_bitfield::intersects(tr_bitfield const& that) const
+{
+    if (hasNone() || that.hasNone())
+    {
+        return false;
+    }
+
+    if (hasAll())
+    {
+        return that.hasAll() || that.count() > 0;
+    }
+
+    if (that.hasAll())
+    {
+        return count() > 0;
+    }
+
+    auto const n = std::min(std::size(flags_), std::size(that.flags_));
+    for (size_t i = 0; i < n; ++i)
+    {
+        if ((flags_[i] & that.flags_[i]) != 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool tr_bitfield::hasAnyNotIn(tr_bitfield const& that) const
+{
+    if (hasNone() || that.hasAll())
+    {
+        return false;
+    }
+
+    if (hasAll())
+    {
+        return true;
+    }
+
+    if (that.hasNone())
+    {
+        return count() > 0;
+    }
+
+    for (size_t i = 0, n = std::size(flags_), n_that = std::size(that.flags_); i < n; ++i)
+    {
+        auto const that_word = i < n_that ? that.flags_[i] : uint64_t{};
+        if ((flags_[i] & ~that_word) != 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+size_t tr_bitfield::findNextSet(size_t begin) const
+{
+    auto const n = size();
+
+    if (begin >= n || hasNone())
+    {
+        return n;
+    }
+
+    if (hasAll())
+    {
+        return begin;
+    }
+
+    auto i = begin >> 6;
+    if (i >= std::size(flags_))
+    {
+        return n;
+    }
+
+    auto word = flags_[i] & headMask(begin);
+    while (word == 0)
+    {
+        if (++i == std::size(flags_))
+        {
+            return n;
+        }
+
+        word = flags_[i];
+    }
+
+    return std::min(n, (i << 6) + countLeadingZeros(word));
+}
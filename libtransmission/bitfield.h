@@ -36,6 +36,10 @@
  *
  * - "Have none" is another special case that has the same advantages
  *   and motivations as "Have all".
+ *
+ * - The bits are kept in 64-bit words, high bit first, so that counting
+ *   and comparing two bitfields (e.g. "does this peer have any piece
+ *   that I want?") are done a word at a time instead of a bit at a time.
  */
 class tr_bitfield
 {
@@ -96,10 +100,37 @@ public:
         return size() == 0;
     }
 
+    // bulk operations. These are meant for bitfields of the same size.
+
+    // clear the bits that aren't set in `that`
+    tr_bitfield& operator&=(tr_bitfield const& that);
+
+    // clear the bits that are set in `that`
+    tr_bitfield& andNot(tr_bitfield const& that);
+
+    // true if any bit is set in both bitfields
+    [[nodiscard]] bool intersects(tr_bitfield const& that) const;
+
+    // true if any bit is set here but not in `that`
+    [[nodiscard]] bool hasAnyNotIn(tr_bitfield const& that) const;
+
+    // returns the index of the first set bit at or after `begin`, or size() if there isn't one
+    [[nodiscard]] size_t findNextSet(size_t begin) const;
+
+    // calls func(bit) for each set bit, in order
+    template<typename Func>
+    void forEachSet(Func func) const
+    {
+        for (auto bit = findNextSet(0), n = size(); bit < n; bit = findNextSet(bit + 1))
+        {
+            func(bit);
+        }
+    }
+
     bool isValid() const;
 
 private:
-    std::vector<uint8_t> flags_;
+    std::vector<uint64_t> flags_;
     [[nodiscard]] size_t countFlags() const;
     [[nodiscard]] size_t countFlags(size_t begin, size_t end) const;
     [[nodiscard]] bool testFlag(size_t bit) const;
@@ -6,17 +6,24 @@
  *
  */
 
-#include <cstdlib> /* qsort() */
+#include <algorithm>
+#include <array>
 #include <ctime>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include <event2/buffer.h>
 
 #include "transmission.h"
 #include "cache.h"
+#include "disk-io.h"
+#include "file.h" /* tr_sys_iovec */
 #include "inout.h"
 #include "log.h"
 #include "peer-common.h" /* MAX_BLOCK_SIZE */
-#include "ptrarray.h"
 #include "torrent.h"
 #include "tr-assert.h"
 #include "trevent.h"
@@ -30,93 +37,445 @@
 *****
 ****/
 
-struct cache_block
+/* A fixed-size pool of MAX_BLOCK_SIZE slots, sized from the cache limit.
+ * Incoming block data is copied into a slot once and is written to disk
+ * straight from there, so steady-state caching does no allocations and the
+ * cache's memory footprint is bounded by its limit. If the pool runs dry --
+ * e.g. because earlier flushes failed -- blocks spill over onto the heap.
+ *
+ * A block can be pinned while something outside of the cache, such as a
+ * peer's output buffer, refers to its memory. Releasing a pinned block is
+ * deferred until its last pin goes away, and so is freeing the arena. */
+class BlockArena
 {
-    tr_torrent* tor;
+public:
+    BlockArena() = default;
+
+    BlockArena(BlockArena const&) = delete;
+    BlockArena& operator=(BlockArena const&) = delete;
+
+    // must only be called when no slots are in use
+    void reset(size_t n_slots)
+    {
+        TR_ASSERT(std::size(free_) == n_slots_);
+
+        tr_free(base_);
+        base_ = static_cast<uint8_t*>(tr_malloc(n_slots * MAX_BLOCK_SIZE));
+        n_slots_ = base_ != nullptr ? n_slots : 0;
+
+        // hand out the lowest slots first so that a lightly-used
+        // cache only ever touches the start of the arena
+        free_.clear();
+        free_.reserve(n_slots_);
+        for (auto i = n_slots_; i > 0; --i)
+        {
+            free_.push_back(i - 1);
+        }
+    }
+
+    [[nodiscard]] uint8_t* alloc()
+    {
+        if (std::empty(free_))
+        {
+            return tr_new(uint8_t, MAX_BLOCK_SIZE);
+        }
+
+        auto const slot = free_.back();
+        free_.pop_back();
+        return base_ + slot * MAX_BLOCK_SIZE;
+    }
+
+    void release(uint8_t* data)
+    {
+        if (auto const it = pins_.find(data); it != std::end(pins_))
+        {
+            it->second.released = true;
+        }
+        else
+        {
+            freeBlock(data);
+        }
+    }
+
+    void pin(uint8_t* data)
+    {
+        ++pins_[data].count;
+    }
+
+    void unpin(uint8_t* data)
+    {
+        auto const it = pins_.find(data);
+        TR_ASSERT(it != std::end(pins_));
+
+        if (--it->second.count == 0)
+        {
+            bool const released = it->second.released;
+            pins_.erase(it);
+
+            if (released)
+            {
+                freeBlock(data);
+            }
+        }
+
+        if (orphaned_ && std::empty(pins_))
+        {
+            delete this;
+        }
+    }
+
+    [[nodiscard]] bool isPinned(uint8_t const* data) const
+    {
+        return pins_.count(const_cast<uint8_t*>(data)) != 0;
+    }
+
+    [[nodiscard]] bool inUse() const
+    {
+        return std::size(free_) != n_slots_;
+    }
+
+    // called instead of `delete` by the arena's owner
+    void orphan()
+    {
+        orphaned_ = true;
 
+        if (std::empty(pins_))
+        {
+            delete this;
+        }
+    }
+
+private:
+    ~BlockArena()
+    {
+        tr_free(base_);
+    }
+
+    void freeBlock(uint8_t* data)
+    {
+        if (contains(data))
+        {
+            free_.push_back((data - base_) / MAX_BLOCK_SIZE);
+        }
+        else
+        {
+            tr_free(data);
+        }
+    }
+
+    [[nodiscard]] bool contains(uint8_t const* data) const
+    {
+        auto const addr = reinterpret_cast<uintptr_t>(data);
+        auto const base = reinterpret_cast<uintptr_t>(base_);
+        return base_ != nullptr && base <= addr && addr < base + n_slots_ * MAX_BLOCK_SIZE;
+    }
+
+    struct Pin
+    {
+        size_t count = 0;
+        bool released = false;
+    };
+
+    uint8_t* base_ = nullptr;
+    size_t n_slots_ = 0;
+    std::vector<size_t> free_;
+    std::unordered_map<uint8_t*, Pin> pins_;
+    bool orphaned_ = false;
+};
+
+struct cache_block
+{
     tr_piece_index_t piece;
     uint32_t offset;
     uint32_t length;
 
     time_t time;
-    tr_block_index_t block;
 
-    struct evbuffer* evbuf;
+    uint8_t* data;
+};
+
+/* A torrent's cached blocks, in a two-level radix index on block index.
+ * The top level is indexed by `block / SpanSize` and points to a span of
+ * SpanSize block slots, along with a bitmask of which slots are in use.
+ * Finding, adding and removing a block are O(1), and walking the spans
+ * visits the blocks in order, so contiguous runs are found without sorting.
+ * A span is allocated when its first block is cached and is freed when its
+ * last one leaves, so the slots' memory follows what's in the cache. */
+class CachedBlocks
+{
+public:
+    [[nodiscard]] bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    [[nodiscard]] size_t size() const
+    {
+        return size_;
+    }
+
+    [[nodiscard]] cache_block* find(tr_block_index_t block)
+    {
+        auto const index = block / SpanSize;
+
+        if (index >= std::size(spans_) || spans_[index] == nullptr || (spans_[index]->used & bitOf(block)) == 0)
+        {
+            return nullptr;
+        }
+
+        return &spans_[index]->blocks[block % SpanSize];
+    }
+
+    // `block` must not be in the cache yet
+    cache_block& add(tr_block_index_t block)
+    {
+        auto const index = block / SpanSize;
+
+        if (index >= std::size(spans_))
+        {
+            spans_.resize(index + 1);
+        }
+
+        auto& span = spans_[index];
+
+        if (span == nullptr)
+        {
+            span = std::make_unique<Span>();
+        }
+
+        TR_ASSERT((span->used & bitOf(block)) == 0);
+        span->used |= bitOf(block);
+        ++size_;
+
+        auto& cb = span->blocks[block % SpanSize];
+        cb = {};
+        return cb;
+    }
+
+    // `block` must be in the cache
+    void remove(tr_block_index_t block)
+    {
+        auto const index = block / SpanSize;
+        TR_ASSERT(index < std::size(spans_));
+        auto& span = spans_[index];
+        TR_ASSERT(span != nullptr);
+        TR_ASSERT((span->used & bitOf(block)) != 0);
+
+        span->used &= ~bitOf(block);
+        --size_;
+
+        if (span->used == 0)
+        {
+            span.reset();
+        }
+    }
+
+    /* call `func(block, len, first, last)` for each run of contiguous cached
+     * blocks in [begin, end), in ascending order. `first` and `last` are the
+     * run's first and last cache_block */
+    template<typename Func>
+    void forEachRun(tr_block_index_t begin, tr_block_index_t end, Func func) const
+    {
+        auto run_begin = tr_block_index_t{};
+        auto run_len = size_t{};
+        cache_block const* first = nullptr;
+        cache_block const* last = nullptr;
+
+        auto const n_spans = std::min(std::size(spans_), (size_t{ end } + SpanSize - 1) / SpanSize);
+        for (size_t index = begin / SpanSize; index < n_spans; ++index)
+        {
+            auto const* const span = spans_[index].get();
+
+            if (span == nullptr)
+            {
+                continue;
+            }
+
+            for (size_t i = 0; i < SpanSize; ++i)
+            {
+                auto const block = tr_block_index_t(index * SpanSize + i);
+
+                if ((span->used & bitOf(block)) == 0 || block < begin || block >= end)
+                {
+                    continue;
+                }
+
+                if (run_len > 0 && block == run_begin + run_len)
+                {
+                    ++run_len;
+                    last = &span->blocks[i];
+                    continue;
+                }
+
+                if (run_len > 0)
+                {
+                    func(run_begin, run_len, *first, *last);
+                }
+
+                run_begin = block;
+                run_len = 1;
+                first = last = &span->blocks[i];
+            }
+        }
+
+        if (run_len > 0)
+        {
+            func(run_begin, run_len, *first, *last);
+        }
+    }
+
+    template<typename Func>
+    void forEach(Func func)
+    {
+        for (auto const& span : spans_)
+        {
+            for (size_t i = 0; span != nullptr && i < SpanSize; ++i)
+            {
+                if ((span->used & (uint64_t{ 1 } << i)) != 0)
+                {
+                    func(span->blocks[i]);
+                }
+            }
+        }
+    }
+
+private:
+    // 64 blocks, so that a span's slots in use fit in one word
+    static auto constexpr SpanSize = size_t{ 64 };
+
+    static constexpr uint64_t bitOf(tr_block_index_t block)
+    {
+        return uint64_t{ 1 } << (block % SpanSize);
+    }
+
+    struct Span
+    {
+        uint64_t used = 0;
+        std::array<cache_block, SpanSize> blocks;
+    };
+
+    std::vector<std::unique_ptr<Span>> spans_;
+    size_t size_ = 0;
+};
+
+struct cache_write;
+
+/* The cached blocks that belong to a single torrent */
+struct cache_torrent
+{
+    tr_torrent* tor = nullptr;
+    CachedBlocks blocks;
+
+    /* blocks that are being written to disk, and the write they're in */
+    std::unordered_map<tr_block_index_t, cache_write*> writing;
+};
+
+/* A run of blocks that a disk I/O worker is writing to disk. The blocks
+ * can still be read from the cache until the write finishes, and their
+ * arena slots are released when it does. */
+struct cache_write
+{
+    tr_cache* cache = nullptr;
+    tr_session* session = nullptr;
+    tr_disk_io* io = nullptr;
+    uint64_t job_id = 0;
+
+    int tor_id = 0;
+    tr_block_index_t block = 0;
+    std::vector<cache_block> blocks;
+
+    std::vector<tr_io_segment> segments;
+    std::vector<tr_sys_iovec> iov;
+
+    int err = 0;
+    tr_file_index_t failed_file = 0;
 };
 
 struct tr_cache
 {
-    tr_ptrArray blocks;
-    int max_blocks;
-    size_t max_bytes;
+    /* keyed on tr_torrent::uniqueId */
+    std::unordered_map<int, cache_torrent> torrents;
+    size_t n_blocks = 0;
+
+    /* writes that have been handed to the disk I/O pool */
+    std::unordered_set<cache_write*> writes;
+    size_t n_writing_blocks = 0;
+
+    /* the first error from a background write, kept to be
+     * returned by the next flush that waits for its writes */
+    int write_err = 0;
+
+    BlockArena* arena = nullptr;
+
+    int max_blocks = 0;
+    size_t max_bytes = 0;
 
-    size_t disk_writes;
-    size_t disk_write_bytes;
-    size_t cache_writes;
-    size_t cache_write_bytes;
+    size_t disk_writes = 0;
+    size_t disk_write_bytes = 0;
+    size_t cache_writes = 0;
+    size_t cache_write_bytes = 0;
 };
 
 /****
 *****
 ****/
 
-struct run_info
+static cache_torrent* getCacheTorrent(tr_cache* cache, tr_torrent const* tor)
 {
-    int pos;
-    int rank;
-    time_t last_block_time;
-    bool is_multi_piece;
-    bool is_piece_done;
-    unsigned int len;
-};
+    auto const it = cache->torrents.find(tor->uniqueId);
+    return it != std::end(cache->torrents) ? &it->second : nullptr;
+}
 
-/* return a count of how many contiguous blocks there are starting at this pos */
-static int getBlockRun(tr_cache const* cache, int pos, struct run_info* info)
+static cache_block* findBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset)
 {
-    int const n = tr_ptrArraySize(&cache->blocks);
-    struct cache_block const* const* blocks = (struct cache_block const* const*)tr_ptrArrayBase(&cache->blocks);
-    struct cache_block const* ref = blocks[pos];
-    tr_block_index_t block = ref->block;
-    int len = 0;
+    auto* const ct = getCacheTorrent(cache, torrent);
 
-    for (int i = pos; i < n; ++i)
+    if (ct == nullptr)
     {
-        struct cache_block const* b = blocks[i];
+        return nullptr;
+    }
 
-        if (b->block != block)
-        {
-            break;
-        }
+    return ct->blocks.find(torrent->blockOf(piece, offset));
+}
 
-        if (b->tor != ref->tor)
-        {
-            break;
-        }
+/* like findBlock(), but also finds blocks that are being written to disk */
+static cache_block const* findReadableBlock(tr_cache* cache, tr_torrent* torrent, tr_block_index_t block)
+{
+    auto* const ct = getCacheTorrent(cache, torrent);
 
-        ++block;
-        ++len;
+    if (ct == nullptr)
+    {
+        return nullptr;
     }
 
-    if (info != nullptr)
+    if (auto const* const cb = ct->blocks.find(block); cb != nullptr)
     {
-        struct cache_block const* b = blocks[pos + len - 1];
-        info->last_block_time = b->time;
-        info->is_piece_done = b->tor->hasPiece(b->piece);
-        info->is_multi_piece = b->piece != blocks[pos]->piece;
-        info->len = len;
-        info->pos = pos;
+        return cb;
     }
 
-    return len;
+    if (auto const it = ct->writing.find(block); it != std::end(ct->writing))
+    {
+        auto const* const w = it->second;
+        return &w->blocks[block - w->block];
+    }
+
+    return nullptr;
 }
 
-/* higher rank comes before lower rank */
-static int compareRuns(void const* va, void const* vb)
+/****
+*****
+****/
+
+struct run_info
 {
-    auto* a = static_cast<struct run_info const*>(va);
-    auto* b = static_cast<struct run_info const*>(vb);
-    return b->rank - a->rank;
-}
+    int tor_id;
+    tr_block_index_t block;
+    int rank;
+    time_t last_block_time;
+    bool is_multi_piece;
+    bool is_piece_done;
+    unsigned int len;
+};
 
 enum
 {
@@ -127,84 +486,254 @@ enum
 
 /* Calculte runs
  *   - Stale runs, runs sitting in cache for a long time or runs not growing, get priority.
- *     Returns number of runs.
+ *     Returns the runs, highest rank first.
  */
-// TODO: return std::vector
-static int calcRuns(tr_cache const* cache, struct run_info* runs)
+static std::vector<run_info> calcRuns(tr_cache const* cache)
 {
-    int const n = tr_ptrArraySize(&cache->blocks);
-    int i = 0;
+    auto runs = std::vector<run_info>{};
     time_t const now = tr_time();
 
-    for (int pos = 0; pos < n; pos += runs[i++].len)
+    for (auto const& [tor_id, ct] : cache->torrents)
     {
-        int rank = getBlockRun(cache, pos, &runs[i]);
+        auto const add_run = [&runs, now, tor_id = tor_id, tor = ct.tor](
+                                 tr_block_index_t block,
+                                 size_t len,
+                                 cache_block const& first,
+                                 cache_block const& last)
+        {
+            auto info = run_info{};
+            info.tor_id = tor_id;
+            info.block = block;
+            info.len = len;
+            info.last_block_time = last.time;
+            info.is_piece_done = tor->hasPiece(last.piece);
+            info.is_multi_piece = last.piece != first.piece;
 
-        /* This adds ~2 to the relative length of a run for every minute it has
-         * languished in the cache. */
-        rank += (now - runs[i].last_block_time) / 32;
+            int rank = len;
 
-        /* Flushing stale blocks should be a top priority as the probability of them
-         * growing is very small, for blocks on piece boundaries, and nonexistant for
-         * blocks inside pieces. */
-        rank |= runs[i].is_piece_done ? DONEFLAG : 0;
+            /* This adds ~2 to the relative length of a run for every minute it has
+             * languished in the cache. */
+            rank += (now - info.last_block_time) / 32;
 
-        /* Move the multi piece runs higher */
-        rank |= runs[i].is_multi_piece ? MULTIFLAG : 0;
+            /* Flushing stale blocks should be a top priority as the probability of them
+             * growing is very small, for blocks on piece boundaries, and nonexistant for
+             * blocks inside pieces. */
+            rank |= info.is_piece_done ? DONEFLAG : 0;
 
-        runs[i].rank = rank;
+            /* Move the multi piece runs higher */
+            rank |= info.is_multi_piece ? MULTIFLAG : 0;
+
+            info.rank = rank;
+            runs.push_back(info);
+        };
+
+        ct.blocks.forEachRun(0, ct.tor->blockCount(), add_run);
     }
 
-    qsort(runs, i, sizeof(struct run_info), compareRuns);
-    return i;
+    /* higher rank comes before lower rank */
+    std::sort(
+        std::begin(runs),
+        std::end(runs),
+        [](auto const& a, auto const& b) { return a.rank > b.rank; });
+    return runs;
 }
 
-static int flushContiguous(tr_cache* cache, int pos, int n)
+/***
+****  Background writes
+***/
+
+static void writeFunc(void* vw)
 {
-    int err = 0;
-    uint8_t* buf = tr_new(uint8_t, n * MAX_BLOCK_SIZE);
-    uint8_t* walk = buf;
-    struct cache_block** blocks = (struct cache_block**)tr_ptrArrayBase(&cache->blocks);
+    auto* const w = static_cast<cache_write*>(vw);
+
+    w->err = tr_ioSegmentsWritev(w->segments, std::data(w->iov), std::size(w->iov), &w->failed_file);
+}
 
-    struct cache_block* b = blocks[pos];
-    tr_torrent* tor = b->tor;
-    tr_piece_index_t const piece = b->piece;
-    uint32_t const offset = b->offset;
+/* drop a finished write's blocks from the cache */
+static void releaseWrite(tr_cache* cache, cache_write* w)
+{
+    auto const it = cache->torrents.find(w->tor_id);
+    TR_ASSERT(it != std::end(cache->torrents));
+    auto& ct = it->second;
+
+    for (size_t i = 0, n = std::size(w->blocks); i < n; ++i)
+    {
+        TR_ASSERT(ct.writing.at(w->block + i) == w);
+        ct.writing.erase(w->block + i);
+        cache->arena->release(w->blocks[i].data);
+    }
+
+    cache->n_writing_blocks -= std::size(w->blocks);
+    cache->writes.erase(w);
+
+    if (std::empty(ct.blocks) && std::empty(ct.writing))
+    {
+        cache->torrents.erase(it);
+    }
+}
+
+static void onWriteDone(void* vw, bool /*cancelled*/)
+{
+    auto* const w = static_cast<cache_write*>(vw);
+    auto* const cache = w->cache;
+
+    tr_ioCloseSegments(w->session, w->segments);
+
+    if (w->err != 0)
+    {
+        if (auto* const tor = tr_torrentFindFromId(w->session, w->tor_id); tor != nullptr)
+        {
+            tr_ioSetWriteError(tor, w->failed_file, w->err);
+        }
+
+        if (cache->write_err == 0)
+        {
+            cache->write_err = w->err;
+        }
+    }
+
+    releaseWrite(cache, w);
+    delete w;
+}
+
+/* wait for the background writes of the torrent `tor_id`, or for all of them if `tor_id` is -1.
+ * returns the first error that any background write has had since the last wait */
+static int waitForWrites(tr_cache* cache, int tor_id)
+{
+    auto jobs = std::vector<std::pair<uint64_t, tr_disk_io*>>{};
 
-    for (int i = 0; i < n; ++i)
+    for (auto const* const w : cache->writes)
     {
-        b = blocks[pos + i];
-        evbuffer_copyout(b->evbuf, walk, b->length);
-        walk += b->length;
-        evbuffer_free(b->evbuf);
-        tr_free(b);
+        if (tor_id == -1 || w->tor_id == tor_id)
+        {
+            jobs.emplace_back(w->job_id, w->io);
+        }
+    }
+
+    /* oldest first */
+    std::sort(std::begin(jobs), std::end(jobs));
+
+    for (auto const& [job_id, io] : jobs)
+    {
+        tr_diskIoWait(io, job_id);
+    }
+
+    return std::exchange(cache->write_err, 0);
+}
+
+/* hand `n` cached blocks, starting at `block`, to the disk I/O pool to be written to disk */
+static int flushContiguous(tr_cache* cache, int tor_id, tr_block_index_t block, size_t n)
+{
+    auto const it = cache->torrents.find(tor_id);
+    TR_ASSERT(it != std::end(cache->torrents));
+
+    auto& ct = it->second;
+    tr_torrent* const tor = ct.tor;
+
+    /* if some of these blocks are still being written from an earlier
+     * flush, that write must land first so that it can't clobber this one */
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (auto const w = ct.writing.find(block + i); w != std::end(ct.writing))
+        {
+            tr_diskIoWait(w->second->io, w->second->job_id);
+        }
     }
 
-    tr_ptrArrayErase(&cache->blocks, pos, pos + n);
+    auto* const w = new cache_write{};
+    w->cache = cache;
+    w->session = tor->session;
+    w->io = tor->session->disk_io;
+    w->tor_id = tor_id;
+    w->block = block;
+    w->blocks.reserve(n);
+    w->iov.reserve(n);
+
+    /* move the run out of the cache, gathering it straight out of the arena */
+    size_t len = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        auto const* const cb = ct.blocks.find(block + i);
+        TR_ASSERT(cb != nullptr);
+
+        w->blocks.push_back(*cb);
+        w->iov.push_back({ cb->data, cb->length });
+        len += cb->length;
 
-    err = tr_ioWrite(tor, piece, offset, walk - buf, buf);
-    tr_free(buf);
+        ct.blocks.remove(block + i);
+        ct.writing.emplace(block + i, w);
+    }
+
+    cache->n_blocks -= n;
+    cache->n_writing_blocks += n;
+    cache->writes.insert(w);
 
     ++cache->disk_writes;
-    cache->disk_write_bytes += walk - buf;
+    cache->disk_write_bytes += len;
+
+    auto const& first = w->blocks.front();
+    int const err = tr_ioOpenSegments(tor, true, first.piece, first.offset, len, w->segments);
+
+    if (err != 0)
+    {
+        releaseWrite(cache, w);
+        delete w;
+    }
+    else if (w->io == nullptr)
+    {
+        writeFunc(w);
+        onWriteDone(w, false);
+        return std::exchange(cache->write_err, 0);
+    }
+    else
+    {
+        w->job_id = tr_diskIoAdd(w->io, cache, writeFunc, onWriteDone, w);
+    }
+
     return err;
 }
 
-static int flushRuns(tr_cache* cache, struct run_info* runs, int n)
+static int flushRuns(tr_cache* cache, std::vector<run_info> const& runs, size_t n)
 {
     int err = 0;
 
-    for (int i = 0; err == 0 && i < n; i++)
+    for (size_t i = 0; err == 0 && i < n; ++i)
     {
-        err = flushContiguous(cache, runs[i].pos, runs[i].len);
+        err = flushContiguous(cache, runs[i].tor_id, runs[i].block, runs[i].len);
+    }
 
-        for (int j = i + 1; j < n; j++)
-        {
-            if (runs[j].pos > runs[i].pos)
-            {
-                runs[j].pos -= runs[i].len;
-            }
-        }
+    return err;
+}
+
+/* write every cached block of `tor` that lies in [begin, end) to disk,
+ * and wait for all of the torrent's writes to finish */
+static int flushSpan(tr_cache* cache, tr_torrent* tor, tr_block_index_t begin, tr_block_index_t end)
+{
+    auto const* const ct = getCacheTorrent(cache, tor);
+
+    if (ct == nullptr)
+    {
+        return 0;
+    }
+
+    /* flushing a run can drop the torrent's entry from the cache, so gather them first */
+    auto spans = std::vector<std::pair<tr_block_index_t, size_t>>{};
+    ct->blocks.forEachRun(
+        begin,
+        end,
+        [&spans](tr_block_index_t block, size_t len, cache_block const& /*first*/, cache_block const& /*last*/)
+        { spans.emplace_back(block, len); });
+
+    int err = 0;
+
+    for (size_t i = 0, n = std::size(spans); err == 0 && i < n; ++i)
+    {
+        err = flushContiguous(cache, tor->uniqueId, spans[i].first, spans[i].second);
+    }
+
+    if (int const write_err = waitForWrites(cache, tor->uniqueId); err == 0)
+    {
+        err = write_err;
     }
 
     return err;
@@ -214,24 +743,31 @@ static int cacheTrim(tr_cache* cache)
 {
     int err = 0;
 
-    if (tr_ptrArraySize(&cache->blocks) > cache->max_blocks)
+    if (cache->n_blocks > (size_t)cache->max_blocks)
     {
+        /* if the disk can't keep up with the writes we've already
+         * queued, wait for them rather than piling up more */
+        if (cache->n_writing_blocks > (size_t)cache->max_blocks)
+        {
+            err = waitForWrites(cache, -1);
+        }
+
         /* Amount of cache that should be removed by the flush. This influences how large
          * runs can grow as well as how often flushes will happen. */
-        int const cacheCutoff = 1 + cache->max_blocks / 4;
-        struct run_info* runs = tr_new(struct run_info, tr_ptrArraySize(&cache->blocks));
-        int i = 0;
-        int j = 0;
-
-        calcRuns(cache, runs);
+        size_t const cacheCutoff = 1 + cache->max_blocks / 4;
+        auto const runs = calcRuns(cache);
+        size_t i = 0;
+        size_t j = 0;
 
-        while (j < cacheCutoff)
+        while (j < cacheCutoff && i < std::size(runs))
         {
             j += runs[i++].len;
         }
 
-        err = flushRuns(cache, runs, i);
-        tr_free(runs);
+        if (int const flush_err = flushRuns(cache, runs, i); err == 0)
+        {
+            err = flush_err;
+        }
     }
 
     return err;
@@ -246,10 +782,60 @@ static int getMaxBlocks(int64_t max_bytes)
     return max_bytes / (double)MAX_BLOCK_SIZE;
 }
 
+/* cacheTrim() runs after a block is added, so the cache briefly holds one
+ * block more than its limit. Blocks that are being written in the background
+ * hold their slots too, but they spill over onto the heap instead of growing
+ * the arena: the pool usually finishes them before the cache fills up again. */
+static size_t getArenaSlots(int max_blocks)
+{
+    return max_blocks + 1;
+}
+
+static int flushAll(tr_cache* cache)
+{
+    auto tors = std::vector<tr_torrent*>{};
+    tors.reserve(std::size(cache->torrents));
+    for (auto const& [tor_id, ct] : cache->torrents)
+    {
+        tors.push_back(ct.tor);
+    }
+
+    int err = 0;
+    for (auto* const tor : tors)
+    {
+        if (int const tor_err = flushSpan(cache, tor, 0, tor->blockCount()); tor_err != 0)
+        {
+            err = tor_err;
+        }
+    }
+
+    if (int const write_err = waitForWrites(cache, -1); err == 0)
+    {
+        err = write_err;
+    }
+
+    return err;
+}
+
 int tr_cacheSetLimit(tr_cache* cache, int64_t max_bytes)
 {
+    int const max_blocks = getMaxBlocks(max_bytes);
+    int err = 0;
+
     cache->max_bytes = max_bytes;
-    cache->max_blocks = getMaxBlocks(max_bytes);
+
+    if (max_blocks != cache->max_blocks)
+    {
+        cache->max_blocks = max_blocks;
+
+        /* the arena can only be resized while it's empty */
+        err = flushAll(cache);
+
+        if (!cache->arena->inUse())
+        {
+            cache->arena->reset(getArenaSlots(max_blocks));
+        }
+    }
 
     tr_logAddNamedDbg(
         MY_NAME,
@@ -257,7 +843,7 @@ int tr_cacheSetLimit(tr_cache* cache, int64_t max_bytes)
         tr_formatter_mem_B(cache->max_bytes).c_str(),
         cache->max_blocks);
 
-    return cacheTrim(cache);
+    return err;
 }
 
 int64_t tr_cacheGetLimit(tr_cache const* cache)
@@ -267,10 +853,11 @@ int64_t tr_cacheGetLimit(tr_cache const* cache)
 
 tr_cache* tr_cacheNew(int64_t max_bytes)
 {
-    tr_cache* cache = tr_new0(tr_cache, 1);
-    cache->blocks = {};
+    auto* const cache = new tr_cache{};
+    cache->arena = new BlockArena{};
     cache->max_bytes = max_bytes;
     cache->max_blocks = getMaxBlocks(max_bytes);
+    cache->arena->reset(getArenaSlots(cache->max_blocks));
     return cache;
 }
 
@@ -280,44 +867,23 @@ void tr_cacheFree(tr_cache* cache)
     // e.g. if writing to disk failed due to disk full / permission error etc
     // then there is still going to be data sitting in the cache on shutdown.
     // Make this assertion smarter or remove it.
-    TR_ASSERT(tr_ptrArrayEmpty(&cache->blocks));
-
-    tr_ptrArrayDestruct(&cache->blocks, nullptr);
-    tr_free(cache);
-}
-
-/***
-****
-***/
+    TR_ASSERT(cache->n_blocks == 0);
 
-static int cache_block_compare(void const* va, void const* vb)
-{
-    auto const* a = static_cast<struct cache_block const*>(va);
-    auto const* b = static_cast<struct cache_block const*>(vb);
+    waitForWrites(cache, -1);
 
-    /* primary key: torrent id */
-    if (a->tor->uniqueId != b->tor->uniqueId)
+    for (auto& [tor_id, ct] : cache->torrents)
     {
-        return a->tor->uniqueId < b->tor->uniqueId ? -1 : 1;
+        ct.blocks.forEach([cache](cache_block const& cb) { cache->arena->release(cb.data); });
     }
 
-    /* secondary key: block # */
-    if (a->block != b->block)
-    {
-        return a->block < b->block ? -1 : 1;
-    }
-
-    /* they're equal */
-    return 0;
+    /* peers may still be sending blocks out of the arena */
+    cache->arena->orphan();
+    delete cache;
 }
 
-static struct cache_block* findBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset)
-{
-    struct cache_block key;
-    key.tor = torrent;
-    key.block = torrent->blockOf(piece, offset);
-    return static_cast<struct cache_block*>(tr_ptrArrayFindSorted(&cache->blocks, &key, cache_block_compare));
-}
+/***
+****
+***/
 
 int tr_cacheWriteBlock(
     tr_cache* cache,
@@ -333,22 +899,31 @@ int tr_cacheWriteBlock(
 
     if (cb == nullptr)
     {
-        cb = tr_new(struct cache_block, 1);
-        cb->tor = torrent;
+        auto& ct = cache->torrents[torrent->uniqueId];
+        ct.tor = torrent;
+
+        cb = &ct.blocks.add(torrent->blockOf(piece, offset));
         cb->piece = piece;
         cb->offset = offset;
         cb->length = length;
-        cb->block = torrent->blockOf(piece, offset);
-        cb->evbuf = evbuffer_new();
-        tr_ptrArrayInsertSorted(&cache->blocks, cb, cache_block_compare);
+        cb->data = cache->arena->alloc();
+
+        ++cache->n_blocks;
     }
 
     TR_ASSERT(cb->length == length);
+    TR_ASSERT(length <= MAX_BLOCK_SIZE);
+
+    /* don't change the block out from under a peer that's sending it */
+    if (cache->arena->isPinned(cb->data))
+    {
+        cache->arena->release(cb->data);
+        cb->data = cache->arena->alloc();
+    }
 
     cb->time = tr_time();
 
-    evbuffer_drain(cb->evbuf, evbuffer_get_length(cb->evbuf));
-    evbuffer_remove_buffer(writeme, cb->evbuf, cb->length);
+    evbuffer_remove(writeme, cb->data, cb->length);
 
     cache->cache_writes++;
     cache->cache_write_bytes += cb->length;
@@ -365,11 +940,11 @@ int tr_cacheReadBlock(
     uint8_t* setme)
 {
     int err = 0;
-    struct cache_block* cb = findBlock(cache, torrent, piece, offset);
+    auto const* const cb = findReadableBlock(cache, torrent, torrent->blockOf(piece, offset));
 
     if (cb != nullptr)
     {
-        evbuffer_copyout(cb->evbuf, setme, len);
+        std::copy_n(cb->data, std::min(len, cb->length), setme);
     }
     else
     {
@@ -379,10 +954,41 @@ int tr_cacheReadBlock(
     return err;
 }
 
+static void unpinBlock(void const* data, size_t /*datalen*/, void* varena)
+{
+    static_cast<BlockArena*>(varena)->unpin(static_cast<uint8_t*>(const_cast<void*>(data)));
+}
+
+bool tr_cacheAddBlockReference(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    struct evbuffer* out)
+{
+    auto const* const cb = findReadableBlock(cache, torrent, torrent->blockOf(piece, offset));
+
+    if (cb == nullptr || cb->piece != piece || cb->offset != offset || len > cb->length)
+    {
+        return false;
+    }
+
+    cache->arena->pin(cb->data);
+
+    if (evbuffer_add_reference(out, cb->data, len, unpinBlock, cache->arena) != 0)
+    {
+        cache->arena->unpin(cb->data);
+        return false;
+    }
+
+    return true;
+}
+
 int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len)
 {
     int err = 0;
-    struct cache_block const* const cb = findBlock(cache, torrent, piece, offset);
+    auto const* const cb = findReadableBlock(cache, torrent, torrent->blockOf(piece, offset));
 
     if (cb == nullptr)
     {
@@ -392,27 +998,39 @@ int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t
     return err;
 }
 
+bool tr_cacheHasBlocks(tr_cache* cache, tr_torrent* torrent, tr_block_index_t begin, tr_block_index_t end)
+{
+    auto const* const ct = getCacheTorrent(cache, torrent);
+
+    if (ct == nullptr)
+    {
+        return false;
+    }
+
+    for (auto block = begin; block < end; ++block)
+    {
+        if (findReadableBlock(cache, torrent, block) != nullptr)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 /***
 ****
 ***/
 
-static int findBlockPos(tr_cache const* cache, tr_torrent* torrent, tr_piece_index_t block)
-{
-    struct cache_block key;
-    key.tor = torrent;
-    key.block = block;
-    return tr_ptrArrayLowerBound(&cache->blocks, &key, cache_block_compare, nullptr);
-}
-
 int tr_cacheFlushDone(tr_cache* cache)
 {
     int err = 0;
 
-    if (tr_ptrArraySize(&cache->blocks) > 0)
+    if (cache->n_blocks > 0)
     {
-        auto* const runs = tr_new(struct run_info, tr_ptrArraySize(&cache->blocks));
-        int i = 0;
-        int const n = calcRuns(cache, runs);
+        auto runs = calcRuns(cache);
+        size_t i = 0;
+        size_t const n = std::size(runs);
 
         while (i < n && (runs[i].is_piece_done || runs[i].is_multi_piece))
         {
@@ -420,7 +1038,6 @@ int tr_cacheFlushDone(tr_cache* cache)
         }
 
         err = flushRuns(cache, runs, i);
-        tr_free(runs);
     }
 
     return err;
@@ -430,48 +1047,14 @@ int tr_cacheFlushFile(tr_cache* cache, tr_torrent* torrent, tr_file_index_t i)
 {
     auto const [begin, end] = tr_torGetFileBlockSpan(torrent, i);
 
-    int pos = findBlockPos(cache, torrent, begin);
     dbgmsg("flushing file %d from cache to disk: blocks [%zu...%zu)", (int)i, (size_t)begin, (size_t)end);
 
     /* flush out all the blocks in that file */
-    int err = 0;
-    while (err == 0 && pos < tr_ptrArraySize(&cache->blocks))
-    {
-        auto const* b = static_cast<struct cache_block const*>(tr_ptrArrayNth(&cache->blocks, pos));
-
-        if (b->tor != torrent)
-        {
-            break;
-        }
-
-        if (b->block < begin || b->block >= end)
-        {
-            break;
-        }
-
-        err = flushContiguous(cache, pos, getBlockRun(cache, pos, nullptr));
-    }
-
-    return err;
+    return flushSpan(cache, torrent, begin, end);
 }
 
 int tr_cacheFlushTorrent(tr_cache* cache, tr_torrent* torrent)
 {
-    int err = 0;
-    int const pos = findBlockPos(cache, torrent, 0);
-
     /* flush out all the blocks in that torrent */
-    while (err == 0 && pos < tr_ptrArraySize(&cache->blocks))
-    {
-        auto const* b = static_cast<struct cache_block const*>(tr_ptrArrayNth(&cache->blocks, pos));
-
-        if (b->tor != torrent)
-        {
-            break;
-        }
-
-        err = flushContiguous(cache, pos, getBlockRun(cache, pos, nullptr));
-    }
-
-    return err;
+    return flushSpan(cache, torrent, 0, torrent->blockCount());
 }
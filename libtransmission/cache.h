@@ -50,8 +50,24 @@ int tr_cacheReadBlock(
     uint32_t len,
     uint8_t* setme);
 
+/* append a cached block to `out` by reference rather than by copying it.
+ * The block's memory stays valid until `out` lets go of it, even if the
+ * block is flushed or the cache is freed in the meantime.
+ * returns false if the block isn't cached. */
+bool tr_cacheAddBlockReference(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    struct evbuffer* out);
+
 int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len);
 
+/* true if any of the blocks in [begin, end) are in the cache,
+ * i.e. if reading them wouldn't have to go to disk */
+bool tr_cacheHasBlocks(tr_cache* cache, tr_torrent* torrent, tr_block_index_t begin, tr_block_index_t end);
+
 /***
 ****
 ***/
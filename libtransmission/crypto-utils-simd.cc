@@ -0,0 +1,764 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib> // getenv()
+#include <cstring> // memcpy()
+#include <limits>
+#include <numeric> // std::iota()
+#include <string_view>
+#include <utility> // std::index_sequence
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define TR_SHA1_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#include "transmission.h"
+#include "crypto-utils.h"
+#include "tr-assert.h"
+
+using namespace std::literals;
+
+namespace
+{
+
+#ifdef TR_SHA1_X86
+
+auto constexpr BlockSize = size_t{ 64 };
+
+using sha1_state_t = std::array<uint32_t, 5>;
+
+auto constexpr Sha1Init = sha1_state_t{ 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+/* A buffer split into the 64-byte blocks that SHA1 consumes: the ones
+ * that can be read straight from the buffer, then one or two padded
+ * tail blocks holding the leftover bytes and the message length. */
+class Sha1Message
+{
+public:
+    Sha1Message(void const* data, size_t len)
+        : data_{ static_cast<uint8_t const*>(data) }
+        , n_full_blocks_{ len / BlockSize }
+    {
+        auto const n_left = len % BlockSize;
+        if (n_left > 0)
+        {
+            memcpy(std::data(tail_), data_ + n_full_blocks_ * BlockSize, n_left);
+        }
+
+        tail_[n_left] = 0x80;
+        n_tail_blocks_ = n_left + 1 + 8 <= BlockSize ? 1 : 2;
+
+        auto n_bits = uint64_t{ len } * 8;
+        for (auto* walk = std::data(tail_) + n_tail_blocks_ * BlockSize - 1; n_bits != 0; --walk, n_bits >>= 8)
+        {
+            *walk = uint8_t(n_bits);
+        }
+    }
+
+    [[nodiscard]] size_t size() const
+    {
+        return n_full_blocks_ + n_tail_blocks_;
+    }
+
+    [[nodiscard]] uint8_t const* block(size_t i) const
+    {
+        return i < n_full_blocks_ ? data_ + i * BlockSize : std::data(tail_) + (i - n_full_blocks_) * BlockSize;
+    }
+
+    [[nodiscard]] size_t nFullBlocks() const
+    {
+        return n_full_blocks_;
+    }
+
+    [[nodiscard]] size_t nTailBlocks() const
+    {
+        return n_tail_blocks_;
+    }
+
+private:
+    uint8_t const* data_;
+    size_t n_full_blocks_;
+    size_t n_tail_blocks_ = 0;
+    std::array<uint8_t, BlockSize * 2> tail_ = {};
+};
+
+tr_sha1_digest_t toDigest(sha1_state_t const& state)
+{
+    auto digest = tr_sha1_digest_t{};
+    auto* walk = std::data(digest);
+
+    for (auto const word : state)
+    {
+        *walk++ = std::byte(word >> 24);
+        *walk++ = std::byte(word >> 16);
+        *walk++ = std::byte(word >> 8);
+        *walk++ = std::byte(word);
+    }
+
+    return digest;
+}
+
+/***
+****  Portable
+***/
+
+constexpr uint32_t rotl(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+void compress(sha1_state_t& state, uint8_t const* block)
+{
+    auto w = std::array<uint32_t, 80>{};
+
+    for (size_t t = 0; t < 16; ++t, block += 4)
+    {
+        w[t] = uint32_t(block[0]) << 24 | uint32_t(block[1]) << 16 | uint32_t(block[2]) << 8 | uint32_t(block[3]);
+    }
+
+    for (size_t t = 16; t < 80; ++t)
+    {
+        w[t] = rotl(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16], 1);
+    }
+
+    auto [a, b, c, d, e] = state;
+
+    for (size_t t = 0; t < 80; ++t)
+    {
+        uint32_t f = 0;
+        uint32_t k = 0;
+
+        if (t < 20)
+        {
+            f = d ^ (b & (c ^ d));
+            k = 0x5A827999;
+        }
+        else if (t < 40)
+        {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }
+        else if (t < 60)
+        {
+            f = (b & c) | (d & (b | c));
+            k = 0x8F1BBCDC;
+        }
+        else
+        {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+
+        auto const tmp = rotl(a, 5) + f + e + k + w[t];
+        e = d;
+        d = c;
+        c = rotl(b, 30);
+        b = a;
+        a = tmp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+/***
+****  SHA extensions: one buffer at a time, but each 4 rounds is one instruction
+***/
+
+#define TR_TARGET_SHA __attribute__((target("sha,sse4.1,ssse3")))
+
+/* rounds 4*G ... 4*G+3. `prev` is the ABCD from before the previous
+ * group, which is where the next group's E comes from. */
+template<int G>
+TR_TARGET_SHA inline void shaniGroup(__m128i& abcd, __m128i& e, __m128i& prev, __m128i (&msg)[4], uint8_t const* block)
+{
+    if constexpr (G < 4)
+    {
+        auto const mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+        msg[G] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(block + 16 * G)), mask);
+    }
+
+    if constexpr (G == 0)
+    {
+        e = _mm_add_epi32(e, msg[0]);
+    }
+    else
+    {
+        e = _mm_sha1nexte_epu32(prev, msg[G % 4]);
+    }
+
+    prev = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e, G / 5);
+
+    // build the message words for group G+1..G+4, one step at a time
+    if constexpr (G >= 1 && G <= 16)
+    {
+        msg[(G - 1) % 4] = _mm_sha1msg1_epu32(msg[(G - 1) % 4], msg[G % 4]);
+    }
+
+    if constexpr (G >= 2 && G <= 17)
+    {
+        msg[(G - 2) % 4] = _mm_xor_si128(msg[(G - 2) % 4], msg[G % 4]);
+    }
+
+    if constexpr (G >= 3 && G <= 18)
+    {
+        msg[(G - 3) % 4] = _mm_sha1msg2_epu32(msg[(G - 3) % 4], msg[G % 4]);
+    }
+}
+
+/* Hash N buffers in lockstep. Each sha1rnds4 depends on the one
+ * before it, so interleaving independent buffers keeps the SHA unit busy. */
+template<int G, size_t N, size_t... Is>
+TR_TARGET_SHA inline void shaniGroupN(
+    __m128i (&abcd)[N],
+    __m128i (&e)[N],
+    __m128i (&prev)[N],
+    __m128i (&msg)[N][4],
+    uint8_t const* const (&blocks)[N],
+    std::index_sequence<Is...> /*lanes*/)
+{
+    (shaniGroup<G>(abcd[Is], e[Is], prev[Is], msg[Is], blocks[Is]), ...);
+}
+
+template<size_t N, size_t... Gs>
+TR_TARGET_SHA inline void shaniRounds(
+    __m128i (&abcd)[N],
+    __m128i (&e)[N],
+    __m128i (&prev)[N],
+    uint8_t const* const (&blocks)[N],
+    std::index_sequence<Gs...> /*groups*/)
+{
+    __m128i msg[N][4];
+    (shaniGroupN<Gs, N>(abcd, e, prev, msg, blocks, std::make_index_sequence<N>{}), ...);
+}
+
+template<size_t N>
+TR_TARGET_SHA void shaniCompress(sha1_state_t* const (&states)[N], uint8_t const* const (&blocks)[N], size_t n_blocks)
+{
+    __m128i abcd[N];
+    __m128i e[N];
+    uint8_t const* walk[N];
+
+    for (size_t i = 0; i < N; ++i)
+    {
+        abcd[i] = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(std::data(*states[i]))), 0x1B);
+        e[i] = _mm_set_epi32(int((*states[i])[4]), 0, 0, 0);
+        walk[i] = blocks[i];
+    }
+
+    for (; n_blocks > 0; --n_blocks)
+    {
+        __m128i abcd_save[N];
+        __m128i e_save[N];
+        __m128i prev[N];
+        for (size_t i = 0; i < N; ++i)
+        {
+            abcd_save[i] = prev[i] = abcd[i];
+            e_save[i] = e[i];
+        }
+
+        shaniRounds<N>(abcd, e, prev, walk, std::make_index_sequence<20>{});
+
+        for (size_t i = 0; i < N; ++i)
+        {
+            e[i] = _mm_sha1nexte_epu32(prev[i], e_save[i]);
+            abcd[i] = _mm_add_epi32(abcd[i], abcd_save[i]);
+            walk[i] += BlockSize;
+        }
+    }
+
+    for (size_t i = 0; i < N; ++i)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(std::data(*states[i])), _mm_shuffle_epi32(abcd[i], 0x1B));
+        (*states[i])[4] = uint32_t(_mm_extract_epi32(e[i], 3));
+    }
+}
+
+void shaniFinish(sha1_state_t& state, Sha1Message const& message, size_t block)
+{
+    sha1_state_t* const states[1] = { &state };
+
+    if (auto const n_full = message.nFullBlocks(); block < n_full)
+    {
+        uint8_t const* const blocks[1] = { message.block(block) };
+        shaniCompress<1>(states, blocks, n_full - block);
+    }
+
+    uint8_t const* const blocks[1] = { message.block(message.nFullBlocks()) };
+    shaniCompress<1>(states, blocks, message.nTailBlocks());
+}
+
+void shaniBatch(size_t n_buffers, void const* const* buffers, size_t const* buffer_lengths, tr_sha1_digest_t* setme)
+{
+    size_t i = 0;
+
+    for (; i + 1 < n_buffers; i += 2)
+    {
+        auto const message_a = Sha1Message{ buffers[i], buffer_lengths[i] };
+        auto const message_b = Sha1Message{ buffers[i + 1], buffer_lengths[i + 1] };
+        auto state_a = Sha1Init;
+        auto state_b = Sha1Init;
+
+        auto const n_common = std::min(message_a.nFullBlocks(), message_b.nFullBlocks());
+        sha1_state_t* const states[2] = { &state_a, &state_b };
+        uint8_t const* const blocks[2] = { message_a.block(0), message_b.block(0) };
+        shaniCompress<2>(states, blocks, n_common);
+
+        shaniFinish(state_a, message_a, n_common);
+        shaniFinish(state_b, message_b, n_common);
+        setme[i] = toDigest(state_a);
+        setme[i + 1] = toDigest(state_b);
+    }
+
+    if (i < n_buffers)
+    {
+        auto state = Sha1Init;
+        shaniFinish(state, Sha1Message{ buffers[i], buffer_lengths[i] }, 0);
+        setme[i] = toDigest(state);
+    }
+}
+
+/***
+****  AVX2: eight buffers side by side, one in each 32-bit lane
+***/
+
+#define TR_TARGET_AVX2 __attribute__((target("avx2")))
+
+auto constexpr NLanes = size_t{ 8 };
+
+template<int N>
+TR_TARGET_AVX2 inline __m256i rotl(__m256i x)
+{
+    return _mm256_or_si256(_mm256_slli_epi32(x, N), _mm256_srli_epi32(x, 32 - N));
+}
+
+/* load eight message words from each lane's block and transpose them,
+ * so that w[j] holds word j of every lane */
+TR_TARGET_AVX2 inline void avx2LoadWords(uint8_t const* const (&blocks)[NLanes], size_t offset, __m256i* w)
+{
+    auto const bswap = _mm256_set_epi8(
+        12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3, //
+        12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+    __m256i r[NLanes];
+    for (size_t i = 0; i < NLanes; ++i)
+    {
+        r[i] = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(blocks[i] + offset));
+    }
+
+    auto const t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+    auto const t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+    auto const t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+    auto const t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+    auto const t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+    auto const t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+    auto const t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+    auto const t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+    auto const u0 = _mm256_unpacklo_epi64(t0, t2);
+    auto const u1 = _mm256_unpackhi_epi64(t0, t2);
+    auto const u2 = _mm256_unpacklo_epi64(t1, t3);
+    auto const u3 = _mm256_unpackhi_epi64(t1, t3);
+    auto const u4 = _mm256_unpacklo_epi64(t4, t6);
+    auto const u5 = _mm256_unpackhi_epi64(t4, t6);
+    auto const u6 = _mm256_unpacklo_epi64(t5, t7);
+    auto const u7 = _mm256_unpackhi_epi64(t5, t7);
+
+    w[0] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u0, u4, 0x20), bswap);
+    w[1] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u1, u5, 0x20), bswap);
+    w[2] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u2, u6, 0x20), bswap);
+    w[3] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u3, u7, 0x20), bswap);
+    w[4] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u0, u4, 0x31), bswap);
+    w[5] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u1, u5, 0x31), bswap);
+    w[6] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u2, u6, 0x31), bswap);
+    w[7] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u3, u7, 0x31), bswap);
+}
+
+TR_TARGET_AVX2 inline __m256i avx2Schedule(__m256i (&w)[16], size_t t)
+{
+    auto const x = _mm256_xor_si256(
+        _mm256_xor_si256(w[(t - 3) & 15], w[(t - 8) & 15]),
+        _mm256_xor_si256(w[(t - 14) & 15], w[t & 15]));
+    return w[t & 15] = rotl<1>(x);
+}
+
+template<int F>
+TR_TARGET_AVX2 inline void avx2Round(__m256i (&s)[5], __m256i w, __m256i k)
+{
+    auto& [a, b, c, d, e] = s;
+    __m256i f;
+
+    if constexpr (F == 0)
+    {
+        f = _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));
+    }
+    else if constexpr (F == 2)
+    {
+        f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)));
+    }
+    else
+    {
+        f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+    }
+
+    auto const tmp = _mm256_add_epi32(_mm256_add_epi32(rotl<5>(a), f), _mm256_add_epi32(_mm256_add_epi32(e, k), w));
+    e = d;
+    d = c;
+    c = rotl<30>(b);
+    b = a;
+    a = tmp;
+}
+
+TR_TARGET_AVX2 void avx2Compress(__m256i (&state)[5], uint8_t const* const (&blocks)[NLanes])
+{
+    __m256i w[16];
+    avx2LoadWords(blocks, 0, w);
+    avx2LoadWords(blocks, 32, w + 8);
+
+    __m256i s[5] = { state[0], state[1], state[2], state[3], state[4] };
+
+    auto k = _mm256_set1_epi32(0x5A827999);
+    for (size_t t = 0; t < 16; ++t)
+    {
+        avx2Round<0>(s, w[t], k);
+    }
+    for (size_t t = 16; t < 20; ++t)
+    {
+        avx2Round<0>(s, avx2Schedule(w, t), k);
+    }
+
+    k = _mm256_set1_epi32(0x6ED9EBA1);
+    for (size_t t = 20; t < 40; ++t)
+    {
+        avx2Round<1>(s, avx2Schedule(w, t), k);
+    }
+
+    k = _mm256_set1_epi32(int(0x8F1BBCDC));
+    for (size_t t = 40; t < 60; ++t)
+    {
+        avx2Round<2>(s, avx2Schedule(w, t), k);
+    }
+
+    k = _mm256_set1_epi32(int(0xCA62C1D6));
+    for (size_t t = 60; t < 80; ++t)
+    {
+        avx2Round<3>(s, avx2Schedule(w, t), k);
+    }
+
+    for (size_t i = 0; i < 5; ++i)
+    {
+        state[i] = _mm256_add_epi32(state[i], s[i]);
+    }
+}
+
+/* Run the blocks of all active lanes through the kernel until one of them runs out */
+TR_TARGET_AVX2 void avx2Run(
+    uint32_t (&lane_state)[5][NLanes],
+    uint8_t const* const (&lane_data)[NLanes],
+    size_t const (&lane_stride)[NLanes],
+    size_t n_blocks)
+{
+    __m256i state[5];
+    for (size_t i = 0; i < 5; ++i)
+    {
+        state[i] = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(lane_state[i]));
+    }
+
+    uint8_t const* blocks[NLanes];
+    std::copy_n(lane_data, NLanes, blocks);
+
+    for (size_t n = 0; n < n_blocks; ++n)
+    {
+        avx2Compress(state, blocks);
+
+        for (size_t lane = 0; lane < NLanes; ++lane)
+        {
+            blocks[lane] += lane_stride[lane];
+        }
+    }
+
+    for (size_t i = 0; i < 5; ++i)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lane_state[i]), state[i]);
+    }
+}
+
+void avx2Batch(size_t n_buffers, void const* const* buffers, size_t const* buffer_lengths, tr_sha1_digest_t* setme)
+{
+    auto messages = std::vector<Sha1Message>{};
+    messages.reserve(n_buffers);
+    for (size_t i = 0; i < n_buffers; ++i)
+    {
+        messages.emplace_back(buffers[i], buffer_lengths[i]);
+    }
+
+    // longest first, so that the lanes tend to run dry together
+    auto order = std::vector<size_t>(n_buffers);
+    std::iota(std::begin(order), std::end(order), 0);
+    std::stable_sort(
+        std::begin(order),
+        std::end(order),
+        [&messages](size_t a, size_t b) { return std::size(messages[a]) > std::size(messages[b]); });
+
+    auto constexpr NoJob = std::numeric_limits<size_t>::max();
+    auto const idle_block = std::array<uint8_t, BlockSize>{};
+    auto next_job = std::begin(order);
+    size_t lane_job[NLanes];
+    size_t lane_block[NLanes] = {};
+    uint32_t lane_state[5][NLanes];
+    std::fill_n(lane_job, NLanes, NoJob);
+
+    for (;;)
+    {
+        auto n_active = size_t{};
+        for (size_t lane = 0; lane < NLanes; ++lane)
+        {
+            if (lane_job[lane] == NoJob && next_job != std::end(order))
+            {
+                lane_job[lane] = *next_job++;
+                lane_block[lane] = 0;
+                for (size_t i = 0; i < 5; ++i)
+                {
+                    lane_state[i][lane] = Sha1Init[i];
+                }
+            }
+
+            n_active += lane_job[lane] != NoJob ? 1 : 0;
+        }
+
+        if (n_active == 0)
+        {
+            break;
+        }
+
+        // the last buffer standing is cheaper to finish one block at a time
+        if (n_active == 1)
+        {
+            auto const lane = size_t(std::find_if(lane_job, lane_job + NLanes, [](size_t job) { return job != NoJob; }) - lane_job);
+            auto const& message = messages[lane_job[lane]];
+            auto state = sha1_state_t{};
+            for (size_t i = 0; i < 5; ++i)
+            {
+                state[i] = lane_state[i][lane];
+            }
+
+            for (size_t i = lane_block[lane]; i < std::size(message); ++i)
+            {
+                compress(state, message.block(i));
+            }
+
+            setme[lane_job[lane]] = toDigest(state);
+            lane_job[lane] = NoJob;
+            continue;
+        }
+
+        // run until a lane reaches a tail block or the end of its buffer
+        auto n_blocks = std::numeric_limits<size_t>::max();
+        uint8_t const* lane_data[NLanes];
+        size_t lane_stride[NLanes];
+        for (size_t lane = 0; lane < NLanes; ++lane)
+        {
+            if (auto const job = lane_job[lane]; job == NoJob)
+            {
+                lane_data[lane] = std::data(idle_block);
+                lane_stride[lane] = 0;
+            }
+            else
+            {
+                auto const& message = messages[job];
+                auto const block = lane_block[lane];
+                lane_data[lane] = message.block(block);
+                lane_stride[lane] = BlockSize;
+                n_blocks = std::min(
+                    n_blocks,
+                    block < message.nFullBlocks() ? message.nFullBlocks() - block : std::size(message) - block);
+            }
+        }
+
+        avx2Run(lane_state, lane_data, lane_stride, n_blocks);
+
+        for (size_t lane = 0; lane < NLanes; ++lane)
+        {
+            auto const job = lane_job[lane];
+            if (job == NoJob)
+            {
+                continue;
+            }
+
+            lane_block[lane] += n_blocks;
+            if (lane_block[lane] == std::size(messages[job]))
+            {
+                auto state = sha1_state_t{};
+                for (size_t i = 0; i < 5; ++i)
+                {
+                    state[i] = lane_state[i][lane];
+                }
+
+                setme[job] = toDigest(state);
+                lane_job[lane] = NoJob;
+            }
+        }
+    }
+}
+
+#endif /* TR_SHA1_X86 */
+
+/***
+****  Dispatch
+***/
+
+enum class Impl
+{
+    Backend,
+    ShaNi,
+    Avx2
+};
+
+#ifdef TR_SHA1_X86
+
+Impl detectImpl()
+{
+    auto eax = unsigned{};
+    auto ebx = unsigned{};
+    auto ecx = unsigned{};
+    auto edx = unsigned{};
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+    {
+        return Impl::Backend;
+    }
+
+    bool const has_ssse3 = (ecx & bit_SSSE3) != 0;
+    bool const has_sse41 = (ecx & bit_SSE4_1) != 0;
+    bool const has_avx = (ecx & bit_AVX) != 0 && (ecx & bit_OSXSAVE) != 0;
+
+    if (__get_cpuid_max(0, nullptr) < 7)
+    {
+        return Impl::Backend;
+    }
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    bool const has_sha = (ebx & bit_SHA) != 0;
+    bool const has_avx2 = (ebx & bit_AVX2) != 0;
+
+    // the OS must also save the ymm registers on a context switch
+    auto xcr0 = unsigned{};
+    if (has_avx)
+    {
+        auto xcr0_high = unsigned{};
+        __asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0_high) : "c"(0));
+    }
+
+    bool const can_sha = has_sha && has_ssse3 && has_sse41;
+    bool const can_avx2 = has_avx && has_avx2 && (xcr0 & 6) == 6;
+
+    // TR_SHA1_BATCH_IMPL can pick a slower implementation, e.g. for benchmarking
+    if (auto const* const env = getenv("TR_SHA1_BATCH_IMPL"); env != nullptr)
+    {
+        if (env == "backend"sv)
+        {
+            return Impl::Backend;
+        }
+
+        if (env == "avx2"sv && can_avx2)
+        {
+            return Impl::Avx2;
+        }
+    }
+
+    if (can_sha)
+    {
+        return Impl::ShaNi;
+    }
+
+    if (can_avx2)
+    {
+        return Impl::Avx2;
+    }
+
+    return Impl::Backend;
+}
+
+#else
+
+Impl detectImpl()
+{
+    return Impl::Backend;
+}
+
+#endif
+
+Impl getImpl()
+{
+    static auto const impl = detectImpl();
+    return impl;
+}
+
+} // namespace
+
+bool tr_sha1_batch(size_t n_buffers, void const* const* buffers, size_t const* buffer_lengths, tr_sha1_digest_t* setme)
+{
+    TR_ASSERT(n_buffers == 0 || (buffers != nullptr && buffer_lengths != nullptr && setme != nullptr));
+
+#ifdef TR_SHA1_X86
+    switch (getImpl())
+    {
+    case Impl::ShaNi:
+        shaniBatch(n_buffers, buffers, buffer_lengths, setme);
+        return true;
+
+    case Impl::Avx2:
+        if (n_buffers > 1)
+        {
+            avx2Batch(n_buffers, buffers, buffer_lengths, setme);
+            return true;
+        }
+        break;
+
+    default:
+        break;
+    }
+#endif
+
+    for (size_t i = 0; i < n_buffers; ++i)
+    {
+        auto const digest = tr_sha1(std::string_view{ static_cast<char const*>(buffers[i]), buffer_lengths[i] });
+        if (!digest)
+        {
+            return false;
+        }
+
+        setme[i] = *digest;
+    }
+
+    return true;
+}
+
+std::string_view tr_sha1_batch_impl()
+{
+    switch (getImpl())
+    {
+    case Impl::ShaNi:
+        return "sha-ni"sv;
+
+    case Impl::Avx2:
+        return "avx2"sv;
+
+    default:
+        return "backend"sv;
+    }
+}
@@ -73,6 +73,21 @@ std::optional<tr_sha1_digest_t> tr_sha1(T... args)
     return std::nullopt;
 }
 
+/**
+ * @brief Generate the SHA1 hashes of several independent buffers at once.
+ *
+ * Uses the CPU's SHA extensions or hashes several buffers side by side
+ * with AVX2 when available, falling back to the crypto backend otherwise.
+ *
+ * @return false if any of the buffers couldn't be hashed.
+ */
+bool tr_sha1_batch(size_t n_buffers, void const* const* buffers, size_t const* buffer_lengths, tr_sha1_digest_t* setme);
+
+/**
+ * @brief Name of the implementation that tr_sha1_batch() uses on this CPU.
+ */
+std::string_view tr_sha1_batch_impl();
+
 /**
  * @brief Allocate and initialize new Diffie-Hellman (DH) key exchange context.
  */
@@ -0,0 +1,306 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "transmission.h"
+#include "disk-io.h"
+#include "log.h"
+#include "platform.h" /* tr_threadNew() */
+#include "session.h"
+#include "tr-assert.h"
+#include "trevent.h"
+
+#define dbgmsg(...) tr_logAddDeepNamed("disk-io", __VA_ARGS__)
+
+/***
+****
+***/
+
+struct disk_io_job
+{
+    uint64_t id;
+    void const* tag;
+    tr_disk_io_work_func work_func;
+    tr_disk_io_done_func done_func;
+    void* user_data;
+
+    bool cancelled = false;
+    bool started = false;
+    bool finished = false;
+};
+
+struct tr_disk_io
+{
+    tr_session* session = nullptr;
+
+    mutable std::mutex mutex;
+
+    /* workers wait on this for new jobs */
+    std::condition_variable work_cv;
+
+    /* tr_diskIoWait() and tr_diskIoFree() wait on this for jobs and workers to finish */
+    std::condition_variable done_cv;
+
+    /* jobs that no worker has picked up yet */
+    std::deque<disk_io_job*> queue;
+
+    /* jobs whose work is done but whose callbacks haven't been run */
+    std::vector<disk_io_job*> finished;
+
+    /* every job whose callback hasn't been run, keyed on id */
+    std::map<uint64_t, disk_io_job*> jobs;
+
+    uint64_t next_id = 1;
+    int n_workers = 0;
+    int max_workers = 1;
+    bool callbacks_pending = false;
+    bool closing = false;
+};
+
+/***
+****
+***/
+
+static void runJobCallback(disk_io_job* job)
+{
+    TR_ASSERT(job->finished);
+
+    (*job->done_func)(job->user_data, job->cancelled);
+    delete job;
+}
+
+/* run the callbacks of every finished job. libtransmission thread only. */
+static void runFinishedCallbacks(tr_disk_io* io)
+{
+    auto finished = std::vector<disk_io_job*>{};
+
+    {
+        auto const lock = std::lock_guard(io->mutex);
+
+        io->callbacks_pending = false;
+        std::swap(finished, io->finished);
+
+        for (auto const* const job : finished)
+        {
+            io->jobs.erase(job->id);
+        }
+    }
+
+    if (!std::empty(finished))
+    {
+        auto const lock = io->session->unique_lock();
+
+        for (auto* const job : finished)
+        {
+            runJobCallback(job);
+        }
+    }
+}
+
+static void onJobsFinished(void* vsession)
+{
+    auto* const session = static_cast<tr_session*>(vsession);
+
+    /* the pool may have been freed since this was queued */
+    if (session->disk_io != nullptr)
+    {
+        runFinishedCallbacks(session->disk_io);
+    }
+}
+
+static void workerFunc(void* vio)
+{
+    auto* const io = static_cast<tr_disk_io*>(vio);
+    auto lock = std::unique_lock(io->mutex);
+
+    for (;;)
+    {
+        io->work_cv.wait(
+            lock,
+            [io]() { return io->closing || io->n_workers > io->max_workers || !std::empty(io->queue); });
+
+        /* exit if the pool is done or has been made smaller */
+        if (std::empty(io->queue) || io->n_workers > io->max_workers)
+        {
+            break;
+        }
+
+        auto* const job = io->queue.front();
+        io->queue.pop_front();
+        job->started = true;
+
+        if (!job->cancelled)
+        {
+            lock.unlock();
+            (*job->work_func)(job->user_data);
+            lock.lock();
+        }
+
+        job->finished = true;
+        io->finished.push_back(job);
+        io->done_cv.notify_all();
+
+        /* one pending tr_runInEventThread() call covers every job
+         * that finishes before it gets run */
+        if (!io->callbacks_pending && !io->closing)
+        {
+            io->callbacks_pending = true;
+            lock.unlock();
+            tr_runInEventThread(io->session, onJobsFinished, io->session);
+            lock.lock();
+        }
+    }
+
+    --io->n_workers;
+    io->done_cv.notify_all();
+}
+
+/* start workers until there are `max_workers` of them. Call with the mutex held. */
+static void startWorkers(tr_disk_io* io)
+{
+    while (io->n_workers < io->max_workers)
+    {
+        ++io->n_workers;
+        tr_threadNew(workerFunc, io);
+        dbgmsg("started disk I/O worker %d", io->n_workers);
+    }
+}
+
+/***
+****
+***/
+
+tr_disk_io* tr_diskIoNew(tr_session* session, int n_workers)
+{
+    TR_ASSERT(n_workers > 0);
+
+    auto* const io = new tr_disk_io{};
+    io->session = session;
+    io->max_workers = n_workers;
+
+    auto const lock = std::lock_guard(io->mutex);
+    startWorkers(io);
+
+    return io;
+}
+
+void tr_diskIoSetThreadCount(tr_disk_io* io, int n_workers)
+{
+    auto const lock = std::lock_guard(io->mutex);
+
+    io->max_workers = std::max(n_workers, 1);
+    startWorkers(io);
+
+    /* wake idle workers so that any extra ones exit */
+    io->work_cv.notify_all();
+}
+
+int tr_diskIoGetThreadCount(tr_disk_io const* io)
+{
+    auto const lock = std::lock_guard(io->mutex);
+
+    return io->max_workers;
+}
+
+void tr_diskIoFree(tr_disk_io* io)
+{
+    {
+        auto lock = std::unique_lock(io->mutex);
+        io->closing = true;
+        io->work_cv.notify_all();
+        io->done_cv.wait(lock, [io]() { return io->n_workers == 0; });
+    }
+
+    runFinishedCallbacks(io);
+
+    TR_ASSERT(std::empty(io->jobs));
+    delete io;
+}
+
+uint64_t tr_diskIoAdd(
+    tr_disk_io* io,
+    void const* tag,
+    tr_disk_io_work_func work_func,
+    tr_disk_io_done_func done_func,
+    void* user_data)
+{
+    TR_ASSERT(work_func != nullptr);
+    TR_ASSERT(done_func != nullptr);
+
+    auto const lock = std::lock_guard(io->mutex);
+    TR_ASSERT(!io->closing);
+
+    auto* const job = new disk_io_job{ io->next_id++, tag, work_func, done_func, user_data };
+    io->jobs.emplace(job->id, job);
+    io->queue.push_back(job);
+    io->work_cv.notify_one();
+
+    return job->id;
+}
+
+void tr_diskIoWait(tr_disk_io* io, uint64_t job_id)
+{
+    TR_ASSERT(tr_amInEventThread(io->session));
+
+    auto lock = std::unique_lock(io->mutex);
+
+    auto const it = io->jobs.find(job_id);
+    if (it == std::end(io->jobs))
+    {
+        return;
+    }
+
+    auto* const job = it->second;
+
+    if (!job->started)
+    {
+        /* don't wait in line behind the other queued jobs */
+        io->queue.erase(std::find(std::begin(io->queue), std::end(io->queue), job));
+        job->started = true;
+
+        if (!job->cancelled)
+        {
+            lock.unlock();
+            (*job->work_func)(job->user_data);
+            lock.lock();
+        }
+
+        job->finished = true;
+    }
+    else
+    {
+        io->done_cv.wait(lock, [job]() { return job->finished; });
+
+        auto& finished = io->finished;
+        finished.erase(std::find(std::begin(finished), std::end(finished), job));
+    }
+
+    io->jobs.erase(job->id);
+    lock.unlock();
+
+    runJobCallback(job);
+}
+
+void tr_diskIoCancel(tr_disk_io* io, void const* tag)
+{
+    auto const lock = std::lock_guard(io->mutex);
+
+    for (auto& [id, job] : io->jobs)
+    {
+        if (job->tag == tag)
+        {
+            job->cancelled = true;
+        }
+    }
+}
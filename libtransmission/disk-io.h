@@ -0,0 +1,76 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstdint> // uint64_t
+
+struct tr_disk_io;
+struct tr_session;
+
+/**
+ * @addtogroup file_io File IO
+ * @{
+ */
+
+/* Called on one of the pool's worker threads. It must not touch
+ * anything that belongs to the libtransmission thread. */
+using tr_disk_io_work_func = void (*)(void* user_data);
+
+/* Called in the libtransmission thread after the work is done.
+ * If the job was cancelled, `cancelled` is true, the work may not
+ * have been run, and the callback should only release `user_data`. */
+using tr_disk_io_done_func = void (*)(void* user_data, bool cancelled);
+
+/**
+ * A pool of worker threads that do blocking disk I/O off the
+ * libtransmission thread. Jobs are started in the order they're added,
+ * and their completion callbacks are marshalled back to the
+ * libtransmission thread with tr_runInEventThread().
+ */
+tr_disk_io* tr_diskIoNew(tr_session* session, int n_workers);
+
+/* Grows or shrinks the pool. Extra workers exit after their current job. */
+void tr_diskIoSetThreadCount(tr_disk_io* io, int n_workers);
+
+int tr_diskIoGetThreadCount(tr_disk_io const* io);
+
+/* Waits for the pool's remaining jobs to finish, then runs their callbacks */
+void tr_diskIoFree(tr_disk_io* io);
+
+/**
+ * Queues a job. `tag` identifies the job's owner for tr_diskIoCancel().
+ * @return an id that can be passed to tr_diskIoWait()
+ */
+uint64_t tr_diskIoAdd(
+    tr_disk_io* io,
+    void const* tag,
+    tr_disk_io_work_func work_func,
+    tr_disk_io_done_func done_func,
+    void* user_data);
+
+/**
+ * Blocks until the job's work is done, then runs its completion callback
+ * in the calling thread. Jobs that haven't started yet are run inline.
+ * A no-op if the job's callback has already been run.
+ * Must be called from the libtransmission thread.
+ */
+void tr_diskIoWait(tr_disk_io* io, uint64_t job_id);
+
+/**
+ * Cancels all the jobs that were added with `tag`. Jobs that haven't
+ * started are skipped; either way, their completion callbacks are told
+ * that they were cancelled.
+ */
+void tr_diskIoCancel(tr_disk_io* io, void const* tag);
+
+/* @} */
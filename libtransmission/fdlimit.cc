@@ -12,6 +12,13 @@
 #include <cinttypes>
 #include <cstring>
 #include <ctime>
+#include <iterator>
+#include <list>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <sys/resource.h> /* getrlimit(), setrlimit() */
+#endif
 
 #include "transmission.h"
 
@@ -23,7 +30,7 @@
 #include "session.h"
 #include "torrent.h" /* tr_isTorrent() */
 #include "tr-assert.h"
-#include "utils.h" // tr_time()
+#include "utils.h" // tr_free()
 
 #define dbgmsg(...) tr_logAddDeepNamed(nullptr, __VA_ARGS__)
 
@@ -124,7 +131,6 @@ struct tr_cached_file
     tr_sys_file_t fd;
     int torrent_id;
     tr_file_index_t file_index;
-    time_t used_at;
 };
 
 static constexpr bool cached_file_is_open(struct tr_cached_file const* o)
@@ -266,103 +272,179 @@ FAIL:
 ****
 ***/
 
-struct tr_fileset
-{
-    struct tr_cached_file* begin;
-    struct tr_cached_file const* end;
-};
-
-static void fileset_construct(struct tr_fileset* set, int n)
+/**
+ * The pool of open files. Lookups go through a hash map keyed on the
+ * torrent id and file index, and the files are kept in a list that's
+ * ordered from most to least recently used, so both finding a file
+ * and picking one to evict are O(1).
+ *
+ * A file's descriptor can be pinned while another thread is using it.
+ * Closing a pinned file is deferred until its last pin goes away.
+ */
+class tr_fileset
 {
-    set->begin = tr_new(struct tr_cached_file, n);
-    set->end = set->begin + n;
-
-    for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+public:
+    explicit tr_fileset(size_t capacity)
+        : capacity_{ std::max(capacity, size_t{ 1 }) }
     {
-        *o = { false, TR_BAD_SYS_FILE, 0, 0, 0 };
     }
-}
 
-static void fileset_close_all(struct tr_fileset* set)
-{
-    if (set != nullptr)
+    tr_fileset(tr_fileset const&) = delete;
+    tr_fileset& operator=(tr_fileset const&) = delete;
+
+    ~tr_fileset()
     {
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+        while (!std::empty(files_))
+        {
+            erase(std::begin(files_));
+        }
+
+        for (auto const& [fd, pin] : pins_)
         {
-            if (cached_file_is_open(o))
+            if (pin.closed)
             {
-                cached_file_close(o);
+                tr_sys_file_close(fd, nullptr);
             }
         }
     }
-}
 
-static void fileset_destruct(struct tr_fileset* set)
-{
-    fileset_close_all(set);
-    tr_free(set->begin);
-    set->end = set->begin = nullptr;
-}
+    [[nodiscard]] tr_cached_file* find(int torrent_id, tr_file_index_t file_index)
+    {
+        auto const it = index_.find(makeKey(torrent_id, file_index));
+        return it == std::end(index_) ? nullptr : &*it->second;
+    }
 
-static void fileset_close_torrent(struct tr_fileset* set, int torrent_id)
-{
-    if (set != nullptr)
+    // mark a file as the most recently used
+    void touch(int torrent_id, tr_file_index_t file_index)
     {
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+        if (auto const it = index_.find(makeKey(torrent_id, file_index)); it != std::end(index_))
         {
-            if (o->torrent_id == torrent_id && cached_file_is_open(o))
-            {
-                cached_file_close(o);
-            }
+            files_.splice(std::begin(files_), files_, it->second);
         }
     }
-}
 
-static struct tr_cached_file* fileset_lookup(struct tr_fileset* set, int torrent_id, tr_file_index_t i)
-{
-    if (set != nullptr)
+    // add a closed entry for a file, evicting the least recently used file if the pool is full
+    tr_cached_file* add(int torrent_id, tr_file_index_t file_index)
+    {
+        TR_ASSERT(find(torrent_id, file_index) == nullptr);
+
+        evict(capacity_ - 1);
+        files_.push_front({ false, TR_BAD_SYS_FILE, torrent_id, file_index });
+        index_.emplace(makeKey(torrent_id, file_index), std::begin(files_));
+        return &files_.front();
+    }
+
+    void remove(int torrent_id, tr_file_index_t file_index)
     {
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+        if (auto const it = index_.find(makeKey(torrent_id, file_index)); it != std::end(index_))
         {
-            if (torrent_id == o->torrent_id && i == o->file_index && cached_file_is_open(o))
-            {
-                return o;
-            }
+            erase(it->second);
         }
     }
 
-    return nullptr;
-}
+    void removeTorrent(int torrent_id)
+    {
+        for (auto it = std::begin(files_); it != std::end(files_);)
+        {
+            it = it->torrent_id == torrent_id ? erase(it) : std::next(it);
+        }
+    }
 
-static struct tr_cached_file* fileset_get_empty_slot(struct tr_fileset* set)
-{
-    struct tr_cached_file* cull = nullptr;
+    void setCapacity(size_t capacity)
+    {
+        capacity_ = std::max(capacity, size_t{ 1 });
+        evict(capacity_);
+    }
 
-    if (set != nullptr && set->begin != nullptr)
+    // close a file's descriptor, or defer closing it if it's pinned
+    void close(tr_cached_file* o)
     {
-        /* try to find an unused slot */
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+        if (auto const it = pins_.find(o->fd); it != std::end(pins_))
         {
-            if (!cached_file_is_open(o))
-            {
-                return o;
-            }
+            it->second.closed = true;
+            o->fd = TR_BAD_SYS_FILE;
+        }
+        else
+        {
+            cached_file_close(o);
         }
+    }
+
+    void pin(tr_sys_file_t fd)
+    {
+        ++pins_[fd].count;
+    }
+
+    void unpin(tr_sys_file_t fd)
+    {
+        auto const it = pins_.find(fd);
+        TR_ASSERT(it != std::end(pins_));
 
-        /* all slots are full... recycle the least recently used */
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+        if (it != std::end(pins_) && --it->second.count == 0)
         {
-            if (cull == nullptr || o->used_at < cull->used_at)
+            if (it->second.closed)
             {
-                cull = o;
+                tr_sys_file_close(fd, nullptr);
             }
+
+            pins_.erase(it);
         }
+    }
 
-        cached_file_close(cull);
+    [[nodiscard]] auto capacity() const
+    {
+        return capacity_;
     }
 
-    return cull;
-}
+    [[nodiscard]] auto size() const
+    {
+        return std::size(files_);
+    }
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+
+private:
+    using list_t = std::list<tr_cached_file>;
+
+    static constexpr uint64_t makeKey(int torrent_id, tr_file_index_t file_index)
+    {
+        return (uint64_t{ uint32_t(torrent_id) } << 32) | file_index;
+    }
+
+    list_t::iterator erase(list_t::iterator it)
+    {
+        if (cached_file_is_open(&*it))
+        {
+            close(&*it);
+        }
+
+        index_.erase(makeKey(it->torrent_id, it->file_index));
+        return files_.erase(it);
+    }
+
+    // close the least recently used files until there are no more than `n` left
+    void evict(size_t n)
+    {
+        while (std::size(files_) > n)
+        {
+            erase(std::prev(std::end(files_)));
+            ++evictions;
+        }
+    }
+
+    struct Pin
+    {
+        size_t count = 0;
+        bool closed = false;
+    };
+
+    list_t files_;
+    std::unordered_map<uint64_t, list_t::iterator> index_;
+    std::unordered_map<tr_sys_file_t, Pin> pins_;
+    size_t capacity_;
+};
 
 /***
 ****
@@ -370,10 +452,18 @@ static struct tr_cached_file* fileset_get_empty_slot(struct tr_fileset* set)
 ****
 ***/
 
+// until the session's open-file-limit setting is applied
+static auto constexpr DefaultFileLimit = size_t{ 32 };
+
 struct tr_fdInfo
 {
-    int peerCount;
-    struct tr_fileset fileset;
+    explicit tr_fdInfo(size_t file_limit)
+        : fileset{ file_limit }
+    {
+    }
+
+    int peerCount = 0;
+    tr_fileset fileset;
 };
 
 static void ensureSessionFdInfoExists(tr_session* session)
@@ -382,12 +472,7 @@ static void ensureSessionFdInfoExists(tr_session* session)
 
     if (session->fdInfo == nullptr)
     {
-        int const FILE_CACHE_SIZE = 32;
-
-        /* Create the local file cache */
-        auto* const i = tr_new0(struct tr_fdInfo, 1);
-        fileset_construct(&i->fileset, FILE_CACHE_SIZE);
-        session->fdInfo = i;
+        session->fdInfo = new tr_fdInfo{ DefaultFileLimit };
     }
 }
 
@@ -395,9 +480,7 @@ void tr_fdClose(tr_session* session)
 {
     if (session != nullptr && session->fdInfo != nullptr)
     {
-        struct tr_fdInfo* i = session->fdInfo;
-        fileset_destruct(&i->fileset);
-        tr_free(i);
+        delete session->fdInfo;
         session->fdInfo = nullptr;
     }
 }
@@ -406,7 +489,7 @@ void tr_fdClose(tr_session* session)
 ****
 ***/
 
-static struct tr_fileset* get_fileset(tr_session* session)
+static tr_fileset* get_fileset(tr_session* session)
 {
     if (session == nullptr)
     {
@@ -417,10 +500,93 @@ static struct tr_fileset* get_fileset(tr_session* session)
     return &session->fdInfo->fileset;
 }
 
+/**
+ * Make sure that the process can have `n_files` cached files open on top of
+ * its peer sockets, raising the soft RLIMIT_NOFILE if needed. If it can't be
+ * raised that far, return how many files there's room for instead.
+ */
+static size_t clampToDescriptorLimit(tr_session const* session, size_t n_files)
+{
+#ifndef _WIN32
+    // descriptors that are kept free for everything that isn't a peer or a cached file:
+    // the listening and tracker sockets, the rpc server, resume and log files...
+    auto constexpr ReservedFds = rlim_t{ 64 };
+
+    struct rlimit rl = {};
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur == RLIM_INFINITY)
+    {
+        return n_files;
+    }
+
+    auto const n_other = rlim_t{ session->peerLimit } + ReservedFds;
+    auto const wanted = rlim_t(n_files) + n_other;
+
+    if (rl.rlim_cur < wanted)
+    {
+        auto const old_limit = rl.rlim_cur;
+        rl.rlim_cur = rl.rlim_max == RLIM_INFINITY ? wanted : std::min(wanted, rl.rlim_max);
+
+        if (setrlimit(RLIMIT_NOFILE, &rl) == 0)
+        {
+            tr_logAddInfo("Changed open file limit from %llu to %llu", (unsigned long long)old_limit, (unsigned long long)rl.rlim_cur);
+        }
+        else
+        {
+            rl.rlim_cur = old_limit;
+        }
+    }
+
+    if (rl.rlim_cur < wanted)
+    {
+        auto const n = rl.rlim_cur > n_other ? size_t(rl.rlim_cur - n_other) : size_t{ 1 };
+        tr_logAddError(
+            _("Open file limit is too low for %zu files and %u peers; only keeping %zu files open"),
+            n_files,
+            unsigned{ session->peerLimit },
+            n);
+        return n;
+    }
+#endif
+
+    return n_files;
+}
+
+void tr_fdSetFileLimit(tr_session* session, size_t limit)
+{
+    auto const lock = session->unique_lock();
+
+    get_fileset(session)->setCapacity(clampToDescriptorLimit(session, limit));
+}
+
+size_t tr_fdGetFileLimit(tr_session const* session)
+{
+    return session->fdInfo != nullptr ? session->fdInfo->fileset.capacity() : DefaultFileLimit;
+}
+
+void tr_fdGetFileStats(tr_session const* session, tr_open_file_stats* setme)
+{
+    auto const lock = session->unique_lock();
+
+    *setme = {};
+    setme->limit = DefaultFileLimit;
+
+    if (session->fdInfo != nullptr)
+    {
+        auto const& set = session->fdInfo->fileset;
+        setme->hits = set.hits;
+        setme->misses = set.misses;
+        setme->evictions = set.evictions;
+        setme->open_files = set.size();
+        setme->limit = set.capacity();
+    }
+}
+
 void tr_fdFileClose(tr_session* s, tr_torrent const* tor, tr_file_index_t i)
 {
-    tr_cached_file* const o = fileset_lookup(get_fileset(s), tr_torrentId(tor), i);
-    if (o != nullptr)
+    auto* const set = get_fileset(s);
+    auto const torrent_id = tr_torrentId(tor);
+
+    if (tr_cached_file* const o = set->find(torrent_id, i); o != nullptr)
     {
         /* flush writable files so that their mtimes will be
          * up-to-date when this function returns to the caller... */
@@ -429,28 +595,45 @@ void tr_fdFileClose(tr_session* s, tr_torrent const* tor, tr_file_index_t i)
             tr_sys_file_flush(o->fd, nullptr);
         }
 
-        cached_file_close(o);
+        set->remove(torrent_id, i);
     }
 }
 
 tr_sys_file_t tr_fdFileGetCached(tr_session* s, int torrent_id, tr_file_index_t i, bool writable)
 {
-    struct tr_cached_file* o = fileset_lookup(get_fileset(s), torrent_id, i);
+    auto* const set = get_fileset(s);
+    tr_cached_file const* const o = set->find(torrent_id, i);
 
     if (o == nullptr || (writable && !o->is_writable))
     {
+        ++set->misses;
         return TR_BAD_SYS_FILE;
     }
 
-    o->used_at = tr_time();
+    ++set->hits;
+    set->touch(torrent_id, i);
     return o->fd;
 }
 
+void tr_fdFilePin(tr_session* session, tr_sys_file_t fd)
+{
+    get_fileset(session)->pin(fd);
+}
+
+void tr_fdFileUnpin(tr_session* session, tr_sys_file_t fd)
+{
+    /* the pool closes pinned files too when it's freed */
+    if (session->fdInfo != nullptr)
+    {
+        session->fdInfo->fileset.unpin(fd);
+    }
+}
+
 void tr_fdTorrentClose(tr_session* session, int torrent_id)
 {
     auto const lock = session->unique_lock();
 
-    fileset_close_torrent(get_fileset(session), torrent_id);
+    get_fileset(session)->removeTorrent(torrent_id);
 }
 
 /* returns an fd on success, or a TR_BAD_SYS_FILE on failure and sets errno */
@@ -463,22 +646,23 @@ tr_sys_file_t tr_fdFileCheckout(
     tr_preallocation_mode allocation,
     uint64_t file_size)
 {
-    struct tr_fileset* set = get_fileset(session);
-    struct tr_cached_file* o = fileset_lookup(set, torrent_id, i);
+    auto* const set = get_fileset(session);
+    tr_cached_file* o = set->find(torrent_id, i);
 
     if (o != nullptr && writable && !o->is_writable)
     {
-        cached_file_close(o); /* close it so we can reopen in rw mode */
+        set->close(o); /* close it so we can reopen in rw mode */
     }
     else if (o == nullptr)
     {
-        o = fileset_get_empty_slot(set);
+        o = set->add(torrent_id, i);
     }
 
     if (!cached_file_is_open(o))
     {
         if (int const err = cached_file_open(o, filename, writable, allocation, file_size); err != 0)
         {
+            set->remove(torrent_id, i);
             errno = err;
             return TR_BAD_SYS_FILE;
         }
@@ -488,9 +672,7 @@ tr_sys_file_t tr_fdFileCheckout(
     }
 
     dbgmsg("checking out '%s'", filename);
-    o->torrent_id = torrent_id;
-    o->file_index = i;
-    o->used_at = tr_time();
+    set->touch(torrent_id, i);
     return o->fd;
 }
 
@@ -12,6 +12,9 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+
 #include "transmission.h"
 #include "file.h"
 #include "net.h"
@@ -28,9 +31,9 @@
 /**
  * Returns an fd to the specified filename.
  *
- * A small pool of open files is kept to avoid the overhead of
- * continually opening and closing the same files when downloading
- * piece data.
+ * A pool of open files is kept to avoid the overhead of
+ * continually opening and closing the same files when reading
+ * and writing piece data. See tr_fdSetFileLimit().
  *
  * - if do_write is true, subfolders in torrentFile are created if necessary.
  * - if do_write is true, the target file is created if necessary.
@@ -61,11 +64,48 @@ tr_sys_file_t tr_fdFileGetCached(tr_session* session, int torrent_id, tr_file_in
  */
 void tr_fdFileClose(tr_session* session, tr_torrent const* tor, tr_file_index_t file_num);
 
+/**
+ * Keeps a descriptor from tr_fdFileCheckout() open until it's unpinned,
+ * even if the pool closes its file in the meantime, so that it can be
+ * used outside of the libtransmission thread without being duplicated.
+ * Must be balanced by tr_fdFileUnpin().
+ */
+void tr_fdFilePin(tr_session* session, tr_sys_file_t fd);
+
+void tr_fdFileUnpin(tr_session* session, tr_sys_file_t fd);
+
 /**
  * Closes all the files associated with a given torrent id
  */
 void tr_fdTorrentClose(tr_session* session, int torrentId);
 
+/**
+ * Sets how many files may be kept open at once.
+ * If more than that are open, the least recently used ones are closed.
+ * The soft RLIMIT_NOFILE is raised to make room for them and the session's
+ * peers; if it can't be raised far enough, fewer files are kept open.
+ */
+void tr_fdSetFileLimit(tr_session* session, size_t limit);
+
+size_t tr_fdGetFileLimit(tr_session const* session);
+
+struct tr_open_file_stats
+{
+    /* lookups that found the file already open */
+    uint64_t hits;
+
+    /* lookups that had to open the file */
+    uint64_t misses;
+
+    /* files that were closed to make room for others */
+    uint64_t evictions;
+
+    size_t open_files;
+    size_t limit;
+};
+
+void tr_fdGetFileStats(tr_session const* session, tr_open_file_stats* setme);
+
 /***********************************************************************
  * Sockets
  **********************************************************************/
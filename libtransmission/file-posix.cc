@@ -24,6 +24,7 @@
 #include <sys/mman.h> /* mmap(), munmap() */
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h> /* preadv(), pwritev(), struct iovec */
 #include <unistd.h> /* lseek(), write(), ftruncate(), pread(), pwrite(), pathconf(), etc */
 #include <vector>
 
@@ -677,6 +678,29 @@ bool tr_sys_file_close(tr_sys_file_t handle, tr_error** error)
     return ret;
 }
 
+tr_sys_file_t tr_sys_file_duplicate(tr_sys_file_t handle, tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+
+#ifdef F_DUPFD_CLOEXEC
+    tr_sys_file_t const ret = fcntl(handle, F_DUPFD_CLOEXEC, 0);
+#else
+    tr_sys_file_t const ret = dup(handle);
+
+    if (ret != TR_BAD_SYS_FILE)
+    {
+        fcntl(ret, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+
+    if (ret == TR_BAD_SYS_FILE)
+    {
+        set_system_error(error, errno);
+    }
+
+    return ret;
+}
+
 bool tr_sys_file_get_info(tr_sys_file_t handle, tr_sys_path_info* info, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
@@ -870,6 +894,174 @@ bool tr_sys_file_write_at(
     return ret;
 }
 
+#if defined(HAVE_PREADV) || defined(HAVE_PWRITEV)
+
+#ifndef IOV_MAX
+#define IOV_MAX 16 /* the POSIX minimum */
+#endif
+
+using iovec_batch_t = std::array<struct iovec, std::min(IOV_MAX, 64)>;
+
+/* copy up to one batch of `iov` into `setme`, returning how many were copied */
+static size_t fill_iovec_batch(iovec_batch_t& setme, tr_sys_iovec const* iov, size_t iov_count, uint64_t* setme_size)
+{
+    size_t const n = std::min(iov_count, std::size(setme));
+    *setme_size = 0;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        setme[i].iov_base = iov[i].base;
+        setme[i].iov_len = iov[i].len;
+        *setme_size += iov[i].len;
+    }
+
+    return n;
+}
+
+#endif
+
+bool tr_sys_file_readv_at(
+    tr_sys_file_t handle,
+    tr_sys_iovec const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_read,
+    tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+    TR_ASSERT(iov != nullptr || iov_count == 0);
+    /* seek requires signed offset, so it should be in mod range */
+    TR_ASSERT(offset < UINT64_MAX / 2);
+
+    uint64_t my_bytes_read = 0;
+
+#ifdef HAVE_PREADV
+
+    auto batch = iovec_batch_t{};
+
+    while (iov_count > 0)
+    {
+        uint64_t batch_size = 0;
+        size_t const n = fill_iovec_batch(batch, iov, iov_count, &batch_size);
+        ssize_t const rc = preadv(handle, std::data(batch), n, offset + my_bytes_read);
+
+        if (rc == -1)
+        {
+            set_system_error(error, errno);
+            return false;
+        }
+
+        my_bytes_read += rc;
+
+        if (uint64_t(rc) != batch_size) /* short read */
+        {
+            break;
+        }
+
+        iov += n;
+        iov_count -= n;
+    }
+
+#else
+
+    for (size_t i = 0; i < iov_count; ++i)
+    {
+        uint64_t n = 0;
+
+        if (!tr_sys_file_read_at(handle, iov[i].base, iov[i].len, offset + my_bytes_read, &n, error))
+        {
+            return false;
+        }
+
+        my_bytes_read += n;
+
+        if (n != iov[i].len) /* short read */
+        {
+            break;
+        }
+    }
+
+#endif
+
+    if (bytes_read != nullptr)
+    {
+        *bytes_read = my_bytes_read;
+    }
+
+    return true;
+}
+
+bool tr_sys_file_writev_at(
+    tr_sys_file_t handle,
+    tr_sys_iovec const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_written,
+    tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+    TR_ASSERT(iov != nullptr || iov_count == 0);
+    /* seek requires signed offset, so it should be in mod range */
+    TR_ASSERT(offset < UINT64_MAX / 2);
+
+    uint64_t my_bytes_written = 0;
+
+#ifdef HAVE_PWRITEV
+
+    auto batch = iovec_batch_t{};
+
+    while (iov_count > 0)
+    {
+        uint64_t batch_size = 0;
+        size_t const n = fill_iovec_batch(batch, iov, iov_count, &batch_size);
+        ssize_t const rc = pwritev(handle, std::data(batch), n, offset + my_bytes_written);
+
+        if (rc == -1)
+        {
+            set_system_error(error, errno);
+            return false;
+        }
+
+        my_bytes_written += rc;
+
+        if (uint64_t(rc) != batch_size) /* short write */
+        {
+            break;
+        }
+
+        iov += n;
+        iov_count -= n;
+    }
+
+#else
+
+    for (size_t i = 0; i < iov_count; ++i)
+    {
+        uint64_t n = 0;
+
+        if (!tr_sys_file_write_at(handle, iov[i].base, iov[i].len, offset + my_bytes_written, &n, error))
+        {
+            return false;
+        }
+
+        my_bytes_written += n;
+
+        if (n != iov[i].len) /* short write */
+        {
+            break;
+        }
+    }
+
+#endif
+
+    if (bytes_written != nullptr)
+    {
+        *bytes_written = my_bytes_written;
+    }
+
+    return true;
+}
+
 bool tr_sys_file_flush(tr_sys_file_t handle, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
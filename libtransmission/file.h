@@ -114,6 +114,13 @@ enum tr_sys_path_type_t
     TR_SYS_PATH_IS_OTHER
 };
 
+/** @brief One buffer of a vectored read or write, as in `struct iovec`. */
+struct tr_sys_iovec
+{
+    void* base;
+    size_t len;
+};
+
 struct tr_sys_path_info
 {
     tr_sys_path_type_t type = {};
@@ -335,6 +342,21 @@ tr_sys_file_t tr_sys_file_open_temp(char* path_template, struct tr_error** error
  */
 bool tr_sys_file_close(tr_sys_file_t handle, struct tr_error** error);
 
+/**
+ * @brief Portability wrapper for `dup()`.
+ *
+ * The new descriptor refers to the same open file as `handle` but has its own
+ * lifetime, so it may be handed to another thread and closed independently.
+ *
+ * @param[in]  handle Valid file descriptor.
+ * @param[out] error  Pointer to error object. Optional, pass `nullptr` if you
+ *                    are not interested in error details.
+ *
+ * @return Duplicated file descriptor on success, `TR_BAD_SYS_FILE` otherwise
+ *         (with `error` set accordingly).
+ */
+tr_sys_file_t tr_sys_file_duplicate(tr_sys_file_t handle, struct tr_error** error);
+
 /**
  * @brief Portability wrapper for `fstat()`.
  *
@@ -448,6 +470,52 @@ bool tr_sys_file_write_at(
     uint64_t* bytes_written,
     struct tr_error** error);
 
+/**
+ * @brief Like `preadv()`, except that the position is undefined afterwards.
+ *        Not thread-safe.
+ *
+ * @param[in]  handle     Valid file descriptor.
+ * @param[in]  iov        Buffers to store read data to, filled in order.
+ * @param[in]  iov_count  Number of buffers in `iov`.
+ * @param[in]  offset     File offset in bytes to start reading from.
+ * @param[out] bytes_read Number of bytes actually read. Optional, pass `nullptr`
+ *                        if you are not interested.
+ * @param[out] error      Pointer to error object. Optional, pass `nullptr` if
+ *                        you are not interested in error details.
+ *
+ * @return `True` on success, `false` otherwise (with `error` set accordingly).
+ */
+bool tr_sys_file_readv_at(
+    tr_sys_file_t handle,
+    struct tr_sys_iovec const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_read,
+    struct tr_error** error);
+
+/**
+ * @brief Like `pwritev()`, except that the position is undefined afterwards.
+ *        Not thread-safe.
+ *
+ * @param[in]  handle        Valid file descriptor.
+ * @param[in]  iov           Buffers to get data being written from, in order.
+ * @param[in]  iov_count     Number of buffers in `iov`.
+ * @param[in]  offset        File offset in bytes to start writing from.
+ * @param[out] bytes_written Number of bytes actually written. Optional, pass
+ *                           `nullptr` if you are not interested.
+ * @param[out] error         Pointer to error object. Optional, pass `nullptr`
+ *                          if you are not interested in error details.
+ *
+ * @return `True` on success, `false` otherwise (with `error` set accordingly).
+ */
+bool tr_sys_file_writev_at(
+    tr_sys_file_t handle,
+    struct tr_sys_iovec const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_written,
+    struct tr_error** error);
+
 /**
  * @brief Portability wrapper for `fsync()`.
  *
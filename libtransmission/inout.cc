@@ -24,6 +24,7 @@
 #include "stats.h" /* tr_statsFileCreated() */
 #include "torrent.h"
 #include "tr-assert.h"
+#include "trevent.h" /* tr_amInEventThread() */
 #include "utils.h"
 
 using namespace std::literals;
@@ -40,40 +41,19 @@ enum
     TR_IO_WRITE
 };
 
-/* returns 0 on success, or an errno on failure */
-static int readOrWriteBytes(
-    tr_session* session,
-    tr_torrent* tor,
-    int ioMode,
-    tr_file_index_t file_index,
-    uint64_t file_offset,
-    void* buf,
-    size_t buflen)
+/* find the file's fd, opening (and maybe creating) the file if it's not cached.
+ * returns 0 on success, or an errno on failure */
+static int getFileFd(tr_session* session, tr_torrent* tor, bool doWrite, tr_file_index_t file_index, tr_sys_file_t* setme)
 {
     int err = 0;
-    bool const doWrite = ioMode >= TR_IO_WRITE;
-
     auto const file_size = tor->fileSize(file_index);
-    TR_ASSERT(file_size == 0 || file_offset < file_size);
-    TR_ASSERT(file_offset + buflen <= file_size);
-
-    if (file_size == 0)
-    {
-        return 0;
-    }
-
-    /***
-    ****  Find the fd
-    ***/
-
     auto fd = tr_fdFileGetCached(session, tr_torrentId(tor), file_index, doWrite);
 
     if (fd == TR_BAD_SYS_FILE) /* it's not cached, so open/create it now */
     {
         /* see if the file exists... */
-        char const* base = nullptr;
-        char* subpath = nullptr;
-        if (!tr_torrentFindFile2(tor, file_index, &base, &subpath, nullptr))
+        auto filename = std::string{};
+        if (!tor->findFileCached(filename, file_index))
         {
             /* we can't read a file that doesn't exist... */
             if (!doWrite)
@@ -82,15 +62,16 @@ static int readOrWriteBytes(
             }
 
             /* figure out where the file should go, so we can create it */
-            base = tr_torrentGetCurrentDir(tor);
-            subpath = tr_sessionIsIncompleteFileNamingEnabled(tor->session) ? tr_torrentBuildPartial(tor, file_index) :
-                                                                              tr_strvDup(tor->fileSubpath(file_index));
+            char* const subpath = tr_sessionIsIncompleteFileNamingEnabled(tor->session) ?
+                tr_torrentBuildPartial(tor, file_index) :
+                tr_strvDup(tor->fileSubpath(file_index));
+            filename = tr_strvPath(tr_torrentGetCurrentDir(tor), subpath);
+            tr_free(subpath);
         }
 
         if (err == 0)
         {
             /* open (and maybe create) the file */
-            auto const filename = tr_strvPath(base, subpath);
             auto const prealloc = (!doWrite || !tor->fileIsWanted(file_index)) ? TR_PREALLOCATE_NONE :
                                                                                  tor->session->preallocationMode;
 
@@ -99,6 +80,9 @@ static int readOrWriteBytes(
             {
                 err = errno;
                 tr_logAddTorErr(tor, "tr_fdFileCheckout failed for \"%s\": %s", filename.c_str(), tr_strerror(err));
+
+                /* the file may have been moved or deleted behind our back */
+                tor->invalidateFileLocation(file_index);
             }
             else if (doWrite)
             {
@@ -106,10 +90,37 @@ static int readOrWriteBytes(
                 tr_statsFileCreated(tor->session);
             }
         }
+    }
+
+    *setme = fd;
+    return err;
+}
+
+/* returns 0 on success, or an errno on failure */
+static int readOrWriteBytes(
+    tr_session* session,
+    tr_torrent* tor,
+    int ioMode,
+    tr_file_index_t file_index,
+    uint64_t file_offset,
+    tr_sys_iovec const* iov,
+    size_t iov_count,
+    size_t buflen)
+{
+    bool const doWrite = ioMode >= TR_IO_WRITE;
+
+    auto const file_size = tor->fileSize(file_index);
+    TR_ASSERT(file_size == 0 || file_offset < file_size);
+    TR_ASSERT(file_offset + buflen <= file_size);
 
-        tr_free(subpath);
+    if (file_size == 0)
+    {
+        return 0;
     }
 
+    auto fd = tr_sys_file_t{ TR_BAD_SYS_FILE };
+    int err = getFileFd(session, tor, doWrite, file_index, &fd);
+
     /***
     ****  Use the fd
     ***/
@@ -120,7 +131,7 @@ static int readOrWriteBytes(
 
         if (ioMode == TR_IO_READ)
         {
-            if (!tr_sys_file_read_at(fd, buf, buflen, file_offset, nullptr, &error))
+            if (!tr_sys_file_readv_at(fd, iov, iov_count, file_offset, nullptr, &error))
             {
                 err = error->code;
                 tr_logAddTorErr(tor, "read failed for \"%s\": %s", tor->fileSubpath(file_index).c_str(), error->message);
@@ -129,7 +140,7 @@ static int readOrWriteBytes(
         }
         else if (ioMode == TR_IO_WRITE)
         {
-            if (!tr_sys_file_write_at(fd, buf, buflen, file_offset, nullptr, &error))
+            if (!tr_sys_file_writev_at(fd, iov, iov_count, file_offset, nullptr, &error))
             {
                 err = error->code;
                 tr_logAddTorErr(tor, "write failed for \"%s\": %s", tor->fileSubpath(file_index).c_str(), error->message);
@@ -149,13 +160,40 @@ static int readOrWriteBytes(
     return err;
 }
 
+/* copy the next `len` bytes' worth of `iov`, starting at the cursor, into `setme` */
+static void sliceIovecs(
+    tr_sys_iovec const* iov,
+    size_t* iov_pos,
+    size_t* iov_skip,
+    uint64_t len,
+    std::vector<tr_sys_iovec>& setme)
+{
+    setme.clear();
+
+    while (len > 0)
+    {
+        auto const& cur = iov[*iov_pos];
+        auto const n = std::min(uint64_t{ cur.len - *iov_skip }, len);
+        setme.push_back({ static_cast<uint8_t*>(cur.base) + *iov_skip, size_t(n) });
+        len -= n;
+        *iov_skip += n;
+
+        if (*iov_skip == cur.len)
+        {
+            ++*iov_pos;
+            *iov_skip = 0;
+        }
+    }
+}
+
 /* returns 0 on success, or an errno on failure */
 static int readOrWritePiece(
     tr_torrent* tor,
     int ioMode,
     tr_piece_index_t pieceIndex,
     uint32_t pieceOffset,
-    uint8_t* buf,
+    tr_sys_iovec const* iov,
+    size_t iov_count,
     size_t buflen)
 {
     int err = 0;
@@ -167,39 +205,246 @@ static int readOrWritePiece(
 
     auto [file_index, file_offset] = tor->fileOffset(pieceIndex, pieceOffset);
 
-    while (buflen != 0 && err == 0)
+    /* the common case: everything lands in a single file */
+    if (buflen <= tor->fileSize(file_index) - file_offset)
     {
-        uint64_t const bytes_this_pass = std::min(uint64_t{ buflen }, uint64_t{ tor->fileSize(file_index) - file_offset });
-
-        err = readOrWriteBytes(tor->session, tor, ioMode, file_index, file_offset, buf, bytes_this_pass);
-        buf += bytes_this_pass;
-        buflen -= bytes_this_pass;
-        ++file_index;
-        file_offset = 0;
+        err = readOrWriteBytes(tor->session, tor, ioMode, file_index, file_offset, iov, iov_count, buflen);
+    }
+    else
+    {
+        auto span = std::vector<tr_sys_iovec>{};
+        size_t iov_pos = 0;
+        size_t iov_skip = 0;
 
-        if (err != 0 && ioMode == TR_IO_WRITE && tor->error != TR_STAT_LOCAL_ERROR)
+        while (buflen != 0 && err == 0)
         {
-            auto const path = tr_strvPath(tor->downloadDir().sv(), tor->fileSubpath(file_index));
-            tor->setLocalError(tr_strvJoin(tr_strerror(err), " ("sv, path, ")"sv));
+            uint64_t const bytes_this_pass = std::min(uint64_t{ buflen }, uint64_t{ tor->fileSize(file_index) - file_offset });
+
+            if (iov != nullptr)
+            {
+                sliceIovecs(iov, &iov_pos, &iov_skip, bytes_this_pass, span);
+            }
+
+            err = readOrWriteBytes(
+                tor->session,
+                tor,
+                ioMode,
+                file_index,
+                file_offset,
+                std::data(span),
+                std::size(span),
+                bytes_this_pass);
+            buflen -= bytes_this_pass;
+
+            if (err != 0)
+            {
+                break;
+            }
+
+            ++file_index;
+            file_offset = 0;
         }
     }
 
+    if (err != 0 && ioMode == TR_IO_WRITE)
+    {
+        tr_ioSetWriteError(tor, file_index, err);
+    }
+
     return err;
 }
 
+static size_t iovecsSize(tr_sys_iovec const* iov, size_t iov_count)
+{
+    size_t ret = 0;
+
+    for (size_t i = 0; i < iov_count; ++i)
+    {
+        ret += iov[i].len;
+    }
+
+    return ret;
+}
+
 int tr_ioRead(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len, uint8_t* buf)
 {
-    return readOrWritePiece(tor, TR_IO_READ, pieceIndex, begin, buf, len);
+    auto const iov = tr_sys_iovec{ buf, len };
+    return readOrWritePiece(tor, TR_IO_READ, pieceIndex, begin, &iov, 1, len);
+}
+
+int tr_ioReadv(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, tr_sys_iovec const* iov, size_t iov_count)
+{
+    return readOrWritePiece(tor, TR_IO_READ, pieceIndex, begin, iov, iov_count, iovecsSize(iov, iov_count));
 }
 
 int tr_ioPrefetch(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len)
 {
-    return readOrWritePiece(tor, TR_IO_PREFETCH, pieceIndex, begin, nullptr, len);
+    return readOrWritePiece(tor, TR_IO_PREFETCH, pieceIndex, begin, nullptr, 0, len);
 }
 
 int tr_ioWrite(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len, uint8_t const* buf)
 {
-    return readOrWritePiece(tor, TR_IO_WRITE, pieceIndex, begin, (uint8_t*)buf, len);
+    auto const iov = tr_sys_iovec{ const_cast<uint8_t*>(buf), len };
+    return readOrWritePiece(tor, TR_IO_WRITE, pieceIndex, begin, &iov, 1, len);
+}
+
+int tr_ioWritev(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, tr_sys_iovec const* iov, size_t iov_count)
+{
+    return readOrWritePiece(tor, TR_IO_WRITE, pieceIndex, begin, iov, iov_count, iovecsSize(iov, iov_count));
+}
+
+void tr_ioSetWriteError(tr_torrent* tor, tr_file_index_t file_index, int err)
+{
+    if (tor->error != TR_STAT_LOCAL_ERROR)
+    {
+        auto const path = tr_strvPath(tor->downloadDir().sv(), tor->fileSubpath(file_index));
+        tor->setLocalError(tr_strvJoin(tr_strerror(err), " ("sv, path, ")"sv));
+    }
+}
+
+/****
+*****  Segments, for doing IO outside of the libtransmission thread
+****/
+
+int tr_ioOpenSegments(
+    tr_torrent* tor,
+    bool do_write,
+    tr_piece_index_t pieceIndex,
+    uint32_t pieceOffset,
+    uint64_t len,
+    std::vector<tr_io_segment>& setme)
+{
+    TR_ASSERT(tr_amInEventThread(tor->session));
+
+    setme.clear();
+
+    if (pieceIndex >= tor->pieceCount())
+    {
+        return EINVAL;
+    }
+
+    int err = 0;
+    auto [file_index, file_offset] = tor->fileOffset(pieceIndex, pieceOffset);
+
+    for (;;)
+    {
+        uint64_t const bytes_this_pass = std::min(len, uint64_t{ tor->fileSize(file_index) - file_offset });
+
+        if (bytes_this_pass != 0)
+        {
+            auto fd = tr_sys_file_t{ TR_BAD_SYS_FILE };
+            err = getFileFd(tor->session, tor, do_write, file_index, &fd);
+
+            if (err != 0)
+            {
+                break;
+            }
+
+            tr_fdFilePin(tor->session, fd);
+            setme.push_back({ fd, file_index, file_offset, bytes_this_pass });
+        }
+
+        len -= bytes_this_pass;
+
+        if (len == 0)
+        {
+            break;
+        }
+
+        ++file_index;
+        file_offset = 0;
+    }
+
+    if (err != 0)
+    {
+        if (do_write)
+        {
+            tr_ioSetWriteError(tor, file_index, err);
+        }
+
+        tr_ioCloseSegments(tor->session, setme);
+    }
+
+    return err;
+}
+
+void tr_ioCloseSegments(tr_session* session, std::vector<tr_io_segment>& segments)
+{
+    for (auto const& segment : segments)
+    {
+        tr_fdFileUnpin(session, segment.fd);
+    }
+
+    segments.clear();
+}
+
+static int readOrWriteSegments(
+    int ioMode,
+    std::vector<tr_io_segment> const& segments,
+    tr_sys_iovec const* iov,
+    size_t iov_count,
+    tr_file_index_t* setme_failed_file)
+{
+    auto span = std::vector<tr_sys_iovec>{};
+    size_t iov_pos = 0;
+    size_t iov_skip = 0;
+
+    for (auto const& segment : segments)
+    {
+        auto const* seg_iov = iov;
+        auto seg_iov_count = iov_count;
+
+        /* a span that crosses files gets its buffers sliced up per file */
+        if (std::size(segments) > 1)
+        {
+            sliceIovecs(iov, &iov_pos, &iov_skip, segment.len, span);
+            seg_iov = std::data(span);
+            seg_iov_count = std::size(span);
+        }
+
+        tr_error* error = nullptr;
+        bool const ok = ioMode == TR_IO_READ ?
+            tr_sys_file_readv_at(segment.fd, seg_iov, seg_iov_count, segment.file_offset, nullptr, &error) :
+            tr_sys_file_writev_at(segment.fd, seg_iov, seg_iov_count, segment.file_offset, nullptr, &error);
+
+        if (!ok)
+        {
+            int const err = error->code;
+            tr_logAddError(
+                "%s failed at offset %" PRIu64 ": %s",
+                ioMode == TR_IO_READ ? "read" : "write",
+                segment.file_offset,
+                error->message);
+            tr_error_free(error);
+
+            if (setme_failed_file != nullptr)
+            {
+                *setme_failed_file = segment.file_index;
+            }
+
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+int tr_ioSegmentsReadv(
+    std::vector<tr_io_segment> const& segments,
+    tr_sys_iovec const* iov,
+    size_t iov_count,
+    tr_file_index_t* setme_failed_file)
+{
+    return readOrWriteSegments(TR_IO_READ, segments, iov, iov_count, setme_failed_file);
+}
+
+int tr_ioSegmentsWritev(
+    std::vector<tr_io_segment> const& segments,
+    tr_sys_iovec const* iov,
+    size_t iov_count,
+    tr_file_index_t* setme_failed_file)
+{
+    return readOrWriteSegments(TR_IO_WRITE, segments, iov, iov_count, setme_failed_file);
 }
 
 /****
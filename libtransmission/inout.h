@@ -12,6 +12,12 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <cstddef> // size_t
+#include <vector>
+
+#include "file.h" // tr_sys_file_t
+
+struct tr_sys_iovec;
 struct tr_torrent;
 
 /**
@@ -25,6 +31,18 @@ struct tr_torrent;
  */
 int tr_ioRead(struct tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t offset, uint32_t len, uint8_t* setme);
 
+/**
+ * Like tr_ioRead(), but scatters the data across a list of buffers
+ * so that a multi-block run can be read with a single syscall per file.
+ * @return 0 on success, or an errno value on failure.
+ */
+int tr_ioReadv(
+    struct tr_torrent* tor,
+    tr_piece_index_t pieceIndex,
+    uint32_t offset,
+    struct tr_sys_iovec const* iov,
+    size_t iov_count);
+
 int tr_ioPrefetch(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len);
 
 /**
@@ -33,6 +51,72 @@ int tr_ioPrefetch(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin,
  */
 int tr_ioWrite(struct tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t offset, uint32_t len, uint8_t const* writeme);
 
+/**
+ * Like tr_ioWrite(), but gathers the data from a list of buffers
+ * so that a multi-block run can be written with a single syscall per file.
+ * @return 0 on success, or an errno value on failure.
+ */
+int tr_ioWritev(
+    struct tr_torrent* tor,
+    tr_piece_index_t pieceIndex,
+    uint32_t offset,
+    struct tr_sys_iovec const* iov,
+    size_t iov_count);
+
+/**
+ * Flags the torrent with a local error for a write that failed with `err`.
+ */
+void tr_ioSetWriteError(tr_torrent* tor, tr_file_index_t file_index, int err);
+
+/**
+ * One file's share of a piece span. It pins the file's descriptor in the
+ * open file pool, so the span can be read or written on another thread while
+ * the libtransmission thread keeps opening and closing its cached files.
+ */
+struct tr_io_segment
+{
+    tr_sys_file_t fd;
+    tr_file_index_t file_index;
+    uint64_t file_offset;
+    uint64_t len;
+};
+
+/**
+ * Opens the files that a piece span covers. Must be called from the
+ * libtransmission thread; release the segments with tr_ioCloseSegments().
+ * @return 0 on success, or an errno value on failure.
+ */
+int tr_ioOpenSegments(
+    struct tr_torrent* tor,
+    bool do_write,
+    tr_piece_index_t pieceIndex,
+    uint32_t offset,
+    uint64_t len,
+    std::vector<tr_io_segment>& setme);
+
+/* unpin the segments' files. Must be called from the libtransmission thread. */
+void tr_ioCloseSegments(tr_session* session, std::vector<tr_io_segment>& segments);
+
+/**
+ * Scatter-reads opened segments. Safe to call from any thread.
+ * @return 0 on success, or an errno value on failure.
+ */
+int tr_ioSegmentsReadv(
+    std::vector<tr_io_segment> const& segments,
+    struct tr_sys_iovec const* iov,
+    size_t iov_count,
+    tr_file_index_t* setme_failed_file);
+
+/**
+ * Gather-writes opened segments. Safe to call from any thread.
+ * @return 0 on success, or an errno value on failure.
+ */
+int tr_ioSegmentsWritev(
+    std::vector<tr_io_segment> const& segments,
+    struct tr_sys_iovec const* iov,
+    size_t iov_count,
+    tr_file_index_t* setme_failed_file);
+
 /**
  * @brief Test to see if the piece matches its metainfo's SHA1 checksum.
  */
@@ -0,0 +1,264 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cmath> /* fabs() */
+#include <string_view>
+
+#include <utf8.h>
+#include <event2/buffer.h>
+
+#define LIBTRANSMISSION_VARIANT_MODULE
+
+#include "transmission.h"
+
+#include "json-writer.h"
+#include "tr-assert.h"
+#include "utils.h"
+#include "variant-common.h"
+#include "variant.h"
+
+void tr_jsonAddStr(evbuffer* out, std::string_view sv)
+{
+    // worst case is a control character, which becomes a six-byte \uXXXX
+    struct evbuffer_iovec vec[1];
+    evbuffer_reserve_space(out, std::size(sv) * 6 + 2, vec, 1);
+    auto* const begin = static_cast<char*>(vec[0].iov_base);
+    char const* const outend = begin + vec[0].iov_len;
+
+    char* outwalk = begin;
+    *outwalk++ = '"';
+
+    for (; !std::empty(sv); sv.remove_prefix(1))
+    {
+        switch (sv.front())
+        {
+        case '\b':
+            *outwalk++ = '\\';
+            *outwalk++ = 'b';
+            break;
+
+        case '\f':
+            *outwalk++ = '\\';
+            *outwalk++ = 'f';
+            break;
+
+        case '\n':
+            *outwalk++ = '\\';
+            *outwalk++ = 'n';
+            break;
+
+        case '\r':
+            *outwalk++ = '\\';
+            *outwalk++ = 'r';
+            break;
+
+        case '\t':
+            *outwalk++ = '\\';
+            *outwalk++ = 't';
+            break;
+
+        case '"':
+            *outwalk++ = '\\';
+            *outwalk++ = '"';
+            break;
+
+        case '\\':
+            *outwalk++ = '\\';
+            *outwalk++ = '\\';
+            break;
+
+        default:
+            if (isprint(static_cast<unsigned char>(sv.front())))
+            {
+                *outwalk++ = sv.front();
+            }
+            else
+            {
+                try
+                {
+                    auto* begin8 = std::data(sv);
+                    auto* end8 = begin8 + std::size(sv);
+                    auto* walk8 = begin8;
+                    auto const uch32 = utf8::next(walk8, end8);
+                    outwalk += tr_snprintf(outwalk, outend - outwalk, "\\u%04x", uch32);
+                    sv.remove_prefix(walk8 - begin8 - 1);
+                }
+                catch (utf8::exception const&)
+                {
+                    *outwalk++ = '?';
+                }
+            }
+            break;
+        }
+    }
+
+    *outwalk++ = '"';
+    vec[0].iov_len = outwalk - begin;
+    evbuffer_commit_space(out, vec, 1);
+}
+
+void tr_jsonAddReal(evbuffer* out, double d)
+{
+    if (fabs(d - (int)d) < 0.00001)
+    {
+        evbuffer_add_printf(out, "%d", (int)d);
+    }
+    else
+    {
+        evbuffer_add_printf(out, "%.4f", tr_truncd(d, 4));
+    }
+}
+
+/***
+****
+***/
+
+void tr_json_writer::addSeparator()
+{
+    if (need_comma_)
+    {
+        evbuffer_add(out_, ",", 1);
+    }
+}
+
+void tr_json_writer::beginObject()
+{
+    addSeparator();
+    evbuffer_add(out_, "{", 1);
+    need_comma_ = false;
+}
+
+void tr_json_writer::endObject()
+{
+    evbuffer_add(out_, "}", 1);
+    need_comma_ = true;
+}
+
+void tr_json_writer::beginArray()
+{
+    addSeparator();
+    evbuffer_add(out_, "[", 1);
+    need_comma_ = false;
+}
+
+void tr_json_writer::endArray()
+{
+    evbuffer_add(out_, "]", 1);
+    need_comma_ = true;
+}
+
+void tr_json_writer::addKey(tr_quark key)
+{
+    addSeparator();
+
+    auto const sv = tr_quark_get_string_view(key);
+    if (key < TR_N_KEYS)
+    {
+        // the predefined keys are all plain ascii and need no escaping
+        evbuffer_add(out_, "\"", 1);
+        evbuffer_add(out_, std::data(sv), std::size(sv));
+        evbuffer_add(out_, "\":", 2);
+    }
+    else
+    {
+        tr_jsonAddStr(out_, sv);
+        evbuffer_add(out_, ":", 1);
+    }
+
+    need_comma_ = false;
+}
+
+void tr_json_writer::addBool(bool value)
+{
+    addSeparator();
+    if (value)
+    {
+        evbuffer_add(out_, "true", 4);
+    }
+    else
+    {
+        evbuffer_add(out_, "false", 5);
+    }
+    need_comma_ = true;
+}
+
+void tr_json_writer::addInt(int64_t value)
+{
+    addSeparator();
+    auto buf = std::array<char, 32>{};
+    auto const* const end = std::to_chars(std::data(buf), std::data(buf) + std::size(buf), value).ptr;
+    evbuffer_add(out_, std::data(buf), end - std::data(buf));
+    need_comma_ = true;
+}
+
+void tr_json_writer::addReal(double value)
+{
+    addSeparator();
+    tr_jsonAddReal(out_, value);
+    need_comma_ = true;
+}
+
+void tr_json_writer::addStr(std::string_view value)
+{
+    addSeparator();
+    tr_jsonAddStr(out_, value);
+    need_comma_ = true;
+}
+
+void tr_json_writer::addVariant(tr_variant const& value)
+{
+    switch (value.type)
+    {
+    case TR_VARIANT_TYPE_INT:
+        addInt(value.val.i);
+        break;
+
+    case TR_VARIANT_TYPE_BOOL:
+        addBool(value.val.b);
+        break;
+
+    case TR_VARIANT_TYPE_REAL:
+        addReal(value.val.d);
+        break;
+
+    case TR_VARIANT_TYPE_STR:
+        {
+            auto sv = std::string_view{};
+            (void)!tr_variantGetStrView(&value, &sv);
+            addStr(sv);
+            break;
+        }
+
+    case TR_VARIANT_TYPE_LIST:
+        beginArray();
+        for (size_t i = 0; i < value.val.l.count; ++i)
+        {
+            addVariant(value.val.l.vals[i]);
+        }
+        endArray();
+        break;
+
+    case TR_VARIANT_TYPE_DICT:
+        beginObject();
+        for (size_t i = 0; i < value.val.l.count; ++i)
+        {
+            auto const& child = value.val.l.vals[i];
+            addKey(child.key);
+            addVariant(child);
+        }
+        endObject();
+        break;
+
+    default:
+        TR_ASSERT_MSG(false, "unhandled variant type");
+        break;
+    }
+}
@@ -0,0 +1,64 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstdint> // int64_t
+#include <string_view>
+
+#include "quark.h"
+
+struct evbuffer;
+struct tr_variant;
+
+/**
+ * Writes lean JSON straight into an evbuffer, for responses that are
+ * too big to build as a tr_variant tree first. Keys are written from
+ * the quark table.
+ *
+ * The writer adds the commas and colons, but it's up to the caller to
+ * nest the begin/end calls correctly and to give every object value a key.
+ */
+class tr_json_writer
+{
+public:
+    explicit tr_json_writer(evbuffer* out)
+        : out_{ out }
+    {
+    }
+
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+
+    void addKey(tr_quark key);
+    void addBool(bool value);
+    void addInt(int64_t value);
+    void addReal(double value);
+    void addStr(std::string_view value);
+
+    /* writes a variant and its children, e.g. a value built by code shared with the tr_variant path */
+    void addVariant(tr_variant const& value);
+
+private:
+    void addSeparator();
+
+    evbuffer* const out_;
+    bool need_comma_ = false;
+};
+
+/* escapes and quotes `str` as a JSON string */
+void tr_jsonAddStr(evbuffer* out, std::string_view str);
+
+/* formats `d` the same way for both the tr_variant serializer and tr_json_writer */
+void tr_jsonAddReal(evbuffer* out, double d);
@@ -247,6 +247,10 @@ void tr_metaInfoBuilderFree(tr_metainfo_builder* builder)
 *****
 ****/
 
+/* how many pieces, and how many bytes of them, getHashInfo() hashes at once */
+static auto constexpr MaxHashBatchPieces = uint32_t{ 8 };
+static auto constexpr MaxHashBatchBytes = uint32_t{ 16 * 1024 * 1024 };
+
 static std::vector<std::byte> getHashInfo(tr_metainfo_builder* b)
 {
     auto ret = std::vector<std::byte>(std::size(tr_sha1_digest_t{}) * b->pieceCount);
@@ -260,10 +264,16 @@ static std::vector<std::byte> getHashInfo(tr_metainfo_builder* b)
     uint64_t totalRemain = b->totalSize;
     uint32_t fileIndex = 0;
     auto* walk = std::data(ret);
-    auto buf = std::vector<char>(b->pieceSize);
     uint64_t off = 0;
     tr_error* error = nullptr;
 
+    /* read several pieces before hashing them, so that they can be hashed together */
+    auto const batch_size = std::clamp(uint32_t(MaxHashBatchBytes / b->pieceSize), uint32_t{ 1 }, MaxHashBatchPieces);
+    auto buf = std::vector<char>(size_t{ b->pieceSize } * batch_size);
+    void const* batch_pieces[MaxHashBatchPieces];
+    size_t batch_lengths[MaxHashBatchPieces];
+    tr_sha1_digest_t batch_digests[MaxHashBatchPieces];
+
     tr_sys_file_t fd = tr_sys_file_open(b->files[fileIndex].filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, &error);
     if (fd == TR_BAD_SYS_FILE)
     {
@@ -276,64 +286,79 @@ static std::vector<std::byte> getHashInfo(tr_metainfo_builder* b)
 
     while (totalRemain != 0)
     {
-        TR_ASSERT(b->pieceIndex < b->pieceCount);
-
-        auto* bufptr = std::data(buf);
-        uint32_t const thisPieceSize = std::min(uint64_t{ b->pieceSize }, totalRemain);
-        uint64_t leftInPiece = thisPieceSize;
+        auto const first_piece = b->pieceIndex;
+        size_t n_pieces = 0;
 
-        while (leftInPiece != 0)
+        for (; n_pieces < batch_size && totalRemain != 0; ++n_pieces)
         {
-            uint64_t const n_this_pass = std::min(b->files[fileIndex].size - off, leftInPiece);
-            uint64_t n_read = 0;
-            (void)tr_sys_file_read(fd, bufptr, n_this_pass, &n_read, nullptr);
-            bufptr += n_read;
-            off += n_read;
-            leftInPiece -= n_read;
-
-            if (off == b->files[fileIndex].size)
-            {
-                off = 0;
-                tr_sys_file_close(fd, nullptr);
-                fd = TR_BAD_SYS_FILE;
+            TR_ASSERT(b->pieceIndex < b->pieceCount);
+
+            auto* const piece_begin = std::data(buf) + size_t{ b->pieceSize } * n_pieces;
+            auto* bufptr = piece_begin;
+            uint32_t const thisPieceSize = std::min(uint64_t{ b->pieceSize }, totalRemain);
+            uint64_t leftInPiece = thisPieceSize;
 
-                if (++fileIndex < b->fileCount)
+            while (leftInPiece != 0)
+            {
+                uint64_t const n_this_pass = std::min(b->files[fileIndex].size - off, leftInPiece);
+                uint64_t n_read = 0;
+                (void)tr_sys_file_read(fd, bufptr, n_this_pass, &n_read, nullptr);
+                bufptr += n_read;
+                off += n_read;
+                leftInPiece -= n_read;
+
+                if (off == b->files[fileIndex].size)
                 {
-                    fd = tr_sys_file_open(b->files[fileIndex].filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, &error);
+                    off = 0;
+                    tr_sys_file_close(fd, nullptr);
+                    fd = TR_BAD_SYS_FILE;
 
-                    if (fd == TR_BAD_SYS_FILE)
+                    if (++fileIndex < b->fileCount)
                     {
-                        b->my_errno = error->code;
-                        tr_strlcpy(b->errfile, b->files[fileIndex].filename, sizeof(b->errfile));
-                        b->result = TR_MAKEMETA_IO_READ;
-                        tr_error_free(error);
-                        return {};
+                        fd = tr_sys_file_open(
+                            b->files[fileIndex].filename,
+                            TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL,
+                            0,
+                            &error);
+
+                        if (fd == TR_BAD_SYS_FILE)
+                        {
+                            b->my_errno = error->code;
+                            tr_strlcpy(b->errfile, b->files[fileIndex].filename, sizeof(b->errfile));
+                            b->result = TR_MAKEMETA_IO_READ;
+                            tr_error_free(error);
+                            return {};
+                        }
                     }
                 }
             }
+
+            TR_ASSERT(bufptr - piece_begin == (int)thisPieceSize);
+            TR_ASSERT(leftInPiece == 0);
+            batch_pieces[n_pieces] = piece_begin;
+            batch_lengths[n_pieces] = thisPieceSize;
+            totalRemain -= thisPieceSize;
+            ++b->pieceIndex;
         }
 
-        TR_ASSERT(bufptr - std::data(buf) == (int)thisPieceSize);
-        TR_ASSERT(leftInPiece == 0);
-        auto const digest = tr_sha1(buf);
-        if (!digest)
+        if (!tr_sha1_batch(n_pieces, batch_pieces, batch_lengths, batch_digests))
         {
             b->my_errno = EIO;
-            tr_snprintf(b->errfile, sizeof(b->errfile), "error hashing piece %" PRIu32, b->pieceIndex);
+            tr_snprintf(b->errfile, sizeof(b->errfile), "error hashing piece %" PRIu32, first_piece);
             b->result = TR_MAKEMETA_IO_READ;
             return {};
         }
 
-        walk = std::copy(std::begin(*digest), std::end(*digest), walk);
+        for (size_t i = 0; i < n_pieces; ++i)
+        {
+            walk = std::copy(std::begin(batch_digests[i]), std::end(batch_digests[i]), walk);
+        }
 
         if (b->abortFlag)
         {
             b->result = TR_MAKEMETA_CANCELLED;
             break;
         }
-
-        totalRemain -= thisPieceSize;
-        ++b->pieceIndex;
     }
 
     TR_ASSERT(b->abortFlag || size_t(walk - std::data(ret)) == std::size(ret));
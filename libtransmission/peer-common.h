@@ -45,6 +45,8 @@ enum PeerEventType
     TR_PEER_CLIENT_GOT_SUGGEST,
     TR_PEER_CLIENT_GOT_PORT,
     TR_PEER_CLIENT_GOT_REJ,
+    /* the GOT_BITFIELD and GOT_HAVE* events are published before tr_peer.have
+     * is changed, so that subscribers can see both the old and the new pieces */
     TR_PEER_CLIENT_GOT_BITFIELD,
     TR_PEER_CLIENT_GOT_HAVE,
     TR_PEER_CLIENT_GOT_HAVE_ALL,
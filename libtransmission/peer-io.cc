@@ -189,6 +189,8 @@ static void didWriteWrapper(tr_peerIo* io, unsigned int bytes_transferred)
     }
 }
 
+static void maybeDecryptInbuf(tr_peerIo* io);
+
 static void canReadWrapper(tr_peerIo* io)
 {
     dbgmsg(io, "canRead");
@@ -209,9 +211,11 @@ static void canReadWrapper(tr_peerIo* io)
         while (!done && !err)
         {
             size_t piece = 0;
+            maybeDecryptInbuf(io);
             size_t const oldLen = evbuffer_get_length(io->inbuf);
             int const ret = io->canRead(io, io->userData, &piece);
             size_t const used = oldLen - evbuffer_get_length(io->inbuf);
+            io->inbuf_decrypted -= std::min(io->inbuf_decrypted, used);
             unsigned int const overhead = guessPacketOverhead(used);
 
             if (piece != 0 || piece != used)
@@ -1048,6 +1052,19 @@ void tr_peerIoSetEncryption(tr_peerIo* io, tr_encryption_type encryption_type)
     io->encryption_type = encryption_type;
 }
 
+void tr_peerIoSetDecryptOnReceive(tr_peerIo* io)
+{
+    TR_ASSERT(tr_isPeerIo(io));
+
+    if (!io->decrypt_on_receive)
+    {
+        // everything in inbuf now is still ciphertext.
+        // It gets decrypted before the next canRead() call.
+        io->decrypt_on_receive = true;
+        io->inbuf_decrypted = 0;
+    }
+}
+
 /**
 ***
 **/
@@ -1164,11 +1181,36 @@ static inline void maybeDecryptBuffer(tr_peerIo* io, struct evbuffer* buf, size_
     }
 }
 
+/* decrypt the input that's come in since the last call, in place */
+static void maybeDecryptInbuf(tr_peerIo* io)
+{
+    if (!io->decrypt_on_receive)
+    {
+        return;
+    }
+
+    size_t const len = evbuffer_get_length(io->inbuf);
+    TR_ASSERT(io->inbuf_decrypted <= len);
+
+    if (io->inbuf_decrypted < len)
+    {
+        maybeDecryptBuffer(io, io->inbuf, io->inbuf_decrypted, len - io->inbuf_decrypted);
+        io->inbuf_decrypted = len;
+    }
+}
+
 void tr_peerIoReadBytesToBuf(tr_peerIo* io, struct evbuffer* inbuf, struct evbuffer* outbuf, size_t byteCount)
 {
     TR_ASSERT(tr_isPeerIo(io));
     TR_ASSERT(evbuffer_get_length(inbuf) >= byteCount);
 
+    if (io->decrypt_on_receive)
+    {
+        /* it's already plaintext, so just move the chains over */
+        evbuffer_remove_buffer(inbuf, outbuf, byteCount);
+        return;
+    }
+
     size_t const old_length = evbuffer_get_length(outbuf);
 
     /* append it to outbuf */
@@ -1185,6 +1227,12 @@ void tr_peerIoReadBytes(tr_peerIo* io, struct evbuffer* inbuf, void* bytes, size
     TR_ASSERT(tr_isPeerIo(io));
     TR_ASSERT(evbuffer_get_length(inbuf) >= byteCount);
 
+    if (io->decrypt_on_receive)
+    {
+        evbuffer_remove(inbuf, bytes, byteCount);
+        return;
+    }
+
     switch (io->encryption_type)
     {
     case PEER_ENCRYPTION_NONE:
@@ -1217,6 +1265,12 @@ void tr_peerIoReadUint32(tr_peerIo* io, struct evbuffer* inbuf, uint32_t* setme)
 
 void tr_peerIoDrain(tr_peerIo* io, struct evbuffer* inbuf, size_t byteCount)
 {
+    if (io->decrypt_on_receive)
+    {
+        evbuffer_drain(inbuf, byteCount);
+        return;
+    }
+
     char buf[4096];
     size_t const buflen = sizeof(buf);
 
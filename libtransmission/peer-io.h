@@ -125,6 +125,12 @@ public:
     // TODO(ckerr): this could be narrowed to 1 byte
     tr_encryption_type encryption_type = PEER_ENCRYPTION_NONE;
 
+    // if true, RC4 input is decrypted in place once, when it's read from
+    // the socket, and the tr_peerIoRead*() functions hand out plaintext.
+    // inbuf_decrypted is how many bytes at the front of inbuf are plaintext.
+    bool decrypt_on_receive = false;
+    size_t inbuf_decrypted = 0;
+
     // TODO: use std::shared_ptr instead of manual refcounting?
     int refCount = 1;
 
@@ -273,11 +279,23 @@ constexpr tr_crypto* tr_peerIoGetCrypto(tr_peerIo* io)
 
 void tr_peerIoSetEncryption(tr_peerIo* io, tr_encryption_type encryption_type);
 
+/* Decrypt input as soon as it's read instead of in each tr_peerIoRead*() call.
+ * This is for after the handshake, which needs to decrypt its input piecemeal. */
+void tr_peerIoSetDecryptOnReceive(tr_peerIo* io);
+
 constexpr bool tr_peerIoIsEncrypted(tr_peerIo const* io)
 {
     return io != nullptr && io->encryption_type == PEER_ENCRYPTION_RC4;
 }
 
+/* true if file data can be added to the output buffer as a file segment,
+ * for the kernel to send straight from the page cache. Encrypted data has
+ * to be transformed in the buffer, and uTP packs its own packets. */
+constexpr bool tr_peerIoSupportsSendfile(tr_peerIo const* io)
+{
+    return !tr_peerIoIsEncrypted(io) && io->socket.type == TR_PEER_SOCKET_TYPE_TCP;
+}
+
 void evbuffer_add_uint8(struct evbuffer* outbuf, uint8_t byte);
 void evbuffer_add_uint16(struct evbuffer* outbuf, uint16_t hs);
 void evbuffer_add_uint32(struct evbuffer* outbuf, uint32_t hl);
@@ -0,0 +1,118 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <cstddef>
+
+#define LIBTRANSMISSION_PEER_MODULE
+
+#include "transmission.h"
+#include "bitfield.h"
+#include "peer-mgr-replication.h"
+#include "peer-mgr-wishlist.h"
+#include "tr-assert.h"
+
+PieceReplication::PieceReplication(Wishlist& wishlist)
+    : wishlist_{ wishlist }
+{
+}
+
+void PieceReplication::reset(tr_piece_index_t n_pieces)
+{
+    counts_.assign(n_pieces, 0);
+    wishlist_.reset();
+}
+
+void PieceReplication::add(tr_bitfield const& have)
+{
+    update(have, 1);
+}
+
+void PieceReplication::remove(tr_bitfield const& have)
+{
+    update(have, -1);
+}
+
+void PieceReplication::gotHave(tr_piece_index_t piece)
+{
+    update(piece, 1);
+}
+
+void PieceReplication::gotHaveAll(tr_bitfield const& old_have)
+{
+    update(old_have, -1);
+    updateAll(1);
+}
+
+void PieceReplication::gotHaveNone(tr_bitfield const& old_have)
+{
+    update(old_have, -1);
+}
+
+void PieceReplication::gotBitfield(tr_bitfield const& old_have, tr_bitfield const& new_have)
+{
+    update(old_have, -1);
+    update(new_have, 1);
+}
+
+size_t PieceReplication::count(tr_piece_index_t piece) const
+{
+    return piece < std::size(counts_) ? counts_[piece] : 0;
+}
+
+void PieceReplication::update(tr_piece_index_t piece, int delta)
+{
+    // a magnet link's peers can announce pieces before we know how many there
+    // are. They're counted by the reset() and add() that follow the metainfo
+    if (piece < std::size(counts_))
+    {
+        TR_ASSERT(delta > 0 || counts_[piece] > 0);
+        counts_[piece] += delta;
+        wishlist_.pieceChanged(piece);
+    }
+}
+
+void PieceReplication::update(tr_bitfield const& have, int delta)
+{
+    if (have.hasAll())
+    {
+        updateAll(delta);
+    }
+    else if (!have.hasNone())
+    {
+        auto const n = std::size(counts_);
+        have.forEachSet(
+            [this, n, delta](size_t piece)
+            {
+                if (piece < n)
+                {
+                    update(tr_piece_index_t(piece), delta);
+                }
+            });
+    }
+}
+
+void PieceReplication::updateAll(int delta)
+{
+    if (std::empty(counts_))
+    {
+        return;
+    }
+
+    for (auto& n : counts_)
+    {
+        TR_ASSERT(delta > 0 || n > 0);
+        n += delta;
+    }
+
+    // Every piece's count changed, so the counts that the wishlist sorted
+    // by are all stale. The order can change too, since pieces that no one
+    // has are sorted last: a seed that arrives moves them up to the rarest,
+    // and one that leaves sends the pieces that only it had to the back
+    wishlist_.reset();
+}
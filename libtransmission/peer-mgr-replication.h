@@ -0,0 +1,67 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef LIBTRANSMISSION_PEER_MODULE
+#error only the libtransmission peer module should #include this header.
+#endif
+
+#include <cstddef> // size_t
+#include <cstdint> // uint16_t
+#include <vector>
+
+#include "transmission.h" // tr_piece_index_t
+
+class tr_bitfield;
+class Wishlist;
+
+/**
+ * Counts how many connected peers have each piece. The counts are updated
+ * as peers announce what they have and as they disconnect, so that neither
+ * rarest-first picking nor the availability stats have to walk every
+ * peer's bitfield. The wishlist is told about every change to the counts.
+ *
+ * The peer events are handled before the peer's `have` bitfield changes,
+ * so that the peer's old pieces can be uncounted first.
+ */
+class PieceReplication
+{
+public:
+    explicit PieceReplication(Wishlist& wishlist);
+
+    // forget all the counts, e.g. because a magnet link got its metainfo
+    void reset(tr_piece_index_t n_pieces);
+
+    // count a connected peer's pieces
+    void add(tr_bitfield const& have);
+
+    // uncount the pieces of a peer that's disconnecting
+    void remove(tr_bitfield const& have);
+
+    void gotHave(tr_piece_index_t piece);
+    void gotHaveAll(tr_bitfield const& old_have);
+    void gotHaveNone(tr_bitfield const& old_have);
+    void gotBitfield(tr_bitfield const& old_have, tr_bitfield const& new_have);
+
+    // count how many connected peers have `piece`
+    [[nodiscard]] size_t count(tr_piece_index_t piece) const;
+
+    [[nodiscard]] tr_piece_index_t size() const
+    {
+        return tr_piece_index_t(std::size(counts_));
+    }
+
+private:
+    void update(tr_piece_index_t piece, int delta);
+    void update(tr_bitfield const& have, int delta);
+    void updateAll(int delta);
+
+    Wishlist& wishlist_;
+    std::vector<uint16_t> counts_;
+};
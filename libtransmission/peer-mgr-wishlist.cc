@@ -8,6 +8,7 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstdint> // SIZE_MAX
 #include <iterator>
 #include <numeric>
 #include <utility>
@@ -24,115 +25,137 @@
 namespace
 {
 
-struct Candidate
+std::vector<tr_block_span_t> makeSpans(tr_block_index_t const* sorted_blocks, size_t n_blocks)
 {
-    tr_piece_index_t piece;
-    size_t n_blocks_missing;
-    tr_priority_t priority;
-    uint8_t salt;
-
-    Candidate(tr_piece_index_t piece_in, size_t missing_in, tr_priority_t priority_in, uint8_t salt_in)
-        : piece{ piece_in }
-        , n_blocks_missing{ missing_in }
-        , priority{ priority_in }
-        , salt{ salt_in }
+    if (n_blocks == 0)
     {
+        return {};
     }
 
-    int compare(Candidate const& that) const // <=>
+    auto spans = std::vector<tr_block_span_t>{};
+    auto cur = tr_block_span_t{ sorted_blocks[0], sorted_blocks[0] + 1 };
+    for (size_t i = 1; i < n_blocks; ++i)
     {
-        // prefer pieces closer to completion
-        if (n_blocks_missing != that.n_blocks_missing)
+        if (cur.end == sorted_blocks[i])
         {
-            return n_blocks_missing < that.n_blocks_missing ? -1 : 1;
+            ++cur.end;
         }
-
-        // prefer higher priority
-        if (priority != that.priority)
+        else
         {
-            return priority > that.priority ? -1 : 1;
+            spans.push_back(cur);
+            cur = tr_block_span_t{ sorted_blocks[i], sorted_blocks[i] + 1 };
         }
+    }
+    spans.push_back(cur);
 
-        if (salt != that.salt)
-        {
-            return salt < that.salt ? -1 : 1;
-        }
+    return spans;
+}
 
-        return 0;
+} // namespace
+
+int Wishlist::Candidate::compare(Wishlist::Candidate const& that) const // <=>
+{
+    // prefer pieces closer to completion
+    if (n_blocks_missing != that.n_blocks_missing)
+    {
+        return n_blocks_missing < that.n_blocks_missing ? -1 : 1;
     }
 
-    bool operator<(Candidate const& that) const // less than
+    // prefer higher priority
+    if (priority != that.priority)
     {
-        return compare(that) < 0;
+        return priority > that.priority ? -1 : 1;
     }
-};
 
-std::vector<Candidate> getCandidates(Wishlist::PeerInfo const& peer_info)
-{
-    // count up the pieces that we still want
-    auto wanted_pieces = std::vector<std::pair<tr_piece_index_t, size_t>>{};
-    auto const n_pieces = peer_info.countAllPieces();
-    wanted_pieces.reserve(n_pieces);
-    for (tr_piece_index_t i = 0; i < n_pieces; ++i)
+    // prefer rarer pieces, so that the swarm's copies stay spread out.
+    // pieces that no one has go last, since they can't be requested anyway
+    if (replication != that.replication)
     {
-        if (!peer_info.clientCanRequestPiece(i))
-        {
-            continue;
-        }
+        auto const rarity = [](size_t n) { return n == 0 ? SIZE_MAX : n; };
+        return rarity(replication) < rarity(that.replication) ? -1 : 1;
+    }
 
-        size_t const n_missing = peer_info.countMissingBlocks(i);
-        if (n_missing == 0)
-        {
-            continue;
-        }
+    if (salt != that.salt)
+    {
+        return salt < that.salt ? -1 : 1;
+    }
+
+    if (piece != that.piece)
+    {
+        return piece < that.piece ? -1 : 1;
+    }
+
+    return 0;
+}
 
-        wanted_pieces.emplace_back(i, n_missing);
+void Wishlist::pieceChanged(tr_piece_index_t piece)
+{
+    if (needs_rebuild_)
+    {
+        return;
     }
 
-    // transform them into candidates
-    auto const n = std::size(wanted_pieces);
-    auto saltbuf = std::vector<char>(n);
-    tr_rand_buffer(std::data(saltbuf), n);
-    auto candidates = std::vector<Candidate>{};
-    candidates.reserve(n);
-    for (size_t i = 0; i < n; ++i)
+    // if most of the pieces changed, or next() isn't being called
+    // because we're not downloading, a rebuild is just as cheap
+    if (std::size(changed_pieces_) >= std::size(piece_candidates_))
     {
-        auto const [piece, n_missing] = wanted_pieces[i];
-        candidates.emplace_back(piece, n_missing, peer_info.priority(piece), saltbuf[i]);
+        reset();
+        return;
     }
 
-    return candidates;
+    changed_pieces_.push_back(piece);
 }
 
-std::vector<tr_block_span_t> makeSpans(tr_block_index_t const* sorted_blocks, size_t n_blocks)
+void Wishlist::reset()
 {
-    if (n_blocks == 0)
+    needs_rebuild_ = true;
+    changed_pieces_.clear();
+}
+
+void Wishlist::update(Wishlist::PeerInfo const& peer_info, tr_piece_index_t piece)
+{
+    auto& it = piece_candidates_[piece];
+
+    if (it != std::end(candidates_))
     {
-        return {};
+        candidates_.erase(it);
+        it = std::end(candidates_);
     }
 
-    auto spans = std::vector<tr_block_span_t>{};
-    auto cur = tr_block_span_t{ sorted_blocks[0], sorted_blocks[0] + 1 };
-    for (size_t i = 1; i < n_blocks; ++i)
+    if (!peer_info.clientWantsPiece(piece))
     {
-        if (cur.end == sorted_blocks[i])
-        {
-            ++cur.end;
-        }
-        else
-        {
-            spans.push_back(cur);
-            cur = tr_block_span_t{ sorted_blocks[i], sorted_blocks[i] + 1 };
-        }
+        return;
     }
-    spans.push_back(cur);
 
-    return spans;
+    size_t const n_missing = peer_info.countMissingBlocks(piece);
+    if (n_missing == 0)
+    {
+        return;
+    }
+
+    auto const replication = peer_info.countPeersWithPiece(piece);
+    it = candidates_.insert(Candidate{ piece, n_missing, peer_info.priority(piece), replication, salt_[piece] }).first;
 }
 
-} // namespace
+void Wishlist::rebuild(Wishlist::PeerInfo const& peer_info)
+{
+    auto const n_pieces = peer_info.countAllPieces();
 
-std::vector<tr_block_span_t> Wishlist::next(Wishlist::PeerInfo const& peer_info, size_t n_wanted_blocks) const
+    candidates_.clear();
+    piece_candidates_.assign(n_pieces, std::end(candidates_));
+    salt_.resize(n_pieces);
+    tr_rand_buffer(std::data(salt_), std::size(salt_));
+
+    for (tr_piece_index_t piece = 0; piece < n_pieces; ++piece)
+    {
+        update(peer_info, piece);
+    }
+
+    changed_pieces_.clear();
+    needs_rebuild_ = false;
+}
+
+std::vector<tr_block_span_t> Wishlist::next(Wishlist::PeerInfo const& peer_info, size_t n_wanted_blocks)
 {
     size_t n_blocks = 0;
     auto spans = std::vector<tr_block_span_t>{};
@@ -140,14 +163,24 @@ std::vector<tr_block_span_t> Wishlist::next(Wishlist::PeerInfo const& peer_info,
     // sanity clause
     TR_ASSERT(n_wanted_blocks > 0);
 
-    // We usually won't need all the candidates until endgame, so don't
-    // waste cycles sorting all of them here. partial sort is enough.
-    auto candidates = getCandidates(peer_info);
-    auto constexpr MaxSortedPieces = size_t{ 30 };
-    auto const middle = std::min(std::size(candidates), MaxSortedPieces);
-    std::partial_sort(std::begin(candidates), std::begin(candidates) + middle, std::end(candidates));
+    // bring the sorted candidates up to date
+    if (needs_rebuild_ || std::size(piece_candidates_) != peer_info.countAllPieces())
+    {
+        rebuild(peer_info);
+    }
+    else
+    {
+        for (auto const piece : changed_pieces_)
+        {
+            update(peer_info, piece);
+        }
+
+        changed_pieces_.clear();
+    }
 
-    for (auto const& candidate : candidates)
+    auto blocks = std::vector<tr_block_index_t>{};
+
+    for (auto const& candidate : candidates_)
     {
         // do we have enough?
         if (n_blocks >= n_wanted_blocks)
@@ -155,10 +188,15 @@ std::vector<tr_block_span_t> Wishlist::next(Wishlist::PeerInfo const& peer_info,
             break;
         }
 
+        // does the peer have this piece?
+        if (!peer_info.clientCanRequestPiece(candidate.piece))
+        {
+            continue;
+        }
+
         // walk the blocks in this piece
         auto const [begin, end] = peer_info.blockSpan(candidate.piece);
-        auto blocks = std::vector<tr_block_index_t>{};
-        blocks.reserve(end - begin);
+        blocks.clear();
         for (tr_block_index_t block = begin; block < end && n_blocks + std::size(blocks) < n_wanted_blocks; ++block)
         {
             // don't request blocks we've already got
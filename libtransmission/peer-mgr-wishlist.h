@@ -13,6 +13,8 @@
 #endif
 
 #include <cstddef> // size_t
+#include <cstdint> // uint8_t
+#include <set>
 #include <vector>
 
 #include "transmission.h"
@@ -21,6 +23,9 @@
 
 /**
  * Figures out what blocks we want to request next.
+ *
+ * The pieces that we want are kept sorted between calls, so callers
+ * must tell the wishlist when a piece's state may have changed.
  */
 class Wishlist
 {
@@ -29,15 +34,60 @@ public:
     {
         virtual bool clientCanRequestBlock(tr_block_index_t block) const = 0;
         virtual bool clientCanRequestPiece(tr_piece_index_t piece) const = 0;
+        virtual bool clientWantsPiece(tr_piece_index_t piece) const = 0;
         virtual bool isEndgame() const = 0;
         virtual size_t countActiveRequests(tr_block_index_t block) const = 0;
         virtual size_t countMissingBlocks(tr_piece_index_t piece) const = 0;
         virtual tr_block_span_t blockSpan(tr_piece_index_t) const = 0;
         virtual tr_piece_index_t countAllPieces() const = 0;
         virtual tr_priority_t priority(tr_piece_index_t) const = 0;
+        virtual size_t countPeersWithPiece(tr_piece_index_t) const = 0;
         virtual ~PeerInfo() = default;
     };
 
     // get a list of the next blocks that we should request from a peer
-    std::vector<tr_block_span_t> next(PeerInfo const& peer_info, size_t n_wanted_blocks) const;
+    std::vector<tr_block_span_t> next(PeerInfo const& peer_info, size_t n_wanted_blocks);
+
+    // a piece's missing blocks or replication changed,
+    // e.g. we got a block, it failed its checksum, or a peer announced it
+    void pieceChanged(tr_piece_index_t piece);
+
+    // priorities, wanted files, or the pieces that we have changed wholesale
+    void reset();
+
+private:
+    struct Candidate
+    {
+        tr_piece_index_t piece;
+        size_t n_blocks_missing;
+        tr_priority_t priority;
+        size_t replication;
+        uint8_t salt;
+
+        int compare(Candidate const& that) const; // <=>
+
+        bool operator<(Candidate const& that) const // less than
+        {
+            return compare(that) < 0;
+        }
+    };
+
+    using candidates_t = std::set<Candidate>;
+
+    void rebuild(PeerInfo const& peer_info);
+    void update(PeerInfo const& peer_info, tr_piece_index_t piece);
+
+    // the pieces that we want, best candidates first
+    candidates_t candidates_;
+
+    // each piece's entry in `candidates_`, or end() if we don't want it
+    std::vector<candidates_t::iterator> piece_candidates_;
+
+    // random tiebreakers, so that equally good pieces aren't picked in index order
+    std::vector<uint8_t> salt_;
+
+    // pieces to re-sort before the next call to next()
+    std::vector<tr_piece_index_t> changed_pieces_;
+
+    bool needs_rebuild_ = true;
 };
@@ -13,6 +13,7 @@
 #include <cstring> /* memcpy, memcmp, strstr */
 #include <ctime>
 #include <iterator>
+#include <memory>
 #include <vector>
 
 #include <event2/event.h>
@@ -36,6 +37,7 @@
 #include "peer-io.h"
 #include "peer-mgr.h"
 #include "peer-mgr-active-requests.h"
+#include "peer-mgr-replication.h"
 #include "peer-mgr-wishlist.h"
 #include "peer-msgs.h"
 #include "ptrarray.h"
@@ -181,10 +183,13 @@ public:
     bool isRunning = false;
     bool needsCompletenessCheck = true;
     bool endgame = false;
+    bool wasTransferring = false; /* true if data was flowing at the last bandwidth pulse */
 
     ActiveRequests active_requests;
     Wishlist wishlist;
 
+    PieceReplication piece_replication{ wishlist };
+
     int interestedCount = 0;
     int maxPeers = 0;
     time_t lastCancel = 0;
@@ -365,6 +370,7 @@ static tr_swarm* swarmNew(tr_peerMgr* manager, tr_torrent* tor)
     auto* swarm = new tr_swarm{ manager, tor };
 
     rebuildWebseedArray(swarm, tor);
+    swarm->piece_replication.reset(tor->pieceCount());
 
     return swarm;
 }
@@ -574,6 +580,11 @@ std::vector<tr_block_span_t> tr_peerMgrGetNextRequests(tr_torrent* torrent, tr_p
             return torrent_->pieceIsWanted(piece) && peer_->have.test(piece);
         }
 
+        bool clientWantsPiece(tr_piece_index_t piece) const override
+        {
+            return torrent_->pieceIsWanted(piece);
+        }
+
         bool isEndgame() const override
         {
             return swarm_->endgame;
@@ -604,6 +615,11 @@ std::vector<tr_block_span_t> tr_peerMgrGetNextRequests(tr_torrent* torrent, tr_p
             return torrent_->piecePriority(piece);
         }
 
+        size_t countPeersWithPiece(tr_piece_index_t piece) const override
+        {
+            return tr_peerMgrPieceAvailability(torrent_, piece);
+        }
+
     private:
         tr_torrent const* const torrent_;
         tr_swarm const* const swarm_;
@@ -764,6 +780,18 @@ void tr_peerMgrPieceCompleted(tr_torrent* tor, tr_piece_index_t p)
     s->needsCompletenessCheck = true;
 }
 
+static void rebuildPieceReplication(tr_swarm* s)
+{
+    s->piece_replication.reset(s->tor->pieceCount());
+
+    auto const n_peers = tr_ptrArraySize(&s->peers);
+    auto const** peers = (tr_peer const**)tr_ptrArrayBase(&s->peers);
+    for (int i = 0; i < n_peers; ++i)
+    {
+        s->piece_replication.add(peers[i]->have);
+    }
+}
+
 static void peerCallbackFunc(tr_peer* peer, tr_peer_event const* e, void* vs)
 {
     TR_ASSERT(peer != nullptr);
@@ -780,7 +808,7 @@ static void peerCallbackFunc(tr_peer* peer, tr_peer_event const* e, void* vs)
             tor->uploadedCur += e->length;
             tr_announcerAddBytes(tor, TR_ANN_UP, e->length);
             tor->setDateActive(now);
-            tor->setDirty();
+            tor->setDirty(TR_DIRTY_STATS);
             tr_statsAddUploaded(tor->session, e->length);
 
             if (peer->atom != nullptr)
@@ -798,7 +826,7 @@ static void peerCallbackFunc(tr_peer* peer, tr_peer_event const* e, void* vs)
 
             tor->downloadedCur += e->length;
             tor->setDateActive(now);
-            tor->setDirty();
+            tor->setDirty(TR_DIRTY_STATS);
 
             tr_statsAddDownloaded(tor->session, e->length);
 
@@ -810,12 +838,22 @@ static void peerCallbackFunc(tr_peer* peer, tr_peer_event const* e, void* vs)
             break;
         }
 
+    /* these are published before peer->have is changed,
+     * so the peer's old bitfield can be uncounted first */
     case TR_PEER_CLIENT_GOT_HAVE:
+        s->piece_replication.gotHave(e->pieceIndex);
+        break;
+
     case TR_PEER_CLIENT_GOT_HAVE_ALL:
+        s->piece_replication.gotHaveAll(peer->have);
+        break;
+
     case TR_PEER_CLIENT_GOT_HAVE_NONE:
+        s->piece_replication.gotHaveNone(peer->have);
+        break;
+
     case TR_PEER_CLIENT_GOT_BITFIELD:
-        /* TODO: if we don't need these, should these events be removed? */
-        /* noop */
+        s->piece_replication.gotBitfield(peer->have, *e->bitfield);
         break;
 
     case TR_PEER_CLIENT_GOT_REJ:
@@ -850,6 +888,7 @@ static void peerCallbackFunc(tr_peer* peer, tr_peer_event const* e, void* vs)
             cancelAllRequestsForBlock(s, block, peer);
             peer->blocksSentToClient.add(tr_time(), 1);
             tr_torrentGotBlock(tor, block);
+            s->wishlist.pieceChanged(p);
             break;
         }
 
@@ -974,6 +1013,7 @@ static void createBitTorrentPeer(tr_torrent* tor, tr_peerIo* io, struct peer_ato
     tr_ptrArrayInsertSorted(&swarm->peers, peer, peerCompare);
     ++swarm->stats.peerCount;
     ++swarm->stats.peerFromCount[atom->fromFirst];
+    tor->markFieldsChanged(TR_FIELDS_ACTIVITY);
 
     TR_ASSERT(swarm->stats.peerCount == tr_ptrArraySize(&swarm->peers));
     TR_ASSERT(swarm->stats.peerFromCount[atom->fromFirst] <= swarm->stats.peerCount);
@@ -1462,6 +1502,9 @@ void tr_peerMgrStartTorrent(tr_torrent* tor)
     s->isRunning = true;
     s->maxPeers = tor->maxConnectedPeers;
 
+    // pieces may have changed while we were stopped, e.g. by verify
+    s->wishlist.reset();
+
     // rechoke soon
     tr_timerAddMsec(s->manager->rechokeTimer, 100);
 }
@@ -1534,6 +1577,9 @@ void tr_peerUpdateProgress(tr_torrent* tor, tr_peer* peer)
 
     peer->progress = std::clamp(peer->progress, 0.0F, 1.0F);
 
+    /* the peer's progress and the torrent's piece availability changed */
+    tor->markFieldsChanged(TR_FIELDS_ACTIVITY);
+
     if (peer->atom != nullptr && peer->progress >= 1.0f)
     {
         atomSetSeed(tor->swarm, peer->atom);
@@ -1542,6 +1588,9 @@ void tr_peerUpdateProgress(tr_torrent* tor, tr_peer* peer)
 
 void tr_peerMgrOnTorrentGotMetainfo(tr_torrent* tor)
 {
+    /* the piece count has changed */
+    rebuildPieceReplication(tor->swarm);
+
     /* the webseed list may have changed... */
     rebuildWebseedArray(tor->swarm, tor);
 
@@ -1564,6 +1613,13 @@ void tr_peerMgrOnTorrentGotMetainfo(tr_torrent* tor)
     }
 }
 
+size_t tr_peerMgrPieceAvailability(tr_torrent const* tor, tr_piece_index_t piece)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+
+    return tor->swarm->piece_replication.count(piece);
+}
+
 void tr_peerMgrTorrentAvailability(tr_torrent const* tor, int8_t* tab, unsigned int tabCount)
 {
     TR_ASSERT(tr_isTorrent(tor));
@@ -1574,8 +1630,6 @@ void tr_peerMgrTorrentAvailability(tr_torrent const* tor, int8_t* tab, unsigned
 
     if (tor->hasMetadata())
     {
-        int const peerCount = tr_ptrArraySize(&tor->swarm->peers);
-        auto const** peers = (tr_peer const**)tr_ptrArrayBase(&tor->swarm->peers);
         float const interval = tor->pieceCount() / (float)tabCount;
         auto const isSeed = tor->isSeed();
 
@@ -1587,15 +1641,9 @@ void tr_peerMgrTorrentAvailability(tr_torrent const* tor, int8_t* tab, unsigned
             {
                 tab[i] = -1;
             }
-            else if (peerCount != 0)
+            else
             {
-                for (int j = 0; j < peerCount; ++j)
-                {
-                    if (peers[j]->have.test(piece))
-                    {
-                        ++tab[i];
-                    }
-                }
+                tab[i] = int8_t(std::min(tr_peerMgrPieceAvailability(tor, piece), size_t{ INT8_MAX }));
             }
         }
     }
@@ -1666,27 +1714,12 @@ uint64_t tr_peerMgrGetDesiredAvailable(tr_torrent const* tor)
         }
     }
 
-    // do it the hard way
-
     auto desired_available = uint64_t{};
     auto const n_pieces = tor->pieceCount();
-    auto have = std::vector<bool>(n_pieces);
 
-    for (size_t i = 0; i < n_peers; ++i)
-    {
-        auto* peer = peers[i];
-        for (size_t j = 0; j < n_pieces; ++j)
-        {
-            if (peer->have.test(j))
-            {
-                have[j] = true;
-            }
-        }
-    }
-
-    for (size_t i = 0; i < n_pieces; ++i)
+    for (tr_piece_index_t i = 0; i < n_pieces; ++i)
     {
-        if (tor->pieceIsWanted(i) && have.at(i))
+        if (tor->pieceIsWanted(i) && tr_peerMgrPieceAvailability(tor, i) > 0)
         {
             desired_available += tor->countMissingBytesInPiece(i);
         }
@@ -1840,8 +1873,17 @@ void tr_peerMgrClearInterest(tr_torrent* tor)
     }
 }
 
+void tr_peerMgrWantedPiecesChanged(tr_torrent* tor)
+{
+    // the swarm doesn't exist yet while the torrent is being constructed
+    if (tor->swarm != nullptr)
+    {
+        tor->swarm->wishlist.reset();
+    }
+}
+
 /* does this peer have any pieces that we want? */
-static bool isPeerInteresting(tr_torrent* const tor, bool const* const piece_is_interesting, tr_peer const* const peer)
+static bool isPeerInteresting(tr_torrent* const tor, tr_bitfield const& interesting_pieces, tr_peer const* const peer)
 {
     /* these cases should have already been handled by the calling code... */
     TR_ASSERT(!tor->isDone());
@@ -1852,15 +1894,7 @@ static bool isPeerInteresting(tr_torrent* const tor, bool const* const piece_is_
         return true;
     }
 
-    for (tr_piece_index_t i = 0; i < tor->pieceCount(); ++i)
-    {
-        if (piece_is_interesting[i] && peer->have.test(i))
-        {
-            return true;
-        }
-    }
-
-    return false;
+    return peer->have.intersects(interesting_pieces);
 }
 
 enum tr_rechoke_state
@@ -1983,19 +2017,22 @@ static void rechokeDownloads(tr_swarm* s)
         int const n = tor->pieceCount();
 
         /* build a bitfield of interesting pieces... */
-        auto* const piece_is_interesting = tr_new(bool, n);
+        auto piece_is_interesting = std::make_unique<bool[]>(n);
 
         for (int i = 0; i < n; ++i)
         {
             piece_is_interesting[i] = tor->pieceIsWanted(i) && !tor->hasPiece(i);
         }
 
+        auto interesting_pieces = tr_bitfield{ size_t(n) };
+        interesting_pieces.setFromBools(piece_is_interesting.get(), n);
+
         /* decide WHICH peers to be interested in (based on their cancel-to-block ratio) */
         for (int i = 0; i < peerCount; ++i)
         {
             auto* const peer = static_cast<tr_peerMsgs*>(tr_ptrArrayNth(&s->peers, i));
 
-            if (!isPeerInteresting(s->tor, piece_is_interesting, peer))
+            if (!isPeerInteresting(s->tor, interesting_pieces, peer))
             {
                 peer->set_interested(false);
             }
@@ -2037,8 +2074,6 @@ static void rechokeDownloads(tr_swarm* s)
                 rechoke_count++;
             }
         }
-
-        tr_free(piece_is_interesting);
     }
 
     if ((rechoke != nullptr) && (rechoke_count > 0))
@@ -2153,6 +2188,7 @@ static void rechokeUploads(tr_swarm* s, uint64_t const now)
 
     /* an optimistic unchoke peer's "optimistic"
      * state lasts for N calls to rechokeUploads(). */
+    auto const* const old_optimistic = s->optimistic;
     if (s->optimisticUnchokeTimeScaler > 0)
     {
         s->optimisticUnchokeTimeScaler--;
@@ -2253,6 +2289,12 @@ static void rechokeUploads(tr_swarm* s, uint64_t const now)
         }
     }
 
+    /* the optimistic peer is flagged in the RPC peer list */
+    if (s->optimistic != old_optimistic)
+    {
+        s->tor->markFieldsChanged(TR_FIELDS_ACTIVITY);
+    }
+
     for (int i = 0; i < size; ++i)
     {
         choke[i].msgs->set_choke(choke[i].isChoked);
@@ -2403,8 +2445,10 @@ static void removePeer(tr_peer* peer)
     atom->time = tr_time();
 
     tr_ptrArrayRemoveSortedPointer(&s->peers, peer, peerCompare);
+    s->piece_replication.remove(peer->have);
     --s->stats.peerCount;
     --s->stats.peerFromCount[atom->fromFirst];
+    s->tor->markFieldsChanged(TR_FIELDS_ACTIVITY);
 
     TR_ASSERT(s->stats.peerCount == tr_ptrArraySize(&s->peers));
     TR_ASSERT(s->stats.peerFromCount[atom->fromFirst] >= 0);
@@ -2640,8 +2684,23 @@ static void bandwidthPulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
     session->bandwidth->allocate(TR_DOWN, BandwidthPeriodMsec);
 
     /* torrent upkeep */
+    auto const now_msec = tr_time_msec();
     for (auto* tor : session->torrents)
     {
+        /* rates and verify progress change without any event to hook,
+           so keep telling RPC clients about them while there's something going on */
+        auto const is_transferring = tor->isRunning &&
+            (tor->bandwidth->getRawSpeedBytesPerSecond(now_msec, TR_UP) != 0 ||
+             tor->bandwidth->getRawSpeedBytesPerSecond(now_msec, TR_DOWN) != 0);
+        if (is_transferring || tor->swarm->wasTransferring || tor->verifyState != TR_VERIFY_NONE)
+        {
+            tor->markFieldsChanged(TR_FIELDS_ACTIVITY);
+        }
+
+        tor->swarm->wasTransferring = is_transferring;
+
+        tr_torrentCheckStalled(tor);
+
         /* possibly stop torrents that have seeded enough */
         tr_torrentCheckSeedLimit(tor);
 
@@ -130,6 +130,9 @@ void tr_peerMgrAddTorrent(tr_peerMgr* manager, struct tr_torrent* tor);
 
 void tr_peerMgrRemoveTorrent(tr_torrent* tor);
 
+/* how many connected peers have `piece` */
+size_t tr_peerMgrPieceAvailability(tr_torrent const* tor, tr_piece_index_t piece);
+
 void tr_peerMgrTorrentAvailability(tr_torrent const* tor, int8_t* tab, unsigned int tabCount);
 
 uint64_t tr_peerMgrGetDesiredAvailable(tr_torrent const* tor);
@@ -146,6 +149,9 @@ unsigned int tr_peerGetPieceSpeed_Bps(tr_peer const* peer, uint64_t now, tr_dire
 
 void tr_peerMgrClearInterest(tr_torrent* tor);
 
+/* the pieces we want, or their priorities, have changed */
+void tr_peerMgrWantedPiecesChanged(tr_torrent* tor);
+
 void tr_peerMgrGotBadPiece(tr_torrent* tor, tr_piece_index_t pieceIndex);
 
 void tr_peerMgrPieceCompleted(tr_torrent* tor, tr_piece_index_t pieceIndex);
@@ -13,7 +13,10 @@
 #include <cstring>
 #include <ctime>
 #include <memory> // std::unique_ptr
+#include <mutex>
 #include <optional>
+#include <utility>
+#include <vector>
 
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
@@ -23,7 +26,10 @@
 
 #include "cache.h"
 #include "completion.h"
+#include "crypto-utils.h"
+#include "disk-io.h"
 #include "file.h"
+#include "inout.h"
 #include "log.h"
 #include "peer-io.h"
 #include "peer-mgr.h"
@@ -180,6 +186,7 @@ struct tr_incoming
 };
 
 class tr_peerMsgsImpl;
+struct peer_block_read;
 // TODO: make these to be member functions
 static ReadState canRead(tr_peerIo* io, void* vmsgs, size_t* piece);
 static void cancelAllRequestsToClient(tr_peerMsgsImpl* msgs);
@@ -264,6 +271,7 @@ public:
             }
         }
 
+        tr_peerIoSetDecryptOnReceive(io);
         tr_peerIoSetIOFuncs(io, canRead, didWrite, gotError, this);
         updateDesiredRequestCount(this);
     }
@@ -273,6 +281,11 @@ public:
         set_active(TR_UP, false);
         set_active(TR_DOWN, false);
 
+        if (this->session->disk_io != nullptr)
+        {
+            tr_diskIoCancel(this->session->disk_io, this);
+        }
+
         if (this->incoming.block != nullptr)
         {
             evbuffer_free(this->incoming.block);
@@ -348,6 +361,10 @@ public:
     {
         TR_ASSERT(tr_isDirection(direction));
 
+        // this is called whenever the choke or interest state changes,
+        // which the RPC peer list shows
+        torrent->markFieldsChanged(TR_FIELDS_ACTIVITY);
+
         set_active(direction, calculate_active(direction));
     }
 
@@ -587,6 +604,13 @@ public:
 
     int prefetchCount = 0;
 
+    /* blocks that the disk I/O pool is reading for this peer. A read
+     * that's no longer in `blockReads` when it finishes was for a request
+     * that has since been cancelled by choking the peer */
+    size_t pendingDiskReadBytes = 0;
+    std::vector<peer_block_read const*> blockReads;
+    bool pendingPieceCheck = false;
+
     /* how long the outMessages batch should be allowed to grow before
      * it's flushed -- some messages (like requests >:) should be sent
      * very quickly; others aren't as urgent. */
@@ -987,6 +1011,10 @@ static void cancelAllRequestsToClient(tr_peerMsgsImpl* msgs)
             protocolSendReject(msgs, &req);
         }
     }
+
+    /* the requests that are being read from disk are cancelled too.
+     * onBlockRead() drops them, or rejects them, when their reads finish */
+    msgs->blockReads.clear();
 }
 
 /**
@@ -1703,8 +1731,8 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
         /* a peer can send the same HAVE message twice... */
         if (!msgs->have.test(ui32))
         {
-            msgs->have.set(ui32);
             msgs->publishClientGotHave(ui32);
+            msgs->have.set(ui32);
         }
 
         updatePeerProgress(msgs);
@@ -1715,8 +1743,10 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
             uint8_t* tmp = tr_new(uint8_t, msglen);
             dbgmsg(msgs, "got a bitfield");
             tr_peerIoReadBytes(msgs->io, inbuf, tmp, msglen);
-            msgs->have.setRaw(tmp, msglen);
-            msgs->publishClientGotBitfield(&msgs->have);
+            auto bitfield = tr_bitfield{ msgs->have.size() };
+            bitfield.setRaw(tmp, msglen);
+            msgs->publishClientGotBitfield(&bitfield);
+            msgs->have = std::move(bitfield);
             updatePeerProgress(msgs);
             tr_free(tmp);
             break;
@@ -1814,8 +1844,8 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
 
         if (fext)
         {
-            msgs->have.setHasAll();
             msgs->publishClientGotHaveAll();
+            msgs->have.setHasAll();
             updatePeerProgress(msgs);
         }
         else
@@ -1831,8 +1861,8 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
 
         if (fext)
         {
-            msgs->have.setHasNone();
             msgs->publishClientGotHaveNone();
+            msgs->have.setHasNone();
             updatePeerProgress(msgs);
         }
         else
@@ -2100,6 +2130,452 @@ static void updateBlockRequests(tr_peerMsgsImpl* msgs)
     }
 }
 
+/**
+***  Reading blocks for the peer in the background
+**/
+
+/* A checksum test of a whole piece, shared by all of the peer requests for
+ * blocks in the piece that come in while it's being tested. Whichever of
+ * their reads runs first reads and hashes the piece, and the rest copy
+ * their blocks out of it. */
+struct tr_piece_check
+{
+    tr_piece_check() = default;
+    tr_piece_check(tr_piece_check const&) = delete;
+    tr_piece_check& operator=(tr_piece_check const&) = delete;
+
+    ~tr_piece_check()
+    {
+        tr_ioCloseSegments(session, segments);
+    }
+
+    tr_session* session = nullptr;
+    tr_sha1_digest_t hash = {};
+    uint32_t size = 0;
+
+    /* only touched by the libtransmission thread, or by the first read */
+    std::vector<tr_io_segment> segments;
+
+    /* the fields below are set by the first read, with the mutex held */
+    std::mutex mutex;
+    bool done = false;
+    int err = 0;
+    bool ok = false;
+    std::vector<uint8_t> data;
+};
+
+struct peer_block_read
+{
+    tr_session* session;
+    tr_peerMsgsImpl* msgs;
+    peer_request req;
+
+    /* the piece message, with the block's space reserved at the end */
+    evbuffer* out;
+    evbuffer_iovec space;
+
+    /* the block's segments, or else the test of the piece it's in */
+    std::vector<tr_io_segment> segments;
+    std::shared_ptr<tr_piece_check> check;
+    bool piece_ok;
+
+    int err;
+};
+
+/* returns the result of a finished test, or nothing if it's still running */
+static std::optional<bool> getPieceCheckResult(tr_piece_check& check)
+{
+    auto const lock = std::lock_guard(check.mutex);
+
+    if (!check.done)
+    {
+        return {};
+    }
+
+    return check.ok;
+}
+
+/* Like tr_torrent::ensurePieceIsChecked(), but doesn't test the piece
+ * again if a test from a peer read has already failed. */
+static bool ensurePieceIsCheckedForPeers(tr_torrent* tor, tr_piece_index_t piece)
+{
+    if (auto const it = tor->piece_checks.find(piece); it != std::end(tor->piece_checks))
+    {
+        if (auto const ok = getPieceCheckResult(*it->second); ok && !*ok)
+        {
+            return false;
+        }
+    }
+
+    return tor->ensurePieceIsChecked(piece);
+}
+
+/* Once a test is done, forget it if the piece passed, so that it's marked as
+ * checked, or if the piece couldn't be read, so that it can be tried again.
+ * A failed test is kept. */
+static void settlePieceCheck(tr_torrent* tor, tr_piece_index_t piece)
+{
+    auto const it = tor->piece_checks.find(piece);
+    if (it == std::end(tor->piece_checks))
+    {
+        return;
+    }
+
+    auto& check = *it->second;
+    auto lock = std::unique_lock(check.mutex);
+
+    if (!check.done)
+    {
+        return;
+    }
+
+    bool const passed = check.ok;
+    bool const failed = check.err == 0 && !check.ok;
+    lock.unlock();
+
+    if (passed && !tor->isPieceChecked(piece))
+    {
+        tor->setPieceChecked(piece, true);
+    }
+
+    if (!failed)
+    {
+        tor->piece_checks.erase(it);
+    }
+}
+
+/* unpin the piece's files once it's been read */
+static void releasePieceCheckFiles(tr_piece_check& check)
+{
+    auto lock = std::unique_lock(check.mutex);
+
+    if (check.done && !std::empty(check.segments))
+    {
+        auto segments = std::move(check.segments);
+        lock.unlock();
+        tr_ioCloseSegments(check.session, segments);
+    }
+}
+
+static void readBlockFunc(void* vread)
+{
+    auto* const r = static_cast<peer_block_read*>(vread);
+
+    if (!r->check)
+    {
+        auto const iov = tr_sys_iovec{ r->space.iov_base, r->req.length };
+        r->err = tr_ioSegmentsReadv(r->segments, &iov, 1, nullptr);
+        return;
+    }
+
+    auto& check = *r->check;
+
+    {
+        auto const lock = std::lock_guard(check.mutex);
+
+        if (!check.done)
+        {
+            check.data.resize(check.size);
+            auto const iov = tr_sys_iovec{ std::data(check.data), std::size(check.data) };
+            check.err = tr_ioSegmentsReadv(check.segments, &iov, 1, nullptr);
+
+            if (check.err == 0)
+            {
+                auto const hash = tr_sha1(check.data);
+                check.ok = hash && *hash == check.hash;
+            }
+
+            /* nothing gets sent out of a piece that failed */
+            if (!check.ok)
+            {
+                check.data = {};
+            }
+
+            check.done = true;
+        }
+    }
+
+    /* the piece doesn't change once it's been read */
+    r->err = check.err;
+    r->piece_ok = check.ok;
+
+    if (r->piece_ok)
+    {
+        std::copy_n(std::data(check.data) + r->req.offset, r->req.length, static_cast<uint8_t*>(r->space.iov_base));
+    }
+}
+
+static void onBlockRead(void* vread, bool cancelled)
+{
+    auto* const r = static_cast<peer_block_read*>(vread);
+    auto* const msgs = r->msgs;
+    auto const* const req = &r->req;
+
+    if (!cancelled)
+    {
+        auto* const tor = msgs->torrent;
+        bool err = r->err != 0;
+
+        msgs->pendingDiskReadBytes -= req->length;
+
+        auto const it = std::find(std::begin(msgs->blockReads), std::end(msgs->blockReads), r);
+        bool const choked = it == std::end(msgs->blockReads);
+        if (!choked)
+        {
+            msgs->blockReads.erase(it);
+        }
+
+        if (r->check)
+        {
+            msgs->pendingPieceCheck = false;
+            settlePieceCheck(tor, req->index);
+
+            if (!err)
+            {
+                err = !r->piece_ok;
+
+                if (err)
+                {
+                    auto const errmsg = tr_strvJoin(
+                        "Please Verify Local Data! Piece #",
+                        std::to_string(req->index),
+                        " is corrupt.");
+                    tor->setLocalError(errmsg);
+                }
+            }
+        }
+
+        if (err || choked)
+        {
+            /* BEP 3 peers forget their requests when they're choked,
+             * so only fast extension peers expect to hear about it */
+            if (tr_peerIoSupportsFEXT(msgs->io))
+            {
+                protocolSendReject(msgs, req);
+            }
+        }
+        else
+        {
+            r->space.iov_len = req->length;
+            evbuffer_commit_space(r->out, &r->space, 1);
+
+            size_t const n = evbuffer_get_length(r->out);
+            dbgmsg(msgs, "sending block %u:%u->%u", req->index, req->offset, req->length);
+            tr_peerIoWriteBuf(msgs->io, r->out, true);
+            msgs->clientSentAnythingAt = tr_time();
+            msgs->blocksSentToPeer.add(tr_time(), 1);
+            TR_ASSERT(n == 4 + 1 + 4 + 4 + req->length);
+        }
+    }
+
+    if (r->check)
+    {
+        releasePieceCheckFiles(*r->check);
+    }
+
+    tr_ioCloseSegments(r->session, r->segments);
+    evbuffer_free(r->out);
+    delete r;
+}
+
+/* returns the test of `piece` that reads for it should share, starting one if
+ * there isn't one yet. Returns nullptr if the piece has already failed a test
+ * or can't be opened. */
+static std::shared_ptr<tr_piece_check> getPieceCheck(tr_torrent* tor, tr_piece_index_t piece)
+{
+    if (auto const it = tor->piece_checks.find(piece); it != std::end(tor->piece_checks))
+    {
+        /* settlePieceCheck() only leaves running and failed tests */
+        return !getPieceCheckResult(*it->second) ? it->second : nullptr;
+    }
+
+    auto check = std::make_shared<tr_piece_check>();
+    check->session = tor->session;
+    check->hash = tor->pieceHash(piece);
+    check->size = tor->pieceSize(piece);
+
+    if (tr_ioOpenSegments(tor, false, piece, 0, check->size, check->segments) != 0)
+    {
+        return nullptr;
+    }
+
+    tor->piece_checks.emplace(piece, check);
+    return check;
+}
+
+/* hand the request to the disk I/O pool if it would have to be read from disk.
+ * returns false if the caller should serve the request itself. */
+static bool readBlockInBackground(tr_peerMsgsImpl* msgs, peer_request const* req, evbuffer* out)
+{
+    auto* const tor = msgs->torrent;
+    auto* const io = msgs->session->disk_io;
+
+    if (io == nullptr)
+    {
+        return false;
+    }
+
+    /* if the piece needs checking, all of it gets read. Cached blocks haven't
+     * necessarily reached the disk yet, so anything that's cached gets
+     * read the usual way. */
+    settlePieceCheck(tor, req->index);
+    bool const check = !tor->isPieceChecked(req->index);
+    auto const span = check ? tor->blockSpanForPiece(req->index) :
+                              tr_block_span_t{ tor->blockOf(req->index, req->offset),
+                                               tor->blockOf(req->index, req->offset + req->length - 1) + 1 };
+    if (tr_cacheHasBlocks(msgs->session->cache, tor, span.begin, span.end))
+    {
+        return false;
+    }
+
+    auto* const r = new peer_block_read{};
+    r->session = msgs->session;
+    r->msgs = msgs;
+    r->req = *req;
+    r->out = out;
+
+    if (check)
+    {
+        r->check = getPieceCheck(tor, req->index);
+
+        if (!r->check)
+        {
+            delete r;
+            return false;
+        }
+
+        msgs->pendingPieceCheck = true;
+    }
+    else if (tr_ioOpenSegments(tor, false, req->index, req->offset, req->length, r->segments) != 0)
+    {
+        delete r;
+        return false;
+    }
+
+    evbuffer_reserve_space(out, req->length, &r->space, 1);
+    msgs->pendingDiskReadBytes += req->length;
+    msgs->blockReads.push_back(r);
+    tr_diskIoAdd(io, msgs, readBlockFunc, onBlockRead, r);
+    return true;
+}
+
+#ifdef EVBUF_FS_CLOSE_ON_FREE
+
+/* a file that's pinned while a peer's output buffer refers to part of it */
+struct peer_pinned_file
+{
+    tr_session* session;
+    std::vector<tr_io_segment> segments;
+};
+
+#endif
+
+/* add the requested block to `out` without copying it: by reference to the
+ * cache's copy if it's cached, or else as a segment of the file that it's in,
+ * for the kernel to send straight from the page cache.
+ * returns false if the caller should copy the block into `out` itself. */
+static bool addBlockWithoutCopying(tr_peerMsgsImpl* msgs, peer_request const* req, evbuffer* out)
+{
+    auto* const tor = msgs->torrent;
+    auto* const cache = msgs->session->cache;
+
+    /* encrypting the block would scramble the data that's referred to */
+    if (tr_peerIoIsEncrypted(msgs->io))
+    {
+        return false;
+    }
+
+    if (tr_cacheAddBlockReference(cache, tor, req->index, req->offset, req->length, out))
+    {
+        return true;
+    }
+
+#ifdef _WIN32
+
+    return false;
+
+#else
+
+    /* a piece that needs checking has to be read in anyway */
+    if (!tr_peerIoSupportsSendfile(msgs->io) || !tor->isPieceChecked(req->index))
+    {
+        return false;
+    }
+
+    /* cached blocks haven't necessarily reached the disk yet */
+    auto const begin = tor->blockOf(req->index, req->offset);
+    auto const end = tor->blockOf(req->index, req->offset + req->length - 1) + 1;
+    if (tr_cacheHasBlocks(cache, tor, begin, end))
+    {
+        return false;
+    }
+
+    auto segments = std::vector<tr_io_segment>{};
+    if (tr_ioOpenSegments(tor, false, req->index, req->offset, req->length, segments) != 0)
+    {
+        return false;
+    }
+
+    /* blocks that straddle two files are rare enough to just copy */
+    if (std::size(segments) != 1)
+    {
+        tr_ioCloseSegments(msgs->session, segments);
+        return false;
+    }
+
+    auto const segment = segments.front();
+
+#ifdef EVBUF_FS_CLOSE_ON_FREE
+
+    /* otherwise libevent maps the file into memory instead of using sendfile() */
+    evbuffer_set_flags(out, EVBUFFER_FLAG_DRAINS_TO_FD);
+
+    auto* const file_segment = evbuffer_file_segment_new(segment.fd, segment.file_offset, segment.len, 0);
+    if (file_segment == nullptr)
+    {
+        tr_ioCloseSegments(msgs->session, segments);
+        return false;
+    }
+
+    /* the file stays pinned until libevent is done with the segment */
+    evbuffer_file_segment_add_cleanup_cb(
+        file_segment,
+        [](evbuffer_file_segment const* /*seg*/, int /*flags*/, void* vpinned)
+        {
+            auto* const pinned = static_cast<peer_pinned_file*>(vpinned);
+            tr_ioCloseSegments(pinned->session, pinned->segments);
+            delete pinned;
+        },
+        new peer_pinned_file{ msgs->session, std::move(segments) });
+
+    int const err = evbuffer_add_file_segment(out, file_segment, 0, segment.len);
+    evbuffer_file_segment_free(file_segment);
+    return err == 0;
+
+#else
+
+    /* libevent 2.0 closes the file when it's done with it, so give it a copy */
+    auto const fd = tr_sys_file_duplicate(segment.fd, nullptr);
+    tr_ioCloseSegments(msgs->session, segments);
+
+    if (fd == TR_BAD_SYS_FILE)
+    {
+        return false;
+    }
+
+    if (evbuffer_add_file(out, fd, segment.file_offset, segment.len) != 0)
+    {
+        tr_sys_file_close(fd, nullptr);
+        return false;
+    }
+
+    return true;
+
+#endif
+
+#endif
+}
+
 static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
 {
     size_t bytesWritten = 0;
@@ -2196,7 +2672,11 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
     ***  Data Blocks
     **/
 
-    if (tr_peerIoGetWriteBufferSpace(msgs->io, now) >= msgs->torrent->blockSize() && popNextRequest(msgs, &req))
+    /* blocks that are still being read from disk will need buffer space too,
+     * and a piece that's being checked has to pass before more is read from it */
+    auto const pending = msgs->pendingDiskReadBytes + msgs->torrent->blockSize();
+
+    if (!msgs->pendingPieceCheck && tr_peerIoGetWriteBufferSpace(msgs->io, now) >= pending && popNextRequest(msgs, &req))
     {
         --msgs->prefetchCount;
 
@@ -2205,29 +2685,45 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
             uint32_t const msglen = 4 + 1 + 4 + 4 + req.length;
             struct evbuffer_iovec iovec[1];
 
+            /* the block may be added by reference, so only reserve space for the header */
             auto* const out = evbuffer_new();
-            evbuffer_expand(out, msglen);
+            evbuffer_expand(out, msglen - req.length);
 
             evbuffer_add_uint32(out, sizeof(uint8_t) + 2 * sizeof(uint32_t) + req.length);
             evbuffer_add_uint8(out, BtPiece);
             evbuffer_add_uint32(out, req.index);
             evbuffer_add_uint32(out, req.offset);
 
-            evbuffer_reserve_space(out, req.length, iovec, 1);
-            bool err = tr_cacheReadBlock(
-                           msgs->session->cache,
-                           msgs->torrent,
-                           req.index,
-                           req.offset,
-                           req.length,
-                           static_cast<uint8_t*>(iovec[0].iov_base)) != 0;
-            iovec[0].iov_len = req.length;
-            evbuffer_commit_space(out, iovec, 1);
+            bool err = false;
+
+            if (addBlockWithoutCopying(msgs, &req, out))
+            {
+                /* the block is in `out` by reference */
+            }
+            else if (readBlockInBackground(msgs, &req, out))
+            {
+                /* the block will be sent when the read is done */
+                prefetchPieces(msgs);
+                return req.length;
+            }
+            else
+            {
+                evbuffer_reserve_space(out, req.length, iovec, 1);
+                err = tr_cacheReadBlock(
+                          msgs->session->cache,
+                          msgs->torrent,
+                          req.index,
+                          req.offset,
+                          req.length,
+                          static_cast<uint8_t*>(iovec[0].iov_base)) != 0;
+                iovec[0].iov_len = req.length;
+                evbuffer_commit_space(out, iovec, 1);
+            }
 
             /* check the piece if it needs checking... */
             if (!err)
             {
-                err = !msgs->torrent->ensurePieceIsChecked(req.index);
+                err = !ensurePieceIsCheckedForPeers(msgs->torrent, req.index);
                 if (err)
                 {
                     auto const errmsg = tr_strvJoin(
@@ -8,6 +8,7 @@
 
 #include <algorithm>
 #include <array>
+#include <mutex>
 #include <string_view>
 #include <vector>
 
@@ -21,7 +22,7 @@ using namespace std::literals;
 namespace
 {
 
-auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
+auto constexpr my_static = std::array<std::string_view, 408>{ ""sv,
                                                               "activeTorrentCount"sv,
                                                               "activity-date"sv,
                                                               "activityDate"sv,
@@ -45,6 +46,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "anti-brute-force-enabled"sv,
                                                               "anti-brute-force-threshold"sv,
                                                               "arguments"sv,
+                                                              "availability"sv,
                                                               "bandwidth-priority"sv,
                                                               "bandwidthPriority"sv,
                                                               "bind-address-ipv4"sv,
@@ -75,6 +77,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "creator"sv,
                                                               "cumulative-stats"sv,
                                                               "current-stats"sv,
+                                                              "cursor"sv,
                                                               "date"sv,
                                                               "dateCreated"sv,
                                                               "delete-local-data"sv,
@@ -83,6 +86,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "details-window-height"sv,
                                                               "details-window-width"sv,
                                                               "dht-enabled"sv,
+                                                              "disk-io-threads"sv,
                                                               "display-name"sv,
                                                               "dnd"sv,
                                                               "done-date"sv,
@@ -112,6 +116,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "errorString"sv,
                                                               "eta"sv,
                                                               "etaIdle"sv,
+                                                              "evictions"sv,
                                                               "failure reason"sv,
                                                               "fields"sv,
                                                               "file-count"sv,
@@ -141,6 +146,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "have"sv,
                                                               "haveUnchecked"sv,
                                                               "haveValid"sv,
+                                                              "hits"sv,
                                                               "honorsSessionLimits"sv,
                                                               "host"sv,
                                                               "id"sv,
@@ -206,6 +212,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "method"sv,
                                                               "min interval"sv,
                                                               "min_request_interval"sv,
+                                                              "misses"sv,
                                                               "move"sv,
                                                               "msg_type"sv,
                                                               "mtimes"sv,
@@ -216,6 +223,10 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "nodes"sv,
                                                               "nodes6"sv,
                                                               "open-dialog-dir"sv,
+                                                              "open-file-limit"sv,
+                                                              "open-file-stats"sv,
+                                                              "openFileLimit"sv,
+                                                              "openFiles"sv,
                                                               "p"sv,
                                                               "path"sv,
                                                               "path.utf-8"sv,
@@ -292,8 +303,11 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "rename-partial-files"sv,
                                                               "reqq"sv,
                                                               "result"sv,
+                                                              "resume-db-enabled"sv,
                                                               "rpc-authentication-required"sv,
                                                               "rpc-bind-address"sv,
+                                                              "rpc-compression-level"sv,
+                                                              "rpc-compression-thread-threshold-kb"sv,
                                                               "rpc-enabled"sv,
                                                               "rpc-host-whitelist"sv,
                                                               "rpc-host-whitelist-enabled"sv,
@@ -406,11 +420,14 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "ut_recommend"sv,
                                                               "utp-enabled"sv,
                                                               "v"sv,
+                                                              "verify-io-limit-mb"sv,
+                                                              "verify-threads"sv,
                                                               "version"sv,
                                                               "wanted"sv,
                                                               "warning message"sv,
                                                               "watch-dir"sv,
                                                               "watch-dir-enabled"sv,
+                                                              "webseed-connections"sv,
                                                               "webseeds"sv,
                                                               "webseedsSendingToUs"sv };
 
@@ -431,13 +448,25 @@ size_t constexpr quarks_are_sorted = ( //
 static_assert(quarks_are_sorted, "Predefined quarks must be sorted by their string value");
 static_assert(std::size(my_static) == TR_N_KEYS);
 
+// quarks can be added by any thread, e.g. by the workers that parse
+// .torrent files at startup, so runtime lookups need to hold this lock
+auto& my_runtime_mutex{ *new std::mutex{} };
 auto& my_runtime{ *new std::vector<std::string_view>{} };
 
-} // namespace
+std::optional<tr_quark> lookupRuntime(std::string_view key)
+{
+    auto const rbegin = std::begin(my_runtime), rend = std::end(my_runtime);
+    auto const rit = std::find(rbegin, rend, key);
+    if (rit != rend)
+    {
+        return TR_N_KEYS + std::distance(rbegin, rit);
+    }
 
-std::optional<tr_quark> tr_quark_lookup(std::string_view key)
+    return {};
+}
+
+std::optional<tr_quark> lookupStatic(std::string_view key)
 {
-    // is it in our static array?
     auto constexpr sbegin = std::begin(my_static), send = std::end(my_static);
     auto const sit = std::lower_bound(sbegin, send, key);
     if (sit != send && *sit == key)
@@ -445,20 +474,34 @@ std::optional<tr_quark> tr_quark_lookup(std::string_view key)
         return std::distance(sbegin, sit);
     }
 
-    /* was it added during runtime? */
-    auto const rbegin = std::begin(my_runtime), rend = std::end(my_runtime);
-    auto const rit = std::find(rbegin, rend, key);
-    if (rit != rend)
+    return {};
+}
+
+} // namespace
+
+std::optional<tr_quark> tr_quark_lookup(std::string_view key)
+{
+    // is it in our static array?
+    if (auto const q = lookupStatic(key); q)
     {
-        return TR_N_KEYS + std::distance(rbegin, rit);
+        return q;
     }
 
-    return {};
+    /* was it added during runtime? */
+    auto const lock = std::lock_guard(my_runtime_mutex);
+    return lookupRuntime(key);
 }
 
 tr_quark tr_quark_new(std::string_view str)
 {
-    if (auto const prior = tr_quark_lookup(str); prior)
+    if (auto const q = lookupStatic(str); q)
+    {
+        return *q;
+    }
+
+    auto const lock = std::lock_guard(my_runtime_mutex);
+
+    if (auto const prior = lookupRuntime(str); prior)
     {
         return *prior;
     }
@@ -470,7 +513,14 @@ tr_quark tr_quark_new(std::string_view str)
 
 std::string_view tr_quark_get_string_view(tr_quark q)
 {
-    return q < TR_N_KEYS ? my_static[q] : my_runtime[q - TR_N_KEYS];
+    if (q < TR_N_KEYS)
+    {
+        return my_static[q];
+    }
+
+    // the strings themselves are never freed, so the view stays valid after unlocking
+    auto const lock = std::lock_guard(my_runtime_mutex);
+    return my_runtime[q - TR_N_KEYS];
 }
 
 char const* tr_quark_get_string(tr_quark q, size_t* len)
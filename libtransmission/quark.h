@@ -47,6 +47,7 @@ enum
     TR_KEY_anti_brute_force_enabled, /* rpc */
     TR_KEY_anti_brute_force_threshold, /* rpc */
     TR_KEY_arguments, /* rpc */
+    TR_KEY_availability,
     TR_KEY_bandwidth_priority,
     TR_KEY_bandwidthPriority,
     TR_KEY_bind_address_ipv4,
@@ -77,6 +78,7 @@ enum
     TR_KEY_creator,
     TR_KEY_cumulative_stats,
     TR_KEY_current_stats,
+    TR_KEY_cursor,
     TR_KEY_date,
     TR_KEY_dateCreated,
     TR_KEY_delete_local_data,
@@ -85,6 +87,7 @@ enum
     TR_KEY_details_window_height,
     TR_KEY_details_window_width,
     TR_KEY_dht_enabled,
+    TR_KEY_disk_io_threads,
     TR_KEY_display_name,
     TR_KEY_dnd,
     TR_KEY_done_date,
@@ -114,6 +117,7 @@ enum
     TR_KEY_errorString,
     TR_KEY_eta,
     TR_KEY_etaIdle,
+    TR_KEY_evictions,
     TR_KEY_failure_reason,
     TR_KEY_fields,
     TR_KEY_file_count,
@@ -143,6 +147,7 @@ enum
     TR_KEY_have,
     TR_KEY_haveUnchecked,
     TR_KEY_haveValid,
+    TR_KEY_hits,
     TR_KEY_honorsSessionLimits,
     TR_KEY_host,
     TR_KEY_id,
@@ -208,6 +213,7 @@ enum
     TR_KEY_method,
     TR_KEY_min_interval,
     TR_KEY_min_request_interval,
+    TR_KEY_misses,
     TR_KEY_move,
     TR_KEY_msg_type,
     TR_KEY_mtimes,
@@ -218,6 +224,10 @@ enum
     TR_KEY_nodes,
     TR_KEY_nodes6,
     TR_KEY_open_dialog_dir,
+    TR_KEY_open_file_limit,
+    TR_KEY_open_file_stats,
+    TR_KEY_openFileLimit,
+    TR_KEY_openFiles,
     TR_KEY_p,
     TR_KEY_path,
     TR_KEY_path_utf_8,
@@ -294,8 +304,11 @@ enum
     TR_KEY_rename_partial_files,
     TR_KEY_reqq,
     TR_KEY_result,
+    TR_KEY_resume_db_enabled,
     TR_KEY_rpc_authentication_required,
     TR_KEY_rpc_bind_address,
+    TR_KEY_rpc_compression_level,
+    TR_KEY_rpc_compression_thread_threshold_kb,
     TR_KEY_rpc_enabled,
     TR_KEY_rpc_host_whitelist,
     TR_KEY_rpc_host_whitelist_enabled,
@@ -408,11 +421,14 @@ enum
     TR_KEY_ut_recommend,
     TR_KEY_utp_enabled,
     TR_KEY_v,
+    TR_KEY_verify_io_limit_mb,
+    TR_KEY_verify_threads,
     TR_KEY_version,
     TR_KEY_wanted,
     TR_KEY_warning_message,
     TR_KEY_watch_dir,
     TR_KEY_watch_dir_enabled,
+    TR_KEY_webseed_connections,
     TR_KEY_webseeds,
     TR_KEY_webseedsSendingToUs,
     TR_N_KEYS
@@ -0,0 +1,477 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <array>
+#include <cerrno> /* EIO */
+#include <cinttypes> /* PRIu64 */
+#include <cstring> /* memcmp(), memcpy() */
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <zlib.h> /* crc32() */
+
+#include "transmission.h"
+#include "crypto-utils.h" /* tr_sha1_to_string() */
+#include "error.h"
+#include "file.h"
+#include "log.h"
+#include "resume-db.h"
+#include "tr-assert.h"
+#include "utils.h"
+
+using namespace std::literals;
+
+#define dbgmsg(...) tr_logAddDeepNamed("resume-db", __VA_ARGS__)
+
+namespace
+{
+
+/* the file starts with this, followed by the records */
+auto constexpr Magic = "TRRESDB1"sv;
+
+/* Each record is the payload's length (uint32, little-endian), a crc32
+ * of the info hash and payload (uint32, little-endian), the info hash,
+ * and the payload. A zero-length payload means the torrent was removed. */
+auto constexpr RecordHeaderSize = size_t{ 4 + 4 + std::tuple_size_v<tr_sha1_digest_t> };
+
+/* don't bother compacting files that are smaller than this */
+auto constexpr MinCompactSize = uint64_t{ 1024 * 1024 };
+
+void putUint32(char* out, uint32_t val)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        out[i] = char(val >> (8 * i));
+    }
+}
+
+uint32_t getUint32(char const* in)
+{
+    auto val = uint32_t{};
+    for (int i = 0; i < 4; ++i)
+    {
+        val |= uint32_t(uint8_t(in[i])) << (8 * i);
+    }
+
+    return val;
+}
+
+uint32_t getChecksum(tr_sha1_digest_t const& info_hash, std::string_view payload)
+{
+    auto crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, reinterpret_cast<Bytef const*>(std::data(info_hash)), std::size(info_hash));
+    if (!std::empty(payload)) // crc32() treats a null buffer as a request for the initial value
+    {
+        crc = crc32(crc, reinterpret_cast<Bytef const*>(std::data(payload)), std::size(payload));
+    }
+
+    return uint32_t(crc);
+}
+
+std::string makeRecord(tr_sha1_digest_t const& info_hash, std::string_view payload)
+{
+    auto record = std::string(RecordHeaderSize, '\0');
+    putUint32(std::data(record), std::size(payload));
+    putUint32(std::data(record) + 4, getChecksum(info_hash, payload));
+    memcpy(std::data(record) + 8, std::data(info_hash), std::size(info_hash));
+    record.append(payload);
+    return record;
+}
+
+} // namespace
+
+struct tr_resume_db
+{
+    /* where a torrent's newest payload is in the file */
+    struct Record
+    {
+        uint64_t offset;
+        uint32_t length;
+    };
+
+    std::string filename;
+    tr_sys_file_t fd = TR_BAD_SYS_FILE;
+    uint64_t file_size = 0;
+
+    /* how big the file would be if it were compacted */
+    uint64_t live_size = 0;
+
+    /* the file's memory mapping, or nullptr if it couldn't be mapped */
+    char const* map = nullptr;
+    uint64_t map_size = 0;
+
+    std::map<tr_sha1_digest_t, Record> records;
+
+    mutable std::mutex mutex;
+};
+
+/***
+****
+***/
+
+static void mapFile(tr_resume_db* db)
+{
+    TR_ASSERT(db->map == nullptr);
+
+    tr_error* error = nullptr;
+    auto* const map = tr_sys_file_map_for_reading(db->fd, 0, db->file_size, &error);
+    if (map == nullptr)
+    {
+        // not fatal; records will be read with tr_sys_file_read_at() instead
+        dbgmsg("Couldn't map \"%s\": %s", db->filename.c_str(), error->message);
+        tr_error_free(error);
+        return;
+    }
+
+    db->map = static_cast<char const*>(map);
+    db->map_size = db->file_size;
+}
+
+static void unmapFile(tr_resume_db* db)
+{
+    if (db->map != nullptr)
+    {
+        tr_sys_file_unmap(db->map, db->map_size, nullptr);
+        db->map = nullptr;
+        db->map_size = 0;
+    }
+}
+
+static void applyRecord(tr_resume_db* db, tr_sha1_digest_t const& info_hash, tr_resume_db::Record const& record)
+{
+    if (auto const it = db->records.find(info_hash); it != std::end(db->records))
+    {
+        db->live_size -= RecordHeaderSize + it->second.length;
+        db->records.erase(it);
+    }
+
+    if (record.length != 0)
+    {
+        db->records.try_emplace(info_hash, record);
+        db->live_size += RecordHeaderSize + record.length;
+    }
+}
+
+/* Adds the records in `data` to the index.
+ * Returns how much of `data` was valid. */
+static uint64_t scanRecords(tr_resume_db* db, char const* data, uint64_t size)
+{
+    auto pos = uint64_t{ std::size(Magic) };
+
+    while (pos + RecordHeaderSize <= size)
+    {
+        auto const* const walk = data + pos;
+        auto const length = getUint32(walk);
+        auto const checksum = getUint32(walk + 4);
+        auto info_hash = tr_sha1_digest_t{};
+        memcpy(std::data(info_hash), walk + 8, std::size(info_hash));
+
+        if (length > size - pos - RecordHeaderSize)
+        {
+            break;
+        }
+
+        auto const payload = std::string_view{ walk + RecordHeaderSize, length };
+        if (getChecksum(info_hash, payload) != checksum)
+        {
+            break;
+        }
+
+        applyRecord(db, info_hash, { pos + RecordHeaderSize, length });
+        pos += RecordHeaderSize + length;
+    }
+
+    return pos;
+}
+
+static bool readPayload(tr_resume_db const* db, tr_resume_db::Record const& record, std::vector<char>& buf, std::string_view* setme)
+{
+    if (db->map != nullptr && record.offset + record.length <= db->map_size)
+    {
+        *setme = std::string_view{ db->map + record.offset, record.length };
+        return true;
+    }
+
+    auto n_read = uint64_t{};
+    buf.resize(record.length);
+    if (!tr_sys_file_read_at(db->fd, std::data(buf), record.length, record.offset, &n_read, nullptr) ||
+        n_read != record.length)
+    {
+        return false;
+    }
+
+    *setme = std::string_view{ std::data(buf), record.length };
+    return true;
+}
+
+/* Rewrites the file with only the newest record of each torrent */
+static bool compact(tr_resume_db* db)
+{
+    auto const tmpname = db->filename + ".tmp";
+    tr_error* error = nullptr;
+    auto const out = tr_sys_file_open(
+        tmpname.c_str(),
+        TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE | TR_SYS_FILE_TRUNCATE | TR_SYS_FILE_SEQUENTIAL,
+        0600,
+        &error);
+    if (out == TR_BAD_SYS_FILE)
+    {
+        tr_logAddError(_("Couldn't compact \"%s\": %s"), db->filename.c_str(), error->message);
+        tr_error_free(error);
+        return false;
+    }
+
+    auto records = std::map<tr_sha1_digest_t, tr_resume_db::Record>{};
+    auto pos = uint64_t{ std::size(Magic) };
+    auto ok = tr_sys_file_write(out, std::data(Magic), std::size(Magic), nullptr, &error);
+
+    auto buf = std::vector<char>{};
+    for (auto it = std::begin(db->records), end = std::end(db->records); ok && it != end; ++it)
+    {
+        auto payload = std::string_view{};
+        if (!readPayload(db, it->second, buf, &payload))
+        {
+            tr_error_set(&error, EIO, "couldn't read record"sv);
+            ok = false;
+            break;
+        }
+
+        auto const record = makeRecord(it->first, payload);
+        ok = tr_sys_file_write(out, std::data(record), std::size(record), nullptr, &error);
+        records.try_emplace(it->first, tr_resume_db::Record{ pos + RecordHeaderSize, it->second.length });
+        pos += std::size(record);
+    }
+
+    ok = ok && tr_sys_file_flush(out, &error);
+    tr_sys_file_close(out, nullptr);
+
+    // close the old file before replacing it; some platforms won't rename over an open file
+    tr_sys_file_close(db->fd, nullptr);
+    ok = ok && tr_sys_path_rename(tmpname.c_str(), db->filename.c_str(), &error);
+    db->fd = tr_sys_file_open(db->filename.c_str(), TR_SYS_FILE_READ | TR_SYS_FILE_WRITE, 0600, nullptr);
+
+    if (!ok)
+    {
+        tr_logAddError(_("Couldn't compact \"%s\": %s"), db->filename.c_str(), error->message);
+        tr_error_free(error);
+        tr_sys_path_remove(tmpname.c_str(), nullptr);
+        return false;
+    }
+
+    dbgmsg("Compacted \"%s\" from %" PRIu64 " to %" PRIu64 " bytes", db->filename.c_str(), db->file_size, pos);
+
+    db->records.swap(records);
+    db->file_size = db->live_size = pos;
+
+    // nothing outside of the db holds views into the old mapping, so drop it now
+    // instead of keeping the replaced file's inode alive until the db is closed
+    unmapFile(db);
+    mapFile(db);
+    return true;
+}
+
+static void maybeCompact(tr_resume_db* db)
+{
+    if (db->file_size >= MinCompactSize && db->file_size > 2 * db->live_size)
+    {
+        compact(db);
+    }
+}
+
+static bool appendRecord(tr_resume_db* db, tr_sha1_digest_t const& info_hash, std::string_view payload)
+{
+    auto const record = makeRecord(info_hash, payload);
+
+    tr_error* error = nullptr;
+    auto n_written = uint64_t{};
+    if (!tr_sys_file_write_at(db->fd, std::data(record), std::size(record), db->file_size, &n_written, &error) ||
+        n_written != std::size(record))
+    {
+        tr_logAddError(
+            _("Couldn't save to \"%s\": %s"),
+            db->filename.c_str(),
+            error != nullptr ? error->message : "short write");
+        tr_error_clear(&error);
+
+        // don't leave a partial record for the next one to be appended after
+        tr_sys_file_truncate(db->fd, db->file_size, nullptr);
+        return false;
+    }
+
+    applyRecord(db, info_hash, { db->file_size + RecordHeaderSize, uint32_t(std::size(payload)) });
+    db->file_size += std::size(record);
+    maybeCompact(db);
+    return true;
+}
+
+/***
+****
+***/
+
+static tr_sys_file_t openFile(std::string const& filename, tr_error** error)
+{
+    auto fd = tr_sys_file_open(filename.c_str(), TR_SYS_FILE_READ | TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600, error);
+    if (fd == TR_BAD_SYS_FILE)
+    {
+        return fd;
+    }
+
+    auto info = tr_sys_path_info{};
+    auto magic = std::array<char, std::size(Magic)>{};
+    auto n_read = uint64_t{};
+    if (tr_sys_file_get_info(fd, &info, nullptr) && info.size == 0)
+    {
+        if (!tr_sys_file_write(fd, std::data(Magic), std::size(Magic), nullptr, error))
+        {
+            tr_sys_file_close(fd, nullptr);
+            return TR_BAD_SYS_FILE;
+        }
+    }
+    else if (
+        !tr_sys_file_read_at(fd, std::data(magic), std::size(magic), 0, &n_read, nullptr) || n_read != std::size(magic) ||
+        std::string_view{ std::data(magic), std::size(magic) } != Magic)
+    {
+        // move it out of the way rather than overwrite something that isn't ours
+        auto const badname = filename + ".bad";
+        tr_logAddError(_("\"%s\" isn't a resume database; moving it to \"%s\""), filename.c_str(), badname.c_str());
+        tr_sys_file_close(fd, nullptr);
+        return tr_sys_path_rename(filename.c_str(), badname.c_str(), error) ? openFile(filename, error) : TR_BAD_SYS_FILE;
+    }
+
+    return fd;
+}
+
+tr_resume_db* tr_resumeDbOpen(std::string_view filename)
+{
+    auto* const db = new tr_resume_db{};
+    db->filename = filename;
+
+    tr_error* error = nullptr;
+    auto info = tr_sys_path_info{};
+    db->fd = openFile(db->filename, &error);
+    if (db->fd == TR_BAD_SYS_FILE || !tr_sys_file_get_info(db->fd, &info, &error))
+    {
+        tr_logAddError(_("Couldn't open \"%s\": %s"), db->filename.c_str(), error->message);
+        tr_error_free(error);
+        tr_resumeDbClose(db);
+        return nullptr;
+    }
+
+    db->file_size = info.size;
+    db->live_size = std::size(Magic);
+    mapFile(db);
+
+    auto end = uint64_t{};
+    if (db->map != nullptr)
+    {
+        end = scanRecords(db, db->map, db->map_size);
+    }
+    else if (auto buf = std::vector<char>{}; tr_loadFile(buf, db->filename))
+    {
+        end = scanRecords(db, std::data(buf), std::size(buf));
+    }
+
+    if (end < db->file_size)
+    {
+        // probably a save that was cut short by a crash
+        tr_logAddError(
+            _("Ignoring %" PRIu64 " bytes of damaged data at the end of \"%s\""),
+            db->file_size - end,
+            db->filename.c_str());
+        unmapFile(db);
+        tr_sys_file_truncate(db->fd, end, nullptr);
+        db->file_size = end;
+        mapFile(db);
+    }
+
+    dbgmsg("Read %zu records from \"%s\"", std::size(db->records), db->filename.c_str());
+    maybeCompact(db);
+    return db;
+}
+
+void tr_resumeDbClose(tr_resume_db* db)
+{
+    if (db->fd != TR_BAD_SYS_FILE)
+    {
+        maybeCompact(db);
+        tr_sys_file_close(db->fd, nullptr);
+    }
+
+    unmapFile(db);
+    delete db;
+}
+
+std::optional<std::string_view> tr_resumeDbGet(tr_resume_db* db, tr_sha1_digest_t const& info_hash, std::vector<char>& buf)
+{
+    auto const lock = std::lock_guard(db->mutex);
+
+    auto const it = db->records.find(info_hash);
+    if (auto payload = std::string_view{}; it != std::end(db->records) && readPayload(db, it->second, buf, &payload))
+    {
+        // copy out of the mapping so that compacting can unmap it while the caller still uses the payload
+        if (std::data(payload) != std::data(buf))
+        {
+            buf.assign(std::begin(payload), std::end(payload));
+        }
+
+        return std::string_view{ std::data(buf), std::size(payload) };
+    }
+
+    return {};
+}
+
+bool tr_resumeDbPut(tr_resume_db* db, tr_sha1_digest_t const& info_hash, std::string_view benc)
+{
+    TR_ASSERT(!std::empty(benc));
+
+    auto const lock = std::lock_guard(db->mutex);
+    return appendRecord(db, info_hash, benc);
+}
+
+void tr_resumeDbRemove(tr_resume_db* db, tr_sha1_digest_t const& info_hash)
+{
+    auto const lock = std::lock_guard(db->mutex);
+
+    if (db->records.count(info_hash) != 0)
+    {
+        appendRecord(db, info_hash, {});
+    }
+}
+
+size_t tr_resumeDbCount(tr_resume_db const* db)
+{
+    auto const lock = std::lock_guard(db->mutex);
+    return std::size(db->records);
+}
+
+bool tr_resumeDbExport(tr_resume_db* db, std::string_view dirname)
+{
+    auto const lock = std::lock_guard(db->mutex);
+
+    auto ok = true;
+    auto buf = std::vector<char>{};
+    for (auto const& [info_hash, record] : db->records)
+    {
+        auto payload = std::string_view{};
+        auto const filename = tr_strvJoin(dirname, "/"sv, tr_sha1_to_string(info_hash), ".resume"sv);
+
+        tr_error* error = nullptr;
+        if (!readPayload(db, record, buf, &payload) || !tr_saveFile(filename, payload, &error))
+        {
+            tr_logAddError(_("Couldn't save \"%s\": %s"), filename.c_str(), error != nullptr ? error->message : "read error");
+            tr_error_clear(&error);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
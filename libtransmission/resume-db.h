@@ -0,0 +1,63 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef> // size_t
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "transmission.h" // tr_sha1_digest_t
+
+struct tr_resume_db;
+
+/**
+ * @addtogroup file_io File IO
+ * @{
+ */
+
+/**
+ * A single-file alternative to keeping one .resume file per torrent.
+ *
+ * Every save appends a record with the torrent's bencoded resume data
+ * to the end of the file, so saving N torrents costs N appends instead
+ * of N file rewrites. Removing a torrent appends a tombstone. Stale
+ * records are dropped by rewriting the file once they take up more
+ * than half of it. When opened, the file is mapped into memory, and
+ * lookups copy out of the mapping instead of reading the file.
+ */
+tr_resume_db* tr_resumeDbOpen(std::string_view filename);
+
+/* Compacts the file if it's worth it, then closes it. */
+void tr_resumeDbClose(tr_resume_db* db);
+
+/**
+ * Finds the newest record for a torrent. The payload is copied into `buf`
+ * and the returned view into it stays valid until `buf` is changed.
+ * Safe to call from any thread.
+ */
+std::optional<std::string_view> tr_resumeDbGet(tr_resume_db* db, tr_sha1_digest_t const& info_hash, std::vector<char>& buf);
+
+/* Appends a new record for a torrent. Safe to call from any thread. */
+bool tr_resumeDbPut(tr_resume_db* db, tr_sha1_digest_t const& info_hash, std::string_view benc);
+
+/* Forgets a torrent. Safe to call from any thread. */
+void tr_resumeDbRemove(tr_resume_db* db, tr_sha1_digest_t const& info_hash);
+
+/* How many torrents have records */
+size_t tr_resumeDbCount(tr_resume_db const* db);
+
+/* Writes every torrent's newest record to `${dirname}/${info_hash}.resume` */
+bool tr_resumeDbExport(tr_resume_db* db, std::string_view dirname);
+
+/* @} */
@@ -7,13 +7,24 @@
  */
 
 #include <algorithm>
+#include <condition_variable>
 #include <cstring>
 #include <ctime>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
 #include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "transmission.h"
 
+#include "crypto-utils.h" /* tr_sha1_to_string() */
 #include "error.h"
 #include "file.h"
 #include "log.h"
@@ -21,10 +32,12 @@
 #include "metainfo.h" /* tr_metainfoGetBasename() */
 #include "peer-mgr.h" /* pex */
 #include "platform.h" /* tr_getResumeDir() */
+#include "resume-db.h"
 #include "resume.h"
 #include "session.h"
 #include "torrent.h"
 #include "tr-assert.h"
+#include "trevent.h" /* tr_runInEventThread() */
 #include "utils.h"
 #include "variant.h"
 
@@ -37,14 +50,18 @@ constexpr int MAX_REMEMBERED_PEERS = 200;
 
 } // unnamed namespace
 
+static std::string getResumeFilename(
+    tr_session const* session,
+    std::string_view name,
+    std::string_view info_hash_string,
+    tr_magnet_metainfo::BasenameFormat format)
+{
+    return tr_magnet_metainfo::makeFilename(tr_getResumeDir(session), name, info_hash_string, format, ".resume"sv);
+}
+
 static std::string getResumeFilename(tr_torrent const* tor, tr_magnet_metainfo::BasenameFormat format)
 {
-    return tr_magnet_metainfo::makeFilename(
-        tr_getResumeDir(tor->session),
-        tr_torrentName(tor),
-        tor->infoHashString(),
-        format,
-        ".resume"sv);
+    return getResumeFilename(tor->session, tr_torrentName(tor), tor->infoHashString(), format);
 }
 
 /***
@@ -649,66 +666,420 @@ static uint64_t loadProgress(tr_variant* dict, tr_torrent* tor)
 ****
 ***/
 
-void tr_torrentSaveResume(tr_torrent* tor)
+static void saveStats(tr_variant* dict, tr_torrent const* tor)
 {
-    tr_variant top;
+    tr_variantDictAddInt(dict, TR_KEY_seeding_time_seconds, tor->secondsSeeding);
+    tr_variantDictAddInt(dict, TR_KEY_downloading_time_seconds, tor->secondsDownloading);
+    tr_variantDictAddInt(dict, TR_KEY_activity_date, tor->activityDate);
+    tr_variantDictAddInt(dict, TR_KEY_added_date, tor->addedDate);
+    tr_variantDictAddInt(dict, TR_KEY_corrupt, tor->corruptPrev + tor->corruptCur);
+    tr_variantDictAddInt(dict, TR_KEY_done_date, tor->doneDate);
+    tr_variantDictAddInt(dict, TR_KEY_downloaded, tor->downloadedPrev + tor->downloadedCur);
+    tr_variantDictAddInt(dict, TR_KEY_uploaded, tor->uploadedPrev + tor->uploadedCur);
+}
 
-    if (!tr_isTorrent(tor))
+static void saveSettings(tr_variant* dict, tr_torrent* tor)
+{
+    tr_variantDictAddQuark(dict, TR_KEY_destination, tor->downloadDir().quark());
+
+    if (!std::empty(tor->incompleteDir()))
+    {
+        tr_variantDictAddQuark(dict, TR_KEY_incomplete_dir, tor->incompleteDir().quark());
+    }
+
+    tr_variantDictAddInt(dict, TR_KEY_max_peers, tor->maxConnectedPeers);
+    tr_variantDictAddBool(dict, TR_KEY_paused, !tor->isRunning && !tor->isQueued());
+    saveSpeedLimits(dict, tor);
+    saveRatioLimits(dict, tor);
+    saveIdleLimits(dict, tor);
+}
+
+static void saveGroup(tr_variant* dict, tr_torrent* tor, uint8_t group)
+{
+    switch (group)
+    {
+    case TR_DIRTY_STATS:
+        saveStats(dict, tor);
+        break;
+
+    case TR_DIRTY_SETTINGS:
+        saveSettings(dict, tor);
+        break;
+
+    case TR_DIRTY_PEERS:
+        savePeers(dict, tor);
+        break;
+
+    case TR_DIRTY_PROGRESS:
+        if (tor->hasMetadata())
+        {
+            saveProgress(dict, tor);
+        }
+        break;
+
+    case TR_DIRTY_PRIORITIES:
+        tr_variantDictAddInt(dict, TR_KEY_bandwidth_priority, tr_torrentGetPriority(tor));
+        if (tor->hasMetadata())
+        {
+            saveFilePriorities(dict, tor);
+            saveDND(dict, tor);
+        }
+        break;
+
+    case TR_DIRTY_NAMES:
+        saveFilenames(dict, tor);
+        saveName(dict, tor);
+        saveLabels(dict, tor);
+        break;
+
+    default:
+        TR_ASSERT_MSG(false, "unknown resume field group");
+        break;
+    }
+}
+
+namespace
+{
+
+// These are small, and some of their fields (e.g. seeding time) change
+// without marking the torrent as dirty, so they're rebuilt on every save.
+auto constexpr AlwaysRebuiltGroups = uint8_t{ TR_DIRTY_STATS | TR_DIRTY_SETTINGS | TR_DIRTY_PEERS };
+
+using resume_snapshot_t = std::vector<std::pair<std::string_view, std::shared_ptr<std::string const>>>;
+
+struct resume_write
+{
+    tr_resume_db* db = nullptr;
+    tr_sha1_digest_t info_hash = {};
+    int torrent_id = 0;
+    std::string filename;
+    std::string old_filename;
+
+    // forget the torrent's resume data before writing the snapshot
+    bool remove = false;
+
+    // the resume data to write, or empty if there's nothing to write
+    resume_snapshot_t snapshot;
+};
+
+struct resume_error
+{
+    tr_session* session;
+    int torrent_id;
+    std::string message;
+};
+
+} // unnamed namespace
+
+static void updateResumeCache(tr_torrent* tor, uint8_t dirty_fields)
+{
+    if (!tor->resume_cache)
+    {
+        tor->resume_cache = std::make_shared<tr_resume_cache>();
+        dirty_fields = TR_DIRTY_ALL;
+    }
+
+    dirty_fields |= AlwaysRebuiltGroups;
+
+    auto& values = tor->resume_cache->values;
+    for (auto group = uint8_t{ 1 }; (group & TR_DIRTY_ALL) != 0; group <<= 1)
+    {
+        if ((dirty_fields & group) == 0)
+        {
+            continue;
+        }
+
+        for (auto it = std::begin(values); it != std::end(values);)
+        {
+            it = it->second.group == group ? values.erase(it) : std::next(it);
+        }
+
+        auto dict = tr_variant{};
+        tr_variantInitDict(&dict, 8);
+        saveGroup(&dict, tor, group);
+
+        auto key = tr_quark{};
+        tr_variant* child = nullptr;
+        for (size_t i = 0; tr_variantDictChild(&dict, i, &key, &child); ++i)
+        {
+            auto benc = std::make_shared<std::string const>(tr_variantToStr(child, TR_VARIANT_FMT_BENC));
+            values.insert_or_assign(tr_quark_get_string_view(key), tr_resume_cache::Value{ group, std::move(benc) });
+        }
+
+        tr_variantFree(&dict);
+    }
+}
+
+static std::string serializeSnapshot(resume_snapshot_t const& snapshot)
+{
+    auto len = size_t{ 2 };
+    for (auto const& [key, benc] : snapshot)
+    {
+        len += 24 + std::size(key) + std::size(*benc);
+    }
+
+    auto ret = std::string{};
+    ret.reserve(len);
+    ret += 'd';
+    for (auto const& [key, benc] : snapshot)
+    {
+        ret += std::to_string(std::size(key));
+        ret += ':';
+        ret += key;
+        ret += *benc;
+    }
+    ret += 'e';
+    return ret;
+}
+
+static void onResumeWriteFailed(void* vdata)
+{
+    auto* const data = static_cast<resume_error*>(vdata);
+
+    if (auto* const tor = tr_torrentFindFromId(data->session, data->torrent_id); tor != nullptr)
+    {
+        tor->setLocalError(data->message);
+    }
+
+    delete data;
+}
+
+/* runs in the resume writer's thread, so it mustn't touch the torrent */
+static void runResumeWrite(tr_session* session, resume_write const& job)
+{
+    if (job.remove)
+    {
+        if (job.db != nullptr)
+        {
+            tr_resumeDbRemove(job.db, job.info_hash);
+        }
+
+        tr_sys_path_remove(job.filename.c_str(), nullptr);
+        tr_sys_path_remove(job.old_filename.c_str(), nullptr);
+    }
+
+    if (std::empty(job.snapshot))
     {
         return;
     }
 
-    tr_variantInitDict(&top, 50); /* arbitrary "big enough" number */
-    tr_variantDictAddInt(&top, TR_KEY_seeding_time_seconds, tor->secondsSeeding);
-    tr_variantDictAddInt(&top, TR_KEY_downloading_time_seconds, tor->secondsDownloading);
-    tr_variantDictAddInt(&top, TR_KEY_activity_date, tor->activityDate);
-    tr_variantDictAddInt(&top, TR_KEY_added_date, tor->addedDate);
-    tr_variantDictAddInt(&top, TR_KEY_corrupt, tor->corruptPrev + tor->corruptCur);
-    tr_variantDictAddInt(&top, TR_KEY_done_date, tor->doneDate);
-    tr_variantDictAddQuark(&top, TR_KEY_destination, tor->downloadDir().quark());
+    auto const benc = serializeSnapshot(job.snapshot);
+    auto errmsg = std::string{};
 
-    if (!std::empty(tor->incompleteDir()))
+    if (job.db != nullptr)
+    {
+        if (!tr_resumeDbPut(job.db, job.info_hash, benc))
+        {
+            errmsg = "Unable to save resume data";
+        }
+    }
+    else if (tr_error* error = nullptr; !tr_saveFile(job.filename, benc, &error))
+    {
+        tr_logAddError(_("Error saving \"%s\": %s (%d)"), job.filename.c_str(), error->message, error->code);
+        errmsg = tr_strvJoin("Unable to save resume file: ", error->message);
+        tr_error_free(error);
+    }
+
+    if (!std::empty(errmsg))
     {
-        tr_variantDictAddQuark(&top, TR_KEY_incomplete_dir, tor->incompleteDir().quark());
+        tr_runInEventThread(session, onResumeWriteFailed, new resume_error{ session, job.torrent_id, std::move(errmsg) });
     }
+}
 
-    tr_variantDictAddInt(&top, TR_KEY_downloaded, tor->downloadedPrev + tor->downloadedCur);
-    tr_variantDictAddInt(&top, TR_KEY_uploaded, tor->uploadedPrev + tor->uploadedCur);
-    tr_variantDictAddInt(&top, TR_KEY_max_peers, tor->maxConnectedPeers);
-    tr_variantDictAddInt(&top, TR_KEY_bandwidth_priority, tr_torrentGetPriority(tor));
-    tr_variantDictAddBool(&top, TR_KEY_paused, !tor->isRunning && !tor->isQueued());
-    savePeers(&top, tor);
+/***
+****
+***/
 
-    if (tor->hasMetadata())
+struct tr_resume_writer
+{
+    explicit tr_resume_writer(tr_session* session_in)
+        : session{ session_in }
     {
-        saveFilePriorities(&top, tor);
-        saveDND(&top, tor);
-        saveProgress(&top, tor);
     }
 
-    saveSpeedLimits(&top, tor);
-    saveRatioLimits(&top, tor);
-    saveIdleLimits(&top, tor);
-    saveFilenames(&top, tor);
-    saveName(&top, tor);
-    saveLabels(&top, tor);
+    tr_session* const session;
+
+    std::mutex mutex;
+    std::condition_variable work_cv;
+    std::condition_variable idle_cv;
 
-    auto const filename = getResumeFilename(tor, tr_magnet_metainfo::BasenameFormat::Hash);
-    auto const err = tr_variantToFile(&top, TR_VARIANT_FMT_BENC, filename.c_str());
-    if (err != 0)
+    // at most one write is pending per torrent; a newer one replaces it
+    std::deque<tr_sha1_digest_t> queue;
+    std::map<tr_sha1_digest_t, resume_write> pending;
+    std::optional<tr_sha1_digest_t> busy;
+    bool paused = false;
+    bool die = false;
+
+    std::thread thread;
+};
+
+static void resumeWriterThreadFunc(tr_resume_writer* writer)
+{
+    auto lock = std::unique_lock(writer->mutex);
+
+    for (;;)
     {
-        tor->setLocalError(tr_strvJoin("Unable to save resume file: ", tr_strerror(err)));
+        writer->work_cv.wait(lock, [writer]() { return writer->die || (!writer->paused && !std::empty(writer->queue)); });
+
+        // finish the queued writes before exiting
+        if (std::empty(writer->queue))
+        {
+            break;
+        }
+
+        auto const info_hash = writer->queue.front();
+        writer->queue.pop_front();
+        auto node = writer->pending.extract(info_hash);
+        writer->busy = info_hash;
+
+        lock.unlock();
+        runResumeWrite(writer->session, node.mapped());
+        lock.lock();
+
+        writer->busy.reset();
+        writer->idle_cv.notify_all();
     }
+}
 
-    tr_variantFree(&top);
+tr_resume_writer* tr_resumeWriterNew(tr_session* session)
+{
+    auto* const writer = new tr_resume_writer{ session };
+    writer->thread = std::thread(resumeWriterThreadFunc, writer);
+    return writer;
+}
+
+void tr_resumeWriterFree(tr_resume_writer* writer)
+{
+    {
+        auto const lock = std::lock_guard(writer->mutex);
+        writer->die = true;
+    }
+
+    writer->work_cv.notify_one();
+    writer->thread.join();
+    delete writer;
+}
+
+void tr_resumeWriterFlush(tr_resume_writer* writer)
+{
+    auto lock = std::unique_lock(writer->mutex);
+    writer->idle_cv.wait(lock, [writer]() { return std::empty(writer->queue) && !writer->busy; });
+}
+
+void tr_resumeWriterSetPaused(tr_resume_writer* writer, bool paused)
+{
+    {
+        auto const lock = std::lock_guard(writer->mutex);
+        writer->paused = paused;
+    }
+
+    writer->work_cv.notify_one();
 }
 
-static uint64_t loadFromFile(tr_torrent* tor, uint64_t fieldsToLoad, bool* didRenameToHashOnlyName)
+/* blocks until the torrent's queued resume data, if any, has been written */
+static void waitForResumeWrite(tr_resume_writer* writer, tr_sha1_digest_t const& info_hash)
+{
+    auto lock = std::unique_lock(writer->mutex);
+    writer->idle_cv.wait(
+        lock,
+        [writer, &info_hash]() { return writer->pending.count(info_hash) == 0 && writer->busy != info_hash; });
+}
+
+static void addResumeWrite(tr_session* session, resume_write&& job)
+{
+    auto* const writer = session->resume_writer;
+    if (writer == nullptr)
+    {
+        runResumeWrite(session, job);
+        return;
+    }
+
+    {
+        auto const lock = std::lock_guard(writer->mutex);
+
+        auto const [it, added] = writer->pending.try_emplace(job.info_hash);
+        if (added)
+        {
+            writer->queue.push_back(job.info_hash);
+        }
+        else if (!std::empty(job.snapshot) && it->second.remove)
+        {
+            // a newer snapshot replaces the pending one, but a pending removal still has to happen first
+            job.remove = true;
+            job.old_filename = std::move(it->second.old_filename);
+        }
+
+        it->second = std::move(job);
+    }
+
+    writer->work_cv.notify_one();
+}
+
+void tr_torrentSaveResume(tr_torrent* tor, uint8_t dirty_fields)
+{
+    if (!tr_isTorrent(tor))
+    {
+        return;
+    }
+
+    updateResumeCache(tor, dirty_fields);
+
+    auto job = resume_write{};
+    job.db = tor->session->resume_db;
+    job.info_hash = tor->infoHash();
+    job.torrent_id = tor->uniqueId;
+    job.filename = getResumeFilename(tor, tr_magnet_metainfo::BasenameFormat::Hash);
+
+    auto const& values = tor->resume_cache->values;
+    job.snapshot.reserve(std::size(values));
+    for (auto const& [key, value] : values)
+    {
+        job.snapshot.emplace_back(key, value.benc);
+    }
+
+    addResumeWrite(tor->session, std::move(job));
+}
+
+void tr_torrentPreloadResume(
+    tr_resume_preload* setme,
+    tr_session const* session,
+    std::string_view name,
+    tr_sha1_digest_t const& info_hash)
+{
+    TR_ASSERT(!setme->loaded);
+
+    auto benc = std::optional<std::string_view>{};
+    if (session->resume_db != nullptr)
+    {
+        benc = tr_resumeDbGet(session->resume_db, info_hash, setme->buf);
+    }
+
+    // if this fails, loadFromFile() will try again and also look for an old-style filename
+    if (!benc)
+    {
+        auto const filename = getResumeFilename(session, name, tr_sha1_to_string(info_hash), tr_magnet_metainfo::BasenameFormat::Hash);
+        if (tr_loadFile(setme->buf, filename, nullptr))
+        {
+            benc = std::string_view{ std::data(setme->buf), std::size(setme->buf) };
+        }
+    }
+
+    if (benc)
+    {
+        setme->loaded = tr_variantFromBuf(&setme->top, TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE, *benc, nullptr, nullptr);
+    }
+}
+
+static uint64_t loadFromFile(
+    tr_torrent* tor,
+    uint64_t fieldsToLoad,
+    bool* didRenameToHashOnlyName,
+    tr_resume_preload* preload)
 {
     TR_ASSERT(tr_isTorrent(tor));
 
     auto boolVal = false;
-    auto const wasDirty = tor->isDirty;
+    auto const wasDirty = tor->dirty_fields.load();
     auto fieldsLoaded = uint64_t{};
     auto i = int64_t{};
     auto top = tr_variant{};
@@ -722,8 +1093,30 @@ static uint64_t loadFromFile(tr_torrent* tor, uint64_t fieldsToLoad, bool* didRe
 
     std::string const filename = getResumeFilename(tor, tr_magnet_metainfo::BasenameFormat::Hash);
 
+    // don't read the resume data while a newer version of it is waiting to be written
+    if (auto* const writer = tor->session->resume_writer; writer != nullptr)
+    {
+        waitForResumeWrite(writer, tor->infoHash());
+    }
+
     auto buf = std::vector<char>{};
-    if (!tr_loadFile(buf, filename, &error) ||
+    auto* const db = tor->session->resume_db;
+    auto benc = std::optional<std::string_view>{};
+    if (preload != nullptr && preload->loaded)
+    {
+        // take ownership of the parsed dict; its strings still point into preload->buf
+        top = preload->top;
+        preload->top = {};
+        preload->loaded = false;
+    }
+    else if (
+        db != nullptr && (benc = tr_resumeDbGet(db, tor->infoHash(), buf)) &&
+        tr_variantFromBuf(&top, TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE, *benc, nullptr, nullptr))
+    {
+        tr_logAddTorDbg(tor, "Read resume data from the resume db");
+    }
+    else if (
+        !tr_loadFile(buf, filename, &error) ||
         !tr_variantFromBuf(
             &top,
             TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE,
@@ -788,6 +1181,11 @@ static uint64_t loadFromFile(tr_torrent* tor, uint64_t fieldsToLoad, bool* didRe
         fieldsLoaded |= TR_FR_INCOMPLETE_DIR;
     }
 
+    if ((fieldsLoaded & (TR_FR_DOWNLOAD_DIR | TR_FR_INCOMPLETE_DIR)) != 0)
+    {
+        tor->invalidateFileLocations();
+    }
+
     if ((fieldsToLoad & TR_FR_DOWNLOADED) != 0 && tr_variantDictFindInt(&top, TR_KEY_downloaded, &i))
     {
         tor->downloadedPrev = i;
@@ -905,7 +1303,7 @@ static uint64_t loadFromFile(tr_torrent* tor, uint64_t fieldsToLoad, bool* didRe
     /* loading the resume file triggers of a lot of changes,
      * but none of them needs to trigger a re-saving of the
      * same resume information... */
-    tor->isDirty = wasDirty;
+    tor->dirty_fields = wasDirty;
 
     tr_variantFree(&top);
     return fieldsLoaded;
@@ -953,7 +1351,12 @@ static uint64_t useFallbackFields(tr_torrent* tor, uint64_t fields, tr_ctor cons
     return setFromCtor(tor, fields, ctor, TR_FALLBACK);
 }
 
-uint64_t tr_torrentLoadResume(tr_torrent* tor, uint64_t fieldsToLoad, tr_ctor const* ctor, bool* didRenameToHashOnlyName)
+uint64_t tr_torrentLoadResume(
+    tr_torrent* tor,
+    uint64_t fieldsToLoad,
+    tr_ctor const* ctor,
+    bool* didRenameToHashOnlyName,
+    tr_resume_preload* preload)
 {
     TR_ASSERT(tr_isTorrent(tor));
 
@@ -961,7 +1364,7 @@ uint64_t tr_torrentLoadResume(tr_torrent* tor, uint64_t fieldsToLoad, tr_ctor co
 
     ret |= useManditoryFields(tor, fieldsToLoad, ctor);
     fieldsToLoad &= ~ret;
-    ret |= loadFromFile(tor, fieldsToLoad, didRenameToHashOnlyName);
+    ret |= loadFromFile(tor, fieldsToLoad, didRenameToHashOnlyName, preload);
     fieldsToLoad &= ~ret;
     ret |= useFallbackFields(tor, fieldsToLoad, ctor);
 
@@ -970,9 +1373,12 @@ uint64_t tr_torrentLoadResume(tr_torrent* tor, uint64_t fieldsToLoad, tr_ctor co
 
 void tr_torrentRemoveResume(tr_torrent const* tor)
 {
-    std::string filename = getResumeFilename(tor, tr_magnet_metainfo::BasenameFormat::Hash);
-    tr_sys_path_remove(filename.c_str(), nullptr);
-
-    filename = getResumeFilename(tor, tr_magnet_metainfo::BasenameFormat::NameAndPartialHash);
-    tr_sys_path_remove(filename.c_str(), nullptr);
+    auto job = resume_write{};
+    job.db = tor->session->resume_db;
+    job.info_hash = tor->infoHash();
+    job.torrent_id = tor->uniqueId;
+    job.filename = getResumeFilename(tor, tr_magnet_metainfo::BasenameFormat::Hash);
+    job.old_filename = getResumeFilename(tor, tr_magnet_metainfo::BasenameFormat::NameAndPartialHash);
+    job.remove = true;
+    addResumeWrite(tor->session, std::move(job));
 }
@@ -13,8 +13,17 @@
 #endif
 
 #include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "variant.h"
 
 struct tr_ctor;
+struct tr_resume_writer;
+struct tr_session;
 struct tr_torrent;
 
 enum
@@ -45,12 +54,97 @@ enum
 };
 
 /**
- * Returns a bitwise-or'ed set of the loaded resume data
+ * The bencoded value of every top-level key in a torrent's resume dict,
+ * tagged with the TR_DIRTY_* group that it belongs to. Saving only
+ * rebuilds the groups that changed, and the values are shared with the
+ * snapshots that are waiting to be written so they never get copied.
+ */
+struct tr_resume_cache
+{
+    struct Value
+    {
+        uint8_t group;
+        std::shared_ptr<std::string const> benc;
+    };
+
+    // std::map keeps the keys in the order that bencoded dicts need
+    std::map<std::string_view, Value> values;
+};
+
+/**
+ * Resume data that was read and parsed before its torrent was created,
+ * e.g. by one of the worker threads that load torrents at startup.
  */
-uint64_t tr_torrentLoadResume(tr_torrent* tor, uint64_t fieldsToLoad, tr_ctor const* ctor, bool* didRenameToHashOnlyName);
+struct tr_resume_preload
+{
+    std::vector<char> buf;
+    tr_variant top = {};
+    bool loaded = false;
+
+    tr_resume_preload() = default;
+    tr_resume_preload(tr_resume_preload const&) = delete;
+    tr_resume_preload& operator=(tr_resume_preload const&) = delete;
 
-void tr_torrentSaveResume(tr_torrent* tor);
+    ~tr_resume_preload()
+    {
+        if (loaded)
+        {
+            tr_variantFree(&top);
+        }
+    }
+};
 
+/**
+ * Reads and parses a torrent's resume data, from the session's resume db
+ * or from its .resume file, without touching the torrent.
+ * Safe to call from any thread.
+ */
+void tr_torrentPreloadResume(
+    tr_resume_preload* setme,
+    tr_session const* session,
+    std::string_view name,
+    tr_sha1_digest_t const& info_hash);
+
+/**
+ * Returns a bitwise-or'ed set of the loaded resume data.
+ * If `preload` holds a parsed resume file, that's used instead of reading it again.
+ */
+uint64_t tr_torrentLoadResume(
+    tr_torrent* tor,
+    uint64_t fieldsToLoad,
+    tr_ctor const* ctor,
+    bool* didRenameToHashOnlyName,
+    tr_resume_preload* preload = nullptr);
+
+/**
+ * Queues the torrent's resume data to be written by the session's resume writer.
+ * Only the TR_DIRTY_* groups in `dirty_fields` are rebuilt; the rest are reused
+ * from the previous save.
+ */
+void tr_torrentSaveResume(tr_torrent* tor, uint8_t dirty_fields);
+
+/* Queues the torrent's resume data to be removed by the session's resume writer */
 void tr_torrentRemoveResume(tr_torrent const* tor);
 
 int tr_torrentRenameResume(tr_torrent const* tor, char const* newname);
+
+/**
+ * A thread that serializes and writes resume data in the background,
+ * so that saving a torrent's resume data only has to take a snapshot
+ * of it. If a torrent is saved again before its previous snapshot
+ * has been written, the newer snapshot replaces the older one.
+ */
+tr_resume_writer* tr_resumeWriterNew(tr_session* session);
+
+/* Waits for the queued writes to finish, then stops the thread */
+void tr_resumeWriterFree(tr_resume_writer* writer);
+
+/* Blocks until all the queued writes have finished */
+void tr_resumeWriterFlush(tr_resume_writer* writer);
+
+/**
+ * @brief Private function that's exposed here only for unit tests.
+ * While paused, the writer queues snapshots and removals without running them,
+ * so flushing a paused writer waits until it's resumed.
+ */
+void tr_resumeWriterSetPaused(tr_resume_writer* writer, bool paused);
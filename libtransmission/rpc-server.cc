@@ -8,11 +8,17 @@
 
 #include <algorithm>
 #include <cerrno>
-#include <cstring> /* memcpy */
+#include <condition_variable>
+#include <cstring>
 #include <ctime>
+#include <deque>
 #include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <vector>
 
 #include <zlib.h>
@@ -28,6 +34,7 @@
 #include "crypto.h" /* tr_ssha1_matches() */
 #include "error.h"
 #include "fdlimit.h"
+#include "file.h"
 #include "log.h"
 #include "net.h"
 #include "platform.h" /* tr_getWebClientDir() */
@@ -256,77 +263,290 @@ static char const* mimetype_guess(char const* path)
     return "application/octet-stream";
 }
 
-static void add_response(struct evhttp_request* req, tr_rpc_server* server, struct evbuffer* out, struct evbuffer* content)
+/***
+****  gzip
+***/
+
+/* how much output space to give deflate() at a time */
+static auto constexpr GzipChunkSize = size_t{ 16 * 1024 };
+
+static bool accepts_gzip(struct evhttp_request* req)
+{
+    char const* encoding = evhttp_find_header(req->input_headers, "Accept-Encoding");
+    return encoding != nullptr && strstr(encoding, "gzip") != nullptr;
+}
+
+bool tr_rpcGzipInit(z_stream* stream, int level)
 {
-    char const* key = "Accept-Encoding";
-    char const* encoding = evhttp_find_header(req->input_headers, key);
-    bool const do_compress = encoding != nullptr && strstr(encoding, "gzip") != nullptr;
+    *stream = {};
 
-    if (!do_compress)
+    // "windowBits can also be greater than 15 for optional gzip encoding.
+    // Add 16 to windowBits to write a simple gzip header and trailer
+    // around the compressed data instead of a zlib wrapper."
+    if (deflateInit2(stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
     {
-        evbuffer_add_buffer(out, content);
+        tr_logAddNamedDbg(MY_NAME, "deflateInit2 failed: %s", stream->msg);
+        return false;
     }
-    else
+
+    return true;
+}
+
+/* Deflates one evbuffer segment at a time, so that the body never has
+ * to be copied into a single contiguous block. */
+bool tr_rpcGzipBuffer(z_stream* stream, struct evbuffer* out, struct evbuffer* content)
+{
+    auto const content_len = evbuffer_get_length(content);
+    auto const n_segments = evbuffer_peek(content, -1, nullptr, nullptr, 0);
+    auto segments = std::vector<struct evbuffer_iovec>(std::max(n_segments, 0));
+    evbuffer_peek(content, -1, nullptr, std::data(segments), n_segments);
+
+    auto ok = content_len > 0;
+
+    for (int i = 0; ok && i < n_segments; ++i)
     {
-        struct evbuffer_iovec iovec[1];
-        void* content_ptr = evbuffer_pullup(content, -1);
-        size_t const content_len = evbuffer_get_length(content);
+        stream->next_in = static_cast<Bytef*>(segments[i].iov_base);
+        stream->avail_in = segments[i].iov_len;
+        int const flush = i + 1 == n_segments ? Z_FINISH : Z_NO_FLUSH;
 
-        if (!server->isStreamInitialized)
+        do
         {
-            server->isStreamInitialized = true;
-            server->stream.zalloc = (alloc_func)Z_NULL;
-            server->stream.zfree = (free_func)Z_NULL;
-            server->stream.opaque = (voidpf)Z_NULL;
-
-            /* zlib's manual says: "Add 16 to windowBits to write a simple gzip header
-             * and trailer around the compressed data instead of a zlib wrapper." */
-#ifdef TR_LIGHTWEIGHT
-            int const compressionLevel = Z_DEFAULT_COMPRESSION;
-#else
-            int const compressionLevel = Z_BEST_COMPRESSION;
-#endif
-            // "windowBits can also be greater than 15 for optional gzip encoding.
-            // Add 16 to windowBits to write a simple gzip header and trailer
-            // around the compressed data instead of a zlib wrapper."
-            if (Z_OK != deflateInit2(&server->stream, compressionLevel, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY))
-            {
-                tr_logAddNamedDbg(MY_NAME, "deflateInit2 failed: %s", server->stream.msg);
-            }
+            struct evbuffer_iovec iovec[1];
+            evbuffer_reserve_space(out, GzipChunkSize, iovec, 1);
+            stream->next_out = static_cast<Bytef*>(iovec[0].iov_base);
+            stream->avail_out = iovec[0].iov_len;
+            auto const state = deflate(stream, flush);
+            iovec[0].iov_len -= stream->avail_out;
+            evbuffer_commit_space(out, iovec, 1);
+
+            /* stop as soon as it's clear that compressing isn't worth it */
+            ok = state != Z_STREAM_ERROR && evbuffer_get_length(out) < content_len;
+        } while (ok && stream->avail_out == 0);
+    }
+
+    deflateReset(stream);
+
+    if (!ok)
+    {
+        evbuffer_drain(out, evbuffer_get_length(out));
+    }
+
+    return ok;
+}
+
+/**
+ * Compresses big RPC responses on its own thread so that peer I/O isn't
+ * held up while they're deflated. The event thread hands over a response's
+ * buffers and doesn't touch them again until the worker posts them back.
+ */
+class tr_rpc_gzip_worker
+{
+public:
+    struct job
+    {
+        /* set to nullptr if libevent frees the request, along with its
+         * connection, before the reply is sent */
+        struct evhttp_request* req;
+        struct evbuffer* content;
+        struct evbuffer* out;
+        int level;
+        bool is_compressed;
+    };
+
+    explicit tr_rpc_gzip_worker(tr_session* session)
+        : session_{ session }
+    {
+    }
+
+    ~tr_rpc_gzip_worker()
+    {
+        stop();
+    }
+
+    tr_rpc_gzip_worker(tr_rpc_gzip_worker&) = delete;
+    tr_rpc_gzip_worker& operator=(tr_rpc_gzip_worker&) = delete;
+
+    void add(job* j)
+    {
+        auto const lock = std::lock_guard<std::mutex>{ mutex_ };
+
+        if (!thread_.joinable())
+        {
+            thread_ = std::thread(&tr_rpc_gzip_worker::run, this);
         }
 
-        server->stream.next_in = static_cast<Bytef*>(content_ptr);
-        server->stream.avail_in = content_len;
+        queue_.push_back(j);
+        cv_.notify_one();
+    }
+
+    /* Called when the server's going away, after its connections are freed.
+     * Jobs that were already posted back to the event thread are still
+     * replied to if their request outlived its connection. */
+    void stop()
+    {
+        {
+            auto const lock = std::lock_guard<std::mutex>{ mutex_ };
+            is_stopped_ = true;
+        }
 
-        /* allocate space for the raw data and call deflate() just once --
-         * we won't use the deflated data if it's longer than the raw data,
-         * so it's okay to let deflate() run out of output buffer space */
-        evbuffer_reserve_space(out, content_len, iovec, 1);
-        server->stream.next_out = static_cast<Bytef*>(iovec[0].iov_base);
-        server->stream.avail_out = iovec[0].iov_len;
-        auto const state = deflate(&server->stream, Z_FINISH);
+        cv_.notify_one();
 
-        if (state == Z_STREAM_END)
+        if (thread_.joinable())
         {
-            iovec[0].iov_len -= server->stream.avail_out;
+            thread_.join();
+        }
 
-#if 0
+        for (auto* j : queue_)
+        {
+            releaseRequest(j);
+            freeJob(j);
+        }
 
-            fprintf(stderr, "compressed response is %.2f of original (raw==%zu bytes; compressed==%zu)\n",
-                (double)evbuffer_get_length(out) / content_len, content_len, evbuffer_get_length(out));
+        queue_.clear();
+    }
 
-#endif
+    /* watch for the request being freed while the job is out of the event thread */
+    static void holdRequest(job* j)
+    {
+        evhttp_connection_set_closecb(evhttp_request_get_connection(j->req), onConnectionClosed, j);
+    }
+
+    /* stop watching, before the job's reply is sent or the job is freed */
+    static void releaseRequest(job* j)
+    {
+        if (auto* const conn = j->req != nullptr ? evhttp_request_get_connection(j->req) : nullptr; conn != nullptr)
+        {
+            evhttp_connection_set_closecb(conn, nullptr, nullptr);
+        }
+    }
+
+    static void freeJob(job* j)
+    {
+        evbuffer_free(j->content);
+        evbuffer_free(j->out);
+        delete j;
+    }
+
+private:
+    void run();
+
+    /* A connection that's freed, e.g. by evhttp_free(), frees its pending
+     * request too. If the client hung up instead, libevent has already
+     * detached the request from the connection, and sending the reply
+     * is what frees it. */
+    static void onConnectionClosed(struct evhttp_connection* conn, void* vjob)
+    {
+        auto* const j = static_cast<job*>(vjob);
+
+        if (evhttp_request_get_connection(j->req) == conn)
+        {
+            j->req = nullptr;
+        }
+    }
+
+    tr_session* const session_;
+
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<job*> queue_;
+    bool is_stopped_ = false;
+};
+
+static void send_json_reply(struct evhttp_request* req, struct evbuffer* body)
+{
+    evhttp_add_header(req->output_headers, "Content-Type", "application/json; charset=UTF-8");
+    evhttp_send_reply(req, HTTP_OK, "OK", body);
+}
+
+static void on_gzip_job_done(void* vjob)
+{
+    auto* const j = static_cast<tr_rpc_gzip_worker::job*>(vjob);
+
+    tr_rpc_gzip_worker::releaseRequest(j);
 
-            evhttp_add_header(req->output_headers, "Content-Encoding", "gzip");
+    if (j->req != nullptr)
+    {
+        if (j->is_compressed)
+        {
+            evhttp_add_header(j->req->output_headers, "Content-Encoding", "gzip");
+            send_json_reply(j->req, j->out);
         }
         else
         {
-            memcpy(iovec[0].iov_base, content_ptr, content_len);
-            iovec[0].iov_len = content_len;
+            send_json_reply(j->req, j->content);
         }
+    }
 
-        evbuffer_commit_space(out, iovec, 1);
-        deflateReset(&server->stream);
+    tr_rpc_gzip_worker::freeJob(j);
+}
+
+void tr_rpc_gzip_worker::run()
+{
+    auto stream = z_stream{};
+    auto stream_level = std::optional<int>{};
+
+    for (;;)
+    {
+        job* j = nullptr;
+
+        {
+            auto lock = std::unique_lock<std::mutex>{ mutex_ };
+            cv_.wait(lock, [this]() { return is_stopped_ || !std::empty(queue_); });
+
+            if (is_stopped_)
+            {
+                break;
+            }
+
+            j = queue_.front();
+            queue_.pop_front();
+        }
+
+        if (stream_level != j->level)
+        {
+            if (stream_level)
+            {
+                deflateEnd(&stream);
+                stream_level.reset();
+            }
+
+            if (tr_rpcGzipInit(&stream, j->level))
+            {
+                stream_level = j->level;
+            }
+        }
+
+        j->is_compressed = stream_level && tr_rpcGzipBuffer(&stream, j->out, j->content);
+        tr_runInEventThread(session_, on_gzip_job_done, j);
+    }
+
+    if (stream_level)
+    {
+        deflateEnd(&stream);
+    }
+}
+
+/***
+****
+***/
+
+static void add_response(struct evhttp_request* req, tr_rpc_server* server, struct evbuffer* out, struct evbuffer* content)
+{
+    bool const do_compress = server->compressionLevel != Z_NO_COMPRESSION && accepts_gzip(req);
+
+    if (do_compress && !server->isStreamInitialized)
+    {
+        server->isStreamInitialized = tr_rpcGzipInit(&server->stream, server->compressionLevel);
+    }
+
+    if (do_compress && server->isStreamInitialized && tr_rpcGzipBuffer(&server->stream, out, content))
+    {
+        evhttp_add_header(req->output_headers, "Content-Encoding", "gzip");
+    }
+    else
+    {
+        evbuffer_add_buffer(out, content);
     }
 }
 
@@ -346,12 +566,68 @@ static void evbuffer_ref_cleanup_tr_free(void const* /*data*/, size_t /*datalen*
     tr_free(extra);
 }
 
+/* The web client's files don't change while we're running, so compress
+ * each one just once, at the best level, and serve it from memory after that.
+ * Returns nullptr if the file can't be read or doesn't get any smaller. */
+static std::string const* get_gzipped_file(tr_rpc_server* server, char const* filename)
+{
+    auto info = tr_sys_path_info{};
+    if (!tr_sys_path_get_info(filename, 0, &info, nullptr))
+    {
+        return nullptr;
+    }
+
+    auto& file = server->gzipped_files[filename];
+
+    if (file.mtime != info.last_modified_at || file.size != info.size)
+    {
+        file.mtime = info.last_modified_at;
+        file.size = info.size;
+        file.gzipped.clear();
+
+        auto file_len = size_t{};
+        void* const contents = tr_loadFile(filename, &file_len, nullptr);
+        auto stream = z_stream{};
+
+        if (contents != nullptr && tr_rpcGzipInit(&stream, Z_BEST_COMPRESSION))
+        {
+            auto* const content = evbuffer_new();
+            auto* const out = evbuffer_new();
+            evbuffer_add_reference(content, contents, file_len, nullptr, nullptr);
+
+            if (tr_rpcGzipBuffer(&stream, out, content))
+            {
+                file.gzipped.resize(evbuffer_get_length(out));
+                evbuffer_remove(out, std::data(file.gzipped), std::size(file.gzipped));
+            }
+
+            evbuffer_free(out);
+            evbuffer_free(content);
+            deflateEnd(&stream);
+        }
+
+        tr_free(contents);
+    }
+
+    return std::empty(file.gzipped) ? nullptr : &file.gzipped;
+}
+
 static void serve_file(struct evhttp_request* req, tr_rpc_server* server, char const* filename)
 {
     if (req->type != EVHTTP_REQ_GET)
     {
         evhttp_add_header(req->output_headers, "Allow", "GET");
         send_simple_response(req, 405, nullptr);
+        return;
+    }
+
+    auto* const out = evbuffer_new();
+    auto const* const gzipped = accepts_gzip(req) ? get_gzipped_file(server, filename) : nullptr;
+
+    if (gzipped != nullptr)
+    {
+        evbuffer_add(out, std::data(*gzipped), std::size(*gzipped));
+        evhttp_add_header(req->output_headers, "Content-Encoding", "gzip");
     }
     else
     {
@@ -364,25 +640,19 @@ static void serve_file(struct evhttp_request* req, tr_rpc_server* server, char c
             auto const tmp = tr_strvJoin(filename, " ("sv, error->message, ")"sv);
             send_simple_response(req, HTTP_NOTFOUND, tmp.c_str());
             tr_error_free(error);
-        }
-        else
-        {
-            auto const now = tr_time();
-
-            auto* const content = evbuffer_new();
-            evbuffer_add_reference(content, file, file_len, evbuffer_ref_cleanup_tr_free, file);
-
-            auto* const out = evbuffer_new();
-            evhttp_add_header(req->output_headers, "Content-Type", mimetype_guess(filename));
-            add_time_header(req->output_headers, "Date", now);
-            add_time_header(req->output_headers, "Expires", now + (24 * 60 * 60));
-            add_response(req, server, out, content);
-            evhttp_send_reply(req, HTTP_OK, "OK", out);
-
             evbuffer_free(out);
-            evbuffer_free(content);
+            return;
         }
+
+        evbuffer_add_reference(out, file, file_len, evbuffer_ref_cleanup_tr_free, file);
     }
+
+    auto const now = tr_time();
+    evhttp_add_header(req->output_headers, "Content-Type", mimetype_guess(filename));
+    add_time_header(req->output_headers, "Date", now);
+    add_time_header(req->output_headers, "Expires", now + (24 * 60 * 60));
+    evhttp_send_reply(req, HTTP_OK, "OK", out);
+    evbuffer_free(out);
 }
 
 static void handle_web_client(struct evhttp_request* req, tr_rpc_server* server)
@@ -436,21 +706,45 @@ struct rpc_response_data
     tr_rpc_server* server;
 };
 
-static void rpc_response_func(tr_session* /*session*/, tr_variant* response, void* user_data)
+static void rpc_response_json_func(tr_session* /*session*/, struct evbuffer* response_buf, void* user_data)
 {
     auto* data = static_cast<struct rpc_response_data*>(user_data);
-    struct evbuffer* response_buf = tr_variantToBuf(response, TR_VARIANT_FMT_JSON_LEAN);
-    struct evbuffer* buf = evbuffer_new();
+    auto* const server = data->server;
+    auto const thread_threshold = size_t(server->compressionThreadThresholdKB) * 1024U;
 
-    add_response(data->req, data->server, buf, response_buf);
-    evhttp_add_header(data->req->output_headers, "Content-Type", "application/json; charset=UTF-8");
-    evhttp_send_reply(data->req, HTTP_OK, "OK", buf);
+    if (thread_threshold > 0 && evbuffer_get_length(response_buf) >= thread_threshold &&
+        server->compressionLevel != Z_NO_COMPRESSION && accepts_gzip(data->req))
+    {
+        if (!server->gzip_worker)
+        {
+            server->gzip_worker = std::make_unique<tr_rpc_gzip_worker>(server->session);
+        }
+
+        auto* const j = new tr_rpc_gzip_worker::job{
+            data->req, evbuffer_new(), evbuffer_new(), server->compressionLevel, false,
+        };
+        evbuffer_add_buffer(j->content, response_buf);
+        tr_rpc_gzip_worker::holdRequest(j);
+        server->gzip_worker->add(j);
+    }
+    else
+    {
+        struct evbuffer* buf = evbuffer_new();
+        add_response(data->req, server, buf, response_buf);
+        send_json_reply(data->req, buf);
+        evbuffer_free(buf);
+    }
 
-    evbuffer_free(buf);
-    evbuffer_free(response_buf);
     tr_free(data);
 }
 
+static void rpc_response_func(tr_session* session, tr_variant* response, void* user_data)
+{
+    struct evbuffer* response_buf = tr_variantToBuf(response, TR_VARIANT_FMT_JSON_LEAN);
+    rpc_response_json_func(session, response_buf, user_data);
+    evbuffer_free(response_buf);
+}
+
 static void handle_rpc_from_json(struct evhttp_request* req, tr_rpc_server* server, std::string_view json)
 {
     auto top = tr_variant{};
@@ -460,7 +754,7 @@ static void handle_rpc_from_json(struct evhttp_request* req, tr_rpc_server* serv
     data->req = req;
     data->server = server;
 
-    tr_rpc_request_exec_json(server->session, have_content ? &top : nullptr, rpc_response_func, data);
+    tr_rpc_request_exec_json_buf(server->session, have_content ? &top : nullptr, rpc_response_json_func, data);
 
     if (have_content)
     {
@@ -1019,6 +1313,34 @@ void tr_rpcSetAntiBruteForceThreshold(tr_rpc_server* server, int badRequests)
     server->antiBruteForceThreshold = badRequests;
 }
 
+int tr_rpcGetCompressionLevel(tr_rpc_server const* server)
+{
+    return server->compressionLevel;
+}
+
+void tr_rpcSetCompressionLevel(tr_rpc_server* server, int level)
+{
+    level = std::clamp(level, Z_DEFAULT_COMPRESSION, Z_BEST_COMPRESSION);
+
+    if (server->compressionLevel != level && server->isStreamInitialized)
+    {
+        deflateEnd(&server->stream);
+        server->isStreamInitialized = false;
+    }
+
+    server->compressionLevel = level;
+}
+
+int tr_rpcGetCompressionThreadThresholdKB(tr_rpc_server const* server)
+{
+    return server->compressionThreadThresholdKB;
+}
+
+void tr_rpcSetCompressionThreadThresholdKB(tr_rpc_server* server, int kb)
+{
+    server->compressionThreadThresholdKB = std::max(kb, 0);
+}
+
 /****
 *****  LIFE CYCLE
 ****/
@@ -1173,6 +1495,28 @@ tr_rpc_server::tr_rpc_server(tr_session* session_in, tr_variant* settings)
         tr_rpcSetAntiBruteForceThreshold(this, i);
     }
 
+    key = TR_KEY_rpc_compression_level;
+
+    if (!tr_variantDictFindInt(settings, key, &i))
+    {
+        missing_settings_key(key);
+    }
+    else
+    {
+        tr_rpcSetCompressionLevel(this, i);
+    }
+
+    key = TR_KEY_rpc_compression_thread_threshold_kb;
+
+    if (!tr_variantDictFindInt(settings, key, &i))
+    {
+        missing_settings_key(key);
+    }
+    else
+    {
+        tr_rpcSetCompressionThreadThresholdKB(this, i);
+    }
+
     key = TR_KEY_rpc_bind_address;
 
     if (!tr_variantDictFindStrView(settings, key, &sv))
@@ -1233,6 +1577,11 @@ tr_rpc_server::~tr_rpc_server()
 
     stopServer(this);
 
+    if (this->gzip_worker)
+    {
+        this->gzip_worker->stop();
+    }
+
     if (this->isStreamInitialized)
     {
         deflateEnd(&this->stream);
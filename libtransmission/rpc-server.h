@@ -12,9 +12,13 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <cstdint> // uint64_t
+#include <ctime> // time_t
 #include <list>
+#include <memory>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 
 #include <zlib.h>
 
@@ -29,6 +33,18 @@
 
 struct tr_variant;
 
+class tr_rpc_gzip_worker;
+
+/* a web client file's gzipped contents, so that it's only compressed once */
+struct tr_rpc_gzipped_file
+{
+    time_t mtime = 0;
+    uint64_t size = 0;
+
+    /* empty if the file doesn't get any smaller when compressed */
+    std::string gzipped;
+};
+
 class tr_rpc_server
 {
 public:
@@ -42,6 +58,11 @@ public:
 
     z_stream stream = {};
 
+    /* compresses big responses so that the event thread doesn't have to */
+    std::unique_ptr<tr_rpc_gzip_worker> gzip_worker;
+
+    std::unordered_map<std::string, tr_rpc_gzipped_file> gzipped_files;
+
     std::list<std::string> hostWhitelist;
     std::list<std::string> whitelist;
     std::string salted_password;
@@ -56,6 +77,8 @@ public:
     tr_session* const session;
 
     int antiBruteForceThreshold = 0;
+    int compressionLevel = Z_DEFAULT_COMPRESSION;
+    int compressionThreadThresholdKB = 0;
     int loginattempts = 0;
     int start_retry_counter = 0;
 
@@ -111,4 +134,23 @@ int tr_rpcGetAntiBruteForceThreshold(tr_rpc_server const* server);
 
 void tr_rpcSetAntiBruteForceThreshold(tr_rpc_server* server, int badRequests);
 
+int tr_rpcGetCompressionLevel(tr_rpc_server const* server);
+
+void tr_rpcSetCompressionLevel(tr_rpc_server* server, int level);
+
+int tr_rpcGetCompressionThreadThresholdKB(tr_rpc_server const* server);
+
+void tr_rpcSetCompressionThreadThresholdKB(tr_rpc_server* server, int kb);
+
 char const* tr_rpcGetBindAddress(tr_rpc_server const* server);
+
+/* Sets up `stream` to write gzip at `level` */
+bool tr_rpcGzipInit(z_stream* stream, int level);
+
+/**
+ * Compresses `content` into `out` with a stream from tr_rpcGzipInit(),
+ * then resets the stream so that it can be reused. Returns false and
+ * leaves `out` empty if deflate() failed or if the compressed body
+ * wouldn't be any smaller than the raw one. `content` is left untouched.
+ */
+bool tr_rpcGzipBuffer(z_stream* stream, struct evbuffer* out, struct evbuffer* content);
@@ -12,6 +12,7 @@
 #include <ctime>
 #include <iterator>
 #include <numeric>
+#include <optional>
 #include <string_view>
 #include <vector>
 
@@ -20,13 +21,17 @@
 #endif
 #include <zlib.h>
 
+#include <event2/buffer.h>
+
 #include "transmission.h"
 #include "completion.h"
 #include "crypto-utils.h"
 #include "error.h"
 #include "fdlimit.h"
 #include "file.h"
+#include "json-writer.h"
 #include "log.h"
+#include "peer-mgr.h"
 #include "platform-quota.h" /* tr_device_info_get_disk_space() */
 #include "rpcimpl.h"
 #include "session.h"
@@ -498,6 +503,18 @@ static void initField(tr_torrent* const tor, tr_stat const* const st, tr_variant
         tr_variantInitInt(initme, st->addedDate);
         break;
 
+    case TR_KEY_availability:
+        {
+            auto const n = tor->pieceCount();
+            tr_variantInitList(initme, n);
+            for (tr_piece_index_t piece = 0; piece < n; ++piece)
+            {
+                auto const n_peers = int64_t(tr_peerMgrPieceAvailability(tor, piece));
+                tr_variantListAddInt(initme, tor->hasPiece(piece) ? -1 : n_peers);
+            }
+        }
+        break;
+
     case TR_KEY_bandwidthPriority:
         tr_variantInitInt(initme, tr_torrentGetPriority(tor));
         break;
@@ -677,7 +694,7 @@ static void initField(tr_torrent* const tor, tr_stat const* const st, tr_variant
         {
             auto const bytes = tor->createPieceBitfield();
             auto const enc = tr_base64_encode({ reinterpret_cast<char const*>(std::data(bytes)), std::size(bytes) });
-            tr_variantInitStrView(initme, enc);
+            tr_variantInitStr(initme, enc);
         }
         else
         {
@@ -859,78 +876,338 @@ static void addTorrentInfo(tr_torrent* tor, tr_format format, tr_variant* entry,
     }
 }
 
-static char const* torrentGet(tr_session* session, tr_variant* args_in, tr_variant* args_out, tr_rpc_idle_data* /*idle_data*/)
+/* Like the tr_variant version, but each field is written out and freed as soon
+ * as it's built, so the response never exists as a tree of every torrent's fields */
+static void addTorrentInfo(tr_torrent* tor, tr_format format, tr_json_writer& out, tr_quark const* fields, size_t fieldCount)
 {
-    auto const torrents = getTorrents(session, args_in);
-    tr_variant* const list = tr_variantDictAddList(args_out, TR_KEY_torrents, std::size(torrents) + 1);
-
-    auto sv = std::string_view{};
-    tr_format const format = tr_variantDictFindStrView(args_in, TR_KEY_format, &sv) && sv == "table"sv ? TR_FORMAT_TABLE :
-                                                                                                         TR_FORMAT_OBJECT;
+    if (format == TR_FORMAT_TABLE)
+    {
+        out.beginArray();
+    }
+    else
+    {
+        out.beginObject();
+    }
 
-    if (tr_variantDictFindStrView(args_in, TR_KEY_ids, &sv) && sv == "recently-active"sv)
+    if (fieldCount > 0)
     {
-        time_t const now = tr_time();
-        auto const interval = RecentlyActiveSeconds;
+        tr_stat const* const st = tr_torrentStat(tor);
 
-        auto const& removed = session->removed_torrents;
-        tr_variant* removed_out = tr_variantDictAddList(args_out, TR_KEY_removed, std::size(removed));
-        for (auto const& [id, time_removed] : removed)
+        for (size_t i = 0; i < fieldCount; ++i)
         {
-            if (time_removed >= now - interval)
+            if (format != TR_FORMAT_TABLE)
             {
-                tr_variantListAddInt(removed_out, id);
+                out.addKey(fields[i]);
             }
+
+            auto field = tr_variant{};
+            tr_variantInitInt(&field, 0);
+            initField(tor, st, &field, fields[i]);
+            out.addVariant(field);
+            tr_variantFree(&field);
+        }
+    }
+
+    if (format == TR_FORMAT_TABLE)
+    {
+        out.endArray();
+    }
+    else
+    {
+        out.endObject();
+    }
+}
+
+/* Whether a torrent-get field may have changed since `cursor`.
+ * Fields that only follow the clock, like how long a torrent has been
+ * seeding, aren't tracked. They're sent along with the torrent's other
+ * activity fields when something else about its activity changes. */
+static bool fieldChangedSince(tr_torrent const* tor, tr_quark key, uint64_t cursor)
+{
+    switch (key)
+    {
+    case TR_KEY_id:
+        return false;
+
+    case TR_KEY_comment:
+    case TR_KEY_creator:
+    case TR_KEY_dateCreated:
+    case TR_KEY_editDate:
+    case TR_KEY_file_count:
+    case TR_KEY_hashString:
+    case TR_KEY_isPrivate:
+    case TR_KEY_magnetLink:
+    case TR_KEY_name:
+    case TR_KEY_pieceCount:
+    case TR_KEY_pieceSize:
+    case TR_KEY_primary_mime_type:
+    case TR_KEY_source:
+    case TR_KEY_torrentFile:
+    case TR_KEY_totalSize:
+    case TR_KEY_webseeds:
+        return tor->fieldsChangedSince(TR_FIELDS_INFO, cursor);
+
+    case TR_KEY_bandwidthPriority:
+    case TR_KEY_downloadDir:
+    case TR_KEY_downloadLimit:
+    case TR_KEY_downloadLimited:
+    case TR_KEY_honorsSessionLimits:
+    case TR_KEY_labels:
+    case TR_KEY_maxConnectedPeers:
+    case TR_KEY_peer_limit:
+    case TR_KEY_priorities:
+    case TR_KEY_seedIdleLimit:
+    case TR_KEY_seedIdleMode:
+    case TR_KEY_seedRatioLimit:
+    case TR_KEY_seedRatioMode:
+    case TR_KEY_uploadLimit:
+    case TR_KEY_uploadLimited:
+    case TR_KEY_wanted:
+        return tor->fieldsChangedSince(TR_FIELDS_SETTINGS, cursor);
+
+    case TR_KEY_manualAnnounceTime:
+    case TR_KEY_trackers:
+    case TR_KEY_trackerStats:
+        return tor->fieldsChangedSince(TR_FIELDS_TRACKERS, cursor);
+
+    case TR_KEY_files: /* names and lengths, but also bytesCompleted */
+        return tor->fieldsChangedSince(TR_FIELDS_INFO, cursor) || tor->fieldsChangedSince(TR_FIELDS_ACTIVITY, cursor);
+
+    default:
+        return tor->fieldsChangedSince(TR_FIELDS_ACTIVITY, cursor);
+    }
+}
+
+static tr_format getTorrentGetFormat(tr_variant* args_in)
+{
+    auto sv = std::string_view{};
+    return tr_variantDictFindStrView(args_in, TR_KEY_format, &sv) && sv == "table"sv ? TR_FORMAT_TABLE : TR_FORMAT_OBJECT;
+}
+
+/* torrent-get's optional "cursor": send what changed since `since`,
+ * and tell the client to use `next` the next time it asks */
+struct torrent_get_cursor
+{
+    uint64_t since = 0;
+    uint64_t next = 0;
+};
+
+static std::optional<torrent_get_cursor> getTorrentGetCursor(tr_session const* session, tr_variant* args_in)
+{
+    auto since = int64_t{};
+    if (!tr_variantDictFindInt(args_in, TR_KEY_cursor, &since))
+    {
+        return {};
+    }
+
+    /* a cursor from the future can't be trusted, so it gets everything */
+    auto const next = uint64_t{ session->change_seq };
+    if (since < 0 || uint64_t(since) > next)
+    {
+        since = 0;
+    }
+
+    return torrent_get_cursor{ uint64_t(since), next };
+}
+
+/* The ids for torrent-get's "removed" argument: the torrents removed since
+ * the cursor, or recently removed ones if "recently-active" was asked for */
+static std::optional<std::vector<int>> getRemovedTorrents(
+    tr_session const* session,
+    tr_variant* args_in,
+    std::optional<torrent_get_cursor> const& cursor)
+{
+    auto sv = std::string_view{};
+    auto const recently_active = tr_variantDictFindStrView(args_in, TR_KEY_ids, &sv) && sv == "recently-active"sv;
+    if (!cursor && !recently_active)
+    {
+        return {};
+    }
+
+    auto const cutoff = tr_time() - RecentlyActiveSeconds;
+    auto ids = std::vector<int>{};
+    for (auto const& [id, time_removed, removed_seq] : session->removed_torrents)
+    {
+        if (cursor ? removed_seq > cursor->since : time_removed >= cutoff)
+        {
+            ids.push_back(id);
         }
     }
 
+    return ids;
+}
+
+/* the keys in torrent-get's "fields" argument, or nullopt if it has none */
+static std::optional<std::vector<tr_quark>> getTorrentGetFields(tr_variant* args_in)
+{
     tr_variant* fields = nullptr;
-    char const* errmsg = nullptr;
     if (!tr_variantDictFindList(args_in, TR_KEY_fields, &fields))
     {
-        errmsg = "no fields specified";
+        return {};
     }
-    else
+
+    auto keys = std::vector<tr_quark>{};
+    size_t const n = tr_variantListSize(fields);
+    keys.reserve(n);
+    for (size_t i = 0; i < n; ++i)
     {
-        /* make an array of property name quarks */
-        size_t keyCount = 0;
-        size_t const n = tr_variantListSize(fields);
-        auto* const keys = tr_new(tr_quark, n);
-        for (size_t i = 0; i < n; ++i)
+        auto sv = std::string_view{};
+        if (!tr_variantGetStrView(tr_variantListChild(fields, i), &sv))
         {
-            if (!tr_variantGetStrView(tr_variantListChild(fields, i), &sv))
-            {
-                continue;
-            }
+            continue;
+        }
 
-            auto const key = tr_quark_lookup(sv);
-            if (!key)
-            {
-                continue;
-            }
+        if (auto const key = tr_quark_lookup(sv); key)
+        {
+            keys.push_back(*key);
+        }
+    }
 
-            keys[keyCount++] = *key;
+    return keys;
+}
+
+/* Which of `keys` to send for a torrent, or nullptr to skip it.
+ * Without a cursor, that's all of them. With one, tables keep every column,
+ * so they get whole rows of the torrents that changed, and objects only get
+ * the fields that changed plus the id to tell them apart. */
+static std::vector<tr_quark> const* getTorrentFieldsToSend(
+    tr_torrent const* tor,
+    tr_format format,
+    std::vector<tr_quark> const& keys,
+    std::optional<torrent_get_cursor> const& cursor,
+    std::vector<tr_quark>& changed_keys)
+{
+    if (!cursor)
+    {
+        return &keys;
+    }
+
+    changed_keys.clear();
+    std::copy_if(
+        std::begin(keys),
+        std::end(keys),
+        std::back_inserter(changed_keys),
+        [tor, &cursor](auto key) { return fieldChangedSince(tor, key, cursor->since); });
+
+    if (std::empty(changed_keys))
+    {
+        return nullptr;
+    }
+
+    if (format == TR_FORMAT_TABLE)
+    {
+        return &keys;
+    }
+
+    changed_keys.push_back(TR_KEY_id);
+    return &changed_keys;
+}
+
+static char const* torrentGet(tr_session* session, tr_variant* args_in, tr_variant* args_out, tr_rpc_idle_data* /*idle_data*/)
+{
+    auto const torrents = getTorrents(session, args_in);
+    tr_variant* const list = tr_variantDictAddList(args_out, TR_KEY_torrents, std::size(torrents) + 1);
+    auto const format = getTorrentGetFormat(args_in);
+    auto const cursor = getTorrentGetCursor(session, args_in);
+
+    if (cursor)
+    {
+        tr_variantDictAddInt(args_out, TR_KEY_cursor, cursor->next);
+    }
+
+    if (auto const removed = getRemovedTorrents(session, args_in, cursor); removed)
+    {
+        tr_variant* removed_out = tr_variantDictAddList(args_out, TR_KEY_removed, std::size(*removed));
+        for (auto const id : *removed)
+        {
+            tr_variantListAddInt(removed_out, id);
         }
+    }
+
+    auto const keys = getTorrentGetFields(args_in);
+    if (!keys)
+    {
+        return "no fields specified";
+    }
 
+    if (format == TR_FORMAT_TABLE)
+    {
+        /* first entry is an array of property names */
+        tr_variant* names = tr_variantListAddList(list, std::size(*keys));
+        for (auto const key : *keys)
+        {
+            tr_variantListAddQuark(names, key);
+        }
+    }
+
+    auto changed_keys = std::vector<tr_quark>{};
+    for (auto* tor : torrents)
+    {
+        if (auto const* const fields = getTorrentFieldsToSend(tor, format, *keys, cursor, changed_keys); fields != nullptr)
+        {
+            addTorrentInfo(tor, format, tr_variantListAdd(list), std::data(*fields), std::size(*fields));
+        }
+    }
+
+    return nullptr;
+}
+
+/* torrentGet(), written straight into the response's JSON */
+static char const* torrentGetJson(tr_session* session, tr_variant* args_in, tr_json_writer& args_out)
+{
+    auto const torrents = getTorrents(session, args_in);
+    auto const format = getTorrentGetFormat(args_in);
+    auto const cursor = getTorrentGetCursor(session, args_in);
+
+    if (cursor)
+    {
+        args_out.addKey(TR_KEY_cursor);
+        args_out.addInt(cursor->next);
+    }
+
+    if (auto const removed = getRemovedTorrents(session, args_in, cursor); removed)
+    {
+        args_out.addKey(TR_KEY_removed);
+        args_out.beginArray();
+        for (auto const id : *removed)
+        {
+            args_out.addInt(id);
+        }
+        args_out.endArray();
+    }
+
+    auto const keys = getTorrentGetFields(args_in);
+
+    args_out.addKey(TR_KEY_torrents);
+    args_out.beginArray();
+
+    if (keys)
+    {
         if (format == TR_FORMAT_TABLE)
         {
             /* first entry is an array of property names */
-            tr_variant* names = tr_variantListAddList(list, keyCount);
-            for (size_t i = 0; i < keyCount; ++i)
+            args_out.beginArray();
+            for (auto const key : *keys)
             {
-                tr_variantListAddQuark(names, keys[i]);
+                args_out.addStr(tr_quark_get_string_view(key));
             }
+            args_out.endArray();
         }
 
+        auto changed_keys = std::vector<tr_quark>{};
         for (auto* tor : torrents)
         {
-            addTorrentInfo(tor, format, tr_variantListAdd(list), keys, keyCount);
+            if (auto const* const fields = getTorrentFieldsToSend(tor, format, *keys, cursor, changed_keys);
+                fields != nullptr)
+            {
+                addTorrentInfo(tor, format, args_out, std::data(*fields), std::size(*fields));
+            }
         }
-
-        tr_free(keys);
     }
 
-    return errmsg;
+    args_out.endArray();
+
+    return keys ? nullptr : "no fields specified";
 }
 
 /***
@@ -1758,6 +2035,11 @@ static char const* sessionSet(
         tr_sessionSetCacheLimit_MB(session, i);
     }
 
+    if (tr_variantDictFindInt(args_in, TR_KEY_open_file_limit, &i))
+    {
+        tr_sessionSetOpenFileLimit(session, i);
+    }
+
     if (tr_variantDictFindInt(args_in, TR_KEY_alt_speed_up, &i))
     {
         tr_sessionSetAltSpeed_KBps(session, TR_UP, i);
@@ -2037,6 +2319,15 @@ static char const* sessionStats(
     tr_variantDictAddInt(d, TR_KEY_sessionCount, currentStats.sessionCount);
     tr_variantDictAddInt(d, TR_KEY_uploadedBytes, currentStats.uploadedBytes);
 
+    auto fileStats = tr_open_file_stats{};
+    tr_fdGetFileStats(session, &fileStats);
+    d = tr_variantDictAddDict(args_out, TR_KEY_open_file_stats, 5);
+    tr_variantDictAddInt(d, TR_KEY_evictions, fileStats.evictions);
+    tr_variantDictAddInt(d, TR_KEY_hits, fileStats.hits);
+    tr_variantDictAddInt(d, TR_KEY_misses, fileStats.misses);
+    tr_variantDictAddInt(d, TR_KEY_openFileLimit, fileStats.limit);
+    tr_variantDictAddInt(d, TR_KEY_openFiles, fileStats.open_files);
+
     return nullptr;
 }
 
@@ -2099,6 +2390,10 @@ static void addSessionField(tr_session* s, tr_variant* d, tr_quark key)
         tr_variantDictAddInt(d, key, tr_sessionGetCacheLimit_MB(s));
         break;
 
+    case TR_KEY_open_file_limit:
+        tr_variantDictAddInt(d, key, tr_sessionGetOpenFileLimit(s));
+        break;
+
     case TR_KEY_blocklist_size:
         tr_variantDictAddInt(d, key, tr_blocklistGetRuleCount(s));
         break;
@@ -2281,17 +2576,21 @@ static void addSessionField(tr_session* s, tr_variant* d, tr_quark key)
     }
 }
 
-static char const* sessionGet(tr_session* s, tr_variant* args_in, tr_variant* args_out, tr_rpc_idle_data* /*idle_data*/)
+/* the keys in session-get's "fields" argument, or every key if it has none */
+static std::vector<tr_quark> getSessionGetFields(tr_variant* args_in)
 {
+    auto keys = std::vector<tr_quark>{};
+
     tr_variant* fields = nullptr;
     if (tr_variantDictFindList(args_in, TR_KEY_fields, &fields))
     {
         size_t const field_count = tr_variantListSize(fields);
+        keys.reserve(field_count);
 
         for (size_t i = 0; i < field_count; ++i)
         {
             auto field_name = std::string_view{};
-            if (tr_variantGetStrView(tr_variantListChild(fields, i), &field_name))
+            if (!tr_variantGetStrView(tr_variantListChild(fields, i), &field_name))
             {
                 continue;
             }
@@ -2299,18 +2598,56 @@ static char const* sessionGet(tr_session* s, tr_variant* args_in, tr_variant* ar
             auto const field_id = tr_quark_lookup(field_name);
             if (field_id)
             {
-                addSessionField(s, args_out, *field_id);
+                keys.push_back(*field_id);
             }
         }
     }
     else
     {
+        keys.reserve(TR_N_KEYS);
+
         for (tr_quark field_id = TR_KEY_NONE + 1; field_id < TR_N_KEYS; ++field_id)
         {
-            addSessionField(s, args_out, field_id);
+            keys.push_back(field_id);
         }
     }
 
+    return keys;
+}
+
+static char const* sessionGet(tr_session* s, tr_variant* args_in, tr_variant* args_out, tr_rpc_idle_data* /*idle_data*/)
+{
+    for (auto const key : getSessionGetFields(args_in))
+    {
+        addSessionField(s, args_out, key);
+    }
+
+    return nullptr;
+}
+
+/* sessionGet(), written straight into the response's JSON */
+static char const* sessionGetJson(tr_session* s, tr_variant* args_in, tr_json_writer& args_out)
+{
+    /* build each field in a scratch dict, write it, and remove it again,
+       so that the fields are shared with the tr_variant path */
+    auto scratch = tr_variant{};
+    tr_variantInitDict(&scratch, 1);
+
+    for (auto const key : getSessionGetFields(args_in))
+    {
+        addSessionField(s, &scratch, key);
+
+        auto child_key = tr_quark{};
+        tr_variant* child = nullptr;
+        if (tr_variantDictChild(&scratch, 0, &child_key, &child))
+        {
+            args_out.addKey(child_key);
+            args_out.addVariant(*child);
+            tr_variantDictRemove(&scratch, child_key);
+        }
+    }
+
+    tr_variantFree(&scratch);
     return nullptr;
 }
 
@@ -2366,42 +2703,52 @@ static char const* sessionClose(
 
 using handler = char const* (*)(tr_session*, tr_variant*, tr_variant*, struct tr_rpc_idle_data*);
 
+/* immediate handlers that can also write their response straight into JSON */
+using json_handler = char const* (*)(tr_session*, tr_variant*, tr_json_writer&);
+
 struct rpc_method
 {
     std::string_view name;
     bool immediate;
     handler func;
+    json_handler json_func;
 };
 
 static auto constexpr Methods = std::array<rpc_method, 22>{ {
-    { "blocklist-update"sv, false, blocklistUpdate },
-    { "free-space"sv, true, freeSpace },
-    { "port-test"sv, false, portTest },
-    { "queue-move-bottom"sv, true, queueMoveBottom },
-    { "queue-move-down"sv, true, queueMoveDown },
-    { "queue-move-top"sv, true, queueMoveTop },
-    { "queue-move-up"sv, true, queueMoveUp },
-    { "session-close"sv, true, sessionClose },
-    { "session-get"sv, true, sessionGet },
-    { "session-set"sv, true, sessionSet },
-    { "session-stats"sv, true, sessionStats },
-    { "torrent-add"sv, false, torrentAdd },
-    { "torrent-get"sv, true, torrentGet },
-    { "torrent-reannounce"sv, true, torrentReannounce },
-    { "torrent-remove"sv, true, torrentRemove },
-    { "torrent-rename-path"sv, false, torrentRenamePath },
-    { "torrent-set"sv, true, torrentSet },
-    { "torrent-set-location"sv, true, torrentSetLocation },
-    { "torrent-start"sv, true, torrentStart },
-    { "torrent-start-now"sv, true, torrentStartNow },
-    { "torrent-stop"sv, true, torrentStop },
-    { "torrent-verify"sv, true, torrentVerify },
+    { "blocklist-update"sv, false, blocklistUpdate, nullptr },
+    { "free-space"sv, true, freeSpace, nullptr },
+    { "port-test"sv, false, portTest, nullptr },
+    { "queue-move-bottom"sv, true, queueMoveBottom, nullptr },
+    { "queue-move-down"sv, true, queueMoveDown, nullptr },
+    { "queue-move-top"sv, true, queueMoveTop, nullptr },
+    { "queue-move-up"sv, true, queueMoveUp, nullptr },
+    { "session-close"sv, true, sessionClose, nullptr },
+    { "session-get"sv, true, sessionGet, sessionGetJson },
+    { "session-set"sv, true, sessionSet, nullptr },
+    { "session-stats"sv, true, sessionStats, nullptr },
+    { "torrent-add"sv, false, torrentAdd, nullptr },
+    { "torrent-get"sv, true, torrentGet, torrentGetJson },
+    { "torrent-reannounce"sv, true, torrentReannounce, nullptr },
+    { "torrent-remove"sv, true, torrentRemove, nullptr },
+    { "torrent-rename-path"sv, false, torrentRenamePath, nullptr },
+    { "torrent-set"sv, true, torrentSet, nullptr },
+    { "torrent-set-location"sv, true, torrentSetLocation, nullptr },
+    { "torrent-start"sv, true, torrentStart, nullptr },
+    { "torrent-start-now"sv, true, torrentStartNow, nullptr },
+    { "torrent-stop"sv, true, torrentStop, nullptr },
+    { "torrent-verify"sv, true, torrentVerify, nullptr },
 } };
 
 static void noop_response_callback(tr_session* /*session*/, tr_variant* /*response*/, void* /*user_data*/)
 {
 }
 
+static rpc_method const* findMethod(std::string_view name)
+{
+    auto const it = std::find_if(std::begin(Methods), std::end(Methods), [&name](auto const& row) { return row.name == name; });
+    return it == std::end(Methods) ? nullptr : &*it;
+}
+
 void tr_rpc_request_exec_json(
     tr_session* session,
     tr_variant const* request,
@@ -2426,15 +2773,11 @@ void tr_rpc_request_exec_json(
     }
     else
     {
-        auto const it = std::find_if(std::begin(Methods), std::end(Methods), [&sv](auto const& row) { return row.name == sv; });
-        if (it == std::end(Methods))
+        method = findMethod(sv);
+        if (method == nullptr)
         {
             result = "method name not recognized";
         }
-        else
-        {
-            method = &*it;
-        }
     }
 
     /* if we couldn't figure out which method to use, return an error */
@@ -2505,6 +2848,70 @@ void tr_rpc_request_exec_json(
     }
 }
 
+struct tr_rpc_json_buf_data
+{
+    tr_rpc_response_json_func callback;
+    void* callback_user_data;
+};
+
+static void json_buf_response_func(tr_session* session, tr_variant* response, void* vdata)
+{
+    auto* const data = static_cast<tr_rpc_json_buf_data*>(vdata);
+    auto* const buf = tr_variantToBuf(response, TR_VARIANT_FMT_JSON_LEAN);
+    (*data->callback)(session, buf, data->callback_user_data);
+    evbuffer_free(buf);
+    delete data;
+}
+
+void tr_rpc_request_exec_json_buf(
+    tr_session* session,
+    tr_variant const* request,
+    tr_rpc_response_json_func callback,
+    void* callback_user_data)
+{
+    TR_ASSERT(callback != nullptr);
+
+    auto* const mutable_request = const_cast<tr_variant*>(request);
+
+    auto sv = std::string_view{};
+    auto const* const method = request != nullptr && tr_variantDictFindStrView(mutable_request, TR_KEY_method, &sv) ?
+        findMethod(sv) :
+        nullptr;
+
+    /* everything that can't be written straight to JSON goes through the tr_variant path */
+    if (method == nullptr || method->json_func == nullptr)
+    {
+        auto* const data = new tr_rpc_json_buf_data{ callback, callback_user_data };
+        tr_rpc_request_exec_json(session, request, json_buf_response_func, data);
+        return;
+    }
+
+    auto* const buf = evbuffer_new();
+    auto out = tr_json_writer{ buf };
+    out.beginObject();
+
+    out.addKey(TR_KEY_arguments);
+    out.beginObject();
+    char const* const result = (*method->json_func)(session, tr_variantDictFind(mutable_request, TR_KEY_arguments), out);
+    out.endObject();
+
+    out.addKey(TR_KEY_result);
+    out.addStr(result != nullptr ? result : "success");
+
+    auto tag = int64_t{};
+    if (tr_variantDictFindInt(mutable_request, TR_KEY_tag, &tag))
+    {
+        out.addKey(TR_KEY_tag);
+        out.addInt(tag);
+    }
+
+    out.endObject();
+    evbuffer_add(buf, "\n", 1);
+
+    (*callback)(session, buf, callback_user_data);
+    evbuffer_free(buf);
+}
+
 /**
  * Munge the URI into a usable form.
  *
@@ -17,10 +17,13 @@
 ****  RPC processing
 ***/
 
+struct evbuffer;
 struct tr_variant;
 
 using tr_rpc_response_func = void (*)(tr_session* session, tr_variant* response, void* user_data);
 
+using tr_rpc_response_json_func = void (*)(tr_session* session, struct evbuffer* response, void* user_data);
+
 /* http://www.json.org/ */
 void tr_rpc_request_exec_json(
     tr_session* session,
@@ -28,6 +31,18 @@ void tr_rpc_request_exec_json(
     tr_rpc_response_func callback,
     void* callback_user_data);
 
+/**
+ * Like tr_rpc_request_exec_json(), but the response is handed back already
+ * serialized as JSON. Methods whose responses can get big, like torrent-get
+ * and session-get, write them straight into the buffer instead of building
+ * a tr_variant tree first.
+ */
+void tr_rpc_request_exec_json_buf(
+    tr_session* session,
+    tr_variant const* request,
+    tr_rpc_response_json_func callback,
+    void* callback_user_data);
+
 /* see the RPC spec's "Request URI Notation" section */
 void tr_rpc_request_exec_uri(
     tr_session* session,
@@ -7,17 +7,22 @@
  */
 
 #include <algorithm> // std::partial_sort(), std::min(), std::max()
+#include <atomic>
 #include <cerrno> /* ENOENT */
 #include <climits> /* INT_MAX */
+#include <condition_variable>
 #include <csignal>
 #include <cstdint>
 #include <cstdlib>
 #include <ctime>
 #include <iterator> // std::back_inserter
-#include <list>
+#include <mutex>
 #include <numeric> // std::acumulate()
+#include <string>
 #include <string_view>
+#include <thread> // std::thread::hardware_concurrency()
 #include <unordered_set>
+#include <utility> // std::exchange()
 #include <vector>
 
 #ifndef _WIN32
@@ -38,6 +43,7 @@
 #include "blocklist.h"
 #include "cache.h"
 #include "crypto-utils.h"
+#include "disk-io.h"
 #include "error-types.h"
 #include "error.h"
 #include "fdlimit.h"
@@ -49,6 +55,8 @@
 #include "platform-quota.h" /* tr_device_info_free() */
 #include "platform.h" /* tr_getTorrentDir() */
 #include "port-forwarding.h"
+#include "resume-db.h"
+#include "resume.h"
 #include "rpc-server.h"
 #include "session-id.h"
 #include "session.h"
@@ -72,10 +80,18 @@ std::recursive_mutex tr_session::session_mutex_;
 
 #ifdef TR_LIGHTWEIGHT
 static auto constexpr DefaultCacheSizeMB = int{ 2 };
+static auto constexpr DefaultOpenFileLimit = int{ 32 };
 static auto constexpr DefaultPrefetchEnabled = bool{ false };
+static auto constexpr DefaultDiskIoThreads = int{ 2 };
+static auto constexpr DefaultVerifyThreads = int{ 1 };
+static auto constexpr LoadTorrentsWorkers = int{ 2 };
 #else
 static auto constexpr DefaultCacheSizeMB = int{ 4 };
+static auto constexpr DefaultOpenFileLimit = int{ 512 };
 static auto constexpr DefaultPrefetchEnabled = bool{ true };
+static auto constexpr DefaultDiskIoThreads = int{ 4 };
+static auto constexpr DefaultVerifyThreads = int{ 2 };
+static auto constexpr LoadTorrentsWorkers = int{ 8 };
 #endif
 static auto constexpr SaveIntervalSecs = int{ 360 };
 
@@ -325,11 +341,12 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
 {
     TR_ASSERT(tr_variantIsDict(d));
 
-    tr_variantDictReserve(d, 69);
+    tr_variantDictReserve(d, 77);
     tr_variantDictAddBool(d, TR_KEY_blocklist_enabled, false);
     tr_variantDictAddStrView(d, TR_KEY_blocklist_url, "http://www.example.com/blocklist"sv);
     tr_variantDictAddInt(d, TR_KEY_cache_size_mb, DefaultCacheSizeMB);
     tr_variantDictAddBool(d, TR_KEY_dht_enabled, true);
+    tr_variantDictAddInt(d, TR_KEY_disk_io_threads, DefaultDiskIoThreads);
     tr_variantDictAddBool(d, TR_KEY_utp_enabled, true);
     tr_variantDictAddBool(d, TR_KEY_lpd_enabled, false);
     tr_variantDictAddStr(d, TR_KEY_download_dir, tr_getDefaultDownloadDir());
@@ -341,6 +358,7 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
     tr_variantDictAddStr(d, TR_KEY_incomplete_dir, tr_getDefaultDownloadDir());
     tr_variantDictAddBool(d, TR_KEY_incomplete_dir_enabled, false);
     tr_variantDictAddInt(d, TR_KEY_message_level, TR_LOG_INFO);
+    tr_variantDictAddInt(d, TR_KEY_open_file_limit, DefaultOpenFileLimit);
     tr_variantDictAddInt(d, TR_KEY_download_queue_size, 5);
     tr_variantDictAddBool(d, TR_KEY_download_queue_enabled, true);
     tr_variantDictAddInt(d, TR_KEY_peer_limit_global, atoi(TR_DEFAULT_PEER_LIMIT_GLOBAL_STR));
@@ -355,13 +373,17 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
     tr_variantDictAddInt(d, TR_KEY_preallocation, TR_PREALLOCATE_SPARSE);
     tr_variantDictAddBool(d, TR_KEY_prefetch_enabled, DefaultPrefetchEnabled);
     tr_variantDictAddInt(d, TR_KEY_peer_id_ttl_hours, 6);
+    tr_variantDictAddInt(d, TR_KEY_webseed_connections, 4);
     tr_variantDictAddBool(d, TR_KEY_queue_stalled_enabled, true);
     tr_variantDictAddInt(d, TR_KEY_queue_stalled_minutes, 30);
     tr_variantDictAddReal(d, TR_KEY_ratio_limit, 2.0);
     tr_variantDictAddBool(d, TR_KEY_ratio_limit_enabled, false);
     tr_variantDictAddBool(d, TR_KEY_rename_partial_files, true);
+    tr_variantDictAddBool(d, TR_KEY_resume_db_enabled, false);
     tr_variantDictAddBool(d, TR_KEY_rpc_authentication_required, false);
     tr_variantDictAddStrView(d, TR_KEY_rpc_bind_address, "0.0.0.0");
+    tr_variantDictAddInt(d, TR_KEY_rpc_compression_level, Z_DEFAULT_COMPRESSION);
+    tr_variantDictAddInt(d, TR_KEY_rpc_compression_thread_threshold_kb, 1024);
     tr_variantDictAddBool(d, TR_KEY_rpc_enabled, false);
     tr_variantDictAddStrView(d, TR_KEY_rpc_password, "");
     tr_variantDictAddStrView(d, TR_KEY_rpc_username, "");
@@ -389,6 +411,8 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
     tr_variantDictAddBool(d, TR_KEY_speed_limit_up_enabled, false);
     tr_variantDictAddInt(d, TR_KEY_umask, 022);
     tr_variantDictAddInt(d, TR_KEY_upload_slots_per_torrent, 14);
+    tr_variantDictAddInt(d, TR_KEY_verify_io_limit_mb, 0);
+    tr_variantDictAddInt(d, TR_KEY_verify_threads, DefaultVerifyThreads);
     tr_variantDictAddStrView(d, TR_KEY_bind_address_ipv4, TR_DEFAULT_BIND_ADDRESS_IPV4);
     tr_variantDictAddStrView(d, TR_KEY_bind_address_ipv6, TR_DEFAULT_BIND_ADDRESS_IPV6);
     tr_variantDictAddBool(d, TR_KEY_start_added_torrents, true);
@@ -401,11 +425,12 @@ void tr_sessionGetSettings(tr_session const* s, tr_variant* d)
 {
     TR_ASSERT(tr_variantIsDict(d));
 
-    tr_variantDictReserve(d, 68);
+    tr_variantDictReserve(d, 76);
     tr_variantDictAddBool(d, TR_KEY_blocklist_enabled, s->useBlocklist());
     tr_variantDictAddStr(d, TR_KEY_blocklist_url, s->blocklistUrl());
     tr_variantDictAddInt(d, TR_KEY_cache_size_mb, tr_sessionGetCacheLimit_MB(s));
     tr_variantDictAddBool(d, TR_KEY_dht_enabled, s->isDHTEnabled);
+    tr_variantDictAddInt(d, TR_KEY_disk_io_threads, tr_sessionGetDiskIoThreads(s));
     tr_variantDictAddBool(d, TR_KEY_utp_enabled, s->isUTPEnabled);
     tr_variantDictAddBool(d, TR_KEY_lpd_enabled, s->isLPDEnabled);
     tr_variantDictAddStr(d, TR_KEY_download_dir, tr_sessionGetDownloadDir(s));
@@ -419,6 +444,7 @@ void tr_sessionGetSettings(tr_session const* s, tr_variant* d)
     tr_variantDictAddStr(d, TR_KEY_incomplete_dir, tr_sessionGetIncompleteDir(s));
     tr_variantDictAddBool(d, TR_KEY_incomplete_dir_enabled, tr_sessionIsIncompleteDirEnabled(s));
     tr_variantDictAddInt(d, TR_KEY_message_level, tr_logGetLevel());
+    tr_variantDictAddInt(d, TR_KEY_open_file_limit, tr_sessionGetOpenFileLimit(s));
     tr_variantDictAddInt(d, TR_KEY_peer_limit_global, s->peerLimit);
     tr_variantDictAddInt(d, TR_KEY_peer_limit_per_torrent, s->peerLimitPerTorrent);
     tr_variantDictAddInt(d, TR_KEY_peer_port, tr_sessionGetPeerPort(s));
@@ -432,13 +458,20 @@ void tr_sessionGetSettings(tr_session const* s, tr_variant* d)
     tr_variantDictAddInt(d, TR_KEY_preallocation, s->preallocationMode);
     tr_variantDictAddBool(d, TR_KEY_prefetch_enabled, s->isPrefetchEnabled);
     tr_variantDictAddInt(d, TR_KEY_peer_id_ttl_hours, s->peer_id_ttl_hours);
+    tr_variantDictAddInt(d, TR_KEY_webseed_connections, s->webseed_connections);
     tr_variantDictAddBool(d, TR_KEY_queue_stalled_enabled, tr_sessionGetQueueStalledEnabled(s));
     tr_variantDictAddInt(d, TR_KEY_queue_stalled_minutes, tr_sessionGetQueueStalledMinutes(s));
     tr_variantDictAddReal(d, TR_KEY_ratio_limit, s->desiredRatio);
     tr_variantDictAddBool(d, TR_KEY_ratio_limit_enabled, s->isRatioLimited);
     tr_variantDictAddBool(d, TR_KEY_rename_partial_files, tr_sessionIsIncompleteFileNamingEnabled(s));
+    tr_variantDictAddBool(d, TR_KEY_resume_db_enabled, s->resume_db != nullptr);
     tr_variantDictAddBool(d, TR_KEY_rpc_authentication_required, tr_sessionIsRPCPasswordEnabled(s));
     tr_variantDictAddStr(d, TR_KEY_rpc_bind_address, tr_sessionGetRPCBindAddress(s));
+    tr_variantDictAddInt(d, TR_KEY_rpc_compression_level, tr_rpcGetCompressionLevel(s->rpc_server_.get()));
+    tr_variantDictAddInt(
+        d,
+        TR_KEY_rpc_compression_thread_threshold_kb,
+        tr_rpcGetCompressionThreadThresholdKB(s->rpc_server_.get()));
     tr_variantDictAddBool(d, TR_KEY_rpc_enabled, tr_sessionIsRPCEnabled(s));
     tr_variantDictAddStr(d, TR_KEY_rpc_password, tr_sessionGetRPCPassword(s));
     tr_variantDictAddInt(d, TR_KEY_rpc_port, tr_sessionGetRPCPort(s));
@@ -464,6 +497,8 @@ void tr_sessionGetSettings(tr_session const* s, tr_variant* d)
     tr_variantDictAddBool(d, TR_KEY_speed_limit_up_enabled, tr_sessionIsSpeedLimited(s, TR_UP));
     tr_variantDictAddInt(d, TR_KEY_umask, s->umask);
     tr_variantDictAddInt(d, TR_KEY_upload_slots_per_torrent, s->uploadSlotsPerTorrent);
+    tr_variantDictAddInt(d, TR_KEY_verify_io_limit_mb, tr_sessionGetVerifyIoLimit_MB(s));
+    tr_variantDictAddInt(d, TR_KEY_verify_threads, tr_sessionGetVerifyThreads(s));
     tr_variantDictAddStr(d, TR_KEY_bind_address_ipv4, tr_address_to_string(&s->bind_ipv4->addr));
     tr_variantDictAddStr(d, TR_KEY_bind_address_ipv6, tr_address_to_string(&s->bind_ipv6->addr));
     tr_variantDictAddBool(d, TR_KEY_start_added_torrents, !tr_sessionGetPaused(s));
@@ -603,10 +638,14 @@ tr_session* tr_sessionInit(char const* config_dir, bool messageQueuingEnabled, t
     session->udp_socket = TR_BAD_SOCKET;
     session->udp6_socket = TR_BAD_SOCKET;
     session->cache = tr_cacheNew(1024 * 1024 * 2);
+    session->disk_io = tr_diskIoNew(session, DefaultDiskIoThreads);
+    session->resume_writer = tr_resumeWriterNew(session);
+    session->verifier = tr_verifierNew();
     session->magicNumber = SESSION_MAGIC_NUMBER;
     session->session_id = tr_session_id_new();
     session->bandwidth = new Bandwidth(nullptr);
     session->removed_torrents.clear();
+    session->change_seq = uint64_t(tr_time()) << 20;
 
     /* nice to start logging at the very beginning */
     auto i = int64_t{};
@@ -770,6 +809,43 @@ static void tr_sessionInitImpl(void* vdata)
 static void turtleBootstrap(tr_session*, struct tr_turtle_info*);
 static void setPeerPort(tr_session* session, tr_port port);
 
+static void setResumeDbEnabled(tr_session* session, bool enabled)
+{
+    auto const filename = tr_strvPath(session->config_dir, "resume.db"sv);
+
+    // the queued writes hold on to the db that was in use when they were queued
+    tr_resumeWriterFlush(session->resume_writer);
+
+    if (enabled)
+    {
+        // torrents that aren't in the db yet will still load from their .resume files
+        if (session->resume_db == nullptr)
+        {
+            session->resume_db = tr_resumeDbOpen(filename);
+        }
+
+        return;
+    }
+
+    // when the db is turned off, write it back out as .resume files
+    auto* db = std::exchange(session->resume_db, nullptr);
+    if (db == nullptr && tr_sys_path_exists(filename.c_str(), nullptr))
+    {
+        db = tr_resumeDbOpen(filename);
+    }
+
+    if (db != nullptr)
+    {
+        auto const exported = tr_resumeDbExport(db, session->resume_dir);
+        tr_resumeDbClose(db);
+
+        if (exported)
+        {
+            tr_sys_path_remove(filename.c_str(), nullptr);
+        }
+    }
+}
+
 static void sessionSetImpl(void* vdata)
 {
     auto* data = static_cast<struct init_data*>(vdata);
@@ -872,6 +948,11 @@ static void sessionSetImpl(void* vdata)
         session->peer_id_ttl_hours = i;
     }
 
+    if (tr_variantDictFindInt(settings, TR_KEY_webseed_connections, &i))
+    {
+        session->webseed_connections = size_t(std::max(i, int64_t{ 1 }));
+    }
+
     /* torrent queues */
     if (tr_variantDictFindInt(settings, TR_KEY_queue_stalled_minutes, &i))
     {
@@ -914,6 +995,26 @@ static void sessionSetImpl(void* vdata)
         session->preallocationMode = tr_preallocation_mode(i);
     }
 
+    if (tr_variantDictFindBool(settings, TR_KEY_resume_db_enabled, &boolVal))
+    {
+        setResumeDbEnabled(session, boolVal);
+    }
+
+    if (tr_variantDictFindInt(settings, TR_KEY_verify_threads, &i))
+    {
+        tr_sessionSetVerifyThreads(session, i);
+    }
+
+    if (tr_variantDictFindInt(settings, TR_KEY_disk_io_threads, &i))
+    {
+        tr_sessionSetDiskIoThreads(session, i);
+    }
+
+    if (tr_variantDictFindInt(settings, TR_KEY_verify_io_limit_mb, &i))
+    {
+        tr_sessionSetVerifyIoLimit_MB(session, i);
+    }
+
     if (tr_variantDictFindStrView(settings, TR_KEY_download_dir, &sv))
     {
         session->setDownloadDir(sv);
@@ -992,6 +1093,11 @@ static void sessionSetImpl(void* vdata)
         session->peerLimit = i;
     }
 
+    if (tr_variantDictFindInt(settings, TR_KEY_open_file_limit, &i))
+    {
+        tr_sessionSetOpenFileLimit(session, i);
+    }
+
     /**
     **/
 
@@ -1860,6 +1966,16 @@ static void sessionCloseImplStart(tr_session* session)
 
     torrents.clear();
 
+    /* the torrents queued their resume data while closing */
+    tr_resumeWriterFree(session->resume_writer);
+    session->resume_writer = nullptr;
+
+    if (session->resume_db != nullptr)
+    {
+        tr_resumeDbClose(session->resume_db);
+        session->resume_db = nullptr;
+    }
+
     /* Close the announcer *after* closing the torrents
        so that all the &event=stopped messages will be
        queued to be sent by tr_announcerClose() */
@@ -1872,6 +1988,12 @@ static void sessionCloseImplStart(tr_session* session)
     tr_cacheFree(session->cache);
     session->cache = nullptr;
 
+    tr_diskIoFree(session->disk_io);
+    session->disk_io = nullptr;
+
+    tr_verifierFree(session->verifier);
+    session->verifier = nullptr;
+
     /* saveTimer is not used at this point, reusing for UDP shutdown wait */
     TR_ASSERT(session->saveTimer == nullptr);
     session->saveTimer = evtimer_new(session->event_base, sessionCloseImplWaitForIdleUdp, session);
@@ -2006,88 +2128,168 @@ void tr_sessionClose(tr_session* session)
     delete session;
 }
 
+/***
+****  Loading the torrents in the torrents dir at startup.
+****
+****  Reading and parsing the .torrent and .resume files is the slow part,
+****  so worker threads do that while the event thread adds the torrents
+****  that are ready, one batch at a time and in directory order.
+***/
+
+static auto constexpr LoadTorrentsBatchSize = size_t{ 256 };
+
 struct sessionLoadTorrentsData
 {
-    tr_session* session;
-    tr_ctor* ctor;
-    int* setmeCount;
-    tr_torrent** torrents;
-    bool done;
+    tr_session* session = nullptr;
+    tr_ctor* ctor = nullptr;
+
+    std::vector<std::string> filenames;
+
+    // filled in by the workers; nullptr if the file wasn't a valid torrent
+    std::vector<tr_torrent_preload*> preloads;
+    std::atomic<size_t> next_preload = 0;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<size_t> n_preloaded; // per batch
+    size_t n_batches_added = 0;
+    int n_workers = 0;
+
+    // only touched by the event thread until every batch has been added
+    std::vector<tr_torrent*> torrents;
+
+    [[nodiscard]] size_t batchSize(size_t batch) const
+    {
+        return std::min(LoadTorrentsBatchSize, std::size(filenames) - batch * LoadTorrentsBatchSize);
+    }
 };
 
-static void sessionLoadTorrents(void* vdata)
+static std::vector<std::string> getTorrentFilenames(tr_session const* session)
 {
-    auto* data = static_cast<struct sessionLoadTorrentsData*>(vdata);
-    TR_ASSERT(tr_isSession(data->session));
-
-    tr_ctorSetSave(data->ctor, false); /* since we already have them */
+    auto filenames = std::vector<std::string>{};
 
     tr_sys_path_info info;
-    char const* const dirname = tr_getTorrentDir(data->session);
+    char const* const dirname = tr_getTorrentDir(session);
     tr_sys_dir_t odir = (tr_sys_path_get_info(dirname, 0, &info, nullptr) && info.type == TR_SYS_PATH_IS_DIRECTORY) ?
         tr_sys_dir_open(dirname, nullptr) :
         TR_BAD_SYS_DIR;
 
-    auto torrents = std::list<tr_torrent*>{};
     if (odir != TR_BAD_SYS_DIR)
     {
         auto const dirname_sv = std::string_view{ dirname };
-        auto path = std::string{};
 
         char const* name = nullptr;
         while ((name = tr_sys_dir_read_name(odir, nullptr)) != nullptr)
         {
-            if (!tr_str_has_suffix(name, ".torrent"))
-            {
-                continue;
-            }
-
-            tr_buildBuf(path, dirname_sv, "/", name);
-            tr_ctorSetMetainfoFromFile(data->ctor, path.c_str(), nullptr);
-            if (tr_torrent* const tor = tr_torrentNew(data->ctor, nullptr); tor != nullptr)
+            if (tr_str_has_suffix(name, ".torrent"))
             {
-                torrents.push_back(tor);
+                tr_buildBuf(filenames.emplace_back(), dirname_sv, "/", name);
             }
         }
 
         tr_sys_dir_close(odir, nullptr);
     }
 
-    int const n = std::size(torrents);
-    data->torrents = tr_new(tr_torrent*, n);
-    std::copy(std::begin(torrents), std::end(torrents), data->torrents);
+    return filenames;
+}
 
-    if (n != 0)
+static void loadTorrentsWorkerFunc(void* vdata)
+{
+    auto* const data = static_cast<sessionLoadTorrentsData*>(vdata);
+    auto const n = std::size(data->filenames);
+
+    for (auto i = data->next_preload++; i < n; i = data->next_preload++)
     {
-        tr_logAddInfo(_("Loaded %d torrents"), n);
+        data->preloads[i] = tr_torrentPreload(data->session, data->filenames[i].c_str());
+
+        auto const lock = std::lock_guard(data->mutex);
+        auto const batch = i / LoadTorrentsBatchSize;
+        if (++data->n_preloaded[batch] == data->batchSize(batch))
+        {
+            data->cv.notify_all();
+        }
     }
 
-    if (data->setmeCount != nullptr)
+    auto const lock = std::lock_guard(data->mutex);
+    --data->n_workers;
+    data->cv.notify_all();
+}
+
+static void addPreloadedTorrents(void* vdata)
+{
+    auto* const data = static_cast<sessionLoadTorrentsData*>(vdata);
+
+    // batches are posted in order, so this is always the next one
+    auto const begin = data->n_batches_added * LoadTorrentsBatchSize;
+    auto const end = begin + data->batchSize(data->n_batches_added);
+
+    for (auto i = begin; i < end; ++i)
     {
-        *data->setmeCount = n;
+        if (auto* const preload = std::exchange(data->preloads[i], nullptr); preload != nullptr)
+        {
+            if (auto* const tor = tr_torrentNewPreloaded(data->ctor, preload); tor != nullptr)
+            {
+                data->torrents.push_back(tor);
+            }
+        }
     }
 
-    data->done = true;
+    auto const lock = std::lock_guard(data->mutex);
+    ++data->n_batches_added;
+    data->cv.notify_all();
 }
 
 tr_torrent** tr_sessionLoadTorrents(tr_session* session, tr_ctor* ctor, int* setmeCount)
 {
-    struct sessionLoadTorrentsData data;
+    TR_ASSERT(tr_isSession(session));
+    TR_ASSERT(!tr_amInEventThread(session));
+
+    tr_ctorSetSave(ctor, false); /* since we already have them */
 
+    auto data = sessionLoadTorrentsData{};
     data.session = session;
     data.ctor = ctor;
-    data.setmeCount = setmeCount;
-    data.torrents = nullptr;
-    data.done = false;
+    data.filenames = getTorrentFilenames(session);
 
-    tr_runInEventThread(session, sessionLoadTorrents, &data);
+    auto const n_files = std::size(data.filenames);
+    auto const n_batches = (n_files + LoadTorrentsBatchSize - 1) / LoadTorrentsBatchSize;
+    data.preloads.resize(n_files);
+    data.n_preloaded.resize(n_batches);
 
-    while (!data.done)
+    auto const n_cpus = std::max(1U, std::thread::hardware_concurrency());
+    data.n_workers = std::min({ int(n_cpus), LoadTorrentsWorkers, int(n_files) });
+    for (int i = 0, n = data.n_workers; i < n; ++i)
     {
-        tr_wait_msec(100);
+        tr_threadNew(loadTorrentsWorkerFunc, &data);
+    }
+
+    // hand each batch to the event thread as soon as it's been preloaded,
+    // so that it adds batch N while the workers are still reading batch N+1
+    auto lock = std::unique_lock(data.mutex);
+    for (size_t batch = 0; batch < n_batches; ++batch)
+    {
+        data.cv.wait(lock, [&data, batch]() { return data.n_preloaded[batch] == data.batchSize(batch); });
+        tr_runInEventThread(session, addPreloadedTorrents, &data);
+    }
+
+    data.cv.wait(lock, [&data, n_batches]() { return data.n_workers == 0 && data.n_batches_added == n_batches; });
+    lock.unlock();
+
+    int const n = std::size(data.torrents);
+    auto** const torrents = tr_new(tr_torrent*, n);
+    std::copy(std::begin(data.torrents), std::end(data.torrents), torrents);
+
+    if (n != 0)
+    {
+        tr_logAddInfo(_("Loaded %d torrents"), n);
+    }
+
+    if (setmeCount != nullptr)
+    {
+        *setmeCount = n;
     }
 
-    return data.torrents;
+    return torrents;
 }
 
 /***
@@ -2245,6 +2447,66 @@ int tr_sessionGetCacheLimit_MB(tr_session const* session)
     return tr_toMemMB(tr_cacheGetLimit(session->cache));
 }
 
+void tr_sessionSetOpenFileLimit(tr_session* session, int limit)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    tr_fdSetFileLimit(session, size_t(std::max(limit, 1)));
+}
+
+int tr_sessionGetOpenFileLimit(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return int(tr_fdGetFileLimit(session));
+}
+
+/***
+****
+***/
+
+void tr_sessionSetDiskIoThreads(tr_session* session, int n)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    tr_diskIoSetThreadCount(session->disk_io, n);
+}
+
+int tr_sessionGetDiskIoThreads(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return tr_diskIoGetThreadCount(session->disk_io);
+}
+
+void tr_sessionSetVerifyThreads(tr_session* session, int n)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    tr_verifySetThreadCount(session, n);
+}
+
+int tr_sessionGetVerifyThreads(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return tr_verifyGetThreadCount(session);
+}
+
+void tr_sessionSetVerifyIoLimit_MB(tr_session* session, int mb)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    tr_verifySetSpeedLimit(session, tr_toMemBytes(std::max(mb, 0)));
+}
+
+int tr_sessionGetVerifyIoLimit_MB(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return tr_toMemMB(tr_verifyGetSpeedLimit(session));
+}
+
 /***
 ****
 ***/
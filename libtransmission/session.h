@@ -15,6 +15,7 @@
 #define TR_NAME "Transmission"
 
 #include <array>
+#include <atomic>
 #include <cstddef> // size_t
 #include <cstdint> // uintX_t
 #include <ctime>
@@ -24,6 +25,7 @@
 #include <mutex>
 #include <string>
 #include <string_view>
+#include <tuple>
 #include <unordered_set>
 #include <vector>
 
@@ -54,7 +56,11 @@ struct tr_announcer_udp;
 struct tr_bindsockets;
 struct tr_blocklistFile;
 struct tr_cache;
+struct tr_disk_io;
 struct tr_fdInfo;
+struct tr_resume_db;
+struct tr_resume_writer;
+struct tr_verifier;
 
 struct tr_turtle_info
 {
@@ -261,8 +267,21 @@ public:
 
     uint8_t peer_id_ttl_hours;
 
-    // torrent id, time removed
-    std::vector<std::pair<int, time_t>> removed_torrents;
+    /* how many range requests each webseed can have running at once */
+    size_t webseed_connections = 4;
+
+    // torrent id, time removed, change sequence number when removed
+    std::vector<std::tuple<int, time_t, uint64_t>> removed_torrents;
+
+    /* bumped whenever a torrent's RPC fields change; see tr_torrent::markFieldsChanged().
+     * Seeded from the clock at startup so that it keeps increasing across restarts
+     * and cursors that RPC clients kept from an earlier run stay meaningful. */
+    std::atomic<uint64_t> change_seq{};
+
+    uint64_t nextChangeSeq()
+    {
+        return ++change_seq;
+    }
 
     bool stalledEnabled;
     bool queueEnabled[2];
@@ -325,12 +344,22 @@ public:
     std::string resume_dir;
     std::string torrent_dir;
 
+    /* if the resume-db-enabled setting is on, where .resume data is saved instead of resume_dir */
+    struct tr_resume_db* resume_db = nullptr;
+
+    /* writes resume data in the background */
+    struct tr_resume_writer* resume_writer = nullptr;
+
     std::list<tr_blocklistFile*> blocklists;
     struct tr_peerMgr* peerMgr;
     struct tr_shared* shared;
 
     struct tr_cache* cache;
 
+    struct tr_disk_io* disk_io = nullptr;
+
+    struct tr_verifier* verifier = nullptr;
+
     struct tr_web* web;
 
     struct tr_session_id* session_id;
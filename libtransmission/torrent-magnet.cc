@@ -316,7 +316,7 @@ void tr_torrentSetMetadataPiece(tr_torrent* tor, int piece, void const* data, in
                         /* save the new .torrent file */
                         tr_variantToFile(&newMetainfo, TR_VARIANT_FMT_BENC, tor->torrentFile());
                         tr_torrentGotNewInfoDict(tor);
-                        tor->setDirty();
+                        tor->setDirty(TR_DIRTY_ALL);
                     }
 
                     tr_variantFree(&newMetainfo);
@@ -21,6 +21,7 @@
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <utility> /* std::move() */
 #include <vector>
 
 #ifndef _WIN32
@@ -196,7 +197,7 @@ void tr_torrent::setSpeedLimitBps(tr_direction dir, unsigned int Bps)
 
     if (this->bandwidth->setDesiredSpeedBytesPerSecond(dir, Bps))
     {
-        this->setDirty();
+        this->setDirty(TR_DIRTY_SETTINGS);
     }
 }
 
@@ -227,7 +228,7 @@ void tr_torrentUseSpeedLimit(tr_torrent* tor, tr_direction dir, bool do_use)
 
     if (tor->bandwidth->setLimited(dir, do_use))
     {
-        tor->setDirty();
+        tor->setDirty(TR_DIRTY_SETTINGS);
     }
 }
 
@@ -244,7 +245,7 @@ void tr_torrentUseSessionLimits(tr_torrent* tor, bool doUse)
 
     if (tor->bandwidth->honorParentLimits(TR_UP, doUse) || tor->bandwidth->honorParentLimits(TR_DOWN, doUse))
     {
-        tor->setDirty();
+        tor->setDirty(TR_DIRTY_SETTINGS);
     }
 }
 
@@ -268,7 +269,7 @@ void tr_torrentSetRatioMode(tr_torrent* tor, tr_ratiolimit mode)
     {
         tor->ratioLimitMode = mode;
 
-        tor->setDirty();
+        tor->setDirty(TR_DIRTY_SETTINGS);
     }
 }
 
@@ -287,7 +288,7 @@ void tr_torrentSetRatioLimit(tr_torrent* tor, double desiredRatio)
     {
         tor->desiredRatio = desiredRatio;
 
-        tor->setDirty();
+        tor->setDirty(TR_DIRTY_SETTINGS);
     }
 }
 
@@ -385,7 +386,7 @@ void tr_torrentSetIdleMode(tr_torrent* tor, tr_idlelimit mode)
     {
         tor->idleLimitMode = mode;
 
-        tor->setDirty();
+        tor->setDirty(TR_DIRTY_SETTINGS);
     }
 }
 
@@ -404,7 +405,7 @@ void tr_torrentSetIdleLimit(tr_torrent* tor, uint16_t idleMinutes)
     {
         tor->idleLimitMinutes = idleMinutes;
 
-        tor->setDirty();
+        tor->setDirty(TR_DIRTY_SETTINGS);
     }
 }
 
@@ -507,10 +508,13 @@ static void tr_torrentClearError(tr_torrent* tor)
     tor->error = TR_STAT_OK;
     tor->error_announce_url.clear();
     tor->error_string.clear();
+    tor->markFieldsChanged(TR_FIELDS_ACTIVITY);
 }
 
 static void onTrackerResponse(tr_torrent* tor, tr_tracker_event const* event, void* /*user_data*/)
 {
+    tor->markFieldsChanged(TR_FIELDS_TRACKERS);
+
     switch (event->messageType)
     {
     case TR_TRACKER_PEERS:
@@ -531,12 +535,14 @@ static void onTrackerResponse(tr_torrent* tor, tr_tracker_event const* event, vo
         tor->error = TR_STAT_TRACKER_WARNING;
         tor->error_announce_url = event->announce_url;
         tor->error_string = event->text;
+        tor->markFieldsChanged(TR_FIELDS_ACTIVITY);
         break;
 
     case TR_TRACKER_ERROR:
         tor->error = TR_STAT_TRACKER_ERROR;
         tor->error_announce_url = event->announce_url;
         tor->error_string = event->text;
+        tor->markFieldsChanged(TR_FIELDS_ACTIVITY);
         break;
 
     case TR_TRACKER_ERROR_CLEAR:
@@ -655,7 +661,7 @@ static void migrateFile(
     }
 }
 
-static void torrentInit(tr_torrent* tor, tr_ctor const* ctor)
+static void torrentInit(tr_torrent* tor, tr_ctor const* ctor, tr_resume_preload* resume)
 {
     static auto next_unique_id = int{ 1 };
     auto const lock = tor->unique_lock();
@@ -700,14 +706,20 @@ static void torrentInit(tr_torrent* tor, tr_ctor const* ctor)
     tor->addedDate = now; // this is a default that will be overwritten by the resume file
     tor->anyDate = now;
 
+    // everything about a new torrent is news to RPC clients
+    for (int i = 0; i < TR_N_FIELD_GROUPS; ++i)
+    {
+        tor->markFieldsChanged(tr_field_group(i));
+    }
+
     // tr_torrentLoadResume() calls a lot of tr_torrentSetFoo() methods
     // that set things as dirty, but... these settings being loaded are
     // the same ones that would be saved back again, so don't let them
     // affect the 'is dirty' flag.
-    auto const was_dirty = tor->isDirty;
+    auto const was_dirty = tor->dirty_fields.load();
     bool didRenameResumeFileToHashOnlyName = false;
-    auto const loaded = tr_torrentLoadResume(tor, ~(uint64_t)0, ctor, &didRenameResumeFileToHashOnlyName);
-    tor->isDirty = was_dirty;
+    auto const loaded = tr_torrentLoadResume(tor, ~(uint64_t)0, ctor, &didRenameResumeFileToHashOnlyName, resume);
+    tor->dirty_fields = was_dirty;
 
     if (didRenameResumeFileToHashOnlyName)
     {
@@ -790,6 +802,33 @@ static void torrentInit(tr_torrent* tor, tr_ctor const* ctor)
     }
 }
 
+static tr_torrent* torrentNew(
+    tr_ctor const* ctor,
+    tr_metainfo_parsed& parsed,
+    tr_resume_preload* resume,
+    tr_torrent** setme_duplicate_of)
+{
+    auto* const session = tr_ctorGetSession(ctor);
+    TR_ASSERT(tr_isSession(session));
+
+    // is it a duplicate?
+    if (auto* const duplicate_of = session->getTorrent(parsed.info.infoHash()); duplicate_of != nullptr)
+    {
+        if (setme_duplicate_of != nullptr)
+        {
+            *setme_duplicate_of = duplicate_of;
+        }
+
+        return nullptr;
+    }
+
+    // add it
+    auto* const tor = new tr_torrent{ parsed.info };
+    tor->swapMetainfo(parsed);
+    torrentInit(tor, ctor, resume);
+    return tor;
+}
+
 tr_torrent* tr_torrentNew(tr_ctor const* ctor, tr_torrent** setme_duplicate_of)
 {
     TR_ASSERT(ctor != nullptr);
@@ -809,21 +848,54 @@ tr_torrent* tr_torrentNew(tr_ctor const* ctor, tr_torrent** setme_duplicate_of)
         return nullptr;
     }
 
-    // is it a duplicate?
-    if (auto* const duplicate_of = session->getTorrent(parsed->info.infoHash()); duplicate_of != nullptr)
+    return torrentNew(ctor, *parsed, nullptr, setme_duplicate_of);
+}
+
+struct tr_torrent_preload
+{
+    explicit tr_torrent_preload(tr_metainfo_parsed&& parsed_in)
+        : parsed{ std::move(parsed_in) }
     {
-        if (setme_duplicate_of != nullptr)
-        {
-            *setme_duplicate_of = duplicate_of;
-        }
+    }
+
+    tr_metainfo_parsed parsed;
+    tr_resume_preload resume;
+};
 
+tr_torrent_preload* tr_torrentPreload(tr_session const* session, char const* filename)
+{
+    auto contents = std::vector<char>{};
+    if (!tr_loadFile(contents, filename))
+    {
         return nullptr;
     }
 
-    // add it
-    auto* const tor = new tr_torrent{ parsed->info };
-    tor->swapMetainfo(*parsed);
-    torrentInit(tor, ctor);
+    auto top = tr_variant{};
+    auto const benc = std::string_view{ std::data(contents), std::size(contents) };
+    if (!tr_variantFromBuf(&top, TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE, benc, nullptr, nullptr))
+    {
+        return nullptr;
+    }
+    auto parsed = tr_metainfoParse(session, &top, nullptr);
+    tr_variantFree(&top);
+    if (!parsed)
+    {
+        return nullptr;
+    }
+
+    auto* const preload = new tr_torrent_preload{ std::move(*parsed) };
+    tr_torrentPreloadResume(&preload->resume, session, preload->parsed.info.name(), preload->parsed.info.infoHash());
+    return preload;
+}
+
+tr_torrent* tr_torrentNewPreloaded(tr_ctor const* ctor, tr_torrent_preload* preload)
+{
+    TR_ASSERT(ctor != nullptr);
+    TR_ASSERT(preload != nullptr);
+    TR_ASSERT(tr_amInEventThread(tr_ctorGetSession(ctor)));
+
+    auto* const tor = torrentNew(ctor, preload->parsed, &preload->resume, nullptr);
+    delete preload;
     return tor;
 }
 
@@ -839,7 +911,7 @@ void tr_torrentSetDownloadDir(tr_torrent* tor, char const* path)
     {
         tor->download_dir = path;
         tor->markEdited();
-        tor->setDirty();
+        tor->setDirty(TR_DIRTY_SETTINGS);
     }
 
     refreshCurrentDir(tor);
@@ -953,6 +1025,19 @@ static inline bool tr_torrentIsStalled(tr_torrent const* tor, int idle_secs)
     return tr_sessionGetQueueStalledEnabled(tor->session) && idle_secs > tr_sessionGetQueueStalledMinutes(tor->session) * 60;
 }
 
+void tr_torrentCheckStalled(tr_torrent* tor)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+
+    auto const is_stalled = tr_torrentIsStalled(tor, torrentGetIdleSecs(tor, tr_torrentGetActivity(tor)));
+
+    if (tor->isStalled != is_stalled)
+    {
+        tor->isStalled = is_stalled;
+        tor->markFieldsChanged(TR_FIELDS_ACTIVITY);
+    }
+}
+
 static double getVerifyProgress(tr_torrent const* tor)
 {
     return tor->verify_progress ? *tor->verify_progress : 0.0;
@@ -1238,7 +1323,7 @@ static void tr_torrentResetTransferStats(tr_torrent* tor)
     tor->corruptPrev += tor->corruptCur;
     tor->corruptCur = 0;
 
-    tor->setDirty();
+    tor->setDirty(TR_DIRTY_STATS);
 }
 
 /***
@@ -1383,7 +1468,7 @@ static void torrentStart(tr_torrent* tor, bool bypass_queue)
      * was missed to ensure that we didn't think someone was cheating. */
     tr_torrentUnsetPeerId(tor);
     tor->isRunning = true;
-    tor->setDirty();
+    tor->setDirty(TR_DIRTY_SETTINGS);
     tr_runInEventThread(tor->session, torrentStartImpl, tor);
 }
 
@@ -1468,6 +1553,9 @@ static void verifyTorrent(void* vdata)
         /* if the torrent's already being verified, stop it */
         tr_verifyRemove(tor);
 
+        /* verifying re-tests every piece, so forget about earlier tests */
+        tor->piece_checks.clear();
+
         bool const startAfter = (tor->isRunning || tor->startAfterVerify) && !tor->isStopping;
 
         if (tor->isRunning)
@@ -1502,10 +1590,9 @@ void tr_torrentSave(tr_torrent* tor)
 {
     TR_ASSERT(tr_isTorrent(tor));
 
-    if (tor->isDirty)
+    if (auto const dirty = tor->dirty_fields.exchange(0); dirty != 0)
     {
-        tor->isDirty = false;
-        tr_torrentSaveResume(tor);
+        tr_torrentSaveResume(tor, dirty);
     }
 }
 
@@ -1553,7 +1640,7 @@ void tr_torrentStop(tr_torrent* tor)
         tor->isRunning = false;
         tor->isStopping = false;
         tor->prefetchMagnetMetadata = false;
-        tor->setDirty();
+        tor->setDirty(TR_DIRTY_SETTINGS);
         tr_runInEventThread(tor->session, stopTorrent, tor);
     }
 }
@@ -1564,7 +1651,7 @@ static void closeTorrent(void* vtor)
 
     TR_ASSERT(tr_isTorrent(tor));
 
-    tor->session->removed_torrents.emplace_back(tor->uniqueId, tr_time());
+    tor->session->removed_torrents.emplace_back(tor->uniqueId, tr_time(), tor->session->nextChangeSeq());
 
     tr_logAddTorInfo(tor, "%s", _("Removing torrent"));
 
@@ -1787,6 +1874,11 @@ static void torrentCallScript(tr_torrent const* tor, char const* script)
     }
 }
 
+void tr_torrent::onWantedPiecesChanged()
+{
+    tr_peerMgrWantedPiecesChanged(this);
+}
+
 void tr_torrent::recheckCompleteness()
 {
     auto const lock = unique_lock();
@@ -1841,7 +1933,7 @@ void tr_torrent::recheckCompleteness()
             tr_torrentCheckSeedLimit(this);
         }
 
-        this->setDirty();
+        this->setDirty(TR_DIRTY_PROGRESS | TR_DIRTY_STATS);
 
         if (this->isDone())
         {
@@ -1894,7 +1986,7 @@ void tr_torrentSetLabels(tr_torrent* tor, tr_labels_t&& labels)
     auto const lock = tor->unique_lock();
 
     tor->labels = std::move(labels);
-    tor->setDirty();
+    tor->setDirty(TR_DIRTY_NAMES);
 }
 
 /***
@@ -1917,7 +2009,7 @@ void tr_torrentSetPriority(tr_torrent* tor, tr_priority_t priority)
     {
         tor->bandwidth->setPriority(priority);
 
-        tor->setDirty();
+        tor->setDirty(TR_DIRTY_PRIORITIES);
     }
 }
 
@@ -1933,7 +2025,7 @@ void tr_torrentSetPeerLimit(tr_torrent* tor, uint16_t maxConnectedPeers)
     {
         tor->maxConnectedPeers = maxConnectedPeers;
 
-        tor->setDirty();
+        tor->setDirty(TR_DIRTY_SETTINGS);
     }
 }
 
@@ -2333,6 +2425,7 @@ static void tr_torrentDeleteLocalData(tr_torrent* tor, tr_fileFunc func)
     tr_fdTorrentClose(tor->session, tor->uniqueId);
 
     deleteLocalData(tor, func);
+    tor->invalidateFileLocations();
 }
 
 /***
@@ -2436,6 +2529,7 @@ static void setLocationImpl(void* vdata)
         {
             tor->incomplete_dir.clear();
             tor->current_dir = tor->downloadDir();
+            tor->invalidateFileLocations();
         }
     }
 
@@ -2547,6 +2641,8 @@ static void tr_torrentFileCompleted(tr_torrent* tor, tr_file_index_t i)
                 tr_logAddTorErr(tor, "Error moving \"%s\" to \"%s\": %s", oldpath.c_str(), newpath.c_str(), error->message);
                 tr_error_free(error);
             }
+
+            tor->invalidateFileLocation(i);
         }
 
         tr_free(sub);
@@ -2578,7 +2674,7 @@ void tr_torrentGotBlock(tr_torrent* tor, tr_block_index_t block)
     if (block_is_new)
     {
         tor->completion.addBlock(block);
-        tor->setDirty();
+        tor->setDirty(TR_DIRTY_PROGRESS);
 
         tr_piece_index_t const p = tor->pieceForBlock(block);
 
@@ -2652,6 +2748,56 @@ std::optional<tr_torrent::tr_found_file_t> tr_torrent::findFile(std::string& fil
     return {};
 }
 
+bool tr_torrent::findFileCached(std::string& filename, tr_file_index_t i)
+{
+    if (std::size(file_locations_) != this->fileCount())
+    {
+        file_locations_.assign(this->fileCount(), FileLocation::Unknown);
+    }
+
+    auto const subpath = std::string_view{ this->fileSubpath(i) };
+
+    switch (file_locations_[i])
+    {
+    case FileLocation::DownloadDir:
+        tr_buildBuf(filename, this->downloadDir().sv(), "/"sv, subpath);
+        return true;
+
+    case FileLocation::DownloadDirPartial:
+        tr_buildBuf(filename, this->downloadDir().sv(), "/"sv, subpath, ".part"sv);
+        return true;
+
+    case FileLocation::IncompleteDir:
+        tr_buildBuf(filename, this->incompleteDir().sv(), "/"sv, subpath);
+        return true;
+
+    case FileLocation::IncompleteDirPartial:
+        tr_buildBuf(filename, this->incompleteDir().sv(), "/"sv, subpath, ".part"sv);
+        return true;
+
+    case FileLocation::Unknown:
+        break;
+    }
+
+    auto const found = this->findFile(filename, i);
+    if (!found)
+    {
+        return false;
+    }
+
+    auto const is_partial = std::size(found->subpath) != std::size(subpath);
+    if (found->base == this->downloadDir().sv())
+    {
+        file_locations_[i] = is_partial ? FileLocation::DownloadDirPartial : FileLocation::DownloadDir;
+    }
+    else
+    {
+        file_locations_[i] = is_partial ? FileLocation::IncompleteDirPartial : FileLocation::IncompleteDir;
+    }
+
+    return true;
+}
+
 // TODO: clients that call this should call tr_torrent::findFile() instead
 bool tr_torrentFindFile2(tr_torrent const* tor, tr_file_index_t fileNum, char const** base, char** subpath, time_t* mtime)
 {
@@ -2713,6 +2859,7 @@ static void refreshCurrentDir(tr_torrent* tor)
     TR_ASSERT(dir == tor->downloadDir() || dir == tor->incompleteDir());
 
     tor->current_dir = dir;
+    tor->invalidateFileLocations();
 }
 
 char* tr_torrentBuildPartial(tr_torrent const* tor, tr_file_index_t i)
@@ -2859,7 +3006,7 @@ static void torrentSetQueued(tr_torrent* tor, bool queued)
     {
         tor->is_queued = queued;
         tor->markChanged();
-        tor->setDirty();
+        tor->setDirty(TR_DIRTY_SETTINGS);
     }
 }
 
@@ -3041,7 +3188,7 @@ static void torrentRenamePath(void* vdata)
                 }
 
                 tor->markEdited();
-                tor->setDirty();
+                tor->setDirty(TR_DIRTY_NAMES);
             }
         }
     }
@@ -3117,11 +3264,45 @@ bool tr_torrentHasMetadata(tr_torrent const* tor)
 void tr_torrent::markEdited()
 {
     this->editDate = tr_time();
+    this->markFieldsChanged(TR_FIELDS_INFO);
 }
 
 void tr_torrent::markChanged()
 {
     this->anyDate = tr_time();
+    this->markFieldsChanged(TR_FIELDS_ACTIVITY);
+}
+
+void tr_torrent::setDirty(uint8_t fields)
+{
+    this->dirty_fields |= fields;
+
+    if ((fields & (TR_DIRTY_STATS | TR_DIRTY_SETTINGS | TR_DIRTY_PROGRESS)) != 0)
+    {
+        this->markFieldsChanged(TR_FIELDS_ACTIVITY);
+    }
+
+    if ((fields & (TR_DIRTY_SETTINGS | TR_DIRTY_PRIORITIES | TR_DIRTY_NAMES)) != 0)
+    {
+        this->markFieldsChanged(TR_FIELDS_SETTINGS);
+    }
+
+    if ((fields & TR_DIRTY_NAMES) != 0)
+    {
+        this->markFieldsChanged(TR_FIELDS_INFO);
+    }
+}
+
+void tr_torrent::markFieldsChanged(tr_field_group group)
+{
+    auto const seq = this->session->nextChangeSeq();
+    auto& changed_at = this->fields_changed_at[group];
+
+    /* if another thread marked this group at the same time, keep the newer of the two */
+    auto prev = changed_at.load();
+    while (prev < seq && !changed_at.compare_exchange_weak(prev, seq))
+    {
+    }
 }
 
 void tr_torrent::setDateActive(time_t t)
@@ -3143,4 +3324,5 @@ void tr_torrent::setName(std::string_view name)
 void tr_torrent::setFileSubpath(tr_file_index_t i, std::string_view subpath)
 {
     this->info.setFileSubpath(i, subpath);
+    this->invalidateFileLocation(i);
 }
@@ -12,8 +12,12 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <array>
+#include <atomic>
 #include <cstddef> // size_t
 #include <ctime>
+#include <map>
+#include <memory>
 #include <optional>
 #include <string>
 #include <string_view>
@@ -39,8 +43,11 @@ class tr_swarm;
 struct tr_error;
 struct tr_magnet_info;
 struct tr_metainfo_parsed;
+struct tr_piece_check;
+struct tr_resume_cache;
 struct tr_session;
 struct tr_torrent;
+struct tr_torrent_preload;
 struct tr_announcer_tiers;
 
 /**
@@ -65,6 +72,20 @@ tr_session* tr_ctorGetSession(tr_ctor const* ctor);
 
 bool tr_ctorGetIncompleteDir(tr_ctor const* ctor, char const** setmeIncompleteDir);
 
+/**
+***  Loading torrents in two steps: the slow part (reading and parsing
+***  the .torrent and .resume files) can run in any thread, and the
+***  rest runs in the event thread.
+**/
+
+/** Read and parse a .torrent file and its resume file. Safe to call from any thread.
+    Returns nullptr if the file can't be read or isn't a valid torrent. */
+tr_torrent_preload* tr_torrentPreload(tr_session const* session, char const* filename);
+
+/** Like tr_torrentNew(), but uses the metainfo and resume data from `preload`.
+    Must be called in the event thread. Takes ownership of `preload`. */
+tr_torrent* tr_torrentNewPreloaded(tr_ctor const* ctor, tr_torrent_preload* preload);
+
 /**
 ***
 **/
@@ -90,9 +111,36 @@ tr_block_span_t tr_torGetFileBlockSpan(tr_torrent const* tor, tr_file_index_t fi
 
 void tr_torrentCheckSeedLimit(tr_torrent* tor);
 
+/** isStalled follows the clock instead of an event, so poll it for RPC's torrent-get cursors */
+void tr_torrentCheckStalled(tr_torrent* tor);
+
 /** save a torrent's .resume file if it's changed since the last time it was saved */
 void tr_torrentSave(tr_torrent* tor);
 
+/* Groups of fields in a torrent's resume data that can be marked dirty
+ * separately, so that saving only rebuilds the groups that changed */
+enum : uint8_t
+{
+    TR_DIRTY_STATS = (1 << 0), /* transfer totals, dates, seeding & downloading time */
+    TR_DIRTY_SETTINGS = (1 << 1), /* limits, run state, download & incomplete dirs */
+    TR_DIRTY_PEERS = (1 << 2),
+    TR_DIRTY_PROGRESS = (1 << 3), /* checked pieces, file mtimes, blocks bitfield */
+    TR_DIRTY_PRIORITIES = (1 << 4), /* file priorities, wanted files, bandwidth priority */
+    TR_DIRTY_NAMES = (1 << 5), /* torrent name, file names, labels */
+    TR_DIRTY_ALL = (1 << 6) - 1
+};
+
+/* Groups of a torrent's RPC fields whose changes are tracked separately,
+ * so that polling clients can ask for only the fields that changed */
+enum tr_field_group : uint8_t
+{
+    TR_FIELDS_INFO, /* metainfo: name, files, piece size, webseeds */
+    TR_FIELDS_SETTINGS, /* limits, file priorities & wanted flags, labels, download dir */
+    TR_FIELDS_TRACKERS, /* tracker list, announce & scrape state */
+    TR_FIELDS_ACTIVITY, /* run state, transfer totals & rates, progress, errors, peer counts */
+    TR_N_FIELD_GROUPS
+};
+
 enum tr_verify_state
 {
     TR_VERIFY_NONE,
@@ -342,13 +390,15 @@ public:
     void setFilePriorities(tr_file_index_t const* files, tr_file_index_t fileCount, tr_priority_t priority)
     {
         file_priorities_.set(files, fileCount, priority);
-        setDirty();
+        onWantedPiecesChanged();
+        setDirty(TR_DIRTY_PRIORITIES);
     }
 
     void setFilePriority(tr_file_index_t file, tr_priority_t priority)
     {
         file_priorities_.set(file, priority);
-        setDirty();
+        onWantedPiecesChanged();
+        setDirty(TR_DIRTY_PRIORITIES);
     }
 
     /// LOCATION
@@ -404,6 +454,28 @@ public:
 
     std::optional<tr_found_file_t> findFile(std::string& filename, tr_file_index_t i) const;
 
+    /**
+     * Like findFile(), but remembers where each file was found so that
+     * looking it up again doesn't need to probe the filesystem.
+     * Only the path is returned, not the file's info.
+     * Must be called with the session lock held.
+     */
+    bool findFileCached(std::string& filename, tr_file_index_t i);
+
+    // forget where a file was found, e.g. because it's been moved or renamed
+    void invalidateFileLocation(tr_file_index_t i)
+    {
+        if (i < std::size(file_locations_))
+        {
+            file_locations_[i] = FileLocation::Unknown;
+        }
+    }
+
+    void invalidateFileLocations()
+    {
+        file_locations_.clear();
+    }
+
     /// METAINFO - TRACKERS
 
     [[nodiscard]] auto const& announceList() const
@@ -518,17 +590,28 @@ public:
     {
         TR_ASSERT(piece < this->pieceCount());
 
-        if (checked_pieces_.test(piece))
+        if (isPieceChecked(piece))
         {
             return true;
         }
 
         bool const checked = checkPiece(piece);
+        setPieceChecked(piece, checked);
+        return checked;
+    }
+
+    [[nodiscard]] bool isPieceChecked(tr_piece_index_t piece) const
+    {
+        return checked_pieces_.test(piece);
+    }
+
+    // record the result of a checksum test that was run outside of checkPiece()
+    void setPieceChecked(tr_piece_index_t piece, bool checked)
+    {
         this->markChanged();
-        this->setDirty();
+        this->setDirty(TR_DIRTY_PROGRESS);
 
         checked_pieces_.set(piece, checked);
-        return checked;
     }
 
     void initCheckedPieces(tr_bitfield const& checked, time_t const* mtimes /*fileCount()*/)
@@ -600,6 +683,7 @@ public:
         this->error = TR_STAT_LOCAL_ERROR;
         this->error_announce_url = TR_KEY_NONE;
         this->error_string = errmsg;
+        this->markFieldsChanged(TR_FIELDS_ACTIVITY);
     }
 
     void setVerifyState(tr_verify_state state);
@@ -614,6 +698,11 @@ public:
 
     tr_bitfield checked_pieces_ = tr_bitfield{ 0 };
 
+    // checksum tests of unchecked pieces that peers have asked for, so that
+    // each piece is only read and hashed once. Failed tests are kept until
+    // the torrent is verified. See peer-msgs.cc
+    std::map<tr_piece_index_t, std::shared_ptr<tr_piece_check>> piece_checks;
+
     tr_block_info block_info;
 
     // TODO(ckerr): make private once some of torrent.cc's `tr_torrentFoo()` methods are member functions
@@ -729,20 +818,35 @@ public:
     void (*queue_started_callback)(tr_torrent*, void* queue_started_user_data) = nullptr;
 
     bool isDeleting = false;
-    bool isDirty = false;
     bool is_queued = false;
     bool isRunning = false;
     bool isStopping = false;
+    bool isStalled = false; /* as of the last tr_torrentCheckStalled() */
     bool startAfterVerify = false;
 
     bool prefetchMagnetMetadata = false;
     bool magnetVerify = false;
 
-    void setDirty()
+    /* a bitwise-or'ed set of TR_DIRTY_* groups that haven't been saved yet.
+     * Atomic because verify workers set it too, without the session lock. */
+    std::atomic<uint8_t> dirty_fields = 0;
+
+    void setDirty(uint8_t fields);
+
+    /* the session's change sequence number from when each tr_field_group last changed.
+     * Marked by verify workers too, and read by RPC in the libtransmission thread. */
+    std::array<std::atomic<uint64_t>, TR_N_FIELD_GROUPS> fields_changed_at = {};
+
+    void markFieldsChanged(tr_field_group group);
+
+    [[nodiscard]] bool fieldsChangedSince(tr_field_group group, uint64_t cursor) const
     {
-        this->isDirty = true;
+        return fields_changed_at[group] > cursor;
     }
 
+    /* the resume data from the last save, so unchanged groups can be reused */
+    std::shared_ptr<tr_resume_cache> resume_cache;
+
     void markEdited();
     void markChanged();
 
@@ -779,15 +883,31 @@ private:
 
         files_wanted_.set(files, n_files, wanted);
         completion.invalidateSizeWhenDone();
+        onWantedPiecesChanged();
 
         if (!is_bootstrapping)
         {
-            setDirty();
+            setDirty(TR_DIRTY_PRIORITIES);
             recheckCompleteness();
         }
     }
 
+    // tell the peer manager to re-sort the pieces it wants to request
+    void onWantedPiecesChanged();
+
     mutable std::vector<tr_sha1_digest_t> piece_checksums_;
+
+    // where findFileCached() last found each file
+    enum class FileLocation : uint8_t
+    {
+        Unknown,
+        DownloadDir,
+        DownloadDirPartial,
+        IncompleteDir,
+        IncompleteDirPartial
+    };
+
+    std::vector<FileLocation> file_locations_;
 };
 
 /***
@@ -481,6 +481,22 @@ void tr_sessionSetLPDEnabled(tr_session* session, bool enabled);
 void tr_sessionSetCacheLimit_MB(tr_session* session, int mb);
 int tr_sessionGetCacheLimit_MB(tr_session const* session);
 
+/** @brief Set how many local files may be kept open at once for reading and writing piece data */
+void tr_sessionSetOpenFileLimit(tr_session* session, int limit);
+int tr_sessionGetOpenFileLimit(tr_session const* session);
+
+/** @brief Set how many threads write cached blocks to disk and read blocks for peers */
+void tr_sessionSetDiskIoThreads(tr_session* session, int n);
+int tr_sessionGetDiskIoThreads(tr_session const* session);
+
+/** @brief Set how many threads hash pieces when verifying local data */
+void tr_sessionSetVerifyThreads(tr_session* session, int n);
+int tr_sessionGetVerifyThreads(tr_session const* session);
+
+/** @brief Cap how many MB per second verifying may read from disk. 0 means no limit. */
+void tr_sessionSetVerifyIoLimit_MB(tr_session* session, int mb);
+int tr_sessionGetVerifyIoLimit_MB(tr_session const* session);
+
 tr_encryption_mode tr_sessionGetEncryption(tr_session* session);
 void tr_sessionSetEncryption(tr_session* session, tr_encryption_mode mode);
 
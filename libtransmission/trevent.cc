@@ -6,9 +6,11 @@
  *
  */
 
+#include <atomic>
 #include <cerrno>
+#include <chrono>
 #include <cstring>
-#include <mutex>
+#include <utility> // std::exchange
 
 #include <csignal>
 
@@ -18,6 +20,10 @@
 #include <unistd.h> /* read(), write(), pipe() */
 #endif
 
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
 #include <event2/dns.h>
 #include <event2/event.h>
 
@@ -149,9 +155,60 @@ using tr_pipe_end_t = int;
 ****
 ***/
 
+struct tr_event_task
+{
+    void (*func)(void*);
+    void* user_data;
+    std::chrono::steady_clock::time_point posted_at;
+    tr_event_task* next;
+};
+
+/* A lock-free multi-producer, single-consumer queue of tasks. Producers push
+ * onto an intrusive stack, and the event thread takes the whole stack at once
+ * and reverses it to get the tasks back in the order they were posted. */
+class TaskQueue
+{
+public:
+    /* returns true if the queue was empty, i.e. if the event thread needs waking */
+    bool push(tr_event_task* task)
+    {
+        auto* head = head_.load(std::memory_order_relaxed);
+
+        do
+        {
+            task->next = head;
+        } while (!head_.compare_exchange_weak(head, task, std::memory_order_release, std::memory_order_relaxed));
+
+        return head == nullptr;
+    }
+
+    /* take every queued task, oldest first */
+    tr_event_task* popAll()
+    {
+        auto* task = head_.exchange(nullptr, std::memory_order_acquire);
+        tr_event_task* oldest = nullptr;
+
+        while (task != nullptr)
+        {
+            auto* const next = task->next;
+            task->next = oldest;
+            oldest = task;
+            task = next;
+        }
+
+        return oldest;
+    }
+
+private:
+    std::atomic<tr_event_task*> head_ = nullptr;
+};
+
 struct tr_event_handle
 {
-    std::recursive_mutex fds_mutex;
+    TaskQueue tasks;
+
+    /* the event thread is only woken when a task is posted to an empty queue.
+     * An eventfd where there is one, or else a pipe */
     tr_pipe_end_t fds[2] = {};
 
     struct event* pipeEvent = nullptr;
@@ -159,65 +216,128 @@ struct tr_event_handle
     tr_session* session = nullptr;
     tr_thread* thread = nullptr;
 
-    bool die = false;
-};
+    /* updated by the posting threads */
+    std::atomic<uint64_t> tasks_posted = 0;
 
-struct tr_run_data
-{
-    void (*func)(void*);
-    void* user_data;
+    /* updated by the event thread */
+    std::atomic<uint64_t> tasks_run = 0;
+    std::atomic<uint64_t> wakeups = 0;
+    std::atomic<size_t> max_batch = 0;
+    std::atomic<uint64_t> total_wait_usec = 0;
+    std::atomic<uint64_t> max_wait_usec = 0;
+    std::atomic<uint64_t> total_wake_usec = 0;
+    std::atomic<uint64_t> max_wake_usec = 0;
+
+    std::atomic<bool> die = false;
 };
 
 #define dbgmsg(...) tr_logAddDeepNamed("event", __VA_ARGS__)
 
-static void readFromPipe(evutil_socket_t fd, short eventType, void* veh)
+static void wakeEventThread(tr_event_handle* eh)
 {
-    auto* eh = static_cast<tr_event_handle*>(veh);
+#ifdef HAVE_EVENTFD
+    uint64_t const one = 1;
+    ev_ssize_t const res = write(eh->fds[1], &one, sizeof(one));
+#else
+    char const ch = 'r';
+    ev_ssize_t const res = pipewrite(eh->fds[1], &ch, 1);
+#endif
 
-    dbgmsg("readFromPipe: eventType is %hd", eventType);
+    if (res == -1 && errno != EAGAIN)
+    {
+        tr_logAddError("Unable to write to libtransmisison event queue: %s", tr_strerror(errno));
+    }
+}
 
-    /* read the command type */
-    char ch = '\0';
+static void clearWakeup(tr_event_handle* eh)
+{
+#ifdef HAVE_EVENTFD
+    uint64_t count = 0;
+    [[maybe_unused]] auto const res = read(eh->fds[0], &count, sizeof(count));
+#else
+    char buf[64];
+    while (piperead(eh->fds[0], buf, sizeof(buf)) == sizeof(buf))
+    {
+    }
+#endif
+}
 
-    int ret = 0;
-    do
+static void freeTasks(tr_event_task* task)
+{
+    while (task != nullptr)
     {
-        ret = piperead(fd, &ch, 1);
-    } while (!eh->die && ret == -1 && errno == EAGAIN);
+        delete std::exchange(task, task->next);
+    }
+}
 
-    dbgmsg("command is [%c], ret is %d, errno is %d", ch, ret, (int)errno);
+static uint64_t usecSince(std::chrono::steady_clock::time_point then, std::chrono::steady_clock::time_point now)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(now - then).count();
+}
 
-    switch (ch)
+static void updateMax(std::atomic<uint64_t>& max, uint64_t val)
+{
+    if (val > max.load(std::memory_order_relaxed))
     {
-    case 'r': /* run in libevent thread */
-        {
-            struct tr_run_data data;
-            size_t const nwant = sizeof(data);
-            ev_ssize_t const ngot = piperead(fd, &data, nwant);
+        max.store(val, std::memory_order_relaxed);
+    }
+}
 
-            if (!eh->die && ngot == (ev_ssize_t)nwant)
-            {
-                dbgmsg("invoking function in libevent thread");
-                (*data.func)(data.user_data);
-            }
+static void onWakeup(evutil_socket_t /*fd*/, short eventType, void* veh)
+{
+    auto* eh = static_cast<tr_event_handle*>(veh);
 
-            break;
-        }
+    dbgmsg("onWakeup: eventType is %hd", eventType);
 
-    case '\0': /* eof */
-        {
-            dbgmsg("pipe eof reached... removing event listener");
-            event_free(eh->pipeEvent);
-            tr_netCloseSocket(eh->fds[0]);
-            event_base_loopexit(eh->base, nullptr);
-            break;
-        }
+    /* clear the wakeup before taking the tasks, so that a task that's
+     * posted after they're taken is sure to wake the thread again */
+    clearWakeup(eh);
+    auto* task = eh->tasks.popAll();
 
-    default:
-        {
-            TR_ASSERT_MSG(false, "unhandled command type %d", (int)ch);
-            break;
-        }
+    if (eh->die)
+    {
+        dbgmsg("event thread is closing... removing event listener");
+        freeTasks(task);
+        event_free(eh->pipeEvent);
+        tr_netCloseSocket(eh->fds[0]);
+#ifndef HAVE_EVENTFD
+        tr_netCloseSocket(eh->fds[1]);
+#endif
+        event_base_loopexit(eh->base, nullptr);
+        return;
+    }
+
+    if (task == nullptr)
+    {
+        return;
+    }
+
+    /* run the whole batch. Tasks that they post go into the next one */
+    auto const now = std::chrono::steady_clock::now();
+    auto const wake_usec = usecSince(task->posted_at, now);
+    ++eh->wakeups;
+    eh->total_wake_usec += wake_usec;
+    updateMax(eh->max_wake_usec, wake_usec);
+
+    size_t n = 0;
+    while (task != nullptr && !eh->die)
+    {
+        auto const wait_usec = usecSince(task->posted_at, now);
+        eh->total_wait_usec += wait_usec;
+        updateMax(eh->max_wait_usec, wait_usec);
+
+        dbgmsg("invoking function in libevent thread");
+        (*task->func)(task->user_data);
+        delete std::exchange(task, task->next);
+        ++n;
+    }
+
+    freeTasks(task);
+    eh->tasks_run += n;
+
+    if (n > eh->max_batch.load(std::memory_order_relaxed))
+    {
+        eh->max_batch.store(n, std::memory_order_relaxed);
     }
 }
 
@@ -251,8 +371,8 @@ static void libeventThreadFunc(void* veh)
     eh->session->evdns_base = evdns_base_new(base, true);
     eh->session->events = eh;
 
-    /* listen to the pipe's read fd */
-    eh->pipeEvent = event_new(base, eh->fds[0], EV_READ | EV_PERSIST, readFromPipe, veh);
+    /* listen for tasks being posted */
+    eh->pipeEvent = event_new(base, eh->fds[0], EV_READ | EV_PERSIST, onWakeup, veh);
     event_add(eh->pipeEvent, nullptr);
     event_set_log_callback(logFunc);
 
@@ -275,7 +395,13 @@ void tr_eventInit(tr_session* session)
 
     auto* const eh = new tr_event_handle{};
 
-    if (pipe(eh->fds) == -1)
+#ifdef HAVE_EVENTFD
+    eh->fds[0] = eh->fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eh->fds[0] == -1)
+#else
+    if (pipe(eh->fds) == -1 || evutil_make_socket_nonblocking(eh->fds[0]) == -1 ||
+        evutil_make_socket_nonblocking(eh->fds[1]) == -1)
+#endif
     {
         tr_logAddError("Unable to write to pipe() in libtransmission: %s", tr_strerror(errno));
     }
@@ -305,7 +431,7 @@ void tr_eventClose(tr_session* session)
         tr_logAddDeep(__FILE__, __LINE__, nullptr, "closing trevent pipe");
     }
 
-    tr_netCloseSocket(session->events->fds[1]);
+    wakeEventThread(session->events);
 }
 
 /**
@@ -329,27 +455,39 @@ void tr_runInEventThread(tr_session* session, void (*func)(void*), void* user_da
     TR_ASSERT(tr_isSession(session));
     TR_ASSERT(session->events != nullptr);
 
-    if (tr_amInThread(session->events->thread))
+    tr_event_handle* const eh = session->events;
+
+    if (tr_amInThread(eh->thread))
     {
         (*func)(user_data);
     }
-    else
+    else if (!eh->die)
     {
-        tr_event_handle* e = session->events;
-        auto const lock = std::unique_lock(e->fds_mutex);
-        auto data = tr_run_data{};
-
-        tr_pipe_end_t const fd = e->fds[1];
-        char ch = 'r';
-        ev_ssize_t const res_1 = pipewrite(fd, &ch, 1);
+        ++eh->tasks_posted;
 
-        data.func = func;
-        data.user_data = user_data;
-        ev_ssize_t const res_2 = pipewrite(fd, &data, sizeof(data));
-
-        if (res_1 == -1 || res_2 == -1)
+        if (eh->tasks.push(new tr_event_task{ func, user_data, std::chrono::steady_clock::now(), nullptr }))
         {
-            tr_logAddError("Unable to write to libtransmisison event queue: %s", tr_strerror(errno));
+            wakeEventThread(eh);
         }
     }
 }
+
+void tr_eventGetStats(tr_session const* session, tr_event_stats* setme)
+{
+    TR_ASSERT(tr_isSession(session));
+    TR_ASSERT(session->events != nullptr);
+
+    auto const* const eh = session->events;
+
+    auto const tasks_run = eh->tasks_run.load();
+    auto const tasks_posted = eh->tasks_posted.load();
+    setme->tasks_run = tasks_run;
+    setme->queue_depth = tasks_posted > tasks_run ? tasks_posted - tasks_run : 0;
+    setme->max_batch = eh->max_batch;
+    setme->wakeups = eh->wakeups;
+    setme->avg_wait_usec = tasks_run != 0 ? eh->total_wait_usec / tasks_run : 0;
+    setme->max_wait_usec = eh->max_wait_usec;
+    auto const wakeups = setme->wakeups;
+    setme->avg_wake_usec = wakeups != 0 ? eh->total_wake_usec / wakeups : 0;
+    setme->max_wake_usec = eh->max_wake_usec;
+}
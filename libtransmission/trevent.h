@@ -12,6 +12,9 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+
 #include "tr-macros.h"
 
 void tr_eventInit(tr_session*);
@@ -21,3 +24,29 @@ void tr_eventClose(tr_session*);
 bool tr_amInEventThread(tr_session const*);
 
 void tr_runInEventThread(tr_session*, void (*func)(void*), void* user_data);
+
+/* counters for the tasks that other threads run in the event thread */
+struct tr_event_stats
+{
+    /* tasks that have been run */
+    uint64_t tasks_run;
+
+    /* tasks that have been posted but haven't been run yet */
+    size_t queue_depth;
+
+    /* the most tasks that were run in one wakeup */
+    size_t max_batch;
+
+    /* how often the event thread was woken to run tasks */
+    uint64_t wakeups;
+
+    /* time between a task being posted and its batch starting to run */
+    uint64_t avg_wait_usec;
+    uint64_t max_wait_usec;
+
+    /* time between a task being posted to an empty queue and the event thread waking up */
+    uint64_t avg_wake_usec;
+    uint64_t max_wake_usec;
+};
+
+void tr_eventGetStats(tr_session const*, tr_event_stats* setme);
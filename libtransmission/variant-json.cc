@@ -7,9 +7,7 @@
  */
 
 #include <array>
-#include <cctype>
 #include <cerrno> /* EILSEQ, EINVAL */
-#include <cmath> /* fabs() */
 #include <cstdio>
 #include <cstring>
 #include <deque>
@@ -22,6 +20,7 @@
 
 #include "transmission.h"
 
+#include "json-writer.h"
 #include "jsonsl.h"
 #include "log.h"
 #include "tr-assert.h"
@@ -506,101 +505,17 @@ static void jsonBoolFunc(tr_variant const* val, void* vdata)
 static void jsonRealFunc(tr_variant const* val, void* vdata)
 {
     auto* data = static_cast<struct jsonWalk*>(vdata);
-
-    if (fabs(val->val.d - (int)val->val.d) < 0.00001)
-    {
-        evbuffer_add_printf(data->out, "%d", (int)val->val.d);
-    }
-    else
-    {
-        evbuffer_add_printf(data->out, "%.4f", tr_truncd(val->val.d, 4));
-    }
-
+    tr_jsonAddReal(data->out, val->val.d);
     jsonChildFunc(data);
 }
 
 static void jsonStringFunc(tr_variant const* val, void* vdata)
 {
-    struct evbuffer_iovec vec[1];
     auto* data = static_cast<struct jsonWalk*>(vdata);
 
     auto sv = std::string_view{};
     (void)!tr_variantGetStrView(val, &sv);
-
-    evbuffer_reserve_space(data->out, std::size(sv) * 4, vec, 1);
-    auto* out = static_cast<char*>(vec[0].iov_base);
-    char const* const outend = out + vec[0].iov_len;
-
-    char* outwalk = out;
-    *outwalk++ = '"';
-
-    for (; !std::empty(sv); sv.remove_prefix(1))
-    {
-        switch (sv.front())
-        {
-        case '\b':
-            *outwalk++ = '\\';
-            *outwalk++ = 'b';
-            break;
-
-        case '\f':
-            *outwalk++ = '\\';
-            *outwalk++ = 'f';
-            break;
-
-        case '\n':
-            *outwalk++ = '\\';
-            *outwalk++ = 'n';
-            break;
-
-        case '\r':
-            *outwalk++ = '\\';
-            *outwalk++ = 'r';
-            break;
-
-        case '\t':
-            *outwalk++ = '\\';
-            *outwalk++ = 't';
-            break;
-
-        case '"':
-            *outwalk++ = '\\';
-            *outwalk++ = '"';
-            break;
-
-        case '\\':
-            *outwalk++ = '\\';
-            *outwalk++ = '\\';
-            break;
-
-        default:
-            if (isprint(sv.front()))
-            {
-                *outwalk++ = sv.front();
-            }
-            else
-            {
-                try
-                {
-                    auto* begin8 = std::data(sv);
-                    auto* end8 = begin8 + std::size(sv);
-                    auto* walk8 = begin8;
-                    auto const uch32 = utf8::next(walk8, end8);
-                    outwalk += tr_snprintf(outwalk, outend - outwalk, "\\u%04x", uch32);
-                    sv.remove_prefix(walk8 - begin8 - 1);
-                }
-                catch (utf8::exception const&)
-                {
-                    *outwalk++ = '?';
-                }
-            }
-            break;
-        }
-    }
-
-    *outwalk++ = '"';
-    vec[0].iov_len = outwalk - out;
-    evbuffer_commit_space(data->out, vec, 1);
+    tr_jsonAddStr(data->out, sv);
 
     jsonChildFunc(data);
 }
@@ -17,9 +17,11 @@
 
 #include <algorithm> // std::sort
 #include <cerrno>
+#include <cstdint>
 #include <cstdlib> /* strtod() */
 #include <cstring>
 #include <stack>
+#include <string>
 #include <string_view>
 #include <vector>
 
@@ -226,17 +228,131 @@ static constexpr char const* getStr(tr_variant const* v)
     return tr_variant_string_get_string(&v->val.s);
 }
 
+/* Dicts with at least DictIndexMinSize children get an open-addressed hash
+ * index from their keys to their children, so that finding a key in them is
+ * O(1). The children themselves stay in one array, in the order they were
+ * added, so small dicts stay compact and serialization order is unchanged.
+ * Like the linear search, the index finds the first child with a given key. */
+static auto constexpr DictIndexMinSize = size_t{ 16 };
+
+struct tr_variant_dict_index
+{
+    /* child index + 1, or 0 for an empty slot. The size is a power of two */
+    std::vector<uint32_t> slots;
+};
+
+static size_t dictIndexSlot(tr_variant_dict_index const* index, tr_quark const key)
+{
+    /* quarks are small sequential integers, so spread them out */
+    return size_t((uint64_t{ key } * 0x9E3779B97F4A7C15U) >> 32) & (std::size(index->slots) - 1);
+}
+
+static void dictIndexInsert(tr_variant* dict, size_t child)
+{
+    auto* const index = dict->val.l.index;
+    auto const key = dict->val.l.vals[child].key;
+    auto const mask = std::size(index->slots) - 1;
+
+    for (auto slot = dictIndexSlot(index, key);; slot = (slot + 1) & mask)
+    {
+        auto& entry = index->slots[slot];
+
+        if (entry == 0)
+        {
+            entry = uint32_t(child + 1);
+            break;
+        }
+
+        /* keep pointing at the first child with this key */
+        if (dict->val.l.vals[entry - 1].key == key)
+        {
+            break;
+        }
+    }
+}
+
+static void dictIndexBuild(tr_variant* dict)
+{
+    auto* index = dict->val.l.index;
+
+    if (index == nullptr)
+    {
+        index = dict->val.l.index = new tr_variant_dict_index{};
+    }
+
+    /* keep the load factor at or below 1/2 */
+    auto n_slots = size_t{ DictIndexMinSize * 2 };
+    while (n_slots < dict->val.l.count * 2)
+    {
+        n_slots *= 2;
+    }
+
+    index->slots.assign(n_slots, 0);
+
+    for (size_t i = 0, n = dict->val.l.count; i < n; ++i)
+    {
+        dictIndexInsert(dict, i);
+    }
+}
+
+static void dictIndexFree(tr_variant* dict)
+{
+    delete dict->val.l.index;
+    dict->val.l.index = nullptr;
+}
+
+/* keep the index up to date when `child` has been appended to the dict */
+static void dictIndexAdd(tr_variant* dict, size_t child)
+{
+    auto const* const index = dict->val.l.index;
+
+    if (index == nullptr)
+    {
+        if (dict->val.l.count >= DictIndexMinSize)
+        {
+            dictIndexBuild(dict);
+        }
+    }
+    else if (dict->val.l.count * 2 > std::size(index->slots))
+    {
+        dictIndexBuild(dict);
+    }
+    else
+    {
+        dictIndexInsert(dict, child);
+    }
+}
+
 static int dictIndexOf(tr_variant const* dict, tr_quark const key)
 {
-    if (tr_variantIsDict(dict))
+    if (!tr_variantIsDict(dict))
+    {
+        return -1;
+    }
+
+    if (auto const* const index = dict->val.l.index; index != nullptr)
     {
-        for (size_t i = 0; i < dict->val.l.count; ++i)
+        auto const mask = std::size(index->slots) - 1;
+
+        for (auto slot = dictIndexSlot(index, key); index->slots[slot] != 0; slot = (slot + 1) & mask)
         {
-            if (dict->val.l.vals[i].key == key)
+            auto const child = index->slots[slot] - 1;
+
+            if (dict->val.l.vals[child].key == key)
             {
-                return (int)i;
+                return int(child);
             }
         }
+
+        return -1;
+    }
+
+    for (size_t i = 0; i < dict->val.l.count; ++i)
+    {
+        if (dict->val.l.vals[i].key == key)
+        {
+            return (int)i;
+        }
     }
 
     return -1;
@@ -391,14 +507,17 @@ bool tr_variantGetReal(tr_variant const* v, double* setme)
 
     if (!success && tr_variantIsString(v))
     {
+        // strings parsed in-place aren't zero-terminated, so copy it before strtod() walks off the end
+        auto const str = std::string{ getStr(v), v->val.s.len };
+
         /* the json spec requires a '.' decimal point regardless of locale */
         struct locale_context locale_ctx;
         use_numeric_locale(&locale_ctx, "C");
         char* endptr = nullptr;
-        double const d = strtod(getStr(v), &endptr);
+        double const d = strtod(str.c_str(), &endptr);
         restore_locale(&locale_ctx);
 
-        if (getStr(v) != endptr && *endptr == '\0')
+        if (str.c_str() != endptr && *endptr == '\0')
         {
             *setme = d;
             success = true;
@@ -626,6 +745,7 @@ tr_variant* tr_variantDictAdd(tr_variant* dict, tr_quark const key)
     ++dict->val.l.count;
     val->key = key;
     tr_variantInit(val, TR_VARIANT_TYPE_INT);
+    dictIndexAdd(dict, dict->val.l.count - 1);
 
     return val;
 }
@@ -746,6 +866,20 @@ bool tr_variantDictRemove(tr_variant* dict, tr_quark const key)
 
         --dict->val.l.count;
 
+        /* a child moved and another child may have the same key,
+         * so rebuilding the index is simpler than patching it */
+        if (dict->val.l.index != nullptr)
+        {
+            if (dict->val.l.count >= DictIndexMinSize)
+            {
+                dictIndexBuild(dict);
+            }
+            else
+            {
+                dictIndexFree(dict);
+            }
+        }
+
         removed = true;
     }
 
@@ -992,6 +1126,7 @@ static void freeStringFunc(tr_variant const* v, void* /*user_data*/)
 static void freeContainerEndFunc(tr_variant const* v, void* /*user_data*/)
 {
     tr_free(v->val.l.vals);
+    delete v->val.l.index;
 }
 
 static struct VariantWalkFuncs const freeWalkFuncs = {
@@ -89,6 +89,9 @@ struct tr_variant
             size_t alloc;
             size_t count;
             struct tr_variant* vals;
+
+            /* large dicts' hash index of their keys, or nullptr */
+            struct tr_variant_dict_index* index;
         } l;
     } val = {};
 };
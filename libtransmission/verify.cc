@@ -7,7 +7,9 @@
  */
 
 #include <algorithm>
+#include <condition_variable>
 #include <ctime>
+#include <list>
 #include <mutex>
 #include <set>
 #include <vector>
@@ -18,141 +20,260 @@
 #include "file.h"
 #include "log.h"
 #include "platform.h"
+#include "session.h"
 #include "torrent.h"
 #include "tr-assert.h"
 #include "utils.h" /* tr_malloc(), tr_free() */
 #include "verify.h"
 
 /***
-****
+****  Throttling
 ***/
 
-static auto constexpr MsecToSleepPerSecondDuringVerify = int{ 100 };
-
-static bool verifyTorrent(tr_torrent* tor, bool* stopFlag)
+/* Caps how fast all of the verify workers, together, read from disk.
+ * Each worker reports what it's about to read, and gets put to sleep
+ * until the current one-second window has room for it. */
+class VerifyThrottle
 {
-    auto const begin = tr_time();
-
-    tr_sys_file_t fd = TR_BAD_SYS_FILE;
-    uint64_t filePos = 0;
-    bool changed = false;
-    bool hadPiece = false;
-    time_t lastSleptAt = 0;
-    uint32_t piecePos = 0;
-    tr_file_index_t fileIndex = 0;
-    tr_file_index_t prevFileIndex = !fileIndex;
-    tr_piece_index_t piece = 0;
-    auto buffer = std::vector<std::byte>(1024 * 256);
-    auto sha = tr_sha1_init();
+public:
+    void setLimit(uint64_t bytes_per_second)
+    {
+        auto const lock = std::lock_guard(mutex_);
+        limit_ = bytes_per_second;
+    }
 
-    tr_logAddTorDbg(tor, "%s", "verifying torrent...");
-    tor->verify_progress = 0;
+    [[nodiscard]] uint64_t limit() const
+    {
+        auto const lock = std::lock_guard(mutex_);
+        return limit_;
+    }
 
-    while (!*stopFlag && piece < tor->pieceCount())
+    void consume(uint64_t n_bytes)
     {
-        auto const file_length = tor->fileSize(fileIndex);
+        auto msec_to_wait = uint64_t{};
 
-        /* if we're starting a new piece... */
-        if (piecePos == 0)
         {
-            hadPiece = tor->hasPiece(piece);
+            auto const lock = std::lock_guard(mutex_);
+
+            if (limit_ == 0)
+            {
+                return;
+            }
+
+            auto const now = tr_time_msec();
+            if (now - window_begin_ >= 1000)
+            {
+                window_begin_ = now;
+                window_bytes_ = 0;
+            }
+
+            // sleep until the window would have allowed these bytes
+            window_bytes_ += n_bytes;
+            auto const allowed_at = window_begin_ + (window_bytes_ * 1000) / limit_;
+            msec_to_wait = allowed_at > now ? allowed_at - now : 0;
         }
 
-        /* if we're starting a new file... */
-        if (filePos == 0 && fd == TR_BAD_SYS_FILE && fileIndex != prevFileIndex)
+        if (msec_to_wait > 0)
         {
-            char* filename = tr_torrentFindFile(tor, fileIndex);
-            fd = filename == nullptr ? TR_BAD_SYS_FILE :
-                                       tr_sys_file_open(filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, nullptr);
-            tr_free(filename);
-            prevFileIndex = fileIndex;
+            tr_wait_msec(long(msec_to_wait));
         }
+    }
+
+private:
+    mutable std::mutex mutex_;
+    uint64_t limit_ = 0;
+    uint64_t window_begin_ = 0;
+    uint64_t window_bytes_ = 0;
+};
+
+/***
+****  Hashing
+***/
+
+/* Pieces this small are read several at a time and hashed together */
+static auto constexpr MaxBatchBytes = size_t{ 4 * 1024 * 1024 };
+static auto constexpr MaxBatchPieces = size_t{ 8 };
+
+static auto constexpr ReadChunkSize = size_t{ 1024 * 256 };
+
+static size_t getBatchSize(tr_torrent const* tor)
+{
+    return std::clamp(MaxBatchBytes / tor->pieceSize(), size_t{ 1 }, MaxBatchPieces);
+}
+
+/* The file a worker is reading from. Consecutive pieces are usually
+ * in the same file, so it's kept open from one piece to the next. */
+class VerifyFile
+{
+public:
+    VerifyFile() = default;
+    VerifyFile(VerifyFile const&) = delete;
+    VerifyFile& operator=(VerifyFile const&) = delete;
 
-        /* figure out how much we can read this pass */
-        uint64_t leftInPiece = tor->pieceSize(piece) - piecePos;
-        uint64_t leftInFile = file_length - filePos;
-        uint64_t bytesThisPass = std::min(leftInFile, leftInPiece);
-        bytesThisPass = std::min(bytesThisPass, uint64_t(std::size(buffer)));
+    ~VerifyFile()
+    {
+        close();
+    }
 
-        /* read a bit */
-        if (fd != TR_BAD_SYS_FILE)
+    [[nodiscard]] tr_sys_file_t get(tr_torrent* tor, tr_file_index_t file_index)
+    {
+        if (fd_ != TR_BAD_SYS_FILE && tor == tor_ && file_index == file_index_)
         {
-            auto numRead = uint64_t{};
-            if (tr_sys_file_read_at(fd, std::data(buffer), bytesThisPass, filePos, &numRead, nullptr) && numRead > 0)
-            {
-                bytesThisPass = numRead;
-                tr_sha1_update(sha, std::data(buffer), bytesThisPass);
-                tr_sys_file_advise(fd, filePos, bytesThisPass, TR_SYS_FILE_ADVICE_DONT_NEED, nullptr);
-            }
+            return fd_;
         }
 
-        /* move our offsets */
-        leftInPiece -= bytesThisPass;
-        leftInFile -= bytesThisPass;
-        piecePos += bytesThisPass;
-        filePos += bytesThisPass;
+        close();
 
-        /* if we're finishing a piece... */
-        if (leftInPiece == 0)
+        if (char* const filename = tr_torrentFindFile(tor, file_index); filename != nullptr)
         {
-            auto hash = tr_sha1_final(sha);
-            auto const hasPiece = hash && *hash == tor->pieceHash(piece);
+            fd_ = tr_sys_file_open(filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, nullptr);
+            tr_free(filename);
+        }
 
-            if (hasPiece || hadPiece)
-            {
-                tor->setHasPiece(piece, hasPiece);
-                changed |= hasPiece != hadPiece;
-            }
+        tor_ = tor;
+        file_index_ = file_index;
+        return fd_;
+    }
 
-            tor->markChanged();
+    void close()
+    {
+        if (fd_ != TR_BAD_SYS_FILE)
+        {
+            tr_sys_file_close(fd_, nullptr);
+            fd_ = TR_BAD_SYS_FILE;
+        }
 
-            /* sleeping even just a few msec per second goes a long
-             * way towards reducing IO load... */
-            if (auto const now = tr_time(); lastSleptAt != now)
-            {
-                lastSleptAt = now;
-                tr_wait_msec(MsecToSleepPerSecondDuringVerify);
-            }
+        tor_ = nullptr;
+    }
 
-            sha = tr_sha1_init();
-            ++piece;
-            tor->verify_progress = piece / double(tor->pieceCount());
-            piecePos = 0;
-        }
+private:
+    tr_torrent* tor_ = nullptr;
+    tr_file_index_t file_index_ = 0;
+    tr_sys_file_t fd_ = TR_BAD_SYS_FILE;
+};
+
+/* Read a piece into `buffer`, passing each chunk to `on_chunk` as it's read.
+ * If the buffer is smaller than the piece, it's reused from the beginning
+ * once it fills up. Returns false if any of the piece couldn't be read. */
+template<typename ChunkFunc>
+static bool readPiece(
+    tr_torrent* tor,
+    tr_piece_index_t piece,
+    VerifyFile& file,
+    VerifyThrottle& throttle,
+    std::byte* buffer,
+    size_t buflen,
+    ChunkFunc on_chunk)
+{
+    auto [file_index, file_pos] = tor->fileOffset(piece, 0);
+    uint64_t left_in_piece = tor->pieceSize(piece);
+    size_t buf_pos = 0;
+    bool ok = true;
 
-        /* if we're finishing a file... */
-        if (leftInFile == 0)
+    while (ok && left_in_piece > 0)
+    {
+        uint64_t const bytes_this_file = std::min(left_in_piece, tor->fileSize(file_index) - file_pos);
+
+        if (bytes_this_file > 0)
         {
-            if (fd != TR_BAD_SYS_FILE)
+            tr_sys_file_t const fd = file.get(tor, file_index);
+            ok = fd != TR_BAD_SYS_FILE;
+
+            for (uint64_t left_in_file = bytes_this_file; ok && left_in_file > 0;)
             {
-                tr_sys_file_close(fd, nullptr);
-                fd = TR_BAD_SYS_FILE;
+                if (buf_pos == buflen)
+                {
+                    buf_pos = 0;
+                }
+
+                auto const bytes_this_pass = std::min(left_in_file, uint64_t(buflen - buf_pos));
+                throttle.consume(bytes_this_pass);
+
+                auto n_read = uint64_t{};
+                ok = tr_sys_file_read_at(fd, buffer + buf_pos, bytes_this_pass, file_pos, &n_read, nullptr) &&
+                    n_read == bytes_this_pass;
+
+                if (ok)
+                {
+                    on_chunk(buffer + buf_pos, bytes_this_pass);
+                    tr_sys_file_advise(fd, file_pos, bytes_this_pass, TR_SYS_FILE_ADVICE_DONT_NEED, nullptr);
+                    buf_pos += bytes_this_pass;
+                    file_pos += bytes_this_pass;
+                    left_in_file -= bytes_this_pass;
+                }
             }
 
-            fileIndex++;
-            filePos = 0;
+            left_in_piece -= bytes_this_file;
         }
+
+        ++file_index;
+        file_pos = 0;
     }
 
-    /* cleanup */
-    if (fd != TR_BAD_SYS_FILE)
+    return ok;
+}
+
+/* Read and hash `n_pieces` pieces starting at `first_piece`.
+ * Sets has_piece[i] to whether the checksum of piece first_piece + i matches. */
+static void verifyPieces(
+    tr_torrent* tor,
+    tr_piece_index_t first_piece,
+    size_t n_pieces,
+    VerifyFile& file,
+    VerifyThrottle& throttle,
+    std::vector<std::byte>& buffer,
+    bool* has_piece)
+{
+    TR_ASSERT(n_pieces <= MaxBatchPieces);
+
+    /* a single piece is hashed as it's read, so that a big one doesn't have to fit in memory */
+    if (n_pieces == 1)
     {
-        tr_sys_file_close(fd, nullptr);
+        buffer.resize(std::max(std::size(buffer), ReadChunkSize));
+
+        auto sha = tr_sha1_init();
+        bool const ok = readPiece(
+            tor,
+            first_piece,
+            file,
+            throttle,
+            std::data(buffer),
+            ReadChunkSize,
+            [sha](std::byte const* chunk, size_t len) { tr_sha1_update(sha, chunk, len); });
+        auto const hash = tr_sha1_final(sha);
+        has_piece[0] = ok && hash && *hash == tor->pieceHash(first_piece);
+        return;
     }
 
-    tor->verify_progress.reset();
-    tr_sha1_final(sha);
-
-    /* stopwatch */
-    time_t const end = tr_time();
-    tr_logAddTorDbg(
-        tor,
-        "Verification is done. It took %d seconds to verify %" PRIu64 " bytes (%" PRIu64 " bytes per second)",
-        (int)(end - begin),
-        tor->totalSize(),
-        (uint64_t)(tor->totalSize() / (1 + (end - begin))));
-
-    return changed;
+    void const* pieces[MaxBatchPieces];
+    size_t lengths[MaxBatchPieces];
+    bool read_ok[MaxBatchPieces];
+    tr_sha1_digest_t digests[MaxBatchPieces];
+
+    buffer.resize(std::max(std::size(buffer), size_t{ tor->pieceSize() } * n_pieces));
+
+    for (size_t i = 0; i < n_pieces; ++i)
+    {
+        auto const piece = tr_piece_index_t(first_piece + i);
+        auto* const walk = std::data(buffer) + size_t{ tor->pieceSize() } * i;
+        pieces[i] = walk;
+        lengths[i] = tor->pieceSize(piece);
+        read_ok[i] = readPiece(
+            tor,
+            piece,
+            file,
+            throttle,
+            walk,
+            lengths[i],
+            [](std::byte const* /*chunk*/, size_t /*len*/) {});
+    }
+
+    bool const hashed = tr_sha1_batch(n_pieces, pieces, lengths, digests);
+
+    for (size_t i = 0; i < n_pieces; ++i)
+    {
+        has_piece[i] = hashed && read_ok[i] && digests[i] == tor->pieceHash(tr_piece_index_t(first_piece + i));
+    }
 }
 
 /***
@@ -197,53 +318,248 @@ struct verify_node
     }
 };
 
-static struct verify_node currentNode;
-// TODO: refactor s.t. this doesn't leak
-static auto& verify_list{ *new std::set<verify_node>{} };
-static tr_thread* verify_thread = nullptr;
-static bool stopCurrent = false;
+/* A torrent that's being verified. Its pieces are handed out to the
+ * workers one at a time, so a big torrent gets hashed by all of them
+ * while small ones are verified side by side. */
+struct verify_job
+{
+    verify_node node;
+    time_t begin = 0;
+
+    /* the next piece to hand to a worker */
+    tr_piece_index_t next_piece = 0;
+
+    /* how many pieces have been hashed */
+    tr_piece_index_t n_verified = 0;
+
+    /* how many workers are hashing its pieces right now */
+    int n_workers = 0;
+
+    bool changed = false;
+    bool stop = false;
+    bool finishing = false;
+};
+
+struct tr_verifier
+{
+    VerifyThrottle throttle;
+
+    /* torrents waiting for a worker to start on them */
+    std::set<verify_node> verify_list;
+
+    std::list<verify_job> active_jobs;
+
+    std::mutex mutex;
+
+    /* signalled when an active job is done, or when a worker exits */
+    std::condition_variable cv;
+
+    int n_workers = 0;
+    int max_workers = 1;
+};
+
+/* find a job that still has pieces to hand out, activating a queued one if needed */
+static verify_job* getNextJob(tr_verifier* v)
+{
+    for (auto& job : v->active_jobs)
+    {
+        if (!job.stop && !job.finishing && job.next_piece < job.node.torrent->pieceCount())
+        {
+            return &job;
+        }
+    }
+
+    if (std::empty(v->verify_list))
+    {
+        return nullptr;
+    }
+
+    auto const it = std::begin(v->verify_list);
+    auto& job = v->active_jobs.emplace_back();
+    job.node = *it;
+    job.begin = tr_time();
+    v->verify_list.erase(it);
+
+    tr_torrent* const tor = job.node.torrent;
+    tr_logAddTorInfo(tor, "%s", _("Verifying torrent"));
+    tr_logAddTorDbg(tor, "%s", "verifying torrent...");
+    tor->setVerifyState(TR_VERIFY_NOW);
+    tor->verify_progress = 0;
+    return &job;
+}
+
+/* Called with the lock held once the job has no more workers. The
+ * lock is released while the callback runs, so that it can queue
+ * another verify. */
+static void finishJob(tr_verifier* v, std::unique_lock<std::mutex>& lock, verify_job* job)
+{
+    TR_ASSERT(job->n_workers == 0);
+    TR_ASSERT(!job->finishing);
+
+    job->finishing = true;
+    auto const node = job->node;
+    auto const aborted = job->stop;
+    auto const changed = job->changed;
+    auto const begin = job->begin;
+    lock.unlock();
+
+    tr_torrent* const tor = node.torrent;
+    tor->verify_progress.reset();
+    tor->setVerifyState(TR_VERIFY_NONE);
+    TR_ASSERT(tr_isTorrent(tor));
+
+    if (!aborted)
+    {
+        time_t const end = tr_time();
+        tr_logAddTorDbg(
+            tor,
+            "Verification is done. It took %d seconds to verify %" PRIu64 " bytes (%" PRIu64 " bytes per second)",
+            (int)(end - begin),
+            tor->totalSize(),
+            (uint64_t)(tor->totalSize() / (1 + (end - begin))));
+
+        if (changed)
+        {
+            tor->setDirty(TR_DIRTY_PROGRESS);
+        }
+    }
+
+    if (node.callback_func != nullptr)
+    {
+        (*node.callback_func)(tor, aborted, node.callback_data);
+    }
+
+    lock.lock();
+    v->active_jobs.remove_if([job](auto const& that) { return &that == job; });
+    v->cv.notify_all();
+}
 
-static std::mutex verify_mutex_;
+/* find a job that's done or stopped, and that no worker is hashing anymore */
+static verify_job* getFinishedJob(tr_verifier* v)
+{
+    for (auto& job : v->active_jobs)
+    {
+        if (!job.finishing && job.n_workers == 0 && (job.stop || job.n_verified == job.node.torrent->pieceCount()))
+        {
+            return &job;
+        }
+    }
+
+    return nullptr;
+}
 
-static void verifyThreadFunc(void* /*user_data*/)
+static void verifyThreadFunc(void* vverifier)
 {
+    auto* const v = static_cast<tr_verifier*>(vverifier);
+    auto buffer = std::vector<std::byte>{};
+    auto file = VerifyFile{};
+    auto lock = std::unique_lock(v->mutex);
+
     for (;;)
     {
+        if (auto* const job = getFinishedJob(v); job != nullptr)
         {
-            auto const lock = std::lock_guard(verify_mutex_);
+            /* the lock is released while the job finishes, and its
+             * torrent may be removed then, so let go of its file */
+            file.close();
+            finishJob(v, lock, job);
+            continue;
+        }
 
-            stopCurrent = false;
-            if (std::empty(verify_list))
-            {
-                currentNode.torrent = nullptr;
-                verify_thread = nullptr;
-                return;
-            }
+        auto* const job = v->n_workers <= v->max_workers ? getNextJob(v) : nullptr;
 
-            auto const it = std::begin(verify_list);
-            currentNode = *it;
-            verify_list.erase(it);
+        if (job == nullptr)
+        {
+            file.close();
+            --v->n_workers;
+            v->cv.notify_all();
+            return;
         }
 
-        tr_torrent* tor = currentNode.torrent;
-        tr_logAddTorInfo(tor, "%s", _("Verifying torrent"));
-        tor->setVerifyState(TR_VERIFY_NOW);
-        auto const changed = verifyTorrent(tor, &stopCurrent);
-        tor->setVerifyState(TR_VERIFY_NONE);
-        TR_ASSERT(tr_isTorrent(tor));
+        tr_torrent* const tor = job->node.torrent;
 
-        if (!stopCurrent && changed)
+        if (job->next_piece >= tor->pieceCount())
         {
-            tor->setDirty();
+            continue;
         }
 
-        if (currentNode.callback_func != nullptr)
+        auto const first_piece = job->next_piece;
+        auto const n_pieces = std::min(getBatchSize(tor), size_t{ tor->pieceCount() - first_piece });
+        job->next_piece += n_pieces;
+
+        bool had_piece[MaxBatchPieces];
+        for (size_t i = 0; i < n_pieces; ++i)
         {
-            (*currentNode.callback_func)(tor, stopCurrent, currentNode.callback_data);
+            had_piece[i] = tor->hasPiece(tr_piece_index_t(first_piece + i));
+        }
+
+        ++job->n_workers;
+        lock.unlock();
+
+        bool has_piece[MaxBatchPieces];
+        verifyPieces(tor, first_piece, n_pieces, file, v->throttle, buffer, has_piece);
+
+        lock.lock();
+        --job->n_workers;
+
+        for (size_t i = 0; i < n_pieces; ++i)
+        {
+            if (has_piece[i] || had_piece[i])
+            {
+                tor->setHasPiece(tr_piece_index_t(first_piece + i), has_piece[i]);
+                job->changed |= has_piece[i] != had_piece[i];
+            }
         }
+
+        tor->markChanged();
+        job->n_verified += n_pieces;
+        tor->verify_progress = job->n_verified / double(tor->pieceCount());
+
+        /* once this worker is done with the job, nothing keeps its torrent
+         * from being removed, so don't hold its file open any longer */
+        if (job->stop || job->next_piece >= tor->pieceCount())
+        {
+            file.close();
+        }
+    }
+}
+
+/* start more workers if there's more work than there are workers */
+static void startWorkers(tr_verifier* v)
+{
+    auto n_jobs = std::size(v->verify_list);
+    for (auto const& job : v->active_jobs)
+    {
+        n_jobs += job.node.torrent->pieceCount() - job.next_piece;
+    }
+
+    while (v->n_workers < v->max_workers && size_t(v->n_workers) < n_jobs)
+    {
+        ++v->n_workers;
+        tr_threadNew(verifyThreadFunc, v);
     }
 }
 
+tr_verifier* tr_verifierNew()
+{
+    return new tr_verifier{};
+}
+
+void tr_verifierFree(tr_verifier* v)
+{
+    {
+        auto lock = std::unique_lock(v->mutex);
+
+        TR_ASSERT(std::empty(v->verify_list));
+        TR_ASSERT(std::empty(v->active_jobs));
+
+        /* workers exit once there's nothing left to hash */
+        v->cv.wait(lock, [v]() { return v->n_workers == 0; });
+    }
+
+    delete v;
+}
+
 void tr_verifyAdd(tr_torrent* tor, tr_verify_done_func callback_func, void* callback_data)
 {
     TR_ASSERT(tr_isTorrent(tor));
@@ -255,60 +571,102 @@ void tr_verifyAdd(tr_torrent* tor, tr_verify_done_func callback_func, void* call
     node.callback_data = callback_data;
     node.current_size = tor->hasTotal();
 
-    auto const lock = std::lock_guard(verify_mutex_);
+    auto* const v = tor->session->verifier;
+    auto const lock = std::lock_guard(v->mutex);
     tor->setVerifyState(TR_VERIFY_WAIT);
-    verify_list.insert(node);
-
-    if (verify_thread == nullptr)
-    {
-        verify_thread = tr_threadNew(verifyThreadFunc, nullptr);
-    }
+    v->verify_list.insert(node);
+    startWorkers(v);
 }
 
 void tr_verifyRemove(tr_torrent* tor)
 {
     TR_ASSERT(tr_isTorrent(tor));
 
-    verify_mutex_.lock();
+    auto* const v = tor->session->verifier;
+    auto lock = std::unique_lock(v->mutex);
 
-    if (tor == currentNode.torrent)
+    auto const job = std::find_if(
+        std::begin(v->active_jobs),
+        std::end(v->active_jobs),
+        [tor](auto const& that) { return tor == that.node.torrent; });
+
+    if (job != std::end(v->active_jobs))
     {
-        stopCurrent = true;
+        job->stop = true;
 
-        while (stopCurrent)
+        /* if no worker is hashing it right now, don't wait for one to notice */
+        if (job->n_workers == 0 && !job->finishing)
         {
-            verify_mutex_.unlock();
-            tr_wait_msec(100);
-            verify_mutex_.lock();
+            finishJob(v, lock, &*job);
         }
+
+        v->cv.wait(
+            lock,
+            [v, tor]()
+            {
+                return std::none_of(
+                    std::begin(v->active_jobs),
+                    std::end(v->active_jobs),
+                    [tor](auto const& that) { return tor == that.node.torrent; });
+            });
     }
     else
     {
         auto const it = std::find_if(
-            std::begin(verify_list),
-            std::end(verify_list),
+            std::begin(v->verify_list),
+            std::end(v->verify_list),
             [tor](auto const& task) { return tor == task.torrent; });
 
         tor->setVerifyState(TR_VERIFY_NONE);
 
-        if (it != std::end(verify_list))
+        if (it != std::end(v->verify_list))
         {
             if (it->callback_func != nullptr)
             {
                 (*it->callback_func)(tor, true, it->callback_data);
             }
 
-            verify_list.erase(it);
+            v->verify_list.erase(it);
         }
     }
+}
+
+void tr_verifyClose(tr_session* session)
+{
+    auto* const v = session->verifier;
+    auto const lock = std::lock_guard(v->mutex);
+
+    for (auto& job : v->active_jobs)
+    {
+        job.stop = true;
+    }
+
+    v->verify_list.clear();
+}
 
-    verify_mutex_.unlock();
+void tr_verifySetThreadCount(tr_session* session, int n)
+{
+    auto* const v = session->verifier;
+    auto const lock = std::lock_guard(v->mutex);
+
+    v->max_workers = std::max(n, 1);
+    startWorkers(v);
 }
 
-void tr_verifyClose(tr_session* /*session*/)
+int tr_verifyGetThreadCount(tr_session const* session)
 {
-    auto const lock = std::lock_guard(verify_mutex_);
+    auto* const v = session->verifier;
+    auto const lock = std::lock_guard(v->mutex);
 
-    stopCurrent = true;
-    verify_list.clear();
+    return v->max_workers;
+}
+
+void tr_verifySetSpeedLimit(tr_session* session, uint64_t bytes_per_second)
+{
+    session->verifier->throttle.setLimit(bytes_per_second);
+}
+
+uint64_t tr_verifyGetSpeedLimit(tr_session const* session)
+{
+    return session->verifier->throttle.limit();
 }
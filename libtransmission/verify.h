@@ -12,15 +12,36 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <cstdint> // uint64_t
+
+struct tr_session;
+struct tr_verifier;
+
 /**
  * @addtogroup file_io File IO
  * @{
  */
 
+/* The session's verify workers and the torrents waiting for them */
+tr_verifier* tr_verifierNew();
+
+/* Waits for the workers to exit. Every torrent must have been removed by then */
+void tr_verifierFree(tr_verifier* verifier);
+
 void tr_verifyAdd(tr_torrent* tor, tr_verify_done_func callback_func, void* callback_user_data);
 
 void tr_verifyRemove(tr_torrent* tor);
 
 void tr_verifyClose(tr_session*);
 
+/* how many threads can hash pieces at once */
+void tr_verifySetThreadCount(tr_session* session, int n);
+
+int tr_verifyGetThreadCount(tr_session const* session);
+
+/* how many bytes per second the verify threads may read, or 0 for no limit */
+void tr_verifySetSpeedLimit(tr_session* session, uint64_t bytes_per_second);
+
+uint64_t tr_verifyGetSpeedLimit(tr_session const* session);
+
 /* @} */
@@ -18,6 +18,7 @@
 #include <curl/curl.h>
 
 #include <event2/buffer.h>
+#include <event2/event.h>
 
 #include "transmission.h"
 #include "crypto-utils.h"
@@ -40,7 +41,14 @@ using namespace std::literals;
 #define USE_LIBCURL_SOCKOPT
 #endif
 
-static auto constexpr ThreadfuncMaxSleepMsec = int{ 200 };
+/* how often to retry webseed downloads that were paused for bandwidth */
+static auto constexpr PausedRetryMsec = int{ 100 };
+
+#ifdef _WIN32
+static auto constexpr LocalSocketpairAf = AF_INET;
+#else
+static auto constexpr LocalSocketpairAf = AF_UNIX;
+#endif
 
 #define dbgmsg(...) tr_logAddDeepNamed("web", __VA_ARGS__)
 
@@ -97,8 +105,28 @@ struct tr_web
 
     char* cookie_filename;
     std::set<CURL*> paused_easy_handles;
+
+    /* The web thread's event loop. curl tells us which sockets and
+     * timeout to watch, and the loop tells curl when they're ready. */
+    CURLM* multi = nullptr;
+    struct event_base* base = nullptr;
+    struct event* curl_timer = nullptr;
+    struct event* paused_timer = nullptr;
+
+    /* other threads write to wakeup_fds[1] when they queue a task or close */
+    evutil_socket_t wakeup_fds[2] = { TR_BAD_SOCKET, TR_BAD_SOCKET };
+    struct event* wakeup_event = nullptr;
+
+    /* tasks that have been added to the multi handle and aren't done yet */
+    size_t n_running = 0;
 };
 
+static void webWakeup(struct tr_web* web)
+{
+    char const ch = 'w';
+    (void)send(web->wakeup_fds[1], &ch, 1, 0);
+}
+
 /***
 ****
 ***/
@@ -115,7 +143,14 @@ static size_t writeFunc(void* ptr, size_t size, size_t nmemb, void* vtask)
 
         if (tor != nullptr && tor->bandwidth->clamp(TR_DOWN, nmemb) == 0)
         {
-            task->session->web->paused_easy_handles.insert(task->curl_easy);
+            auto* const web = task->session->web;
+            web->paused_easy_handles.insert(task->curl_easy);
+
+            if (evtimer_pending(web->paused_timer, nullptr) == 0)
+            {
+                tr_timerAddMsec(web->paused_timer, PausedRetryMsec);
+            }
+
             return CURL_WRITEFUNC_PAUSE;
         }
     }
@@ -297,6 +332,15 @@ static CURL* createEasy(tr_session* s, struct tr_web* web, struct tr_web_task* t
         curl_easy_setopt(e, CURLOPT_RANGE, task->range.c_str());
         /* don't bother asking the server to compress webseed fragments */
         curl_easy_setopt(e, CURLOPT_ENCODING, "identity");
+
+        /* webseeds send a steady stream of range requests to the same host,
+           so keep the connections alive between them. The multi handle's
+           connection cache reuses them; with HTTP/2, wait for an existing
+           connection so the requests get multiplexed instead */
+        curl_easy_setopt(e, CURLOPT_TCP_KEEPALIVE, 1L);
+#if LIBCURL_VERSION_NUM >= 0x072B00 /* CURLOPT_PIPEWAIT was added in 7.43.0 */
+        curl_easy_setopt(e, CURLOPT_PIPEWAIT, 1L);
+#endif
     }
 
     return e;
@@ -365,6 +409,7 @@ static struct tr_web_task* tr_webRunImpl(
         auto const lock = std::unique_lock(session->web->web_tasks_mutex);
         task->next = session->web->tasks;
         session->web->tasks = task;
+        webWakeup(session->web);
     }
 
     return task;
@@ -396,6 +441,223 @@ struct tr_web_task* tr_webRunWebseed(
     return tr_webRunImpl(tor->session, tr_torrentId(tor), url, range, {}, done_func, done_func_user_data, buffer);
 }
 
+/***
+****
+***/
+
+static bool webIsDone(struct tr_web const* web)
+{
+    return web->close_mode == TR_WEB_CLOSE_NOW ||
+        (web->close_mode == TR_WEB_CLOSE_WHEN_IDLE && web->tasks == nullptr && web->n_running == 0);
+}
+
+/* pump completed tasks from the multi */
+static void checkFinishedTasks(struct tr_web* web)
+{
+    auto unused = int{};
+    CURLMsg* msg = nullptr;
+    while ((msg = curl_multi_info_read(web->multi, &unused)) != nullptr)
+    {
+        if (msg->msg == CURLMSG_DONE && msg->easy_handle != nullptr)
+        {
+            CURL* const e = msg->easy_handle;
+
+            struct tr_web_task* task = nullptr;
+            curl_easy_getinfo(e, CURLINFO_PRIVATE, (void*)&task);
+            TR_ASSERT(e == task->curl_easy);
+
+            auto req_bytes_sent = long{};
+            auto total_time = double{};
+            curl_easy_getinfo(e, CURLINFO_RESPONSE_CODE, &task->code);
+            curl_easy_getinfo(e, CURLINFO_REQUEST_SIZE, &req_bytes_sent);
+            curl_easy_getinfo(e, CURLINFO_TOTAL_TIME, &total_time);
+            task->did_connect = task->code > 0 || req_bytes_sent > 0;
+            task->did_timeout = task->code == 0 && total_time >= task->timeout_secs;
+            curl_multi_remove_handle(web->multi, e);
+            web->paused_easy_handles.erase(e);
+            curl_easy_cleanup(e);
+            --web->n_running;
+            tr_runInEventThread(task->session, task_finish_func, task);
+        }
+    }
+
+    if (webIsDone(web))
+    {
+        event_base_loopbreak(web->base);
+    }
+}
+
+static void onSocketEvent(evutil_socket_t fd, short what, void* vweb)
+{
+    auto* const web = static_cast<struct tr_web*>(vweb);
+
+    int const action = ((what & EV_READ) != 0 ? CURL_CSELECT_IN : 0) | ((what & EV_WRITE) != 0 ? CURL_CSELECT_OUT : 0);
+    auto unused = int{};
+    curl_multi_socket_action(web->multi, fd, action, &unused);
+    checkFinishedTasks(web);
+}
+
+/* CURLMOPT_SOCKETFUNCTION: curl wants us to watch a socket, stop watching it, or watch it for something else */
+static int onCurlSocket(CURL* /*easy*/, curl_socket_t fd, int action, void* vweb, void* vsocket_event)
+{
+    auto* const web = static_cast<struct tr_web*>(vweb);
+    auto* socket_event = static_cast<struct event*>(vsocket_event);
+
+    if (action == CURL_POLL_REMOVE)
+    {
+        if (socket_event != nullptr)
+        {
+            event_free(socket_event);
+            curl_multi_assign(web->multi, fd, nullptr);
+        }
+
+        return 0;
+    }
+
+    short const what = EV_PERSIST | ((action & CURL_POLL_IN) != 0 ? EV_READ : 0) | ((action & CURL_POLL_OUT) != 0 ? EV_WRITE : 0);
+
+    if (socket_event == nullptr)
+    {
+        socket_event = event_new(web->base, fd, what, onSocketEvent, web);
+        curl_multi_assign(web->multi, fd, socket_event);
+    }
+    else
+    {
+        event_del(socket_event);
+        event_assign(socket_event, web->base, fd, what, onSocketEvent, web);
+    }
+
+    event_add(socket_event, nullptr);
+    return 0;
+}
+
+static void onCurlTimer(evutil_socket_t /*fd*/, short /*what*/, void* vweb)
+{
+    auto* const web = static_cast<struct tr_web*>(vweb);
+
+    auto unused = int{};
+    curl_multi_socket_action(web->multi, CURL_SOCKET_TIMEOUT, 0, &unused);
+    checkFinishedTasks(web);
+}
+
+/* CURLMOPT_TIMERFUNCTION: curl wants onCurlTimer() called in timeout_msec, or not at all if it's -1 */
+static int onCurlTimeoutChanged(CURLM* /*multi*/, long timeout_msec, void* vweb)
+{
+    auto* const web = static_cast<struct tr_web*>(vweb);
+
+    if (timeout_msec < 0)
+    {
+        evtimer_del(web->curl_timer);
+    }
+    else
+    {
+        tr_timerAddMsec(web->curl_timer, int(timeout_msec));
+    }
+
+    return 0;
+}
+
+/* resume the paused webseed downloads, some of which may pause again */
+static void onPausedTimer(evutil_socket_t /*fd*/, short /*what*/, void* vweb)
+{
+    auto* const web = static_cast<struct tr_web*>(vweb);
+
+    /* swap paused_easy_handles to prevent oscillation
+       between writeFunc and this loop */
+    auto paused = decltype(web->paused_easy_handles){};
+    std::swap(paused, web->paused_easy_handles);
+    std::for_each(std::begin(paused), std::end(paused), [](auto* curl) { curl_easy_pause(curl, CURLPAUSE_CONT); });
+
+    checkFinishedTasks(web);
+}
+
+static void onWakeup(evutil_socket_t fd, short /*what*/, void* vweb)
+{
+    auto* const web = static_cast<struct tr_web*>(vweb);
+
+    char buf[64];
+    while (recv(fd, buf, sizeof(buf), 0) > 0)
+    {
+    }
+
+    /* add tasks from the queue */
+    {
+        auto const lock = std::unique_lock(web->web_tasks_mutex);
+
+        while (web->tasks != nullptr)
+        {
+            /* pop the task */
+            struct tr_web_task* task = web->tasks;
+            web->tasks = task->next;
+            task->next = nullptr;
+
+            dbgmsg("adding task to curl: [%s]", task->url.c_str());
+            curl_multi_add_handle(web->multi, createEasy(task->session, web, task));
+            ++web->n_running;
+        }
+    }
+
+    if (webIsDone(web))
+    {
+        event_base_loopbreak(web->base);
+    }
+}
+
+static bool webInitEvents(struct tr_web* web)
+{
+    if (evutil_socketpair(LocalSocketpairAf, SOCK_STREAM, 0, web->wakeup_fds) == -1)
+    {
+        tr_logAddNamedError("web", "Unable to create wakeup socket: %s", tr_strerror(errno));
+        return false;
+    }
+
+    evutil_make_socket_nonblocking(web->wakeup_fds[0]);
+    evutil_make_socket_nonblocking(web->wakeup_fds[1]);
+
+    web->base = event_base_new();
+    web->wakeup_event = event_new(web->base, web->wakeup_fds[0], EV_READ | EV_PERSIST, onWakeup, web);
+    web->curl_timer = evtimer_new(web->base, onCurlTimer, web);
+    web->paused_timer = evtimer_new(web->base, onPausedTimer, web);
+    event_add(web->wakeup_event, nullptr);
+
+    web->multi = curl_multi_init();
+    curl_multi_setopt(web->multi, CURLMOPT_SOCKETFUNCTION, onCurlSocket);
+    curl_multi_setopt(web->multi, CURLMOPT_SOCKETDATA, web);
+    curl_multi_setopt(web->multi, CURLMOPT_TIMERFUNCTION, onCurlTimeoutChanged);
+    curl_multi_setopt(web->multi, CURLMOPT_TIMERDATA, web);
+    return true;
+}
+
+static void webFreeEvents(struct tr_web* web)
+{
+    /* this first, since curl removes its sockets' events as it closes them */
+    if (web->multi != nullptr)
+    {
+        curl_multi_cleanup(web->multi);
+    }
+
+    for (auto* ev : { web->wakeup_event, web->curl_timer, web->paused_timer })
+    {
+        if (ev != nullptr)
+        {
+            event_free(ev);
+        }
+    }
+
+    if (web->base != nullptr)
+    {
+        event_base_free(web->base);
+    }
+
+    for (auto const fd : web->wakeup_fds)
+    {
+        if (fd != TR_BAD_SOCKET)
+        {
+            evutil_closesocket(fd);
+        }
+    }
+}
+
 static void tr_webThreadFunc(void* vsession)
 {
     auto* session = static_cast<tr_session*>(vsession);
@@ -430,132 +692,35 @@ static void tr_webThreadFunc(void* vsession)
         web->cookie_filename = tr_strvDup(str);
     }
 
-    auto* const multi = curl_multi_init();
-    session->web = web;
-
-    auto repeats = uint32_t{};
-    for (;;)
+    /* run until there's nothing left to do, or until we're told to stop */
+    if (webInitEvents(web))
     {
-        if (web->close_mode == TR_WEB_CLOSE_NOW)
-        {
-            break;
-        }
-
-        if (web->close_mode == TR_WEB_CLOSE_WHEN_IDLE && web->tasks == nullptr)
-        {
-            break;
-        }
-
-        /* add tasks from the queue */
-        {
-            auto const lock = std::unique_lock(web->web_tasks_mutex);
-
-            while (web->tasks != nullptr)
-            {
-                /* pop the task */
-                struct tr_web_task* task = web->tasks;
-                web->tasks = task->next;
-                task->next = nullptr;
-
-                dbgmsg("adding task to curl: [%s]", task->url.c_str());
-                curl_multi_add_handle(multi, createEasy(session, web, task));
-            }
-        }
-
-        /* resume any paused curl handles.
-           swap paused_easy_handles to prevent oscillation
-           between writeFunc this while loop */
-        auto paused = decltype(web->paused_easy_handles){};
-        std::swap(paused, web->paused_easy_handles);
-        std::for_each(std::begin(paused), std::end(paused), [](auto* curl) { curl_easy_pause(curl, CURLPAUSE_CONT); });
-
-        /* maybe wait a little while before calling curl_multi_perform() */
-        auto msec = long{};
-        curl_multi_timeout(multi, &msec);
-
-        if (msec < 0)
-        {
-            msec = ThreadfuncMaxSleepMsec;
-        }
-
-        if (session->isClosed)
-        {
-            msec = 100; /* on shutdown, call perform() more frequently */
-        }
-
-        if (msec > 0)
-        {
-            if (msec > ThreadfuncMaxSleepMsec)
-            {
-                msec = ThreadfuncMaxSleepMsec;
-            }
-
-            auto numfds = int{};
-            curl_multi_wait(multi, nullptr, 0, msec, &numfds);
-            if (!numfds)
-            {
-                repeats++;
-                if (repeats > 1)
-                {
-                    /* curl_multi_wait() returns immediately if there are
-                     * no fds to wait for, so we need an explicit wait here
-                     * to emulate select() behavior */
-                    tr_wait_msec(std::min(msec, ThreadfuncMaxSleepMsec / 2L));
-                }
-            }
-            else
-            {
-                repeats = 0;
-            }
-        }
-
-        /* call curl_multi_perform() */
-        auto mcode = CURLMcode{};
-        auto unused = int{};
-        do
-        {
-            mcode = curl_multi_perform(multi, &unused);
-        } while (mcode == CURLM_CALL_MULTI_PERFORM);
-
-        /* pump completed tasks from the multi */
-        CURLMsg* msg = nullptr;
-        while ((msg = curl_multi_info_read(multi, &unused)) != nullptr)
-        {
-            if (msg->msg == CURLMSG_DONE && msg->easy_handle != nullptr)
-            {
-                CURL* const e = msg->easy_handle;
-
-                struct tr_web_task* task = nullptr;
-                curl_easy_getinfo(e, CURLINFO_PRIVATE, (void*)&task);
-                TR_ASSERT(e == task->curl_easy);
-
-                auto req_bytes_sent = long{};
-                auto total_time = double{};
-                curl_easy_getinfo(e, CURLINFO_RESPONSE_CODE, &task->code);
-                curl_easy_getinfo(e, CURLINFO_REQUEST_SIZE, &req_bytes_sent);
-                curl_easy_getinfo(e, CURLINFO_TOTAL_TIME, &total_time);
-                task->did_connect = task->code > 0 || req_bytes_sent > 0;
-                task->did_timeout = task->code == 0 && total_time >= task->timeout_secs;
-                curl_multi_remove_handle(multi, e);
-                web->paused_easy_handles.erase(e);
-                curl_easy_cleanup(e);
-                tr_runInEventThread(task->session, task_finish_func, task);
-            }
-        }
+        session->web = web;
+        event_base_dispatch(web->base);
+    }
+    else
+    {
+        /* let tr_webRunImpl() stop waiting for us. Its tasks are discarded below */
+        web->close_mode = TR_WEB_CLOSE_NOW;
+        session->web = web;
     }
 
     /* Discard any remaining tasks.
      * This is rare, but can happen on shutdown with unresponsive trackers. */
-    while (web->tasks != nullptr)
     {
-        struct tr_web_task* task = web->tasks;
-        web->tasks = task->next;
-        dbgmsg("Discarding task \"%s\"", task->url.c_str());
-        task_free(task);
+        auto const lock = std::unique_lock(web->web_tasks_mutex);
+
+        while (web->tasks != nullptr)
+        {
+            struct tr_web_task* task = web->tasks;
+            web->tasks = task->next;
+            dbgmsg("Discarding task \"%s\"", task->url.c_str());
+            task_free(task);
+        }
     }
 
     /* cleanup */
-    curl_multi_cleanup(multi);
+    webFreeEvents(web);
     tr_free(web->curl_ca_bundle);
     tr_free(web->cookie_filename);
     delete web;
@@ -567,6 +732,7 @@ void tr_webClose(tr_session* session, tr_web_close_mode close_mode)
     if (session->web != nullptr)
     {
         session->web->close_mode = close_mode;
+        webWakeup(session->web);
 
         if (close_mode == TR_WEB_CLOSE_NOW)
         {
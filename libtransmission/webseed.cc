@@ -53,7 +53,14 @@ auto constexpr FAILURE_RETRY_INTERVAL = 150;
 
 auto constexpr MAX_CONSECUTIVE_FAILURES = 5;
 
-auto constexpr MAX_WEBSEED_CONNECTIONS = 4;
+/* how long each range request should take at the webseed's current speed.
+   Long enough that the per-request round trip is noise, short enough that
+   a slow or stalled connection doesn't sit on too many blocks */
+auto constexpr TARGET_REQUEST_MSEC = 2000;
+
+auto constexpr MIN_BLOCKS_PER_REQUEST = tr_block_index_t{ 4 };
+
+auto constexpr MAX_BLOCKS_PER_REQUEST = tr_block_index_t{ 256 };
 
 void webseed_timer_func(evutil_socket_t fd, short what, void* vw);
 
@@ -119,6 +126,7 @@ public:
     int retry_challenge = 0;
     int idle_connections = 0;
     int active_transfers = 0;
+    tr_block_index_t blocks_per_request = MIN_BLOCKS_PER_REQUEST;
     std::vector<std::string> file_urls;
 };
 
@@ -197,48 +205,42 @@ static void fire_client_got_piece_data(tr_webseed* w, uint32_t length)
 ****
 ***/
 
-struct write_block_data
+/* Hands the blocks that have arrived so far to the cache as one batch.
+   The response bodies are kept in the task's buffer until the request
+   is over, so this runs once per request rather than once per block.
+   If `is_done` is false, a trailing partial block is left in the buffer */
+static void write_blocks(tr_torrent* tor, struct tr_webseed_task* t, bool is_done)
 {
-    tr_session* session;
-    int torrent_id;
-    struct tr_webseed* webseed;
-    struct evbuffer* content;
-    tr_piece_index_t piece_index;
-    tr_block_index_t block_index;
-    tr_block_index_t count;
-    uint32_t block_offset;
-};
+    uint32_t const block_size = tor->blockSize();
+    uint32_t const buf_len = evbuffer_get_length(t->content);
+    uint32_t len = is_done ? buf_len : buf_len - buf_len % block_size;
 
-static void write_block_func(void* vdata)
-{
-    auto* const data = static_cast<struct write_block_data*>(vdata);
-    struct tr_webseed* const w = data->webseed;
-    struct evbuffer* const buf = data->content;
+    if (len == 0)
+    {
+        return;
+    }
 
-    auto* const tor = tr_torrentFindFromId(data->session, data->torrent_id);
-    if (tor != nullptr)
+    auto const first_block = t->block + t->blocks_done;
+    tr_block_index_t const n_blocks = (len + block_size - 1) / block_size;
+    t->blocks_done += n_blocks;
+
+    if (tor->hasPiece(t->piece_index))
     {
-        uint32_t const block_size = tor->blockSize();
-        uint32_t len = evbuffer_get_length(buf);
-        uint32_t const offset_end = data->block_offset + len;
-        tr_cache* cache = data->session->cache;
-        tr_piece_index_t const piece = data->piece_index;
+        evbuffer_drain(t->content, len);
+        return;
+    }
 
-        if (!tor->hasPiece(piece))
-        {
-            while (len > 0)
-            {
-                uint32_t const bytes_this_pass = std::min(len, block_size);
-                tr_cacheWriteBlock(cache, tor, piece, offset_end - len, bytes_this_pass, buf);
-                len -= bytes_this_pass;
-            }
+    auto offset = t->piece_offset + (first_block - t->block) * block_size;
 
-            fire_client_got_blocks(tor, w, data->block_index, data->count);
-        }
+    while (len > 0)
+    {
+        uint32_t const bytes_this_pass = std::min(len, block_size);
+        tr_cacheWriteBlock(t->session->cache, tor, t->piece_index, offset, bytes_this_pass, t->content);
+        offset += bytes_this_pass;
+        len -= bytes_this_pass;
     }
 
-    evbuffer_free(buf);
-    tr_free(data);
+    fire_client_got_blocks(tor, t->webseed, first_block, n_blocks);
 }
 
 /***
@@ -316,36 +318,27 @@ static void on_content_changed(struct evbuffer* buf, struct evbuffer_cb_info con
                                                    task->piece_offset + task->blocks_done * task->block_size + len - 1 });
             }
         }
-
-        if (task->response_code == 206 && len >= task->block_size)
-        {
-            /* once we've got at least one full block, save it */
-
-            uint32_t const block_size = task->block_size;
-            tr_block_index_t const completed = len / block_size;
-
-            auto* const data = tr_new(struct write_block_data, 1);
-            data->webseed = task->webseed;
-            data->piece_index = task->piece_index;
-            data->block_index = task->block + task->blocks_done;
-            data->count = completed;
-            data->block_offset = task->piece_offset + task->blocks_done * block_size;
-            data->content = evbuffer_new();
-            data->torrent_id = w->torrent_id;
-            data->session = w->session;
-
-            /* we don't use locking on this evbuffer so we must copy out the data
-               that will be needed when writing the block in a different thread */
-            evbuffer_remove_buffer(task->content, data->content, (size_t)block_size * (size_t)completed);
-
-            tr_runInEventThread(w->session, write_block_func, data);
-            task->blocks_done += completed;
-        }
     }
 }
 
 static void task_request_next_chunk(struct tr_webseed_task* task);
 
+/* Size the next range requests so that each one takes about
+   TARGET_REQUEST_MSEC at the speed that each connection is getting.
+   Grow gradually so that one fast sample doesn't hand a single
+   connection a huge run of blocks */
+static tr_block_index_t update_blocks_per_request(tr_webseed* w, tr_torrent const* tor)
+{
+    auto const n_connections = std::max(w->session->webseed_connections, size_t{ 1 });
+    uint64_t const bytes_per_second = w->bandwidth.getPieceSpeedBytesPerSecond(tr_time_msec(), TR_DOWN);
+    uint64_t const bytes_per_request = bytes_per_second * TARGET_REQUEST_MSEC / 1000U / n_connections;
+    auto const target = tr_block_index_t(bytes_per_request / tor->blockSize());
+
+    auto const max = std::min(MAX_BLOCKS_PER_REQUEST, w->blocks_per_request * 2);
+    w->blocks_per_request = std::clamp(target, MIN_BLOCKS_PER_REQUEST, std::max(max, MIN_BLOCKS_PER_REQUEST));
+    return w->blocks_per_request;
+}
+
 static void on_idle(tr_webseed* w)
 {
     auto want = int{};
@@ -366,35 +359,53 @@ static void on_idle(tr_webseed* w)
     }
     else
     {
-        want = MAX_WEBSEED_CONNECTIONS - running_tasks;
+        want = int(w->session->webseed_connections) - running_tasks;
         w->retry_challenge = running_tasks + w->idle_connections + 1;
     }
 
     if (tor != nullptr && tor->isRunning && !tor->isDone() && want > 0)
     {
-        auto n_tasks = size_t{};
+        auto const blocks_per_request = update_blocks_per_request(w, tor);
+        auto n_tasks = int{};
 
-        for (auto const span : tr_peerMgrGetNextRequests(tor, w, want))
+        /* each span is confined to a single piece, so ask for
+           a request's worth of blocks at a time until every
+           free connection has a range to download */
+        while (n_tasks < want)
         {
-            auto const [begin, end] = span;
-            auto* const task = tr_new0(tr_webseed_task, 1);
-            task->session = tor->session;
-            task->webseed = w;
-            task->block = begin;
-            task->piece_index = tor->pieceForBlock(begin);
-            task->piece_offset = tor->blockSize() * begin - tor->pieceSize() * task->piece_index;
-            task->length = (end - 1 - begin) * tor->blockSize() + tor->blockSize(end - 1);
-            task->blocks_done = 0;
-            task->response_code = 0;
-            task->block_size = tor->blockSize();
-            task->content = evbuffer_new();
-            evbuffer_add_cb(task->content, on_content_changed, task);
-            w->tasks.insert(task);
-            task_request_next_chunk(task);
-
-            --w->idle_connections;
-            ++n_tasks;
-            tr_peerMgrClientSentRequests(tor, w, span);
+            auto const spans = tr_peerMgrGetNextRequests(tor, w, blocks_per_request);
+            if (std::empty(spans))
+            {
+                break;
+            }
+
+            for (auto const span : spans)
+            {
+                if (n_tasks >= want)
+                {
+                    break;
+                }
+
+                auto const [begin, end] = span;
+                auto* const task = tr_new0(tr_webseed_task, 1);
+                task->session = tor->session;
+                task->webseed = w;
+                task->block = begin;
+                task->piece_index = tor->pieceForBlock(begin);
+                task->piece_offset = tor->blockSize() * begin - tor->pieceSize() * task->piece_index;
+                task->length = (end - 1 - begin) * tor->blockSize() + tor->blockSize(end - 1);
+                task->blocks_done = 0;
+                task->response_code = 0;
+                task->block_size = tor->blockSize();
+                task->content = evbuffer_new();
+                evbuffer_add_cb(task->content, on_content_changed, task);
+                w->tasks.insert(task);
+                task_request_next_chunk(task);
+
+                --w->idle_connections;
+                ++n_tasks;
+                tr_peerMgrClientSentRequests(tor, w, span);
+            }
         }
 
         if (w->retry_tickcount >= FAILURE_RETRY_INTERVAL && n_tasks > 0)
@@ -435,6 +446,9 @@ static void web_response_func(
 
         if (!success)
         {
+            /* keep whatever full blocks did arrive */
+            write_blocks(tor, t, false);
+
             tr_block_index_t const blocks_remain = (t->length + tor->blockSize() - 1) / tor->blockSize() - t->blocks_done;
 
             if (blocks_remain != 0)
@@ -470,14 +484,7 @@ static void web_response_func(
             }
             else
             {
-                if (buf_len != 0 && !tor->hasPiece(t->piece_index))
-                {
-                    /* on_content_changed() will not write a block if it is smaller than
-                       the torrent's block size, i.e. the torrent's very last block */
-                    tr_cacheWriteBlock(session->cache, tor, t->piece_index, t->piece_offset + bytes_done, buf_len, t->content);
-
-                    fire_client_got_blocks(tor, t->webseed, t->block + t->blocks_done, 1);
-                }
+                write_blocks(tor, t, true);
 
                 ++w->idle_connections;
 
@@ -535,6 +542,9 @@ static void task_request_next_chunk(struct tr_webseed_task* t)
         char range[64];
         tr_snprintf(range, sizeof(range), "%" PRIu64 "-%" PRIu64, file_offset, file_offset + this_pass - 1);
 
+        /* on_content_changed() reads t->web_task in the web thread as soon as
+           the first bytes arrive, so don't let it run until it's been set */
+        auto const lock = tor->unique_lock();
         t->web_task = tr_webRunWebseed(tor, urls[file_index].c_str(), range, web_response_func, t, t->content);
     }
 }
@@ -0,0 +1,242 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "bandwidth.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+auto constexpr PeriodMsec = 500U;
+
+// A synthetic peer-io: it can take up to `capacity` bytes per period,
+// like a socket whose send buffer drains at a fixed speed.
+struct Sink
+{
+    size_t capacity = 0;
+    size_t used_this_period = 0;
+    uint64_t speed_bps = 0;
+    uint64_t total = 0;
+};
+
+struct Result
+{
+    uint64_t bytes = 0;
+    uint64_t flushes = 0;
+    double nsecs = 0;
+};
+
+// Flushes up to `limit` bytes to a sink, honoring the sink's capacity and what's left of the global budget.
+size_t flushSink(Sink& sink, size_t limit, size_t& budget_left, uint64_t& flushes)
+{
+    ++flushes;
+    auto const n = std::min({ limit, sink.capacity - sink.used_this_period, budget_left });
+    sink.used_this_period += n;
+    sink.total += n;
+    budget_left -= n;
+    return n;
+}
+
+void endPeriod(std::vector<Sink>& sinks)
+{
+    for (auto& sink : sinks)
+    {
+        sink.speed_bps = sink.used_this_period * 1000U / PeriodMsec;
+        sink.used_this_period = 0;
+    }
+}
+
+// what Bandwidth::phaseOne() used to do: pick a random peer and offer it 3000 bytes
+Result runRandom(std::vector<Sink>& sinks, size_t budget, size_t periods)
+{
+    auto rng = std::mt19937{ 12345 };
+    auto result = Result{};
+    auto const begin = std::chrono::steady_clock::now();
+
+    auto order = std::vector<Sink*>{};
+    for (size_t period = 0; period < periods; ++period)
+    {
+        order.clear();
+        for (auto& sink : sinks)
+        {
+            order.push_back(&sink);
+        }
+
+        auto budget_left = budget;
+        auto n = std::size(order);
+        while (n > 0)
+        {
+            auto const i = std::uniform_int_distribution<size_t>{ 0, n - 1 }(rng);
+            auto const increment = size_t{ 3000 };
+            auto const used = flushSink(*order[i], increment, budget_left, result.flushes);
+            result.bytes += used;
+
+            if (used != increment)
+            {
+                std::swap(order[i], order[n - 1]);
+                --n;
+            }
+        }
+
+        endPeriod(sinks);
+    }
+
+    result.nsecs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+    return result;
+}
+
+// what Bandwidth::phaseOne() does now: weighted round robin with quanta sized to each peer's speed
+Result runRoundRobin(std::vector<Sink>& sinks, size_t budget, size_t periods)
+{
+    auto rng = std::mt19937{ 12345 };
+    auto result = Result{};
+    auto const begin = std::chrono::steady_clock::now();
+
+    auto peers = std::vector<std::pair<Sink*, size_t>>{};
+    for (size_t period = 0; period < periods; ++period)
+    {
+        auto const fair_share = budget / std::size(sinks);
+
+        peers.clear();
+        for (auto& sink : sinks)
+        {
+            peers.emplace_back(&sink, Bandwidth::getQuantum(sink.speed_bps, PeriodMsec, fair_share));
+        }
+
+        auto budget_left = budget;
+        auto const first = std::uniform_int_distribution<size_t>{ 0, std::size(peers) - 1 }(rng);
+        Bandwidth::roundRobin(
+            peers,
+            first,
+            [&](Sink* sink, size_t quantum)
+            {
+                auto const used = flushSink(*sink, quantum, budget_left, result.flushes);
+                result.bytes += used;
+                return used;
+            });
+
+        endPeriod(sinks);
+    }
+
+    result.nsecs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+    return result;
+}
+
+// The max-min fair split of `budget` among sinks of the given capacities.
+std::vector<double> maxMinShares(std::vector<Sink> const& sinks, size_t budget)
+{
+    auto idx = std::vector<size_t>(std::size(sinks));
+    std::iota(std::begin(idx), std::end(idx), 0);
+    std::sort(
+        std::begin(idx),
+        std::end(idx),
+        [&sinks](auto a, auto b) { return sinks[a].capacity < sinks[b].capacity; });
+
+    auto shares = std::vector<double>(std::size(sinks));
+    auto left = double(budget);
+    for (size_t i = 0; i < std::size(idx); ++i)
+    {
+        auto const even = left / double(std::size(idx) - i);
+        auto const share = std::min(even, double(sinks[idx[i]].capacity));
+        shares[idx[i]] = share;
+        left -= share;
+    }
+
+    return shares;
+}
+
+// Jain's fairness index of each sink's throughput relative to its max-min fair share: 1.0 is perfectly fair.
+double fairness(std::vector<Sink> const& sinks, size_t budget, size_t periods)
+{
+    auto const shares = maxMinShares(sinks, budget);
+
+    auto sum = double{};
+    auto sum_sq = double{};
+    for (size_t i = 0; i < std::size(sinks); ++i)
+    {
+        auto const x = double(sinks[i].total) / double(periods) / shares[i];
+        sum += x;
+        sum_sq += x * x;
+    }
+
+    return sum * sum / (double(std::size(sinks)) * sum_sq);
+}
+
+void report(char const* name, std::vector<Sink> const& sinks, size_t budget, size_t periods, Result const& result)
+{
+    auto const gb = double(result.bytes) / 1e9;
+
+    printf(
+        "  %-12s %8.2f GB  %10.0f flushes/GB  %8.1f ms CPU/GB  fairness %.4f\n",
+        name,
+        gb,
+        double(result.flushes) / gb,
+        result.nsecs / 1e6 / gb,
+        fairness(sinks, budget, periods));
+}
+
+void runScenario(char const* title, std::vector<size_t> const& capacities, size_t budget, size_t periods)
+{
+    printf("%s\n", title);
+
+    auto sinks = std::vector<Sink>{};
+    for (auto const capacity : capacities)
+    {
+        sinks.push_back(Sink{ capacity });
+    }
+
+    auto random_sinks = sinks;
+    auto const random_result = runRandom(random_sinks, budget, periods);
+    report("random 3000", random_sinks, budget, periods, random_result);
+
+    auto rr_sinks = sinks;
+    auto const rr_result = runRoundRobin(rr_sinks, budget, periods);
+    report("round robin", rr_sinks, budget, periods, rr_result);
+}
+
+} // namespace
+
+// Simulates Bandwidth::allocate()'s first phase of IO against synthetic peers,
+// comparing the old random 3000-byte scheduler with the weighted round robin.
+// usage: libtransmission-bandwidth-benchmark [n-peers] [n-periods]
+int main(int argc, char** argv)
+{
+    auto const n_peers = size_t(argc > 1 ? atoi(argv[1]) : 2000);
+    auto const n_periods = size_t(argc > 2 ? atoi(argv[2]) : 20);
+
+    // 10 Gbit/s worth of bytes per period
+    auto const ten_gbit = size_t{ 10000000000ULL / 8U * PeriodMsec / 1000U };
+
+    runScenario("unlimited, equal peers:", std::vector<size_t>(n_peers, ten_gbit / n_peers), ten_gbit, n_periods);
+
+    runScenario(
+        "limited to half of the peers' capacity, equal peers:",
+        std::vector<size_t>(n_peers, ten_gbit / n_peers),
+        ten_gbit / 2U,
+        n_periods);
+
+    auto mixed = std::vector<size_t>{};
+    for (size_t i = 0; i < n_peers; ++i)
+    {
+        // a few fast peers and many slow ones
+        mixed.push_back(i % 10 == 0 ? ten_gbit / (n_peers / 10U) : ten_gbit / n_peers / 20U);
+    }
+
+    runScenario("limited, mixed fast and slow peers:", mixed, ten_gbit / 2U, n_periods);
+
+    return 0;
+}
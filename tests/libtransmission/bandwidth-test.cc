@@ -0,0 +1,143 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "bandwidth.h"
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+TEST(Bandwidth, quantumFollowsSpeed)
+{
+    auto constexpr PeriodMsec = 500U;
+    auto constexpr FairShare = size_t{ 10 * 1024 * 1024 };
+
+    // a peer that sends 200 KiB/s gets a half-second's worth: 100 KiB
+    EXPECT_EQ(size_t{ 100 * 1024 }, Bandwidth::getQuantum(200 * 1024, PeriodMsec, FairShare));
+
+    // twice as fast, twice the quantum
+    EXPECT_EQ(size_t{ 200 * 1024 }, Bandwidth::getQuantum(400 * 1024, PeriodMsec, FairShare));
+}
+
+TEST(Bandwidth, quantumIsClamped)
+{
+    auto constexpr PeriodMsec = 500U;
+    auto constexpr FairShare = size_t{ 10 * 1024 * 1024 };
+
+    // new and idle peers still get enough for a full-sized frame
+    EXPECT_EQ(Bandwidth::MinQuantum, Bandwidth::getQuantum(0, PeriodMsec, FairShare));
+    EXPECT_EQ(Bandwidth::MinQuantum, Bandwidth::getQuantum(100, PeriodMsec, FairShare));
+
+    // very fast peers are capped
+    EXPECT_EQ(Bandwidth::MaxQuantum, Bandwidth::getQuantum(100 * 1024 * 1024, PeriodMsec, FairShare));
+
+    // a fast peer can't take more than its share of limited bandwidth...
+    EXPECT_EQ(size_t{ 16 * 1024 }, Bandwidth::getQuantum(1024 * 1024, PeriodMsec, 16 * 1024));
+
+    // ...but the share can't push the quantum below the minimum
+    EXPECT_EQ(Bandwidth::MinQuantum, Bandwidth::getQuantum(1024 * 1024, PeriodMsec, 100));
+}
+
+TEST(Bandwidth, roundRobinStartsWithFirst)
+{
+    auto peers = std::vector<std::pair<int, size_t>>{ { 0, 10 }, { 1, 10 }, { 2, 10 }, { 3, 10 } };
+
+    // every peer uses less than it's offered, so each is called once
+    auto order = std::vector<int>{};
+    Bandwidth::roundRobin(
+        peers,
+        2,
+        [&order](int peer, size_t /*quantum*/)
+        {
+            order.push_back(peer);
+            return size_t{ 0 };
+        });
+
+    ASSERT_EQ(4U, std::size(order));
+    EXPECT_EQ(2, order.front());
+    auto sorted = order;
+    std::sort(std::begin(sorted), std::end(sorted));
+    EXPECT_EQ((std::vector<int>{ 0, 1, 2, 3 }), sorted);
+}
+
+TEST(Bandwidth, roundRobinDropsPeersThatAreDone)
+{
+    // peer 0 wants 25 bytes, peer 1 wants 100, peer 2 wants 0
+    auto wants = std::map<int, size_t>{ { 0, 25 }, { 1, 100 }, { 2, 0 } };
+    auto peers = std::vector<std::pair<int, size_t>>{ { 0, 10 }, { 1, 10 }, { 2, 10 } };
+    auto calls = std::map<int, int>{};
+    auto got = std::map<int, size_t>{};
+
+    Bandwidth::roundRobin(
+        peers,
+        0,
+        [&](int peer, size_t quantum)
+        {
+            ++calls[peer];
+            auto const n = std::min(quantum, wants[peer]);
+            wants[peer] -= n;
+            got[peer] += n;
+            return n;
+        });
+
+    // everyone got everything they wanted...
+    EXPECT_EQ(25U, got[0]);
+    EXPECT_EQ(100U, got[1]);
+    EXPECT_EQ(0U, got[2]);
+
+    // ...and wasn't offered more after using less than a full quantum
+    EXPECT_EQ(3, calls[0]);
+    EXPECT_EQ(11, calls[1]);
+    EXPECT_EQ(1, calls[2]);
+}
+
+TEST(Bandwidth, roundRobinSharesLimitedBandwidthByWeight)
+{
+    // three peers that would take everything, sharing 60000 bytes.
+    // Peer 2's quantum is twice the others', so it should get twice as much
+    auto peers = std::vector<std::pair<int, size_t>>{ { 0, 1000 }, { 1, 1000 }, { 2, 2000 } };
+    auto budget = size_t{ 60000 };
+    auto got = std::map<int, size_t>{};
+
+    Bandwidth::roundRobin(
+        peers,
+        1,
+        [&](int peer, size_t quantum)
+        {
+            auto const n = std::min(quantum, budget);
+            budget -= n;
+            got[peer] += n;
+            return n;
+        });
+
+    EXPECT_EQ(0U, budget);
+    EXPECT_EQ(15000U, got[0]);
+    EXPECT_EQ(15000U, got[1]);
+    EXPECT_EQ(30000U, got[2]);
+}
+
+TEST(Bandwidth, roundRobinWithNoPeers)
+{
+    auto peers = std::vector<std::pair<int, size_t>>{};
+    auto n_calls = int{};
+
+    Bandwidth::roundRobin(
+        peers,
+        0,
+        [&n_calls](int /*peer*/, size_t /*quantum*/)
+        {
+            ++n_calls;
+            return size_t{};
+        });
+
+    EXPECT_EQ(0, n_calls);
+}
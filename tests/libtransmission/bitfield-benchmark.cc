@@ -0,0 +1,97 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "bitfield.h"
+#include "crypto-utils.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+// Measures the bitfield scans that the peer manager does for every peer.
+// The peer's pieces and the wanted pieces don't overlap, so every scan
+// has to look at the whole bitfield before it can say "not interesting".
+// usage: libtransmission-bitfield-benchmark [pieces] [scans]
+int main(int argc, char** argv)
+{
+    auto const n_pieces = size_t(argc > 1 ? atoi(argv[1]) : 50000);
+    auto const n_scans = size_t(argc > 2 ? atoi(argv[2]) : 20000);
+    if (n_pieces == 0 || n_scans == 0)
+    {
+        return 1;
+    }
+
+    // the peer has a random half of the pieces; we want the other half
+    auto raw = std::vector<uint8_t>((n_pieces + 7) / 8);
+    tr_rand_buffer(std::data(raw), std::size(raw));
+    auto have = tr_bitfield{ n_pieces };
+    have.setRaw(std::data(raw), std::size(raw));
+
+    auto piece_is_interesting = std::make_unique<bool[]>(n_pieces);
+    for (size_t i = 0; i < n_pieces; ++i)
+    {
+        piece_is_interesting[i] = !have.test(i);
+    }
+    auto interesting = tr_bitfield{ n_pieces };
+    interesting.setFromBools(piece_is_interesting.get(), n_pieces);
+
+    auto const run = [n_scans](char const* name, auto scan)
+    {
+        auto hits = size_t{};
+        auto const begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < n_scans; ++i)
+        {
+            hits += scan() ? 1 : 0;
+        }
+
+        auto const secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        printf("%-16s %10.2f us per scan (%zu hits)\n", name, secs * 1e6 / double(n_scans), hits);
+    };
+
+    printf("scanning %zu pieces %zu times\n", n_pieces, n_scans);
+
+    run("per-piece test",
+        [&]()
+        {
+            for (size_t i = 0; i < n_pieces; ++i)
+            {
+                if (piece_is_interesting[i] && have.test(i))
+                {
+                    return true;
+                }
+            }
+            return false;
+        });
+
+    run("intersects", [&]() { return have.intersects(interesting); });
+
+    run("hasAnyNotIn", [&]() { return interesting.hasAnyNotIn(interesting); });
+
+    run("count(begin, end)", [&]() { return have.count(1, n_pieces) == 0; });
+
+    run("forEachSet",
+        [&]()
+        {
+            auto n = size_t{};
+            have.forEachSet([&n](size_t /*bit*/) { ++n; });
+            return n == 0;
+        });
+
+    run("raw round-trip",
+        [&]()
+        {
+            auto copy = tr_bitfield{ n_pieces };
+            copy.setRaw(std::data(have.raw()), std::size(raw));
+            return copy.hasNone();
+        });
+
+    return 0;
+}
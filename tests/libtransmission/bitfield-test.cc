@@ -323,3 +323,140 @@ TEST(Bitfield, hasAllNone)
         EXPECT_TRUE(!field.hasNone());
     }
 }
+
+TEST(Bitfield, rawRoundTrip)
+{
+    // sizes on both sides of the byte and word boundaries
+    for (size_t const bit_count : { 1, 7, 8, 9, 63, 64, 65, 127, 128, 129, 1000 })
+    {
+        auto raw = std::vector<uint8_t>((bit_count + 7) / 8);
+        tr_rand_buffer(std::data(raw), std::size(raw));
+
+        // spare bits at the end are zero
+        if (auto const excess = std::size(raw) * 8 - bit_count; excess != 0)
+        {
+            raw.back() &= uint8_t(0xFF << excess);
+        }
+
+        auto bf = tr_bitfield{ bit_count };
+        bf.setRaw(std::data(raw), std::size(raw));
+        EXPECT_EQ(raw, bf.raw());
+
+        // the first byte corresponds to indices 0 - 7 from high bit to low bit
+        auto true_count = size_t{};
+        for (size_t i = 0; i < bit_count; ++i)
+        {
+            auto const expected = (raw[i / 8] & (0x80 >> (i % 8))) != 0;
+            EXPECT_EQ(expected, bf.test(i));
+            true_count += expected ? 1 : 0;
+        }
+        EXPECT_EQ(true_count, bf.count());
+
+        // and the bits survive another trip through the bitfield
+        auto copy = tr_bitfield{ bit_count };
+        copy.setRaw(std::data(bf.raw()), std::size(raw));
+        EXPECT_EQ(raw, copy.raw());
+    }
+
+    // a raw bitfield with its spare bits set gets them cleared
+    auto raw = std::vector<uint8_t>(9, 0xFF);
+    auto bf = tr_bitfield{ 65 };
+    bf.setRaw(std::data(raw), std::size(raw));
+    EXPECT_TRUE(bf.hasAll());
+    EXPECT_EQ(65, bf.count());
+    raw.back() = 0x80;
+    EXPECT_EQ(raw, bf.raw());
+
+    // a short raw bitfield is padded with zeroes
+    raw = std::vector<uint8_t>{ 0xFF };
+    bf = tr_bitfield{ 100 };
+    bf.setRaw(std::data(raw), std::size(raw));
+    EXPECT_EQ(8, bf.count());
+    EXPECT_EQ(13, std::size(bf.raw()));
+    EXPECT_EQ(0xFF, bf.raw().front());
+    EXPECT_EQ(0, bf.raw().back());
+}
+
+TEST(Bitfield, bulkOperations)
+{
+    auto constexpr BitCount = size_t{ 200 };
+
+    auto a = tr_bitfield{ BitCount };
+    auto b = tr_bitfield{ BitCount };
+    for (size_t i = 0; i < BitCount; ++i)
+    {
+        if (i % 3 == 0)
+        {
+            a.set(i);
+        }
+
+        if (i % 5 == 0)
+        {
+            b.set(i);
+        }
+    }
+
+    EXPECT_TRUE(a.intersects(b));
+    EXPECT_TRUE(a.hasAnyNotIn(b));
+
+    auto a_and_b = a;
+    a_and_b &= b;
+    auto a_and_not_b = a;
+    a_and_not_b.andNot(b);
+    for (size_t i = 0; i < BitCount; ++i)
+    {
+        EXPECT_EQ(i % 15 == 0, a_and_b.test(i));
+        EXPECT_EQ(i % 3 == 0 && i % 5 != 0, a_and_not_b.test(i));
+    }
+    EXPECT_FALSE(a_and_not_b.intersects(b));
+    EXPECT_FALSE(a_and_b.hasAnyNotIn(b));
+
+    // findNextSet() and forEachSet() visit the set bits in order
+    auto visited = std::vector<size_t>{};
+    a_and_b.forEachSet([&visited](size_t bit) { visited.push_back(bit); });
+    EXPECT_EQ((std::vector<size_t>{ 0, 15, 30, 45, 60, 75, 90, 105, 120, 135, 150, 165, 180, 195 }), visited);
+    EXPECT_EQ(60, a_and_b.findNextSet(46));
+    EXPECT_EQ(195, a_and_b.findNextSet(195));
+    EXPECT_EQ(BitCount, a_and_b.findNextSet(196));
+    EXPECT_EQ(BitCount, a_and_b.findNextSet(BitCount));
+
+    // the have-all and have-none special cases
+    auto all = tr_bitfield{ BitCount };
+    all.setHasAll();
+    auto none = tr_bitfield{ BitCount };
+    none.setHasNone();
+
+    EXPECT_TRUE(all.intersects(a));
+    EXPECT_TRUE(all.hasAnyNotIn(a));
+    EXPECT_FALSE(a.hasAnyNotIn(all));
+    EXPECT_FALSE(none.intersects(a));
+    EXPECT_FALSE(a.intersects(none));
+    EXPECT_TRUE(a.hasAnyNotIn(none));
+    EXPECT_FALSE(none.hasAnyNotIn(a));
+    EXPECT_EQ(7, all.findNextSet(7));
+    EXPECT_EQ(BitCount, none.findNextSet(0));
+
+    auto bf = all;
+    bf &= a;
+    EXPECT_EQ(a.count(), bf.count());
+    EXPECT_FALSE(bf.hasAnyNotIn(a));
+    EXPECT_FALSE(a.hasAnyNotIn(bf));
+
+    bf = all;
+    bf.andNot(a);
+    EXPECT_EQ(BitCount - a.count(), bf.count());
+    EXPECT_FALSE(bf.intersects(a));
+
+    bf = a;
+    bf &= none;
+    EXPECT_TRUE(bf.hasNone());
+
+    bf = a;
+    bf.andNot(all);
+    EXPECT_TRUE(bf.hasNone());
+
+    bf = a;
+    bf.andNot(a);
+    EXPECT_TRUE(bf.hasNone());
+    EXPECT_EQ(BitCount, bf.findNextSet(0));
+}
@@ -0,0 +1,216 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "cache.h"
+#include "crypto-utils.h"
+#include "file.h"
+#include "torrent.h"
+#include "trevent.h"
+#include "utils.h"
+#include "variant.h"
+
+#include <event2/buffer.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+// small pieces, so that a lot of blocks fit in a modest amount of disk
+auto constexpr PieceSize = uint32_t{ 1024 };
+
+tr_torrent* createTorrent(tr_session* session, size_t n_pieces)
+{
+    auto pieces = std::string(n_pieces * SHA_DIGEST_LENGTH, '\0');
+    tr_rand_buffer(std::data(pieces), std::size(pieces));
+
+    auto top = tr_variant{};
+    tr_variantInitDict(&top, 1);
+    auto* const info = tr_variantDictAddDict(&top, TR_KEY_info, 4);
+    tr_variantDictAddStr(info, TR_KEY_name, "cache-benchmark");
+    tr_variantDictAddInt(info, TR_KEY_length, int64_t{ PieceSize } * n_pieces);
+    tr_variantDictAddInt(info, TR_KEY_piece_length, PieceSize);
+    tr_variantDictAddRaw(info, TR_KEY_pieces, std::data(pieces), std::size(pieces));
+    auto const benc = tr_variantToStr(&top, TR_VARIANT_FMT_BENC);
+    tr_variantFree(&top);
+
+    auto* const ctor = tr_ctorNew(session);
+    tr_ctorSetMetainfo(ctor, std::data(benc), std::size(benc), nullptr);
+    tr_ctorSetPaused(ctor, TR_FORCE, true);
+    auto* const tor = tr_torrentNew(ctor, nullptr);
+    tr_ctorFree(ctor);
+    return tor;
+}
+
+void removeRecursive(std::string const& path)
+{
+    auto info = tr_sys_path_info{};
+    if (tr_sys_path_get_info(path.c_str(), 0, &info, nullptr) && info.type == TR_SYS_PATH_IS_DIRECTORY)
+    {
+        auto children = std::vector<std::string>{};
+        auto* const odir = tr_sys_dir_open(path.c_str(), nullptr);
+        char const* name = nullptr;
+        while ((name = tr_sys_dir_read_name(odir, nullptr)) != nullptr)
+        {
+            if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+            {
+                children.push_back(path + '/' + name);
+            }
+        }
+        tr_sys_dir_close(odir, nullptr);
+
+        for (auto const& child : children)
+        {
+            removeRecursive(child);
+        }
+    }
+
+    tr_sys_path_remove(path.c_str(), nullptr);
+}
+
+tr_session* sessionInit(std::string const& config_dir)
+{
+    auto settings = tr_variant{};
+    tr_variantInitDict(&settings, 0);
+    tr_sessionGetDefaultSettings(&settings);
+    tr_variantDictAddStr(&settings, TR_KEY_download_dir, config_dir);
+    tr_variantDictAddBool(&settings, TR_KEY_dht_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_lpd_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_utp_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_rpc_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_port_forwarding_enabled, false);
+    tr_variantDictAddInt(&settings, TR_KEY_message_level, TR_LOG_ERROR);
+    auto* const session = tr_sessionInit(config_dir.c_str(), false, &settings);
+    tr_variantFree(&settings);
+    return session;
+}
+
+// run `func` in the session thread and wait for it to finish
+template<typename Func>
+void runInEventThread(tr_session* session, Func func)
+{
+    struct Data
+    {
+        Func func;
+        std::atomic<bool> done;
+    };
+
+    auto data = Data{ std::move(func), false };
+    tr_runInEventThread(
+        session,
+        [](void* vdata)
+        {
+            auto* const d = static_cast<Data*>(vdata);
+            d->func();
+            d->done = true;
+        },
+        &data);
+
+    while (!data.done)
+    {
+        std::this_thread::yield();
+    }
+}
+
+} // namespace
+
+// Measures tr_cacheWriteBlock() and tr_cacheReadBlock() with many blocks.
+// The blocks are written in a random order, as they would be by a swarm,
+// so the cache holds lots of short runs whenever it's trimmed.
+// usage: libtransmission-cache-benchmark [blocks] [cache-MiB]
+int main(int argc, char** argv)
+{
+    auto const n_blocks = size_t(argc > 1 ? atoi(argv[1]) : 100000);
+    auto const cache_mib = int64_t(argc > 2 ? atoi(argv[2]) : 64);
+    if (n_blocks == 0 || cache_mib <= 0)
+    {
+        return 1;
+    }
+
+    auto config_dir = std::string{ "transmission-cache-benchmark-XXXXXX" };
+    if (!tr_sys_dir_create_temp(std::data(config_dir), nullptr))
+    {
+        return 1;
+    }
+
+    auto* const session = sessionInit(config_dir);
+    auto* const tor = createTorrent(session, n_blocks);
+    if (tor == nullptr)
+    {
+        return 1;
+    }
+
+    auto order = std::vector<tr_block_index_t>(n_blocks);
+    std::iota(std::begin(order), std::end(order), 0);
+    std::shuffle(std::begin(order), std::end(order), std::mt19937{ 42 });
+
+    printf("%zu blocks of %u bytes through a %lld MiB cache\n", n_blocks, PieceSize, (long long)cache_mib);
+
+    runInEventThread(
+        session,
+        [&]()
+        {
+            auto* const cache = tr_cacheNew(cache_mib * 1024 * 1024);
+            auto block = std::vector<uint8_t>(PieceSize);
+            auto n_errors = size_t{};
+
+            auto const run = [n_blocks](char const* name, auto func)
+            {
+                auto const begin = std::chrono::steady_clock::now();
+                func();
+                auto const msecs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+                printf("%-8s %10.1f ms (%.2f usec/block)\n", name, msecs, msecs * 1000 / double(n_blocks));
+            };
+
+            run("write",
+                [&]()
+                {
+                    auto* const buf = evbuffer_new();
+                    for (auto const piece : order)
+                    {
+                        evbuffer_add(buf, std::data(block), std::size(block));
+                        n_errors += tr_cacheWriteBlock(cache, tor, piece, 0, PieceSize, buf) != 0 ? 1 : 0;
+                    }
+                    evbuffer_free(buf);
+                });
+
+            run("read",
+                [&]()
+                {
+                    for (auto const piece : order)
+                    {
+                        n_errors += tr_cacheReadBlock(cache, tor, piece, 0, PieceSize, std::data(block)) != 0 ? 1 : 0;
+                    }
+                });
+
+            run("flush", [&]() { n_errors += tr_cacheFlushTorrent(cache, tor) != 0 ? 1 : 0; });
+
+            if (n_errors != 0)
+            {
+                printf("%zu errors\n", n_errors);
+            }
+
+            tr_cacheFree(cache);
+        });
+
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+    tr_sessionClose(session);
+    removeRecursive(config_dir);
+    return 0;
+}
@@ -0,0 +1,328 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <event2/buffer.h>
+
+#include "transmission.h"
+#include "cache.h"
+#include "crypto-utils.h" // tr_sha1_digest_t
+#include "inout.h" // tr_ioRead()
+#include "torrent.h"
+#include "trevent.h" // tr_runInEventThread()
+#include "utils.h"
+#include "variant.h"
+
+#include "test-fixtures.h"
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class CacheTest : public SessionTest
+{
+protected:
+    // create a single-file torrent whose blocks are each `piece_size` bytes long
+    tr_torrent* createTorrent(uint64_t piece_size, size_t n_pieces)
+    {
+        auto top = tr_variant{};
+        tr_variantInitDict(&top, 1);
+        auto* const info = tr_variantDictAddDict(&top, TR_KEY_info, 4);
+        tr_variantDictAddStr(info, TR_KEY_name, "cache-test");
+        tr_variantDictAddInt(info, TR_KEY_length, piece_size * n_pieces);
+        tr_variantDictAddInt(info, TR_KEY_piece_length, piece_size);
+        auto const pieces = std::string(n_pieces * sizeof(tr_sha1_digest_t), '\0');
+        tr_variantDictAddRaw(info, TR_KEY_pieces, std::data(pieces), std::size(pieces));
+        auto const benc = tr_variantToStr(&top, TR_VARIANT_FMT_BENC);
+        tr_variantFree(&top);
+
+        auto* const ctor = tr_ctorNew(session_);
+        tr_error* error = nullptr;
+        EXPECT_TRUE(tr_ctorSetMetainfo(ctor, std::data(benc), std::size(benc), &error));
+        EXPECT_EQ(nullptr, error);
+        tr_ctorSetPaused(ctor, TR_FORCE, true);
+        auto* const tor = tr_torrentNew(ctor, nullptr);
+        EXPECT_NE(nullptr, tor);
+        tr_ctorFree(ctor);
+        return tor;
+    }
+
+    // run `func` in the session thread and wait for it to finish
+    void runInEventThread(std::function<void()> func, int msec = 5000)
+    {
+        struct Data
+        {
+            std::function<void()> func;
+            bool done = false;
+        };
+
+        auto data = Data{ std::move(func), false };
+        auto const threadfunc = [](void* vdata) noexcept
+        {
+            auto* const d = static_cast<Data*>(vdata);
+            d->func();
+            d->done = true;
+        };
+
+        tr_runInEventThread(session_, threadfunc, &data);
+        EXPECT_TRUE(waitFor([&data]() { return data.done; }, msec));
+    }
+
+    // the fill pattern for a block, so that misplaced blocks are noticed
+    static std::vector<uint8_t> blockContents(tr_block_index_t block, uint32_t len)
+    {
+        auto ret = std::vector<uint8_t>(len);
+        for (uint32_t i = 0; i < len; ++i)
+        {
+            ret[i] = uint8_t(block * 31 + i);
+        }
+        return ret;
+    }
+};
+
+TEST_F(CacheTest, readWriteFlush)
+{
+    auto constexpr PieceSize = uint64_t{ 1024 * 16 };
+    auto constexpr NumPieces = size_t{ 8 };
+    auto* const tor = createTorrent(PieceSize, NumPieces);
+    auto const block_size = tor->blockSize();
+    auto* const cache = tr_cacheNew(1024 * 1024);
+
+    runInEventThread(
+        [&]()
+        {
+            // write the blocks out of order
+            auto* const buf = evbuffer_new();
+            for (auto const block : { 5, 1, 7, 0, 2, 6 })
+            {
+                auto const contents = blockContents(block, block_size);
+                evbuffer_add(buf, std::data(contents), std::size(contents));
+                EXPECT_EQ(0, tr_cacheWriteBlock(cache, tor, block, 0, block_size, buf));
+                EXPECT_EQ(0, evbuffer_get_length(buf));
+            }
+            evbuffer_free(buf);
+
+            // read them back from the cache
+            auto readbuf = std::vector<uint8_t>(block_size);
+            for (auto const block : { 0, 1, 2, 5, 6, 7 })
+            {
+                EXPECT_EQ(0, tr_cacheReadBlock(cache, tor, block, 0, block_size, std::data(readbuf)));
+                EXPECT_EQ(blockContents(block, block_size), readbuf);
+            }
+
+            // flush everything and confirm the blocks landed on disk
+            EXPECT_EQ(0, tr_cacheFlushTorrent(cache, tor));
+            for (auto const block : { 0, 1, 2, 5, 6, 7 })
+            {
+                EXPECT_EQ(0, tr_ioRead(tor, block, 0, block_size, std::data(readbuf)));
+                EXPECT_EQ(blockContents(block, block_size), readbuf);
+            }
+        });
+
+    tr_cacheFree(cache);
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(CacheTest, setLimit)
+{
+    auto constexpr PieceSize = uint64_t{ 1024 * 16 };
+    auto constexpr NumPieces = size_t{ 8 };
+    auto* const tor = createTorrent(PieceSize, NumPieces);
+    auto const block_size = tor->blockSize();
+    auto* const cache = tr_cacheNew(1024 * 1024);
+
+    runInEventThread(
+        [&]()
+        {
+            auto* const buf = evbuffer_new();
+            for (tr_block_index_t block = 0; block < NumPieces; ++block)
+            {
+                auto const contents = blockContents(block, block_size);
+                evbuffer_add(buf, std::data(contents), std::size(contents));
+                EXPECT_EQ(0, tr_cacheWriteBlock(cache, tor, block, 0, block_size, buf));
+            }
+            evbuffer_free(buf);
+
+            // resizing the cache writes out what it was holding
+            EXPECT_EQ(0, tr_cacheSetLimit(cache, 1024 * 64));
+            EXPECT_EQ(1024 * 64, tr_cacheGetLimit(cache));
+
+            auto readbuf = std::vector<uint8_t>(block_size);
+            for (tr_block_index_t block = 0; block < NumPieces; ++block)
+            {
+                EXPECT_EQ(0, tr_ioRead(tor, block, 0, block_size, std::data(readbuf)));
+                EXPECT_EQ(blockContents(block, block_size), readbuf);
+            }
+
+            // and the smaller cache still works
+            auto* const buf2 = evbuffer_new();
+            for (tr_block_index_t block = 0; block < NumPieces; ++block)
+            {
+                auto const contents = blockContents(block + 1, block_size);
+                evbuffer_add(buf2, std::data(contents), std::size(contents));
+                EXPECT_EQ(0, tr_cacheWriteBlock(cache, tor, block, 0, block_size, buf2));
+            }
+            evbuffer_free(buf2);
+
+            for (tr_block_index_t block = 0; block < NumPieces; ++block)
+            {
+                EXPECT_EQ(0, tr_cacheReadBlock(cache, tor, block, 0, block_size, std::data(readbuf)));
+                EXPECT_EQ(blockContents(block + 1, block_size), readbuf);
+            }
+
+            EXPECT_EQ(0, tr_cacheFlushTorrent(cache, tor));
+        });
+
+    tr_cacheFree(cache);
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(CacheTest, blockReference)
+{
+    auto constexpr PieceSize = uint64_t{ 1024 * 16 };
+    auto constexpr NumPieces = size_t{ 4 };
+    auto* const tor = createTorrent(PieceSize, NumPieces);
+    auto const block_size = tor->blockSize();
+    auto* const cache = tr_cacheNew(1024 * 1024);
+    auto* const out = evbuffer_new();
+
+    runInEventThread(
+        [&]()
+        {
+            auto* const buf = evbuffer_new();
+            auto contents = blockContents(1, block_size);
+            evbuffer_add(buf, std::data(contents), std::size(contents));
+            EXPECT_EQ(0, tr_cacheWriteBlock(cache, tor, 1, 0, block_size, buf));
+
+            // only cached blocks can be referenced
+            EXPECT_FALSE(tr_cacheAddBlockReference(cache, tor, 0, 0, block_size, out));
+            EXPECT_TRUE(tr_cacheAddBlockReference(cache, tor, 1, 0, block_size, out));
+            EXPECT_EQ(block_size, evbuffer_get_length(out));
+
+            // rewriting the block mustn't change what was referenced...
+            contents = blockContents(2, block_size);
+            evbuffer_add(buf, std::data(contents), std::size(contents));
+            EXPECT_EQ(0, tr_cacheWriteBlock(cache, tor, 1, 0, block_size, buf));
+            evbuffer_free(buf);
+
+            // ...and nor must flushing it
+            EXPECT_EQ(0, tr_cacheFlushTorrent(cache, tor));
+        });
+
+    // the reference outlives the cache
+    tr_cacheFree(cache);
+
+    auto readbuf = std::vector<uint8_t>(block_size);
+    evbuffer_remove(out, std::data(readbuf), std::size(readbuf));
+    EXPECT_EQ(blockContents(1, block_size), readbuf);
+    evbuffer_free(out);
+
+    runInEventThread(
+        [&]()
+        {
+            EXPECT_EQ(0, tr_ioRead(tor, 1, 0, block_size, std::data(readbuf)));
+            EXPECT_EQ(blockContents(2, block_size), readbuf);
+        });
+
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(CacheTest, runsCrossSpans)
+{
+    // 16-byte pieces, so each block is 16 bytes too
+    auto constexpr PieceSize = uint64_t{ 16 };
+    auto constexpr NumBlocks = size_t{ 256 };
+    auto* const tor = createTorrent(PieceSize, NumBlocks);
+    auto* const cache = tr_cacheNew(1024 * 1024);
+
+    runInEventThread(
+        [&]()
+        {
+            // runs that straddle the cache's 64-block index spans, with gaps
+            // between them, written back to front
+            auto const blocks = std::vector<tr_block_index_t>{ 255, 192, 191, 130, 128, 127, 65, 64, 63, 0 };
+            auto* const buf = evbuffer_new();
+            for (auto const block : blocks)
+            {
+                auto const contents = blockContents(block, PieceSize);
+                evbuffer_add(buf, std::data(contents), std::size(contents));
+                EXPECT_EQ(0, tr_cacheWriteBlock(cache, tor, block, 0, PieceSize, buf));
+            }
+            evbuffer_free(buf);
+
+            EXPECT_TRUE(tr_cacheHasBlocks(cache, tor, 64, 65));
+            EXPECT_FALSE(tr_cacheHasBlocks(cache, tor, 1, 63));
+            EXPECT_FALSE(tr_cacheHasBlocks(cache, tor, 66, 127));
+            EXPECT_FALSE(tr_cacheHasBlocks(cache, tor, 129, 130));
+            EXPECT_FALSE(tr_cacheHasBlocks(cache, tor, 193, 255));
+
+            // the blocks around the gaps mustn't be written as one run
+            EXPECT_EQ(0, tr_cacheFlushTorrent(cache, tor));
+            EXPECT_FALSE(tr_cacheHasBlocks(cache, tor, 0, NumBlocks));
+            auto readbuf = std::vector<uint8_t>(PieceSize);
+            for (auto const block : blocks)
+            {
+                EXPECT_EQ(0, tr_ioRead(tor, block, 0, PieceSize, std::data(readbuf)));
+                EXPECT_EQ(blockContents(block, PieceSize), readbuf) << block;
+            }
+        });
+
+    tr_cacheFree(cache);
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(CacheTest, manyBlocks)
+{
+    // 16-byte pieces, so each block is 16 bytes too
+    auto constexpr PieceSize = uint64_t{ 16 };
+    auto constexpr NumBlocks = size_t{ 128 * 1024 };
+    auto* const tor = createTorrent(PieceSize, NumBlocks);
+    EXPECT_EQ(NumBlocks, tor->blockCount());
+    auto* const cache = tr_cacheNew(int64_t{ 1024 } * 1024 * 64);
+
+    runInEventThread(
+        [&]()
+        {
+            // write the blocks in a scattered order so that the cache has to
+            // index, trim and flush lots of short runs
+            auto* const buf = evbuffer_new();
+            auto constexpr Stride = size_t{ 7919 };
+            for (size_t i = 0; i < NumBlocks; ++i)
+            {
+                auto const block = tr_block_index_t((i * Stride) % NumBlocks);
+                auto const contents = blockContents(block, PieceSize);
+                evbuffer_add(buf, std::data(contents), std::size(contents));
+                EXPECT_EQ(0, tr_cacheWriteBlock(cache, tor, block, 0, PieceSize, buf));
+            }
+            evbuffer_free(buf);
+
+            // read every block back, whether it's still cached or not
+            auto readbuf = std::vector<uint8_t>(PieceSize);
+            for (tr_block_index_t block = 0; block < NumBlocks; ++block)
+            {
+                EXPECT_EQ(0, tr_cacheReadBlock(cache, tor, block, 0, PieceSize, std::data(readbuf)));
+                EXPECT_EQ(blockContents(block, PieceSize), readbuf);
+            }
+
+            EXPECT_EQ(0, tr_cacheFlushTorrent(cache, tor));
+        },
+        60000);
+
+    tr_cacheFree(cache);
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -12,6 +12,7 @@
 #include <string>
 #include <string_view>
 #include <unordered_set>
+#include <vector>
 
 #include "transmission.h"
 
@@ -121,6 +122,48 @@ TEST(Crypto, sha1)
     EXPECT_EQ("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"sv, tr_sha1_to_string(*hash5));
 }
 
+TEST(Crypto, sha1Batch)
+{
+    // lengths on both sides of the one- and two-tail-block boundaries,
+    // and enough buffers that some of them share a batch unevenly
+    auto constexpr Lengths = std::array<size_t, 13>{ 0, 1, 55, 56, 63, 64, 65, 119, 120, 128, 1000, 16384, 100000 };
+
+    auto buffers = std::vector<std::string>{};
+    for (size_t i = 0; i < 3 * std::size(Lengths); ++i)
+    {
+        auto buf = std::string(Lengths[i % std::size(Lengths)] + i / std::size(Lengths), '\0');
+        tr_rand_buffer(std::data(buf), std::size(buf));
+        buffers.push_back(std::move(buf));
+    }
+
+    for (size_t n = 0; n <= std::size(buffers); ++n)
+    {
+        auto ptrs = std::vector<void const*>{};
+        auto lengths = std::vector<size_t>{};
+        for (size_t i = 0; i < n; ++i)
+        {
+            ptrs.push_back(std::data(buffers[i]));
+            lengths.push_back(std::size(buffers[i]));
+        }
+
+        auto digests = std::vector<tr_sha1_digest_t>(n);
+        EXPECT_TRUE(tr_sha1_batch(n, std::data(ptrs), std::data(lengths), std::data(digests)));
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            auto const expected = tr_sha1(buffers[i]);
+            EXPECT_TRUE(expected);
+            EXPECT_EQ(*expected, digests[i]) << "impl " << tr_sha1_batch_impl() << ", buffer " << i << " of " << n;
+        }
+    }
+
+    auto const* const test = "test";
+    auto const test_len = strlen(test);
+    auto digest = tr_sha1_digest_t{};
+    EXPECT_TRUE(tr_sha1_batch(1, reinterpret_cast<void const* const*>(&test), &test_len, &digest));
+    EXPECT_EQ("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"sv, tr_sha1_to_string(digest));
+}
+
 TEST(Crypto, ssha1)
 {
     struct LocalTest
@@ -0,0 +1,171 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <array>
+#include <atomic>
+
+#include "transmission.h"
+#include "disk-io.h"
+#include "session.h"
+#include "trevent.h"
+
+#include "test-fixtures.h"
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class DiskIoTest : public SessionTest
+{
+protected:
+    struct Job
+    {
+        tr_session* session = nullptr;
+        std::atomic<bool> worked = false;
+        bool worked_in_session_thread = false;
+        bool done = false;
+        bool done_in_session_thread = false;
+        bool cancelled = false;
+    };
+
+    static void workFunc(void* vjob)
+    {
+        auto* const job = static_cast<Job*>(vjob);
+        job->worked_in_session_thread = tr_amInEventThread(job->session);
+        job->worked = true;
+    }
+
+    static void doneFunc(void* vjob, bool cancelled)
+    {
+        auto* const job = static_cast<Job*>(vjob);
+        job->done_in_session_thread = tr_amInEventThread(job->session);
+        job->cancelled = cancelled;
+        job->done = true;
+    }
+};
+
+TEST_F(DiskIoTest, callbacksRunInSessionThread)
+{
+    auto jobs = std::array<Job, 32>{};
+
+    for (auto& job : jobs)
+    {
+        job.session = session_;
+        tr_diskIoAdd(session_->disk_io, this, workFunc, doneFunc, &job);
+    }
+
+    for (auto& job : jobs)
+    {
+        EXPECT_TRUE(waitFor([&job]() { return job.done; }, 5000));
+        EXPECT_TRUE(job.worked);
+        EXPECT_FALSE(job.worked_in_session_thread);
+        EXPECT_TRUE(job.done_in_session_thread);
+        EXPECT_FALSE(job.cancelled);
+    }
+}
+
+TEST_F(DiskIoTest, waitRunsCallback)
+{
+    struct Data
+    {
+        Job job;
+        bool done_after_wait = false;
+        bool finished = false;
+    };
+
+    auto data = Data{};
+    data.job.session = session_;
+
+    tr_runInEventThread(
+        session_,
+        [](void* vdata)
+        {
+            auto* const d = static_cast<Data*>(vdata);
+            auto* const io = d->job.session->disk_io;
+            auto const id = tr_diskIoAdd(io, d, workFunc, doneFunc, &d->job);
+            tr_diskIoWait(io, id);
+            d->done_after_wait = d->job.done;
+
+            // waiting on a job whose callback has already run is a no-op
+            tr_diskIoWait(io, id);
+            d->finished = true;
+        },
+        &data);
+
+    EXPECT_TRUE(waitFor([&data]() { return data.finished; }, 5000));
+    EXPECT_TRUE(data.done_after_wait);
+    EXPECT_TRUE(data.job.worked);
+    EXPECT_TRUE(data.job.done_in_session_thread);
+}
+
+TEST_F(DiskIoTest, cancel)
+{
+    auto job = Job{};
+    job.session = session_;
+
+    tr_runInEventThread(
+        session_,
+        [](void* vjob)
+        {
+            auto* const j = static_cast<Job*>(vjob);
+            auto* const io = j->session->disk_io;
+            tr_diskIoAdd(io, j, workFunc, doneFunc, j);
+            tr_diskIoCancel(io, j);
+        },
+        &job);
+
+    EXPECT_TRUE(waitFor([&job]() { return job.done; }, 5000));
+    EXPECT_TRUE(job.cancelled);
+    EXPECT_TRUE(job.done_in_session_thread);
+}
+
+TEST_F(DiskIoTest, threadCountSetting)
+{
+    tr_sessionSetDiskIoThreads(session_, 3);
+    EXPECT_EQ(3, tr_sessionGetDiskIoThreads(session_));
+
+    auto settings = tr_variant{};
+    tr_variantInitDict(&settings, 0);
+    tr_sessionGetSettings(session_, &settings);
+    auto i = int64_t{};
+    EXPECT_TRUE(tr_variantDictFindInt(&settings, TR_KEY_disk_io_threads, &i));
+    EXPECT_EQ(3, i);
+    tr_variantFree(&settings);
+
+    // zero or fewer threads still leaves one to do the work
+    tr_sessionSetDiskIoThreads(session_, 0);
+    EXPECT_EQ(1, tr_sessionGetDiskIoThreads(session_));
+}
+
+TEST_F(DiskIoTest, jobsRunAfterResizing)
+{
+    for (auto const n_threads : { 8, 1, 4 })
+    {
+        tr_sessionSetDiskIoThreads(session_, n_threads);
+
+        auto jobs = std::array<Job, 32>{};
+        for (auto& job : jobs)
+        {
+            job.session = session_;
+            tr_diskIoAdd(session_->disk_io, this, workFunc, doneFunc, &job);
+        }
+
+        for (auto& job : jobs)
+        {
+            EXPECT_TRUE(waitFor([&job]() { return job.done; }, 5000));
+            EXPECT_TRUE(job.worked);
+            EXPECT_FALSE(job.cancelled);
+        }
+    }
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -0,0 +1,135 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "file.h"
+#include "trevent.h"
+#include "variant.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Measures how fast other threads can post tasks to the event thread,
+// and how long the event thread takes to wake up for a lone task.
+// usage: libtransmission-event-benchmark [posting-threads] [tasks-per-thread]
+int main(int argc, char** argv)
+{
+    auto const n_threads = size_t(argc > 1 ? atoi(argv[1]) : 4);
+    auto const n_tasks = size_t(argc > 2 ? atoi(argv[2]) : 250000);
+    if (n_threads == 0)
+    {
+        return 1;
+    }
+
+    auto config_dir = std::string{ "transmission-event-benchmark-XXXXXX" };
+    if (!tr_sys_dir_create_temp(std::data(config_dir), nullptr))
+    {
+        return 1;
+    }
+
+    auto settings = tr_variant{};
+    tr_variantInitDict(&settings, 0);
+    tr_sessionGetDefaultSettings(&settings);
+    tr_variantDictAddBool(&settings, TR_KEY_dht_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_lpd_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_utp_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_rpc_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_port_forwarding_enabled, false);
+    tr_variantDictAddInt(&settings, TR_KEY_message_level, TR_LOG_ERROR);
+    auto* const session = tr_sessionInit(config_dir.c_str(), false, &settings);
+    tr_variantFree(&settings);
+
+    using clock = std::chrono::steady_clock;
+
+    // throughput: every thread posts its tasks as fast as it can
+    static auto n_run = std::atomic<size_t>{};
+    auto const begin = clock::now();
+    auto threads = std::vector<std::thread>{};
+    for (size_t i = 0; i < n_threads; ++i)
+    {
+        threads.emplace_back(
+            [session, n_tasks]()
+            {
+                for (size_t j = 0; j < n_tasks; ++j)
+                {
+                    tr_runInEventThread(
+                        session,
+                        [](void* /*user_data*/) { ++n_run; },
+                        nullptr);
+                }
+            });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    while (n_run < n_threads * n_tasks)
+    {
+        std::this_thread::yield();
+    }
+
+    auto const secs = std::chrono::duration<double>(clock::now() - begin).count();
+    printf("%zu threads: %.0f tasks/s\n", n_threads, double(n_threads * n_tasks) / secs);
+
+    // wake latency: post a task to the idle event thread and wait for it to run
+    struct Ping
+    {
+        clock::time_point posted_at;
+        std::atomic<bool> done;
+        clock::time_point ran_at;
+    };
+
+    auto latencies = std::vector<double>{};
+    for (int i = 0; i < 20000; ++i)
+    {
+        auto ping = Ping{ clock::now(), false, {} };
+        tr_runInEventThread(
+            session,
+            [](void* vping)
+            {
+                auto* const p = static_cast<Ping*>(vping);
+                p->ran_at = clock::now();
+                p->done = true;
+            },
+            &ping);
+
+        while (!ping.done)
+        {
+        }
+
+        latencies.push_back(std::chrono::duration<double, std::micro>(ping.ran_at - ping.posted_at).count());
+    }
+
+    std::sort(std::begin(latencies), std::end(latencies));
+    printf(
+        "wake latency: p50 %.1f usec, p99 %.1f usec\n",
+        latencies[std::size(latencies) / 2],
+        latencies[std::size(latencies) * 99 / 100]);
+
+    auto stats = tr_event_stats{};
+    tr_eventGetStats(session, &stats);
+    printf(
+        "tasks run %llu, wakeups %llu, max batch %zu, avg wait %llu usec, max wait %llu usec\n",
+        (unsigned long long)stats.tasks_run,
+        (unsigned long long)stats.wakeups,
+        stats.max_batch,
+        (unsigned long long)stats.avg_wait_usec,
+        (unsigned long long)stats.max_wait_usec);
+
+    tr_sessionClose(session);
+    tr_sys_path_remove(config_dir.c_str(), nullptr);
+    return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <string>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "transmission.h"
+#include "fdlimit.h"
+#include "file.h"
+#include "utils.h"
+
+#include "test-fixtures.h"
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class FdlimitTest : public SessionTest
+{
+protected:
+    static auto constexpr TorrentA = 1001;
+    static auto constexpr TorrentB = 1002;
+
+    // checks out a file in the pool, creating it if it doesn't exist yet
+    tr_sys_file_t checkout(int torrent_id, tr_file_index_t i) const
+    {
+        auto const filename = tr_strvPath(sandboxDir(), "fdlimit-" + std::to_string(torrent_id), std::to_string(i));
+        return tr_fdFileCheckout(session_, torrent_id, i, filename.c_str(), true, TR_PREALLOCATE_NONE, 0);
+    }
+
+    // n.b. finding a file marks it as the most recently used
+    bool isOpen(int torrent_id, tr_file_index_t i) const
+    {
+        return tr_fdFileGetCached(session_, torrent_id, i, false) != TR_BAD_SYS_FILE;
+    }
+
+    tr_open_file_stats stats() const
+    {
+        auto ret = tr_open_file_stats{};
+        tr_fdGetFileStats(session_, &ret);
+        return ret;
+    }
+};
+
+TEST_F(FdlimitTest, evictsLeastRecentlyUsed)
+{
+    tr_fdSetFileLimit(session_, 4);
+    auto const evictions = stats().evictions;
+
+    for (tr_file_index_t i = 0; i < 4; ++i)
+    {
+        EXPECT_NE(TR_BAD_SYS_FILE, checkout(TorrentA, i));
+    }
+    EXPECT_EQ(4U, stats().open_files);
+    EXPECT_EQ(evictions, stats().evictions);
+
+    // using file 0 again makes file 1 the least recently used
+    EXPECT_NE(TR_BAD_SYS_FILE, checkout(TorrentA, 0));
+    EXPECT_NE(TR_BAD_SYS_FILE, checkout(TorrentA, 4));
+    EXPECT_EQ(4U, stats().open_files);
+    EXPECT_EQ(evictions + 1, stats().evictions);
+    EXPECT_FALSE(isOpen(TorrentA, 1));
+
+    // these lookups leave file 0 as the least recently used
+    EXPECT_TRUE(isOpen(TorrentA, 0));
+    EXPECT_TRUE(isOpen(TorrentA, 2));
+    EXPECT_TRUE(isOpen(TorrentA, 3));
+    EXPECT_TRUE(isOpen(TorrentA, 4));
+
+    EXPECT_NE(TR_BAD_SYS_FILE, checkout(TorrentA, 5));
+    EXPECT_EQ(evictions + 2, stats().evictions);
+    EXPECT_FALSE(isOpen(TorrentA, 0));
+    EXPECT_TRUE(isOpen(TorrentA, 5));
+
+    tr_fdTorrentClose(session_, TorrentA);
+}
+
+TEST_F(FdlimitTest, shrinkingEvictsOldestFiles)
+{
+    tr_fdSetFileLimit(session_, 8);
+    auto const evictions = stats().evictions;
+
+    for (tr_file_index_t i = 0; i < 6; ++i)
+    {
+        EXPECT_NE(TR_BAD_SYS_FILE, checkout(TorrentA, i));
+    }
+
+    tr_fdSetFileLimit(session_, 2);
+    EXPECT_EQ(2U, tr_fdGetFileLimit(session_));
+    EXPECT_EQ(2U, stats().limit);
+    EXPECT_EQ(2U, stats().open_files);
+    EXPECT_EQ(evictions + 4, stats().evictions);
+    EXPECT_TRUE(isOpen(TorrentA, 4));
+    EXPECT_TRUE(isOpen(TorrentA, 5));
+
+    // growing the pool again doesn't reopen anything
+    tr_fdSetFileLimit(session_, 8);
+    EXPECT_EQ(2U, stats().open_files);
+    EXPECT_FALSE(isOpen(TorrentA, 0));
+
+    tr_fdTorrentClose(session_, TorrentA);
+}
+
+TEST_F(FdlimitTest, removesOneTorrentsFiles)
+{
+    tr_fdSetFileLimit(session_, 8);
+    auto const evictions = stats().evictions;
+
+    EXPECT_NE(TR_BAD_SYS_FILE, checkout(TorrentA, 0));
+    EXPECT_NE(TR_BAD_SYS_FILE, checkout(TorrentB, 0));
+    EXPECT_NE(TR_BAD_SYS_FILE, checkout(TorrentA, 1));
+    EXPECT_EQ(3U, stats().open_files);
+
+    // closing a torrent's files isn't counted as evicting them
+    tr_fdTorrentClose(session_, TorrentA);
+    EXPECT_EQ(1U, stats().open_files);
+    EXPECT_EQ(evictions, stats().evictions);
+    EXPECT_FALSE(isOpen(TorrentA, 0));
+    EXPECT_FALSE(isOpen(TorrentA, 1));
+    EXPECT_TRUE(isOpen(TorrentB, 0));
+
+    tr_fdTorrentClose(session_, TorrentB);
+    EXPECT_EQ(0U, stats().open_files);
+}
+
+#ifndef _WIN32
+
+TEST_F(FdlimitTest, limitFitsInDescriptorLimit)
+{
+    // more files than any process may have open
+    tr_fdSetFileLimit(session_, size_t{ 1 } << 30);
+
+    auto rl = rlimit{};
+    ASSERT_EQ(0, getrlimit(RLIMIT_NOFILE, &rl));
+    if (rl.rlim_cur != RLIM_INFINITY)
+    {
+        EXPECT_LT(rlim_t(tr_fdGetFileLimit(session_)), rl.rlim_cur);
+    }
+
+    EXPECT_LE(1U, tr_fdGetFileLimit(session_));
+}
+
+#endif
+
+} // namespace test
+
+} // namespace libtransmission
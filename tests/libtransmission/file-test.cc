@@ -1139,6 +1139,54 @@ TEST_F(FileTest, fileReadWriteSeek)
     tr_sys_path_remove(path1.c_str(), nullptr);
 }
 
+TEST_F(FileTest, fileReadWriteVectored)
+{
+    auto const test_dir = createTestDir(currentTestName());
+
+    auto const path1 = tr_strvPath(test_dir, "a"sv);
+    auto const fd = tr_sys_file_open(path1.c_str(), TR_SYS_FILE_READ | TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600, nullptr);
+
+    auto hello = std::array<char, 5>{ 'h', 'e', 'l', 'l', 'o' };
+    auto space = std::array<char, 1>{ ' ' };
+    auto world = std::array<char, 5>{ 'w', 'o', 'r', 'l', 'd' };
+    auto const out = std::array<tr_sys_iovec, 3>{ tr_sys_iovec{ hello.data(), hello.size() },
+                                                  tr_sys_iovec{ space.data(), space.size() },
+                                                  tr_sys_iovec{ world.data(), world.size() } };
+
+    uint64_t n;
+    tr_error* err = nullptr;
+    EXPECT_TRUE(tr_sys_file_writev_at(fd, out.data(), out.size(), 2, &n, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(11, n);
+
+    auto buf = std::array<char, 100>{};
+    EXPECT_TRUE(tr_sys_file_read_at(fd, buf.data(), buf.size(), 2, &n, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(11, n);
+    EXPECT_EQ(0, memcmp("hello world", buf.data(), 11));
+
+    // scatter the data back out across uneven buffers
+    auto a = std::array<char, 3>{};
+    auto b = std::array<char, 7>{};
+    auto const in = std::array<tr_sys_iovec, 2>{ tr_sys_iovec{ a.data(), a.size() }, tr_sys_iovec{ b.data(), b.size() } };
+    EXPECT_TRUE(tr_sys_file_readv_at(fd, in.data(), in.size(), 3, &n, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(10, n);
+    EXPECT_EQ(0, memcmp("ell", a.data(), 3));
+    EXPECT_EQ(0, memcmp("o world", b.data(), 7));
+
+    // a short read stops at EOF
+    EXPECT_TRUE(tr_sys_file_readv_at(fd, in.data(), in.size(), 8, &n, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(5, n);
+    EXPECT_EQ(0, memcmp("wor", a.data(), 3));
+    EXPECT_EQ(0, memcmp("ld", b.data(), 2));
+
+    tr_sys_file_close(fd, nullptr);
+
+    tr_sys_path_remove(path1.c_str(), nullptr);
+}
+
 TEST_F(FileTest, fileTruncate)
 {
     auto const test_dir = createTestDir(currentTestName());
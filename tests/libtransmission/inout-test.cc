@@ -0,0 +1,270 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <event2/buffer.h>
+
+#include "transmission.h"
+#include "cache.h" // tr_cacheWriteBlock()
+#include "fdlimit.h"
+#include "file.h" // tr_sys_iovec
+#include "inout.h"
+#include "torrent.h"
+#include "trevent.h"
+#include "utils.h" // tr_strvPath()
+#include "variant.h"
+
+#include "test-fixtures.h"
+
+using namespace std::literals;
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class InoutTest : public SessionTest
+{
+protected:
+    // where findFileCached() thinks a file is, or an empty string if it can't find it
+    static std::string findCached(tr_torrent* tor, tr_file_index_t i)
+    {
+        auto const lock = tor->unique_lock();
+        auto filename = std::string{};
+        return tor->findFileCached(filename, i) ? filename : std::string{};
+    }
+};
+
+TEST_F(InoutTest, vectoredIoSpansFiles)
+{
+    // the zero torrent's first file is 1048576 bytes long,
+    // so this span straddles the first and second files
+    auto* const tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+    auto constexpr Begin = uint64_t{ 1048576 - 1000 };
+    auto const piece = tr_piece_index_t(Begin / tor->pieceSize());
+    auto const offset = uint32_t(Begin % tor->pieceSize());
+
+    auto a = std::vector<uint8_t>(1500);
+    auto b = std::vector<uint8_t>(700);
+    std::iota(std::begin(a), std::end(a), uint8_t{ 1 });
+    std::iota(std::begin(b), std::end(b), uint8_t{ 7 });
+    auto const out = std::array<tr_sys_iovec, 2>{ tr_sys_iovec{ std::data(a), std::size(a) },
+                                                  tr_sys_iovec{ std::data(b), std::size(b) } };
+    EXPECT_EQ(0, tr_ioWritev(tor, piece, offset, std::data(out), std::size(out)));
+
+    // read it back as one buffer...
+    auto all = std::vector<uint8_t>(std::size(a) + std::size(b));
+    EXPECT_EQ(0, tr_ioRead(tor, piece, offset, std::size(all), std::data(all)));
+    EXPECT_TRUE(std::equal(std::begin(a), std::end(a), std::begin(all)));
+    EXPECT_TRUE(std::equal(std::begin(b), std::end(b), std::begin(all) + std::size(a)));
+
+    // ...and scattered across differently-sized buffers
+    auto c = std::vector<uint8_t>(100);
+    auto d = std::vector<uint8_t>(std::size(all) - std::size(c));
+    auto const in = std::array<tr_sys_iovec, 2>{ tr_sys_iovec{ std::data(c), std::size(c) },
+                                                 tr_sys_iovec{ std::data(d), std::size(d) } };
+    EXPECT_EQ(0, tr_ioReadv(tor, piece, offset, std::data(in), std::size(in)));
+    EXPECT_TRUE(std::equal(std::begin(c), std::end(c), std::begin(all)));
+    EXPECT_TRUE(std::equal(std::begin(d), std::end(d), std::begin(all) + std::size(c)));
+
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(InoutTest, segmentsOutliveClosedFiles)
+{
+    auto* const tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+    auto constexpr Begin = uint64_t{ 1048576 - 1000 };
+    auto constexpr Len = uint32_t{ 2000 };
+    auto const piece = tr_piece_index_t(Begin / tor->pieceSize());
+    auto const offset = uint32_t(Begin % tor->pieceSize());
+
+    auto expected = std::vector<uint8_t>(Len);
+    EXPECT_EQ(0, tr_ioRead(tor, piece, offset, Len, std::data(expected)));
+
+    struct Data
+    {
+        tr_torrent* tor;
+        tr_piece_index_t piece;
+        uint32_t offset;
+        std::vector<uint8_t> got;
+        size_t n_segments = 0;
+        size_t open_files_after_close = 0;
+        int err = -1;
+        bool done = false;
+    };
+
+    auto data = Data{ tor, piece, offset, std::vector<uint8_t>(Len) };
+    tr_runInEventThread(
+        session_,
+        [](void* vdata)
+        {
+            auto* const d = static_cast<Data*>(vdata);
+            auto* const session = d->tor->session;
+            auto segments = std::vector<tr_io_segment>{};
+            d->err = tr_ioOpenSegments(d->tor, false, d->piece, d->offset, std::size(d->got), segments);
+            d->n_segments = std::size(segments);
+
+            // the pool forgets the files, but the segments' pinned descriptors stay usable
+            tr_fdTorrentClose(session, d->tor->uniqueId);
+            auto stats = tr_open_file_stats{};
+            tr_fdGetFileStats(session, &stats);
+            d->open_files_after_close = stats.open_files;
+
+            if (d->err == 0)
+            {
+                auto const iov = tr_sys_iovec{ std::data(d->got), std::size(d->got) };
+                d->err = tr_ioSegmentsReadv(segments, &iov, 1, nullptr);
+            }
+
+            tr_ioCloseSegments(session, segments);
+            d->done = true;
+        },
+        &data);
+
+    EXPECT_TRUE(waitFor([&data]() { return data.done; }, 5000));
+    EXPECT_EQ(0, data.err);
+    EXPECT_EQ(2U, data.n_segments);
+    EXPECT_EQ(0U, data.open_files_after_close);
+    EXPECT_EQ(expected, data.got);
+
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(InoutTest, cachedLocationForgetsVanishedFiles)
+{
+    auto* const tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+    auto const filename = tr_strvPath(tor->currentDir().sv(), tor->fileSubpath(0));
+    EXPECT_EQ(filename, findCached(tor, 0));
+
+    // the file vanishes behind our back. The cached location isn't
+    // rechecked until opening the file fails...
+    tr_fdTorrentClose(session_, tor->uniqueId);
+    EXPECT_TRUE(tr_sys_path_remove(filename.c_str(), nullptr));
+    EXPECT_EQ(filename, findCached(tor, 0));
+
+    auto buf = std::vector<uint8_t>(1024);
+    EXPECT_EQ(ENOENT, tr_ioRead(tor, 0, 0, std::size(buf), std::data(buf)));
+
+    // ...and then it's forgotten
+    EXPECT_EQ(""s, findCached(tor, 0));
+
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(InoutTest, cachedLocationFollowsSetLocation)
+{
+    auto* const tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+    EXPECT_EQ(tr_strvPath(tor->currentDir().sv(), tor->fileSubpath(0)), findCached(tor, 0));
+
+    auto const target_dir = tr_strvPath(sandboxDir(), "target");
+    auto state = int{ -1 };
+    tr_torrentSetLocation(tor, target_dir.c_str(), true, nullptr, &state);
+    EXPECT_TRUE(waitFor([&state]() { return state == TR_LOC_DONE; }, 3000));
+
+    for (tr_file_index_t i = 0, n = tor->fileCount(); i < n; ++i)
+    {
+        EXPECT_EQ(tr_strvPath(target_dir, tor->fileSubpath(i)), findCached(tor, i));
+    }
+
+    auto buf = std::vector<uint8_t>(1024);
+    EXPECT_EQ(0, tr_ioRead(tor, 0, 0, std::size(buf), std::data(buf)));
+
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+class InoutIncompleteDirTest : public InoutTest
+{
+protected:
+    void SetUp() override
+    {
+        tr_variantDictAddStr(settings(), TR_KEY_download_dir, "Downloads");
+        tr_variantDictAddStr(settings(), TR_KEY_incomplete_dir, "Incomplete");
+        tr_variantDictAddBool(settings(), TR_KEY_incomplete_dir_enabled, true);
+
+        InoutTest::SetUp();
+    }
+};
+
+TEST_F(InoutIncompleteDirTest, cachedLocationFollowsCompletedTorrent)
+{
+    // the zero torrent's first file is missing its first piece
+    auto* const tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, false);
+    auto const* const incomplete_dir = tr_sessionGetIncompleteDir(session_);
+    EXPECT_EQ(tr_strvPath(incomplete_dir, tor->fileSubpath(0)) + ".part", findCached(tor, 0));
+    EXPECT_EQ(tr_strvPath(incomplete_dir, tor->fileSubpath(1)), findCached(tor, 1));
+
+    // fill in the missing piece the way a peer would, so that the first file
+    // loses its ".part" suffix and then every file moves out of the incomplete dir
+    struct Data
+    {
+        tr_torrent* tor;
+        bool done = false;
+    };
+
+    auto data = Data{ tor };
+    tr_runInEventThread(
+        session_,
+        [](void* vdata)
+        {
+            auto* const d = static_cast<Data*>(vdata);
+            auto const zeroes = std::vector<uint8_t>(d->tor->blockSize());
+            auto* const buf = evbuffer_new();
+            auto const [begin, end] = d->tor->blockSpanForPiece(0);
+
+            for (auto block = begin; block < end; ++block)
+            {
+                evbuffer_add(buf, std::data(zeroes), std::size(zeroes));
+                tr_cacheWriteBlock(d->tor->session->cache, d->tor, 0, block * d->tor->blockSize(), d->tor->blockSize(), buf);
+                tr_torrentGotBlock(d->tor, block);
+            }
+
+            evbuffer_free(buf);
+            d->done = true;
+        },
+        &data);
+    EXPECT_TRUE(waitFor([&data]() { return data.done; }, 3000));
+
+    auto const* const download_dir = tr_sessionGetDownloadDir(session_);
+    auto const moved = [tor, download_dir]()
+    {
+        for (tr_file_index_t i = 0, n = tor->fileCount(); i < n; ++i)
+        {
+            if (findCached(tor, i) != tr_strvPath(download_dir, tor->fileSubpath(i)))
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+    EXPECT_TRUE(waitFor(moved, 3000));
+    EXPECT_EQ(0U, tr_torrentStat(tor)->leftUntilDone);
+
+    for (tr_file_index_t i = 0, n = tor->fileCount(); i < n; ++i)
+    {
+        EXPECT_TRUE(tr_sys_path_exists(findCached(tor, i).c_str(), nullptr));
+    }
+
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+} // namespace test
+
+} // namespace libtransmission
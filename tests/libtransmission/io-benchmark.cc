@@ -0,0 +1,193 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "crypto-utils.h"
+#include "file.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+auto constexpr BlockSize = size_t{ 16 * 1024 };
+
+// The number of read and write syscalls this process has made so far,
+// or zero where the platform doesn't say
+std::pair<uint64_t, uint64_t> getSyscallCounts()
+{
+    auto syscr = uint64_t{};
+    auto syscw = uint64_t{};
+
+#ifdef __linux__
+    if (auto* const in = fopen("/proc/self/io", "r"); in != nullptr)
+    {
+        char line[128];
+        while (fgets(line, sizeof(line), in) != nullptr)
+        {
+            unsigned long long val = 0;
+            if (sscanf(line, "syscr: %llu", &val) == 1)
+            {
+                syscr = val;
+            }
+            else if (sscanf(line, "syscw: %llu", &val) == 1)
+            {
+                syscw = val;
+            }
+        }
+        fclose(in);
+    }
+#endif
+
+    return { syscr, syscw };
+}
+
+} // namespace
+
+// Measures writing and reading runs of cached blocks, the way the cache
+// flushes them. The blocks live in scattered slots of an arena, so they're
+// written one syscall per block, copied into a staging buffer and written
+// with one syscall, or gathered straight from the arena with one writev.
+// usage: libtransmission-io-benchmark [blocks-per-run] [MiB-to-write]
+int main(int argc, char** argv)
+{
+    auto const run_len = size_t(argc > 1 ? atoi(argv[1]) : 16);
+    auto const total_size = size_t(argc > 2 ? atoi(argv[2]) : 256) * 1024 * 1024;
+    auto const n_runs = total_size / (run_len * BlockSize);
+    if (run_len == 0 || n_runs == 0)
+    {
+        return 1;
+    }
+
+    auto filename = std::string{ "transmission-io-benchmark-XXXXXX" };
+    auto const fd = tr_sys_file_open_temp(std::data(filename), nullptr);
+    if (fd == TR_BAD_SYS_FILE)
+    {
+        return 1;
+    }
+
+    // the arena, and the slots that each run's blocks are in
+    auto arena = std::vector<uint8_t>(run_len * 4 * BlockSize);
+    tr_rand_buffer(std::data(arena), std::size(arena));
+    auto slots = std::vector<size_t>(run_len * 4);
+    std::iota(std::begin(slots), std::end(slots), 0);
+    std::shuffle(std::begin(slots), std::end(slots), std::mt19937{ 42 });
+    slots.resize(run_len);
+
+    auto iov = std::vector<tr_sys_iovec>{};
+    for (auto const slot : slots)
+    {
+        iov.push_back({ std::data(arena) + slot * BlockSize, BlockSize });
+    }
+
+    auto staging = std::vector<uint8_t>(run_len * BlockSize);
+
+    // fill the file first so that none of the timed writes have to grow it
+    for (size_t i = 0; i < n_runs; ++i)
+    {
+        tr_sys_file_write_at(fd, std::data(staging), std::size(staging), uint64_t(i) * std::size(staging), nullptr, nullptr);
+    }
+
+    auto const run = [&](char const* name, auto io_run)
+    {
+        auto const [syscr_before, syscw_before] = getSyscallCounts();
+        auto const begin = std::chrono::steady_clock::now();
+
+        auto ok = true;
+        for (size_t i = 0; ok && i < n_runs; ++i)
+        {
+            ok = io_run(uint64_t(i) * run_len * BlockSize);
+        }
+
+        auto const secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        auto const [syscr_after, syscw_after] = getSyscallCounts();
+        auto const n_syscalls = (syscr_after - syscr_before) + (syscw_after - syscw_before);
+        printf(
+            "%-16s %8.1f MiB/s %8.2f syscalls per run%s\n",
+            name,
+            double(n_runs * run_len * BlockSize) / secs / (1024 * 1024),
+            double(n_syscalls) / double(n_runs),
+            ok ? "" : " (failed)");
+    };
+
+    printf("%zu runs of %zu %zu KiB blocks\n", n_runs, run_len, BlockSize / 1024);
+
+    run("write per-block",
+        [&](uint64_t offset)
+        {
+            for (auto const& vec : iov)
+            {
+                if (!tr_sys_file_write_at(fd, vec.base, vec.len, offset, nullptr, nullptr))
+                {
+                    return false;
+                }
+                offset += vec.len;
+            }
+            return true;
+        });
+
+    run("write staged",
+        [&](uint64_t offset)
+        {
+            auto* walk = std::data(staging);
+            for (auto const& vec : iov)
+            {
+                walk = std::copy_n(static_cast<uint8_t const*>(vec.base), vec.len, walk);
+            }
+            return tr_sys_file_write_at(fd, std::data(staging), std::size(staging), offset, nullptr, nullptr);
+        });
+
+    run("writev",
+        [&](uint64_t offset) { return tr_sys_file_writev_at(fd, std::data(iov), std::size(iov), offset, nullptr, nullptr); });
+
+    run("read per-block",
+        [&](uint64_t offset)
+        {
+            for (auto const& vec : iov)
+            {
+                if (!tr_sys_file_read_at(fd, vec.base, vec.len, offset, nullptr, nullptr))
+                {
+                    return false;
+                }
+                offset += vec.len;
+            }
+            return true;
+        });
+
+    run("read staged",
+        [&](uint64_t offset)
+        {
+            if (!tr_sys_file_read_at(fd, std::data(staging), std::size(staging), offset, nullptr, nullptr))
+            {
+                return false;
+            }
+
+            auto const* walk = std::data(staging);
+            for (auto const& vec : iov)
+            {
+                std::copy_n(walk, vec.len, static_cast<uint8_t*>(vec.base));
+                walk += vec.len;
+            }
+            return true;
+        });
+
+    run("readv",
+        [&](uint64_t offset) { return tr_sys_file_readv_at(fd, std::data(iov), std::size(iov), offset, nullptr, nullptr); });
+
+    tr_sys_file_close(fd, nullptr);
+    tr_sys_path_remove(filename.c_str(), nullptr);
+    return 0;
+}
@@ -0,0 +1,368 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "crypto.h"
+#include "crypto-utils.h"
+#include "fdlimit.h"
+#include "net.h"
+#include "peer-io.h"
+#include "peer-socket.h"
+#include "session.h"
+#include "trevent.h"
+
+#include "test-fixtures.h"
+
+#include <event2/buffer.h>
+#include <event2/util.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class PeerIoTest : public SessionTest
+{
+protected:
+    // the fields of a BitTorrent handshake, which are read one at a time
+    static auto constexpr HandshakeFields = std::array<size_t, 5>{ 1, 19, 8, 20, 20 };
+
+    enum class How
+    {
+        ReadBytes, // wait for the whole message, then tr_peerIoReadBytes()
+        ReadBytesToBuf, // tr_peerIoReadBytesToBuf() whatever has arrived
+        Drain // wait for the whole message, then tr_peerIoDrain()
+    };
+
+    static How how(size_t message_index)
+    {
+        return static_cast<How>(message_index % 3);
+    }
+
+    // Reads a handshake and then length-prefixed messages, the way
+    // tr_handshake and tr_peerMsgs do. Runs in the session thread
+    struct Reader
+    {
+        tr_session* session = nullptr;
+        tr_peerIo* io = nullptr;
+        size_t n_messages = 0;
+
+        size_t field = 0;
+        std::string handshake;
+        size_t inbuf_at_switch = 0;
+
+        std::vector<std::string> messages;
+        std::optional<uint32_t> message_len;
+        evbuffer* partial = evbuffer_new();
+
+        std::atomic<bool> done = false;
+        std::atomic<bool> error = false;
+
+        ~Reader()
+        {
+            evbuffer_free(partial);
+        }
+    };
+
+    static ReadState canRead(tr_peerIo* io, void* vreader, size_t* /*piece*/)
+    {
+        auto* const r = static_cast<Reader*>(vreader);
+        auto* const inbuf = tr_peerIoGetReadBuffer(io);
+        auto const n_available = evbuffer_get_length(inbuf);
+
+        if (r->field < std::size(HandshakeFields))
+        {
+            auto const n = HandshakeFields[r->field];
+            if (n_available < n)
+            {
+                return READ_LATER;
+            }
+
+            auto buf = std::string(n, '\0');
+            tr_peerIoReadBytes(io, inbuf, std::data(buf), n);
+            r->handshake += buf;
+
+            if (++r->field == std::size(HandshakeFields))
+            {
+                // the handshake is done; everything after it gets
+                // decrypted in place as it arrives
+                r->inbuf_at_switch = evbuffer_get_length(inbuf);
+                tr_peerIoSetDecryptOnReceive(io);
+            }
+
+            return READ_NOW;
+        }
+
+        if (!r->message_len)
+        {
+            if (n_available < sizeof(uint32_t))
+            {
+                return READ_LATER;
+            }
+
+            auto len = uint32_t{};
+            tr_peerIoReadUint32(io, inbuf, &len);
+            r->message_len = len;
+            return READ_NOW;
+        }
+
+        auto const len = *r->message_len;
+        auto const index = std::size(r->messages);
+
+        switch (how(index))
+        {
+        case How::ReadBytes:
+            if (n_available < len)
+            {
+                return READ_LATER;
+            }
+
+            r->messages.emplace_back(len, '\0');
+            tr_peerIoReadBytes(io, inbuf, std::data(r->messages.back()), len);
+            break;
+
+        case How::ReadBytesToBuf:
+            {
+                auto const n_have = evbuffer_get_length(r->partial);
+                tr_peerIoReadBytesToBuf(io, inbuf, r->partial, std::min(size_t{ len } - n_have, n_available));
+                if (evbuffer_get_length(r->partial) < len)
+                {
+                    return READ_LATER;
+                }
+
+                auto& message = r->messages.emplace_back(len, '\0');
+                evbuffer_remove(r->partial, std::data(message), len);
+                break;
+            }
+
+        case How::Drain:
+            if (n_available < len)
+            {
+                return READ_LATER;
+            }
+
+            tr_peerIoDrain(io, inbuf, len);
+            r->messages.emplace_back(len, '\0');
+            break;
+        }
+
+        r->message_len.reset();
+        if (std::size(r->messages) == r->n_messages)
+        {
+            r->done = true;
+            return READ_LATER;
+        }
+
+        return READ_NOW;
+    }
+
+    static void gotError(tr_peerIo* /*io*/, short /*what*/, void* vreader)
+    {
+        static_cast<Reader*>(vreader)->error = true;
+    }
+
+    // Sends a handshake and `messages` through a TCP connection to a
+    // tr_peerIo, split into randomly-sized writes, and checks what it read
+    void testReadsMessages(tr_encryption_type encryption_type)
+    {
+        // listen on a loopback port and connect to it
+        auto addr = sockaddr_in{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        auto const listener = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT_NE(TR_BAD_SOCKET, listener);
+        ASSERT_EQ(0, bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+        ASSERT_EQ(0, listen(listener, 1));
+        auto len = socklen_t{ sizeof(addr) };
+        ASSERT_EQ(0, getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &len));
+        auto const sender = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT_EQ(0, connect(sender, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+
+        // the sending end of the connection
+        auto const hash = tr_sha1_digest_t{ std::byte{ 1 } };
+        auto outgoing = tr_crypto{ &hash, false };
+
+        // the plaintext: a handshake, then messages of mixed sizes
+        auto rng = std::mt19937{ 42 };
+        auto const random_string = [&rng](size_t n)
+        {
+            auto str = std::string(n, '\0');
+            std::generate(std::begin(str), std::end(str), [&rng]() { return char(rng()); });
+            return str;
+        };
+
+        auto handshake_len = size_t{};
+        for (auto const n : HandshakeFields)
+        {
+            handshake_len += n;
+        }
+
+        auto const handshake = random_string(handshake_len);
+        auto messages = std::vector<std::string>{};
+        auto stream = handshake;
+        for (auto const n : { 0, 1, 3, 4, 5, 13, 17, 16 * 1024 + 9, 1, 2, 100 * 1024, 7, 0, 0, 16 * 1024 + 13, 4096, 1 })
+        {
+            auto const& message = messages.emplace_back(random_string(n));
+            auto const nlen = htonl(uint32_t(n));
+            stream.append(reinterpret_cast<char const*>(&nlen), sizeof(nlen));
+            stream += message;
+        }
+
+        auto reader = Reader{};
+        reader.session = session_;
+        reader.n_messages = std::size(messages);
+
+        struct Setup
+        {
+            Reader* reader;
+            tr_socket_t listener;
+            tr_encryption_type encryption_type;
+            tr_sha1_digest_t const* hash;
+            tr_crypto* outgoing;
+            std::atomic<bool> done = false;
+        };
+
+        auto setup = Setup{ &reader, listener, encryption_type, &hash, &outgoing };
+        tr_runInEventThread(
+            session_,
+            [](void* vsetup)
+            {
+                auto* const s = static_cast<Setup*>(vsetup);
+                auto* const session = s->reader->session;
+
+                // accept the connection the way the session does, so that
+                // closing the tr_peerIo balances the peer socket count
+                auto peer_addr = tr_address{};
+                auto peer_port = tr_port{};
+                auto const sock = tr_fdSocketAccept(session, s->listener, &peer_addr, &peer_port);
+                evutil_closesocket(s->listener);
+                evutil_make_socket_nonblocking(sock);
+                auto* const io = tr_peerIoNewIncoming(
+                    session,
+                    session->bandwidth,
+                    &peer_addr,
+                    peer_port,
+                    tr_peer_socket_tcp_create(sock));
+
+                // the keys that the two ends would have agreed on in the handshake
+                tr_peerIoSetTorrentHash(io, *s->hash);
+                auto* const incoming = tr_peerIoGetCrypto(io);
+                auto key_len = int{};
+                tr_cryptoComputeSecret(incoming, tr_cryptoGetMyPublicKey(s->outgoing, &key_len));
+                tr_cryptoComputeSecret(s->outgoing, tr_cryptoGetMyPublicKey(incoming, &key_len));
+                tr_cryptoDecryptInit(incoming);
+                tr_cryptoEncryptInit(s->outgoing);
+
+                tr_peerIoSetEncryption(io, s->encryption_type);
+                tr_peerIoSetIOFuncs(io, canRead, nullptr, gotError, s->reader);
+                tr_peerIoSetEnabled(io, TR_DOWN, true);
+                s->reader->io = io;
+                s->done = true;
+            },
+            &setup);
+        EXPECT_TRUE(waitFor([&setup]() { return setup.done.load(); }, 5000));
+
+        if (encryption_type == PEER_ENCRYPTION_RC4)
+        {
+            tr_cryptoEncrypt(&outgoing, std::size(stream), std::data(stream), std::data(stream));
+        }
+
+        // send the handshake along with the start of the messages, so that
+        // some ciphertext is already waiting when the reader switches over.
+        // Send the rest in pieces that split the length prefixes and messages
+        auto const send_all = [sender](char const* walk, size_t n)
+        {
+            while (n > 0)
+            {
+                auto const n_sent = send(sender, walk, n, 0);
+                if (n_sent <= 0)
+                {
+                    return false;
+                }
+
+                walk += n_sent;
+                n -= size_t(n_sent);
+            }
+
+            return true;
+        };
+
+        auto offset = handshake_len + 9;
+        EXPECT_TRUE(send_all(std::data(stream), offset));
+        while (offset < std::size(stream))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+            auto const n = std::min(std::size(stream) - offset, size_t{ 1 + rng() % 6000 });
+            EXPECT_TRUE(send_all(std::data(stream) + offset, n));
+            offset += n;
+        }
+
+        EXPECT_TRUE(waitFor([&reader]() { return reader.done || reader.error; }, 10000));
+        EXPECT_FALSE(reader.error);
+
+        tr_runInEventThread(
+            session_,
+            [](void* vsetup)
+            {
+                auto* const s = static_cast<Setup*>(vsetup);
+                tr_peerIoClear(s->reader->io);
+                tr_peerIoUnref(s->reader->io);
+                s->done = false;
+            },
+            &setup);
+        EXPECT_TRUE(waitFor([&setup]() { return !setup.done; }, 5000));
+        evutil_closesocket(sender);
+
+        EXPECT_EQ(handshake, reader.handshake);
+        EXPECT_LT(size_t{ 0 }, reader.inbuf_at_switch);
+        ASSERT_EQ(std::size(messages), std::size(reader.messages));
+        for (size_t i = 0; i < std::size(messages); ++i)
+        {
+            if (how(i) == How::Drain)
+            {
+                EXPECT_EQ(std::size(messages[i]), std::size(reader.messages[i])) << i;
+            }
+            else
+            {
+                EXPECT_EQ(messages[i], reader.messages[i]) << i;
+            }
+        }
+    }
+};
+
+TEST_F(PeerIoTest, readsEncryptedMessages)
+{
+    testReadsMessages(PEER_ENCRYPTION_RC4);
+}
+
+TEST_F(PeerIoTest, readsPlaintextMessages)
+{
+    testReadsMessages(PEER_ENCRYPTION_NONE);
+}
+
+} // namespace test
+
+} // namespace libtransmission
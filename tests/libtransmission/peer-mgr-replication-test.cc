@@ -0,0 +1,293 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#define LIBTRANSMISSION_PEER_MODULE
+
+#include "transmission.h"
+
+#include "bitfield.h"
+#include "peer-mgr-replication.h"
+#include "peer-mgr-wishlist.h"
+
+#include "gtest/gtest.h"
+
+#include <vector>
+
+class PeerMgrReplicationTest : public ::testing::Test
+{
+protected:
+    static auto constexpr PieceCount = tr_piece_index_t{ 8 };
+
+    // A torrent whose pieces are one block each, with nothing downloaded.
+    // The wishlist sees the counts in `replication`
+    struct MockPeerInfo : public Wishlist::PeerInfo
+    {
+        explicit MockPeerInfo(PieceReplication const& replication_in)
+            : replication{ replication_in }
+        {
+        }
+
+        [[nodiscard]] bool clientCanRequestBlock(tr_block_index_t /*block*/) const final
+        {
+            return true;
+        }
+
+        [[nodiscard]] bool clientCanRequestPiece(tr_piece_index_t /*piece*/) const final
+        {
+            return true;
+        }
+
+        [[nodiscard]] bool clientWantsPiece(tr_piece_index_t /*piece*/) const final
+        {
+            return true;
+        }
+
+        [[nodiscard]] bool isEndgame() const final
+        {
+            return false;
+        }
+
+        [[nodiscard]] size_t countActiveRequests(tr_block_index_t /*block*/) const final
+        {
+            return 0;
+        }
+
+        [[nodiscard]] size_t countMissingBlocks(tr_piece_index_t /*piece*/) const final
+        {
+            return 1;
+        }
+
+        [[nodiscard]] tr_block_span_t blockSpan(tr_piece_index_t piece) const final
+        {
+            return { piece, piece + 1 };
+        }
+
+        [[nodiscard]] tr_piece_index_t countAllPieces() const final
+        {
+            return replication.size();
+        }
+
+        [[nodiscard]] tr_priority_t priority(tr_piece_index_t /*piece*/) const final
+        {
+            return TR_PRI_NORMAL;
+        }
+
+        [[nodiscard]] size_t countPeersWithPiece(tr_piece_index_t piece) const final
+        {
+            return replication.count(piece);
+        }
+
+        PieceReplication const& replication;
+    };
+
+    static tr_bitfield makeHave(std::vector<tr_piece_index_t> const& pieces)
+    {
+        auto have = tr_bitfield{ PieceCount };
+        for (auto const piece : pieces)
+        {
+            have.set(piece);
+        }
+        return have;
+    }
+
+    static tr_bitfield makeHaveAll()
+    {
+        auto have = tr_bitfield{ PieceCount };
+        have.setHasAll();
+        return have;
+    }
+
+    static std::vector<size_t> counts(PieceReplication const& replication)
+    {
+        auto ret = std::vector<size_t>{};
+        for (tr_piece_index_t piece = 0; piece < replication.size(); ++piece)
+        {
+            ret.push_back(replication.count(piece));
+        }
+        return ret;
+    }
+
+    // the piece that the wishlist would request first
+    static tr_piece_index_t firstPick(Wishlist& wishlist, MockPeerInfo const& peer_info)
+    {
+        auto const spans = wishlist.next(peer_info, 1);
+        EXPECT_EQ(1U, std::size(spans));
+        return std::empty(spans) ? PieceCount : spans.front().begin;
+    }
+};
+
+TEST_F(PeerMgrReplicationTest, countsHaves)
+{
+    auto wishlist = Wishlist{};
+    auto replication = PieceReplication{ wishlist };
+    replication.reset(PieceCount);
+    EXPECT_EQ(PieceCount, replication.size());
+    EXPECT_EQ((std::vector<size_t>{ 0, 0, 0, 0, 0, 0, 0, 0 }), counts(replication));
+
+    replication.gotHave(1);
+    replication.gotHave(1);
+    replication.gotHave(7);
+    EXPECT_EQ((std::vector<size_t>{ 0, 2, 0, 0, 0, 0, 0, 1 }), counts(replication));
+
+    // out-of-range pieces are ignored
+    replication.gotHave(PieceCount);
+    EXPECT_EQ(0U, replication.count(PieceCount));
+    EXPECT_EQ((std::vector<size_t>{ 0, 2, 0, 0, 0, 0, 0, 1 }), counts(replication));
+}
+
+TEST_F(PeerMgrReplicationTest, bitfieldReplacesOldPieces)
+{
+    auto wishlist = Wishlist{};
+    auto replication = PieceReplication{ wishlist };
+    replication.reset(PieceCount);
+
+    // a peer announces two pieces, then sends a bitfield
+    replication.gotHave(0);
+    replication.gotHave(3);
+    auto const old_have = makeHave({ 0, 3 });
+    replication.gotBitfield(old_have, makeHave({ 3, 4, 5 }));
+    EXPECT_EQ((std::vector<size_t>{ 0, 0, 0, 1, 1, 1, 0, 0 }), counts(replication));
+
+    // ...and another one that says it has everything
+    replication.gotBitfield(makeHave({ 3, 4, 5 }), makeHaveAll());
+    EXPECT_EQ((std::vector<size_t>{ 1, 1, 1, 1, 1, 1, 1, 1 }), counts(replication));
+}
+
+TEST_F(PeerMgrReplicationTest, haveAllAndHaveNone)
+{
+    auto wishlist = Wishlist{};
+    auto replication = PieceReplication{ wishlist };
+    replication.reset(PieceCount);
+
+    // another peer has pieces 2 and 6
+    replication.add(makeHave({ 2, 6 }));
+
+    // this peer announced piece 2, then says it's a seed.
+    // Its old piece 2 isn't counted twice
+    replication.gotHave(2);
+    replication.gotHaveAll(makeHave({ 2 }));
+    EXPECT_EQ((std::vector<size_t>{ 1, 1, 2, 1, 1, 1, 2, 1 }), counts(replication));
+
+    // then it says that it has nothing after all
+    replication.gotHaveNone(makeHaveAll());
+    EXPECT_EQ((std::vector<size_t>{ 0, 0, 1, 0, 0, 0, 1, 0 }), counts(replication));
+
+    // a peer that had nothing says it has nothing
+    replication.gotHaveNone(tr_bitfield{ PieceCount });
+    EXPECT_EQ((std::vector<size_t>{ 0, 0, 1, 0, 0, 0, 1, 0 }), counts(replication));
+}
+
+TEST_F(PeerMgrReplicationTest, disconnectUncountsPieces)
+{
+    auto wishlist = Wishlist{};
+    auto replication = PieceReplication{ wishlist };
+    replication.reset(PieceCount);
+
+    auto const seed = makeHaveAll();
+    auto const leech = makeHave({ 1, 2 });
+    replication.add(seed);
+    replication.add(leech);
+    replication.add(tr_bitfield{ PieceCount });
+    EXPECT_EQ((std::vector<size_t>{ 1, 2, 2, 1, 1, 1, 1, 1 }), counts(replication));
+
+    replication.remove(leech);
+    EXPECT_EQ((std::vector<size_t>{ 1, 1, 1, 1, 1, 1, 1, 1 }), counts(replication));
+
+    replication.remove(seed);
+    EXPECT_EQ((std::vector<size_t>{ 0, 0, 0, 0, 0, 0, 0, 0 }), counts(replication));
+
+    // a peer that never announced anything
+    replication.remove(tr_bitfield{ PieceCount });
+    EXPECT_EQ((std::vector<size_t>{ 0, 0, 0, 0, 0, 0, 0, 0 }), counts(replication));
+}
+
+TEST_F(PeerMgrReplicationTest, magnetRebuild)
+{
+    auto wishlist = Wishlist{};
+    auto replication = PieceReplication{ wishlist };
+
+    // before a magnet link has its metainfo, there are no pieces to count
+    replication.reset(0);
+    EXPECT_EQ(0U, replication.size());
+
+    // but peers still send what they have. Those bitfields are sized to
+    // the piece count that they sent, and are kept in tr_peer.have
+    auto seed = tr_bitfield{ 0 };
+    replication.gotHaveAll(seed);
+    seed.setHasAll();
+    auto leech = tr_bitfield{ 0 };
+    replication.gotBitfield(leech, makeHave({ 0, 5 }));
+    leech = makeHave({ 0, 5 });
+    replication.gotHave(5);
+    EXPECT_EQ(0U, replication.size());
+    EXPECT_EQ(0U, replication.count(5));
+
+    // the metainfo arrived, so count the connected peers' pieces
+    replication.reset(PieceCount);
+    replication.add(seed);
+    replication.add(leech);
+    EXPECT_EQ((std::vector<size_t>{ 2, 1, 1, 1, 1, 2, 1, 1 }), counts(replication));
+
+    // and the peers come and go as usual
+    replication.remove(seed);
+    EXPECT_EQ((std::vector<size_t>{ 1, 0, 0, 0, 0, 1, 0, 0 }), counts(replication));
+}
+
+TEST_F(PeerMgrReplicationTest, wishlistFollowsCounts)
+{
+    auto wishlist = Wishlist{};
+    auto replication = PieceReplication{ wishlist };
+    auto const peer_info = MockPeerInfo{ replication };
+    replication.reset(PieceCount);
+
+    // every piece but 0 is common, and piece 3 is the rarest of those
+    auto const leech = makeHave({ 1, 2, 3, 4, 5, 6, 7 });
+    replication.add(leech);
+    replication.add(makeHave({ 1, 2, 4, 5, 6, 7 }));
+    EXPECT_EQ(3U, firstPick(wishlist, peer_info));
+
+    // a HAVE makes piece 3 as common as the others, so piece 0 is still
+    // last because no one has it. Then the leech has piece 0 too
+    replication.gotHave(3);
+    EXPECT_NE(0U, firstPick(wishlist, peer_info));
+    replication.gotHave(0);
+    EXPECT_EQ(0U, firstPick(wishlist, peer_info));
+}
+
+TEST_F(PeerMgrReplicationTest, wishlistFollowsSeeds)
+{
+    auto wishlist = Wishlist{};
+    auto replication = PieceReplication{ wishlist };
+    auto const peer_info = MockPeerInfo{ replication };
+    replication.reset(PieceCount);
+
+    // no one has piece 0, and piece 3 is the rarest that can be had
+    replication.add(makeHave({ 1, 2, 3, 4, 5, 6, 7 }));
+    replication.add(makeHave({ 1, 2, 4, 5, 6, 7 }));
+    EXPECT_EQ(3U, firstPick(wishlist, peer_info));
+
+    // a seed arrives, so piece 0 is the rarest and can be had now
+    auto seed = tr_bitfield{ PieceCount };
+    replication.gotHaveAll(seed);
+    seed.setHasAll();
+    EXPECT_EQ((std::vector<size_t>{ 1, 3, 3, 2, 3, 3, 3, 3 }), counts(replication));
+    EXPECT_EQ(0U, firstPick(wishlist, peer_info));
+
+    // the seed leaves, so no one has piece 0 again
+    replication.remove(seed);
+    EXPECT_EQ((std::vector<size_t>{ 0, 2, 2, 1, 2, 2, 2, 2 }), counts(replication));
+    EXPECT_EQ(3U, firstPick(wishlist, peer_info));
+
+    // another seed arrives, then HAVEs re-sort just the one piece
+    replication.gotHaveAll(tr_bitfield{ PieceCount });
+    EXPECT_EQ(0U, firstPick(wishlist, peer_info));
+    replication.gotHave(0);
+    replication.gotHave(0);
+    EXPECT_EQ((std::vector<size_t>{ 3, 3, 3, 2, 3, 3, 3, 3 }), counts(replication));
+    EXPECT_EQ(3U, firstPick(wishlist, peer_info));
+}
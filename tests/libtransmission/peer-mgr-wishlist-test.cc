@@ -26,6 +26,7 @@ protected:
         mutable std::map<tr_piece_index_t, size_t> missing_block_count_;
         mutable std::map<tr_piece_index_t, tr_block_span_t> block_span_;
         mutable std::map<tr_piece_index_t, tr_priority_t> piece_priority_;
+        mutable std::map<tr_piece_index_t, size_t> piece_replication_;
         mutable std::set<tr_block_index_t> can_request_block_;
         mutable std::set<tr_piece_index_t> can_request_piece_;
         tr_piece_index_t piece_count_ = 0;
@@ -41,6 +42,11 @@ protected:
             return can_request_piece_.count(piece) != 0;
         }
 
+        [[nodiscard]] bool clientWantsPiece(tr_piece_index_t piece) const final
+        {
+            return can_request_piece_.count(piece) != 0;
+        }
+
         [[nodiscard]] bool isEndgame() const final
         {
             return is_endgame_;
@@ -70,6 +76,11 @@ protected:
         {
             return piece_priority_[piece];
         }
+
+        [[nodiscard]] size_t countPeersWithPiece(tr_piece_index_t piece) const final
+        {
+            return piece_replication_[piece];
+        }
     };
 };
 
@@ -351,3 +362,118 @@ TEST_F(PeerMgrWishlistTest, prefersNearlyCompletePieces)
         EXPECT_EQ(0, requested.count(200, 300));
     }
 }
+
+TEST_F(PeerMgrWishlistTest, prefersRarePieces)
+{
+    auto peer_info = MockPeerInfo{};
+    auto wishlist = Wishlist{};
+
+    // setup: three pieces, same size, all missing
+    peer_info.piece_count_ = 3;
+    for (tr_piece_index_t piece = 0; piece < 3; ++piece)
+    {
+        peer_info.block_span_[piece] = { piece * 100, (piece + 1) * 100 };
+        peer_info.missing_block_count_[piece] = 100;
+        peer_info.can_request_piece_.insert(piece);
+    }
+    for (tr_block_index_t i = 0; i < 300; ++i)
+    {
+        peer_info.can_request_block_.insert(i);
+    }
+
+    // the third piece is the rarest
+    peer_info.piece_replication_[0] = 10;
+    peer_info.piece_replication_[1] = 5;
+    peer_info.piece_replication_[2] = 1;
+
+    auto const requested = [&peer_info, &wishlist](size_t n_wanted)
+    {
+        auto ret = tr_bitfield(300);
+        for (auto const& span : wishlist.next(peer_info, n_wanted))
+        {
+            ret.setSpan(span.begin, span.end);
+        }
+        return ret;
+    };
+
+    // NB: when all other things are equal in the wishlist, pieces are
+    // picked at random so this test -could- pass even if there's a bug.
+    // So test several times to shake out any randomness
+    auto const num_runs = 1000;
+    for (int run = 0; run < num_runs; ++run)
+    {
+        auto const got = requested(150);
+        EXPECT_EQ(150, got.count());
+        EXPECT_EQ(100, got.count(200, 300));
+        EXPECT_EQ(50, got.count(100, 200));
+    }
+
+    // a peer announced the second piece and it's no longer rarer than
+    // the first; no one has the third anymore, so it can't be picked first
+    peer_info.piece_replication_[1] = 20;
+    wishlist.pieceChanged(1);
+    peer_info.piece_replication_[2] = 0;
+    wishlist.pieceChanged(2);
+    auto const got = requested(100);
+    EXPECT_EQ(100, got.count(0, 100));
+}
+
+TEST_F(PeerMgrWishlistTest, resortsChangedPieces)
+{
+    auto peer_info = MockPeerInfo{};
+    auto wishlist = Wishlist{};
+
+    // setup: three pieces, same size, all missing
+    peer_info.piece_count_ = 3;
+    for (tr_piece_index_t piece = 0; piece < 3; ++piece)
+    {
+        peer_info.block_span_[piece] = { piece * 100, (piece + 1) * 100 };
+        peer_info.missing_block_count_[piece] = 100;
+        peer_info.can_request_piece_.insert(piece);
+    }
+    for (tr_block_index_t i = 0; i < 300; ++i)
+    {
+        peer_info.can_request_block_.insert(i);
+    }
+
+    auto const requested = [&peer_info, &wishlist](size_t n_wanted)
+    {
+        auto ret = tr_bitfield(300);
+        for (auto const& span : wishlist.next(peer_info, n_wanted))
+        {
+            ret.setSpan(span.begin, span.end);
+        }
+        return ret;
+    };
+    EXPECT_EQ(10, requested(10).count());
+
+    // we got most of the third piece, so it should be next in line
+    for (tr_block_index_t i = 200; i < 290; ++i)
+    {
+        peer_info.can_request_block_.erase(i);
+    }
+    peer_info.missing_block_count_[2] = 10;
+    wishlist.pieceChanged(2);
+    auto got = requested(10);
+    EXPECT_EQ(10, got.count(290, 300));
+
+    // we got all of it, so it should be dropped
+    for (tr_block_index_t i = 290; i < 300; ++i)
+    {
+        peer_info.can_request_block_.erase(i);
+    }
+    peer_info.missing_block_count_[2] = 0;
+    wishlist.pieceChanged(2);
+    got = requested(1000);
+    EXPECT_EQ(200, got.count());
+    EXPECT_EQ(0, got.count(200, 300));
+
+    // we no longer want the first piece and the second one
+    // is high priority; neither change is seen until reset()
+    peer_info.can_request_piece_.erase(0);
+    peer_info.piece_priority_[1] = TR_PRI_HIGH;
+    wishlist.reset();
+    got = requested(1000);
+    EXPECT_EQ(100, got.count());
+    EXPECT_EQ(100, got.count(100, 200));
+}
@@ -206,7 +206,7 @@ TEST_F(RenameTest, singleFilenameTorrent)
     EXPECT_TRUE(testFileExistsAndConsistsOfThisString(tor, 0, "hello, world!\n")); // confirm the contents are right
 
     // (while it's renamed: confirm that the .resume file remembers the changes)
-    tr_torrentSaveResume(tor);
+    tr_torrentSaveResume(tor, TR_DIRTY_ALL);
     sync();
     loaded = tr_torrentLoadResume(tor, ~0ULL, ctor, nullptr);
     EXPECT_STREQ("foobar", tr_torrentName(tor));
@@ -317,7 +317,7 @@ TEST_F(RenameTest, multifileTorrent)
     EXPECT_TRUE(testFileExistsAndConsistsOfThisString(tor, 2, expected_contents[2]));
 
     // (while the branch is renamed: confirm that the .resume file remembers the changes)
-    tr_torrentSaveResume(tor);
+    tr_torrentSaveResume(tor, TR_DIRTY_ALL);
     // this is a bit dodgy code-wise, but let's make sure the .resume file got the name
     tor->setFileSubpath(1, "gabba gabba hey"sv);
     auto const loaded = tr_torrentLoadResume(tor, ~0ULL, ctor, nullptr);
@@ -505,6 +505,40 @@ TEST_F(RenameTest, partialFile)
     torrentRemoveAndWait(tor, 0);
 }
 
+TEST_F(RenameTest, cachedLocationFollowsRenames)
+{
+    auto* const tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+
+    auto const find_cached = [tor](tr_file_index_t i)
+    {
+        auto const lock = tor->unique_lock();
+        auto filename = std::string{};
+        return tor->findFileCached(filename, i) ? filename : std::string{};
+    };
+
+    // remember where every file is...
+    for (tr_file_index_t i = 0; i < 3; ++i)
+    {
+        EXPECT_EQ(tr_strvPath(tor->currentDir().sv(), tor->fileSubpath(i)), find_cached(i));
+    }
+
+    // ...then rename one file, and then the folder that holds all of them
+    EXPECT_EQ(0, torrentRenameAndWait(tor, "files-filled-with-zeroes/512", "five-twelve"));
+    EXPECT_EQ(tr_strvPath(tor->currentDir().sv(), "files-filled-with-zeroes", "five-twelve"), find_cached(2));
+
+    EXPECT_EQ(0, torrentRenameAndWait(tor, "files-filled-with-zeroes", "zeroes"));
+    EXPECT_EQ(tr_strvPath(tor->currentDir().sv(), "zeroes", "1048576"), find_cached(0));
+    EXPECT_EQ(tr_strvPath(tor->currentDir().sv(), "zeroes", "4096"), find_cached(1));
+    EXPECT_EQ(tr_strvPath(tor->currentDir().sv(), "zeroes", "five-twelve"), find_cached(2));
+    for (tr_file_index_t i = 0; i < 3; ++i)
+    {
+        EXPECT_TRUE(tr_sys_path_exists(find_cached(i).c_str(), nullptr));
+    }
+
+    torrentRemoveAndWait(tor, 0);
+}
+
 } // namespace test
 
 } // namespace libtransmission
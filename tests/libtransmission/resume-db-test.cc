@@ -0,0 +1,214 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "transmission.h"
+#include "crypto-utils.h"
+#include "file.h"
+#include "resume-db.h"
+#include "utils.h"
+
+#include "test-fixtures.h"
+
+using namespace std::literals;
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class ResumeDbTest : public SandboxedTest
+{
+protected:
+    std::string dbFilename() const
+    {
+        return tr_strvPath(sandboxDir(), "resume.db");
+    }
+
+    uint64_t fileSize(std::string const& filename) const
+    {
+        auto info = tr_sys_path_info{};
+        EXPECT_TRUE(tr_sys_path_get_info(filename.c_str(), 0, &info, nullptr));
+        return info.size;
+    }
+
+    static tr_sha1_digest_t makeHash(int i)
+    {
+        return *tr_sha1(std::to_string(i));
+    }
+
+    static std::string get(tr_resume_db* db, tr_sha1_digest_t const& hash)
+    {
+        auto buf = std::vector<char>{};
+        auto const payload = tr_resumeDbGet(db, hash, buf);
+        return payload ? std::string{ *payload } : std::string{};
+    }
+};
+
+TEST_F(ResumeDbTest, putGetRemove)
+{
+    auto* db = tr_resumeDbOpen(dbFilename());
+    ASSERT_NE(nullptr, db);
+    EXPECT_EQ(0U, tr_resumeDbCount(db));
+
+    EXPECT_TRUE(tr_resumeDbPut(db, makeHash(1), "d3:fooi1ee"sv));
+    EXPECT_TRUE(tr_resumeDbPut(db, makeHash(2), "d3:fooi2ee"sv));
+    EXPECT_TRUE(tr_resumeDbPut(db, makeHash(1), "d3:fooi3ee"sv));
+    EXPECT_EQ(2U, tr_resumeDbCount(db));
+    EXPECT_EQ("d3:fooi3ee"sv, get(db, makeHash(1)));
+    EXPECT_EQ("d3:fooi2ee"sv, get(db, makeHash(2)));
+    EXPECT_EQ(""sv, get(db, makeHash(3)));
+
+    tr_resumeDbRemove(db, makeHash(2));
+    EXPECT_EQ(1U, tr_resumeDbCount(db));
+    EXPECT_EQ(""sv, get(db, makeHash(2)));
+    tr_resumeDbClose(db);
+
+    // the newest records and the removal survive reopening
+    db = tr_resumeDbOpen(dbFilename());
+    ASSERT_NE(nullptr, db);
+    EXPECT_EQ(1U, tr_resumeDbCount(db));
+    EXPECT_EQ("d3:fooi3ee"sv, get(db, makeHash(1)));
+    EXPECT_EQ(""sv, get(db, makeHash(2)));
+    tr_resumeDbClose(db);
+}
+
+TEST_F(ResumeDbTest, ignoresDamagedTail)
+{
+    auto* db = tr_resumeDbOpen(dbFilename());
+    ASSERT_NE(nullptr, db);
+    EXPECT_TRUE(tr_resumeDbPut(db, makeHash(1), "d3:fooi1ee"sv));
+    EXPECT_TRUE(tr_resumeDbPut(db, makeHash(2), "d3:fooi2ee"sv));
+    tr_resumeDbClose(db);
+
+    // simulate a crash in the middle of writing the last record
+    auto const size = fileSize(dbFilename());
+    auto const fd = tr_sys_file_open(dbFilename().c_str(), TR_SYS_FILE_WRITE, 0600, nullptr);
+    EXPECT_TRUE(tr_sys_file_truncate(fd, size - 3, nullptr));
+    tr_sys_file_close(fd, nullptr);
+
+    db = tr_resumeDbOpen(dbFilename());
+    ASSERT_NE(nullptr, db);
+    EXPECT_EQ(1U, tr_resumeDbCount(db));
+    EXPECT_EQ("d3:fooi1ee"sv, get(db, makeHash(1)));
+
+    // new records go after the last good one
+    EXPECT_TRUE(tr_resumeDbPut(db, makeHash(3), "d3:fooi3ee"sv));
+    tr_resumeDbClose(db);
+
+    db = tr_resumeDbOpen(dbFilename());
+    ASSERT_NE(nullptr, db);
+    EXPECT_EQ(2U, tr_resumeDbCount(db));
+    EXPECT_EQ("d3:fooi3ee"sv, get(db, makeHash(3)));
+    tr_resumeDbClose(db);
+}
+
+TEST_F(ResumeDbTest, compacts)
+{
+    auto constexpr NumTorrents = 100;
+    auto const payload = std::string(1000, 'x');
+
+    auto* db = tr_resumeDbOpen(dbFilename());
+    ASSERT_NE(nullptr, db);
+
+    // keep overwriting the same records; the file shouldn't keep growing
+    for (int round = 0; round < 50; ++round)
+    {
+        for (int i = 0; i < NumTorrents; ++i)
+        {
+            EXPECT_TRUE(tr_resumeDbPut(db, makeHash(i), payload + std::to_string(round)));
+        }
+    }
+
+    EXPECT_EQ(size_t{ NumTorrents }, tr_resumeDbCount(db));
+    EXPECT_GT(4U * 1024 * 1024, fileSize(dbFilename()));
+    for (int i = 0; i < NumTorrents; ++i)
+    {
+        EXPECT_EQ(payload + "49", get(db, makeHash(i)));
+    }
+
+    tr_resumeDbClose(db);
+
+    db = tr_resumeDbOpen(dbFilename());
+    ASSERT_NE(nullptr, db);
+    EXPECT_EQ(size_t{ NumTorrents }, tr_resumeDbCount(db));
+    EXPECT_EQ(payload + "49", get(db, makeHash(NumTorrents - 1)));
+    tr_resumeDbClose(db);
+}
+
+TEST_F(ResumeDbTest, getOutlivesCompaction)
+{
+    auto constexpr NumTorrents = 100;
+    auto const payload = std::string(1000, 'x');
+
+    auto* db = tr_resumeDbOpen(dbFilename());
+    ASSERT_NE(nullptr, db);
+    EXPECT_TRUE(tr_resumeDbPut(db, makeHash(0), payload));
+    tr_resumeDbClose(db);
+
+    // reopen so that the record is read from the file's mapping
+    db = tr_resumeDbOpen(dbFilename());
+    ASSERT_NE(nullptr, db);
+    auto buf = std::vector<char>{};
+    auto const view = tr_resumeDbGet(db, makeHash(0), buf);
+    ASSERT_TRUE(view);
+
+    // compacting replaces the file and its mapping; the view must not point into either
+    for (int round = 0; round < 50; ++round)
+    {
+        for (int i = 1; i < NumTorrents; ++i)
+        {
+            EXPECT_TRUE(tr_resumeDbPut(db, makeHash(i), payload + std::to_string(round)));
+        }
+    }
+
+    EXPECT_GT(4U * 1024 * 1024, fileSize(dbFilename()));
+    EXPECT_EQ(payload, *view);
+    tr_resumeDbClose(db);
+}
+
+TEST_F(ResumeDbTest, exportsResumeFiles)
+{
+    auto* const db = tr_resumeDbOpen(dbFilename());
+    ASSERT_NE(nullptr, db);
+    EXPECT_TRUE(tr_resumeDbPut(db, makeHash(1), "d3:fooi1ee"sv));
+    EXPECT_TRUE(tr_resumeDbPut(db, makeHash(2), "d3:fooi2ee"sv));
+
+    auto const dirname = tr_strvPath(sandboxDir(), "resume");
+    tr_sys_dir_create(dirname.c_str(), TR_SYS_DIR_CREATE_PARENTS, 0700, nullptr);
+    EXPECT_TRUE(tr_resumeDbExport(db, dirname));
+    tr_resumeDbClose(db);
+
+    for (int i : { 1, 2 })
+    {
+        auto contents = std::vector<char>{};
+        auto const filename = tr_strvPath(dirname, tr_sha1_to_string(makeHash(i)) + ".resume");
+        EXPECT_TRUE(tr_loadFile(contents, filename));
+        EXPECT_EQ("d3:fooi" + std::to_string(i) + "ee", std::string(std::data(contents), std::size(contents)));
+    }
+}
+
+TEST_F(ResumeDbTest, replacesForeignFile)
+{
+    createFileWithContents(dbFilename(), "this is not a resume database");
+
+    auto* const db = tr_resumeDbOpen(dbFilename());
+    ASSERT_NE(nullptr, db);
+    EXPECT_EQ(0U, tr_resumeDbCount(db));
+    tr_resumeDbClose(db);
+
+    EXPECT_TRUE(tr_sys_path_exists((dbFilename() + ".bad").c_str(), nullptr));
+}
+
+} // namespace test
+
+} // namespace libtransmission
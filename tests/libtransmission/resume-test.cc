@@ -0,0 +1,183 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "transmission.h"
+#include "crypto-utils.h"
+#include "file.h"
+#include "platform.h" // tr_getResumeDir()
+#include "resume.h"
+#include "session.h"
+#include "torrent.h"
+#include "variant.h"
+
+#include "test-fixtures.h"
+
+using namespace std::literals;
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class ResumeTest : public SessionTest
+{
+protected:
+    std::string resumeFilename(tr_torrent const* tor) const
+    {
+        return tr_strvJoin(tr_getResumeDir(session_), "/"sv, tor->infoHashString(), ".resume"sv);
+    }
+
+    std::shared_ptr<std::string const> cachedValue(tr_torrent const* tor, std::string_view key) const
+    {
+        auto const& values = tor->resume_cache->values;
+        auto const it = values.find(key);
+        return it != std::end(values) ? it->second.benc : nullptr;
+    }
+
+    // resumes the writer after a short delay, from another thread
+    std::thread resumeWriterLater() const
+    {
+        return std::thread{ [writer = session_->resume_writer]()
+                            {
+                                tr_wait_msec(100);
+                                tr_resumeWriterSetPaused(writer, false);
+                            } };
+    }
+
+    double loadRatioLimit(tr_torrent* tor) const
+    {
+        auto* const ctor = tr_ctorNew(session_);
+        auto const loaded = tr_torrentLoadResume(tor, TR_FR_RATIOLIMIT, ctor, nullptr);
+        tr_ctorFree(ctor);
+        EXPECT_NE(0U, loaded & TR_FR_RATIOLIMIT);
+        return tr_torrentGetRatioLimit(tor);
+    }
+
+    void setResumeDbEnabled(bool enabled) const
+    {
+        auto settings = tr_variant{};
+        tr_variantInitDict(&settings, 1);
+        tr_variantDictAddBool(&settings, TR_KEY_resume_db_enabled, enabled);
+        tr_sessionSet(session_, &settings);
+        tr_variantFree(&settings);
+    }
+};
+
+TEST_F(ResumeTest, statsOnlySaveReusesProgress)
+{
+    auto* const tor = zeroTorrentInit();
+    tr_torrentSaveResume(tor, TR_DIRTY_ALL);
+
+    auto const progress = cachedValue(tor, "progress"sv);
+    auto const uploaded = cachedValue(tor, "uploaded"sv);
+    ASSERT_NE(nullptr, progress);
+    ASSERT_NE(nullptr, uploaded);
+
+    // a stats-only save rebuilds the stats but shares the old progress
+    tr_torrentSaveResume(tor, TR_DIRTY_STATS);
+    EXPECT_EQ(progress, cachedValue(tor, "progress"sv));
+    EXPECT_NE(uploaded, cachedValue(tor, "uploaded"sv));
+
+    // and saving the progress rebuilds it
+    tr_torrentSaveResume(tor, TR_DIRTY_PROGRESS);
+    EXPECT_NE(progress, cachedValue(tor, "progress"sv));
+    EXPECT_EQ(*progress, *cachedValue(tor, "progress"sv));
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(ResumeTest, queuedRemoveStillRunsBeforeSave)
+{
+    auto* const tor = zeroTorrentInit();
+
+    // a resume file with an old-style name, which only a removal deletes
+    auto const old_filename = tr_strvJoin(
+        tr_getResumeDir(session_),
+        "/"sv,
+        tr_torrentName(tor),
+        "."sv,
+        tor->infoHashString().substr(0, 16),
+        ".resume"sv);
+    createFileWithContents(old_filename, "d3:fooi1ee");
+
+    // queue a removal, then a save that replaces it before either runs
+    tr_resumeWriterSetPaused(session_->resume_writer, true);
+    tr_torrentRemoveResume(tor);
+    tr_torrentSetRatioLimit(tor, 2.5);
+    tr_torrentSaveResume(tor, TR_DIRTY_SETTINGS);
+    tr_resumeWriterSetPaused(session_->resume_writer, false);
+    tr_resumeWriterFlush(session_->resume_writer);
+
+    EXPECT_FALSE(tr_sys_path_exists(old_filename.c_str(), nullptr));
+    EXPECT_TRUE(tr_sys_path_exists(resumeFilename(tor).c_str(), nullptr));
+    tr_torrentSetRatioLimit(tor, 1.0);
+    EXPECT_EQ(2.5, loadRatioLimit(tor));
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(ResumeTest, loadWaitsForPendingWrite)
+{
+    auto* const tor = zeroTorrentInit();
+    tr_torrentSetRatioLimit(tor, 1.0);
+    tr_torrentSaveResume(tor, TR_DIRTY_SETTINGS);
+    tr_resumeWriterFlush(session_->resume_writer);
+
+    // the newer value is still queued when the torrent is loaded
+    tr_resumeWriterSetPaused(session_->resume_writer, true);
+    tr_torrentSetRatioLimit(tor, 2.5);
+    tr_torrentSaveResume(tor, TR_DIRTY_SETTINGS);
+    tr_torrentSetRatioLimit(tor, 4.0);
+
+    auto resumer = resumeWriterLater();
+    EXPECT_EQ(2.5, loadRatioLimit(tor));
+    resumer.join();
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(ResumeTest, togglingResumeDbFlushesWrites)
+{
+    auto* const tor = zeroTorrentInit();
+    auto const db_filename = tr_strvPath(sandboxDir(), "resume.db");
+
+    // a write queued before the db is turned on still goes to the .resume file
+    tr_resumeWriterSetPaused(session_->resume_writer, true);
+    tr_torrentSetRatioLimit(tor, 2.5);
+    tr_torrentSaveResume(tor, TR_DIRTY_SETTINGS);
+    auto resumer = resumeWriterLater();
+    setResumeDbEnabled(true);
+    resumer.join();
+    EXPECT_TRUE(tr_sys_path_exists(resumeFilename(tor).c_str(), nullptr));
+    EXPECT_TRUE(tr_sys_path_exists(db_filename.c_str(), nullptr));
+
+    // a write queued before the db is turned off lands in the db,
+    // which is then exported to .resume files
+    tr_resumeWriterSetPaused(session_->resume_writer, true);
+    tr_torrentSetRatioLimit(tor, 3.5);
+    tr_torrentSaveResume(tor, TR_DIRTY_SETTINGS);
+    resumer = resumeWriterLater();
+    setResumeDbEnabled(false);
+    resumer.join();
+    EXPECT_FALSE(tr_sys_path_exists(db_filename.c_str(), nullptr));
+
+    tr_torrentSetRatioLimit(tor, 1.0);
+    EXPECT_EQ(3.5, loadRatioLimit(tor));
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+} // namespace test
+
+} // namespace libtransmission
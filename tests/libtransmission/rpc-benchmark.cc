@@ -0,0 +1,291 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "crypto-utils.h"
+#include "file.h"
+#include "rpcimpl.h"
+#include "trevent.h"
+#include "utils.h"
+#include "variant.h"
+
+#include <event2/buffer.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+auto constexpr PieceSize = int64_t{ 256 * 1024 };
+
+// Writes a .torrent file for a fake torrent
+void createTorrent(std::string const& config_dir, size_t idx, size_t n_files)
+{
+    auto const total_size = int64_t(n_files) * 4 * 1024 * 1024;
+    auto pieces = std::string(size_t(total_size / PieceSize) * SHA_DIGEST_LENGTH, '\0');
+    tr_rand_buffer(std::data(pieces), std::size(pieces));
+
+    auto top = tr_variant{};
+    tr_variantInitDict(&top, 2);
+    tr_variantDictAddStr(&top, TR_KEY_announce, "http://tracker.example.com/announce");
+    auto* const info = tr_variantDictAddDict(&top, TR_KEY_info, 4);
+    tr_variantDictAddStr(info, TR_KEY_name, "rpc-benchmark-" + std::to_string(idx));
+    tr_variantDictAddInt(info, TR_KEY_piece_length, PieceSize);
+    tr_variantDictAddRaw(info, TR_KEY_pieces, std::data(pieces), std::size(pieces));
+    auto* const files = tr_variantDictAddList(info, TR_KEY_files, n_files);
+    for (size_t i = 0; i < n_files; ++i)
+    {
+        auto* const file = tr_variantListAddDict(files, 2);
+        tr_variantDictAddInt(file, TR_KEY_length, total_size / n_files);
+        auto* const path = tr_variantDictAddList(file, TR_KEY_path, 2);
+        tr_variantListAddStr(path, "dir-" + std::to_string(i % 10));
+        tr_variantListAddStr(path, "file-" + std::to_string(i) + ".bin");
+    }
+
+    auto const hash_string = tr_sha1_to_string(*tr_sha1(tr_variantToStr(info, TR_VARIANT_FMT_BENC)));
+    tr_variantToFile(&top, TR_VARIANT_FMT_BENC, config_dir + "/torrents/" + hash_string + ".torrent");
+    tr_variantFree(&top);
+}
+
+void removeRecursive(std::string const& path)
+{
+    auto info = tr_sys_path_info{};
+    if (tr_sys_path_get_info(path.c_str(), 0, &info, nullptr) && info.type == TR_SYS_PATH_IS_DIRECTORY)
+    {
+        auto children = std::vector<std::string>{};
+        auto* const odir = tr_sys_dir_open(path.c_str(), nullptr);
+        char const* name = nullptr;
+        while ((name = tr_sys_dir_read_name(odir, nullptr)) != nullptr)
+        {
+            if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+            {
+                children.push_back(path + '/' + name);
+            }
+        }
+        tr_sys_dir_close(odir, nullptr);
+
+        for (auto const& child : children)
+        {
+            removeRecursive(child);
+        }
+    }
+
+    tr_sys_path_remove(path.c_str(), nullptr);
+}
+
+tr_session* sessionInit(std::string const& config_dir)
+{
+    auto settings = tr_variant{};
+    tr_variantInitDict(&settings, 0);
+    tr_sessionGetDefaultSettings(&settings);
+    tr_variantDictAddBool(&settings, TR_KEY_dht_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_lpd_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_utp_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_rpc_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_port_forwarding_enabled, false);
+    tr_variantDictAddInt(&settings, TR_KEY_message_level, TR_LOG_ERROR);
+    auto* const session = tr_sessionInit(config_dir.c_str(), false, &settings);
+    tr_variantFree(&settings);
+    return session;
+}
+
+// peak resident set size of this process so far, in MiB
+double peakRssMiB()
+{
+#ifndef _WIN32
+    auto usage = rusage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return double(usage.ru_maxrss) / (1024 * 1024);
+#else
+    return double(usage.ru_maxrss) / 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+// A torrent-get like the web client's, with the big per-file and per-tracker lists
+void buildRequest(tr_variant* request)
+{
+    tr_variantInitDict(request, 2);
+    tr_variantDictAddStrView(request, TR_KEY_method, "torrent-get");
+    auto* const args = tr_variantDictAddDict(request, TR_KEY_arguments, 1);
+    auto* const fields = tr_variantDictAddList(args, TR_KEY_fields, 16);
+    for (auto const* const field : { "id",
+                                     "name",
+                                     "status",
+                                     "percentDone",
+                                     "rateDownload",
+                                     "rateUpload",
+                                     "uploadRatio",
+                                     "eta",
+                                     "sizeWhenDone",
+                                     "downloadDir",
+                                     "files",
+                                     "fileStats",
+                                     "priorities",
+                                     "wanted",
+                                     "trackerStats",
+                                     "peers" })
+    {
+        tr_variantListAddStr(fields, field);
+    }
+}
+
+struct Result
+{
+    size_t bytes = 0;
+    double msecs = 0;
+};
+
+// Runs the request in the libtransmission thread, the way the RPC server does
+template<typename Exec>
+Result runInEventThread(tr_session* session, Exec exec)
+{
+    struct Data
+    {
+        tr_session* session;
+        Exec* exec;
+        Result result;
+        std::atomic<bool> done;
+    };
+
+    auto data = Data{ session, &exec, {}, false };
+    tr_runInEventThread(
+        session,
+        [](void* vdata)
+        {
+            auto* const d = static_cast<Data*>(vdata);
+            auto const begin = std::chrono::steady_clock::now();
+            d->result.bytes = (*d->exec)(d->session);
+            d->result.msecs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+            d->done = true;
+        },
+        &data);
+
+    while (!data.done)
+    {
+        std::this_thread::yield();
+    }
+
+    return data.result;
+}
+
+// today's path: build the response as a tr_variant tree, then serialize it
+size_t execTree(tr_session* session)
+{
+    auto request = tr_variant{};
+    buildRequest(&request);
+
+    auto bytes = size_t{};
+    tr_rpc_request_exec_json(
+        session,
+        &request,
+        [](tr_session* /*session*/, tr_variant* response, void* vbytes)
+        {
+            auto* const buf = tr_variantToBuf(response, TR_VARIANT_FMT_JSON_LEAN);
+            *static_cast<size_t*>(vbytes) = evbuffer_get_length(buf);
+            evbuffer_free(buf);
+        },
+        &bytes);
+
+    tr_variantFree(&request);
+    return bytes;
+}
+
+// the streaming path: write the response straight into the evbuffer
+size_t execStream(tr_session* session)
+{
+    auto request = tr_variant{};
+    buildRequest(&request);
+
+    auto bytes = size_t{};
+    tr_rpc_request_exec_json_buf(
+        session,
+        &request,
+        [](tr_session* /*session*/, struct evbuffer* response, void* vbytes)
+        { *static_cast<size_t*>(vbytes) = evbuffer_get_length(response); },
+        &bytes);
+
+    tr_variantFree(&request);
+    return bytes;
+}
+
+} // namespace
+
+// Compares torrent-get's response time and peak memory when the response is
+// built as a tr_variant tree and when it's written straight to JSON.
+// Each mode runs in its own process so that their peak RSS can be compared.
+// usage: libtransmission-rpc-benchmark tree|stream [torrents] [files-per-torrent] [iterations]
+int main(int argc, char** argv)
+{
+    auto const mode = std::string{ argc > 1 ? argv[1] : "stream" };
+    auto const n_torrents = size_t(argc > 2 ? atoi(argv[2]) : 5000);
+    auto const n_files = size_t(argc > 3 ? atoi(argv[3]) : 20);
+    auto const n_iterations = size_t(argc > 4 ? atoi(argv[4]) : 5);
+    if ((mode != "tree" && mode != "stream") || n_files == 0 || n_iterations == 0)
+    {
+        fprintf(stderr, "usage: %s tree|stream [torrents] [files-per-torrent] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    auto config_dir = std::string{ "transmission-rpc-benchmark-XXXXXX" };
+    if (!tr_sys_dir_create_temp(std::data(config_dir), nullptr))
+    {
+        return 1;
+    }
+
+    tr_sys_dir_create((config_dir + "/torrents").c_str(), TR_SYS_DIR_CREATE_PARENTS, 0700, nullptr);
+    for (size_t i = 0; i < n_torrents; ++i)
+    {
+        createTorrent(config_dir, i, n_files);
+    }
+
+    auto* const session = sessionInit(config_dir);
+    auto* const ctor = tr_ctorNew(session);
+    tr_ctorSetPaused(ctor, TR_FORCE, true);
+    auto n_loaded = int{};
+    tr_free(tr_sessionLoadTorrents(session, ctor, &n_loaded));
+    tr_ctorFree(ctor);
+
+    auto const rss_before = peakRssMiB();
+    auto total = Result{};
+    for (size_t i = 0; i < n_iterations; ++i)
+    {
+        auto const result = runInEventThread(session, mode == "tree" ? execTree : execStream);
+        total.bytes = result.bytes;
+        total.msecs += result.msecs;
+    }
+    auto const rss_after = peakRssMiB();
+
+    printf(
+        "%-6s %d torrents x %zu files: %8.1f MB response, %8.1f ms per request, peak RSS %8.1f MiB (+%.1f MiB)\n",
+        mode.c_str(),
+        n_loaded,
+        n_files,
+        double(total.bytes) / 1e6,
+        total.msecs / double(n_iterations),
+        rss_after,
+        rss_after - rss_before);
+
+    tr_sessionClose(session);
+    removeRecursive(config_dir);
+    return 0;
+}
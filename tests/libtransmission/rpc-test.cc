@@ -7,15 +7,33 @@
  */
 
 #include "transmission.h"
+#include "crypto-utils.h"
+#include "rpc-server.h"
 #include "rpcimpl.h"
+#include "session.h"
+#include "torrent.h"
+#include "trevent.h"
 #include "utils.h"
 #include "variant.h"
 
 #include "test-fixtures.h"
 
+#include <event2/buffer.h>
+
+#include <zlib.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#endif
+
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <optional>
 #include <set>
+#include <string>
 #include <string_view>
 #include <vector>
 
@@ -97,7 +115,7 @@ TEST_F(RpcTest, sessionGet)
     EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
 
     // what we expected
-    auto const expected_keys = std::array<tr_quark, 55>{
+    auto const expected_keys = std::array<tr_quark, 56>{
         TR_KEY_alt_speed_down,
         TR_KEY_alt_speed_enabled,
         TR_KEY_alt_speed_time_begin,
@@ -123,6 +141,7 @@ TEST_F(RpcTest, sessionGet)
         TR_KEY_incomplete_dir,
         TR_KEY_incomplete_dir_enabled,
         TR_KEY_lpd_enabled,
+        TR_KEY_open_file_limit,
         TR_KEY_peer_limit_global,
         TR_KEY_peer_limit_per_torrent,
         TR_KEY_peer_port,
@@ -188,6 +207,646 @@ TEST_F(RpcTest, sessionGet)
     tr_torrentRemove(tor, false, nullptr);
 }
 
+TEST_F(RpcTest, torrentGetCursor)
+{
+    auto const rpc_response_func = [](tr_session* /*session*/, tr_variant* response, void* setme) noexcept
+    {
+        *static_cast<tr_variant*>(setme) = *response;
+        tr_variantInitBool(response, false);
+    };
+
+    auto* tor = zeroTorrentInit();
+    EXPECT_NE(nullptr, tor);
+
+    auto const torrent_get = [this, &rpc_response_func](int64_t cursor, tr_variant* response)
+    {
+        tr_variant request;
+        tr_variantInitDict(&request, 2);
+        tr_variantDictAddStrView(&request, TR_KEY_method, "torrent-get");
+        auto* args = tr_variantDictAddDict(&request, TR_KEY_arguments, 2);
+        tr_variantDictAddInt(args, TR_KEY_cursor, cursor);
+        auto* fields = tr_variantDictAddList(args, TR_KEY_fields, 2);
+        tr_variantListAddStrView(fields, "name");
+        tr_variantListAddStrView(fields, "uploadLimit");
+        tr_rpc_request_exec_json(session_, &request, rpc_response_func, response);
+        tr_variantFree(&request);
+
+        tr_variant* response_args = nullptr;
+        EXPECT_TRUE(tr_variantDictFindDict(response, TR_KEY_arguments, &response_args));
+        return response_args;
+    };
+
+    // a zero cursor gets everything, and a cursor to use next time
+    tr_variant response;
+    auto* args = torrent_get(0, &response);
+    auto cursor = int64_t{};
+    EXPECT_TRUE(tr_variantDictFindInt(args, TR_KEY_cursor, &cursor));
+    EXPECT_LT(0, cursor);
+    tr_variant* torrents = nullptr;
+    EXPECT_TRUE(tr_variantDictFindList(args, TR_KEY_torrents, &torrents));
+    EXPECT_EQ(1U, tr_variantListSize(torrents));
+    auto sv = std::string_view{};
+    EXPECT_TRUE(tr_variantDictFindStrView(tr_variantListChild(torrents, 0), TR_KEY_name, &sv));
+    EXPECT_EQ("files-filled-with-zeroes"sv, sv);
+    tr_variantFree(&response);
+
+    // nothing has changed since then
+    args = torrent_get(cursor, &response);
+    EXPECT_TRUE(tr_variantDictFindList(args, TR_KEY_torrents, &torrents));
+    EXPECT_EQ(0U, tr_variantListSize(torrents));
+    tr_variantFree(&response);
+
+    // only the field that changed is returned, along with the id
+    tr_torrentSetSpeedLimit_KBps(tor, TR_UP, 42);
+    args = torrent_get(cursor, &response);
+    EXPECT_TRUE(tr_variantDictFindList(args, TR_KEY_torrents, &torrents));
+    EXPECT_EQ(1U, tr_variantListSize(torrents));
+    auto* const entry = tr_variantListChild(torrents, 0);
+    auto i = int64_t{};
+    EXPECT_TRUE(tr_variantDictFindInt(entry, TR_KEY_uploadLimit, &i));
+    EXPECT_EQ(42, i);
+    EXPECT_TRUE(tr_variantDictFindInt(entry, TR_KEY_id, &i));
+    EXPECT_EQ(tr_torrentId(tor), i);
+    EXPECT_FALSE(tr_variantDictFindStrView(entry, TR_KEY_name, &sv));
+    tr_variantFree(&response);
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(RpcTest, torrentGetCursorSkipsClockFields)
+{
+    auto const rpc_response_func = [](tr_session* /*session*/, tr_variant* response, void* setme) noexcept
+    {
+        *static_cast<tr_variant*>(setme) = *response;
+        tr_variantInitBool(response, false);
+    };
+
+    auto const torrent_get = [this, &rpc_response_func](int64_t cursor, tr_variant* response)
+    {
+        tr_variant request;
+        tr_variantInitDict(&request, 2);
+        tr_variantDictAddStrView(&request, TR_KEY_method, "torrent-get");
+        auto* args = tr_variantDictAddDict(&request, TR_KEY_arguments, 2);
+        tr_variantDictAddInt(args, TR_KEY_cursor, cursor);
+        auto* fields = tr_variantDictAddList(args, TR_KEY_fields, 6);
+        for (auto const* const field : { "eta", "etaIdle", "isStalled", "peers", "secondsDownloading", "secondsSeeding" })
+        {
+            tr_variantListAddStrView(fields, field);
+        }
+        tr_rpc_request_exec_json(session_, &request, rpc_response_func, response);
+        tr_variantFree(&request);
+
+        tr_variant* response_args = nullptr;
+        EXPECT_TRUE(tr_variantDictFindDict(response, TR_KEY_arguments, &response_args));
+        return response_args;
+    };
+
+    // a complete torrent that's seeding to no one
+    auto* tor = zeroTorrentInit();
+    EXPECT_NE(nullptr, tor);
+    zeroTorrentPopulate(tor, true);
+    blockingTorrentVerify(tor);
+    tr_torrentStart(tor);
+    EXPECT_TRUE(waitFor([tor]() { return tr_torrentGetActivity(tor) == TR_STATUS_SEED; }, 5000));
+
+    // starting it marks its activity as changed, and the start may still be
+    // finishing in the session thread. Wait for it before taking the cursor
+    auto started = std::atomic<bool>{ false };
+    tr_runInEventThread(
+        session_,
+        [](void* vstarted) { *static_cast<std::atomic<bool>*>(vstarted) = true; },
+        &started);
+    EXPECT_TRUE(waitFor([&started]() { return started.load(); }, 5000));
+
+    tr_variant response;
+    auto* args = torrent_get(0, &response);
+    auto cursor = int64_t{};
+    EXPECT_TRUE(tr_variantDictFindInt(args, TR_KEY_cursor, &cursor));
+    tr_variantFree(&response);
+
+    // it keeps seeding, but nothing else about it changes
+    auto const seconds_seeding = tor->secondsSeeding;
+    EXPECT_TRUE(waitFor([tor, seconds_seeding]() { return tor->secondsSeeding > seconds_seeding + 1; }, 5000));
+    args = torrent_get(cursor, &response);
+    tr_variant* torrents = nullptr;
+    EXPECT_TRUE(tr_variantDictFindList(args, TR_KEY_torrents, &torrents));
+    EXPECT_EQ(0U, tr_variantListSize(torrents));
+    tr_variantFree(&response);
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+// torrent-get and session-get responses are written straight to JSON by
+// tr_rpc_request_exec_json_buf(). They should parse to the same values as
+// the tr_variant responses do
+class RpcJsonTest : public SessionTest
+{
+protected:
+    // a string that needs every kind of escaping that tr_jsonAddStr() does
+    static auto constexpr EscapeMe = "quote\" backslash\\ slash/ \b\f\n\r\t ctrl\x01 utf8 \xc3\xa9 \xe2\x82\xac"sv;
+
+    // serializes both responses to `request` to benc, which sorts the dict keys
+    std::pair<std::string, std::string> execBoth(tr_variant* request)
+    {
+        auto variant_json = std::string{};
+        tr_rpc_request_exec_json(
+            session_,
+            request,
+            [](tr_session* /*session*/, tr_variant* response, void* vjson)
+            { *static_cast<std::string*>(vjson) = tr_variantToStr(response, TR_VARIANT_FMT_JSON_LEAN); },
+            &variant_json);
+
+        auto streamed_json = std::string{};
+        tr_rpc_request_exec_json_buf(
+            session_,
+            request,
+            [](tr_session* /*session*/, evbuffer* response, void* vjson)
+            {
+                auto const len = evbuffer_get_length(response);
+                static_cast<std::string*>(vjson)->assign(
+                    reinterpret_cast<char const*>(evbuffer_pullup(response, -1)),
+                    len);
+            },
+            &streamed_json);
+
+        return { toBenc(variant_json), toBenc(streamed_json) };
+    }
+
+    static std::string toBenc(std::string_view json)
+    {
+        auto top = tr_variant{};
+        EXPECT_TRUE(tr_variantFromBuf(&top, TR_VARIANT_PARSE_JSON, json));
+
+        // this one can change between the two calls
+        tr_variant* args = nullptr;
+        if (tr_variantDictFindDict(&top, TR_KEY_arguments, &args))
+        {
+            tr_variantDictRemove(args, TR_KEY_download_dir_free_space);
+        }
+
+        auto benc = tr_variantToStr(&top, TR_VARIANT_FMT_BENC);
+        tr_variantFree(&top);
+        return benc;
+    }
+};
+
+TEST_F(RpcJsonTest, torrentGetMatchesVariant)
+{
+    auto* tor = zeroTorrentInit();
+    EXPECT_NE(nullptr, tor);
+    tr_torrentSetLabels(tor, { std::string{ EscapeMe } });
+    tr_torrentSetRatioMode(tor, TR_RATIOLIMIT_SINGLE);
+    tr_torrentSetRatioLimit(tor, 2.71828);
+
+    tr_variant request;
+    tr_variantInitDict(&request, 3);
+    tr_variantDictAddStrView(&request, TR_KEY_method, "torrent-get");
+    tr_variantDictAddInt(&request, TR_KEY_tag, 1234);
+    auto* args = tr_variantDictAddDict(&request, TR_KEY_arguments, 1);
+    auto* fields = tr_variantDictAddList(args, TR_KEY_fields, 20);
+    for (auto const* const field : { "id",
+                                     "name",
+                                     "hashString",
+                                     "labels",
+                                     "status",
+                                     "percentDone",
+                                     "uploadRatio",
+                                     "seedRatioLimit",
+                                     "seedRatioMode",
+                                     "sizeWhenDone",
+                                     "downloadDir",
+                                     "files",
+                                     "fileStats",
+                                     "priorities",
+                                     "wanted",
+                                     "pieceCount",
+                                     "pieces",
+                                     "trackers",
+                                     "trackerStats",
+                                     "peers" })
+    {
+        tr_variantListAddStr(fields, field);
+    }
+
+    auto const [expected, actual] = execBoth(&request);
+    EXPECT_EQ(expected, actual);
+
+    // spot-check the values that needed escaping and formatting
+    tr_variant response;
+    EXPECT_TRUE(tr_variantFromBuf(&response, TR_VARIANT_PARSE_BENC, actual));
+    tr_variant* response_args = nullptr;
+    tr_variant* torrents = nullptr;
+    EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &response_args));
+    EXPECT_TRUE(tr_variantDictFindList(response_args, TR_KEY_torrents, &torrents));
+    ASSERT_EQ(1U, tr_variantListSize(torrents));
+    auto* const entry = tr_variantListChild(torrents, 0);
+    tr_variant* labels = nullptr;
+    auto sv = std::string_view{};
+    EXPECT_TRUE(tr_variantDictFindList(entry, TR_KEY_labels, &labels));
+    EXPECT_TRUE(tr_variantGetStrView(tr_variantListChild(labels, 0), &sv));
+    EXPECT_EQ(EscapeMe, sv);
+    auto d = double{};
+    EXPECT_TRUE(tr_variantDictFindReal(entry, TR_KEY_seedRatioLimit, &d));
+    EXPECT_DOUBLE_EQ(2.7182, d);
+    auto i = int64_t{};
+    EXPECT_TRUE(tr_variantDictFindInt(&response, TR_KEY_tag, &i));
+    EXPECT_EQ(1234, i);
+    tr_variantFree(&response);
+
+    // cleanup
+    tr_variantFree(&request);
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(RpcJsonTest, sessionGetMatchesVariant)
+{
+    auto const script = std::string{ EscapeMe };
+    tr_sessionSetScript(session_, TR_SCRIPT_ON_TORRENT_DONE, script.c_str());
+    tr_sessionSetRatioLimit(session_, 1.5);
+
+    tr_variant request;
+    tr_variantInitDict(&request, 1);
+    tr_variantDictAddStrView(&request, TR_KEY_method, "session-get");
+
+    auto const [expected, actual] = execBoth(&request);
+    EXPECT_EQ(expected, actual);
+
+    // spot-check the values that needed escaping and formatting
+    tr_variant response;
+    EXPECT_TRUE(tr_variantFromBuf(&response, TR_VARIANT_PARSE_BENC, actual));
+    tr_variant* response_args = nullptr;
+    EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &response_args));
+    auto sv = std::string_view{};
+    EXPECT_TRUE(tr_variantDictFindStrView(response_args, TR_KEY_script_torrent_done_filename, &sv));
+    EXPECT_EQ(EscapeMe, sv);
+    auto d = double{};
+    EXPECT_TRUE(tr_variantDictFindReal(response_args, TR_KEY_seedRatioLimit, &d));
+    EXPECT_DOUBLE_EQ(1.5, d);
+    tr_variantFree(&response);
+
+    // cleanup
+    tr_variantFree(&request);
+}
+
+/***
+****  gzip
+***/
+
+// inflates a gzip stream, or returns nullopt if it isn't valid
+static std::optional<std::string> gunzip(std::string_view gzipped)
+{
+    auto stream = z_stream{};
+    if (inflateInit2(&stream, 15 + 16) != Z_OK)
+    {
+        return {};
+    }
+
+    auto out = std::string{};
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(std::data(gzipped)));
+    stream.avail_in = std::size(gzipped);
+    auto state = Z_OK;
+    while (state == Z_OK)
+    {
+        auto chunk = std::array<char, 4096>{};
+        stream.next_out = reinterpret_cast<Bytef*>(std::data(chunk));
+        stream.avail_out = std::size(chunk);
+        state = inflate(&stream, Z_NO_FLUSH);
+        out.append(std::data(chunk), std::size(chunk) - stream.avail_out);
+    }
+
+    inflateEnd(&stream);
+    return state == Z_STREAM_END ? std::make_optional(out) : std::nullopt;
+}
+
+static std::string toString(evbuffer* buf)
+{
+    return { reinterpret_cast<char const*>(evbuffer_pullup(buf, -1)), evbuffer_get_length(buf) };
+}
+
+TEST(RpcGzip, multiSegmentRoundTrip)
+{
+    // build the body out of many separately-allocated segments
+    auto expected = std::string{};
+    auto* const content = evbuffer_new();
+    for (int i = 0; i < 2000; ++i)
+    {
+        auto const line = "{\"id\":" + std::to_string(i) + ",\"name\":\"torrent number " + std::to_string(i) + "\"},";
+        auto* const segment = evbuffer_new();
+        evbuffer_add(segment, std::data(line), std::size(line));
+        evbuffer_add_buffer(content, segment);
+        evbuffer_free(segment);
+        expected += line;
+    }
+    EXPECT_LT(1, evbuffer_peek(content, -1, nullptr, nullptr, 0));
+
+    auto stream = z_stream{};
+    EXPECT_TRUE(tr_rpcGzipInit(&stream, Z_DEFAULT_COMPRESSION));
+
+    // the stream is reset after each body, so it can be reused
+    for (int i = 0; i < 2; ++i)
+    {
+        auto* const out = evbuffer_new();
+        EXPECT_TRUE(tr_rpcGzipBuffer(&stream, out, content));
+        EXPECT_LT(evbuffer_get_length(out), std::size(expected));
+        EXPECT_EQ(expected, gunzip(toString(out)));
+        evbuffer_free(out);
+    }
+
+    // the content is left untouched
+    EXPECT_EQ(expected, toString(content));
+
+    deflateEnd(&stream);
+    evbuffer_free(content);
+}
+
+TEST(RpcGzip, incompressibleBodyIsNotCompressed)
+{
+    auto random = std::vector<char>(64 * 1024);
+    tr_rand_buffer(std::data(random), std::size(random));
+    auto* const content = evbuffer_new();
+    evbuffer_add(content, std::data(random), std::size(random));
+
+    auto stream = z_stream{};
+    EXPECT_TRUE(tr_rpcGzipInit(&stream, Z_BEST_COMPRESSION));
+    auto* const out = evbuffer_new();
+    EXPECT_FALSE(tr_rpcGzipBuffer(&stream, out, content));
+    EXPECT_EQ(0U, evbuffer_get_length(out));
+    EXPECT_EQ(std::size(random), evbuffer_get_length(content));
+
+    // neither are empty ones
+    auto* const empty = evbuffer_new();
+    EXPECT_FALSE(tr_rpcGzipBuffer(&stream, out, empty));
+    EXPECT_EQ(0U, evbuffer_get_length(out));
+
+    deflateEnd(&stream);
+    evbuffer_free(empty);
+    evbuffer_free(out);
+    evbuffer_free(content);
+}
+
+TEST(RpcGzip, levelZeroIsNotCompressed)
+{
+    // level 0 only wraps the body in stored blocks, which makes it bigger
+    auto const text = std::string(16 * 1024, 'x');
+    auto* const content = evbuffer_new();
+    evbuffer_add(content, std::data(text), std::size(text));
+
+    auto stream = z_stream{};
+    EXPECT_TRUE(tr_rpcGzipInit(&stream, Z_NO_COMPRESSION));
+    auto* const out = evbuffer_new();
+    EXPECT_FALSE(tr_rpcGzipBuffer(&stream, out, content));
+    EXPECT_EQ(0U, evbuffer_get_length(out));
+
+    deflateEnd(&stream);
+    evbuffer_free(out);
+    evbuffer_free(content);
+}
+
+#ifndef _WIN32
+
+// Sends RPC requests to the session's RPC server over HTTP
+class RpcServerTest : public SessionTest
+{
+protected:
+    struct Response
+    {
+        int status = 0;
+        std::string headers;
+        std::string body;
+    };
+
+    static uint16_t findFreePort()
+    {
+        auto const sock = socket(AF_INET, SOCK_STREAM, 0);
+        auto addr = sockaddr_in{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        auto len = socklen_t{ sizeof(addr) };
+        getsockname(sock, reinterpret_cast<sockaddr*>(&addr), &len);
+        close(sock);
+        return ntohs(addr.sin_port);
+    }
+
+    // connects to the RPC server and sends a request, returning the socket
+    int sendRequest(std::string_view json, bool accept_gzip)
+    {
+        auto const sock = socket(AF_INET, SOCK_STREAM, 0);
+        auto addr = sockaddr_in{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port_);
+        if (connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+        {
+            close(sock);
+            return -1;
+        }
+
+        auto request = "POST /transmission/rpc HTTP/1.0\r\n"
+                       "Host: 127.0.0.1\r\n"
+                       "Content-Type: application/json\r\n"s;
+        request += "Content-Length: " + std::to_string(std::size(json)) + "\r\n";
+        request += "X-Transmission-Session-Id: " + session_id_ + "\r\n";
+        if (accept_gzip)
+        {
+            request += "Accept-Encoding: gzip\r\n";
+        }
+        request += "\r\n";
+        request += json;
+        send(sock, std::data(request), std::size(request), 0);
+        return sock;
+    }
+
+    Response post(std::string_view json, bool accept_gzip)
+    {
+        auto response = Response{};
+        auto const sock = sendRequest(json, accept_gzip);
+        if (sock < 0)
+        {
+            return response;
+        }
+
+        auto raw = std::string{};
+        auto buf = std::array<char, 4096>{};
+        for (;;)
+        {
+            auto const n = recv(sock, std::data(buf), std::size(buf), 0);
+            if (n <= 0)
+            {
+                break;
+            }
+            raw.append(std::data(buf), n);
+        }
+        close(sock);
+
+        auto const end_of_headers = raw.find("\r\n\r\n");
+        if (end_of_headers == std::string::npos || sscanf(raw.c_str(), "HTTP/%*s %d", &response.status) != 1)
+        {
+            return response;
+        }
+
+        response.headers = raw.substr(0, end_of_headers + 2);
+        response.body = raw.substr(end_of_headers + 4);
+        return response;
+    }
+
+    // the body of a successful response, uncompressed if need be
+    static std::string getBody(Response const& response)
+    {
+        EXPECT_EQ(HTTP_OK, response.status);
+        if (response.headers.find("Content-Encoding: gzip\r\n") == std::string::npos)
+        {
+            return response.body;
+        }
+
+        return gunzip(response.body).value_or("");
+    }
+
+    static bool isGzipped(Response const& response)
+    {
+        return response.headers.find("Content-Encoding: gzip\r\n") != std::string::npos;
+    }
+
+    void SetUp() override
+    {
+        port_ = findFreePort();
+        tr_variantDictAddBool(settings(), TR_KEY_rpc_enabled, true);
+        tr_variantDictAddStr(settings(), TR_KEY_rpc_bind_address, "127.0.0.1");
+        tr_variantDictAddInt(settings(), TR_KEY_rpc_port, port_);
+        tr_variantDictAddInt(settings(), TR_KEY_rpc_compression_thread_threshold_kb, 1);
+
+        SessionTest::SetUp();
+
+        // the first request is turned away with the session id to use
+        auto response = Response{};
+        EXPECT_TRUE(waitFor(
+            [this, &response]()
+            {
+                response = post("{}", false);
+                return response.status != 0;
+            },
+            5000));
+        EXPECT_EQ(409, response.status);
+        auto const key = "X-Transmission-Session-Id: "sv;
+        auto const pos = response.headers.find(key);
+        ASSERT_NE(std::string::npos, pos);
+        session_id_ = response.headers.substr(pos + std::size(key), response.headers.find('\r', pos) - pos - std::size(key));
+    }
+
+    // a torrent-get whose response is big and compresses well
+    std::string bigRequest(tr_torrent* tor, std::string const& label)
+    {
+        tr_torrentSetLabels(tor, { label });
+        return R"({"method":"torrent-get","arguments":{"fields":["id","labels"]}})";
+    }
+
+    static std::string getLabel(std::string_view json)
+    {
+        auto top = tr_variant{};
+        auto label = std::string{};
+        tr_variant* args = nullptr;
+        tr_variant* torrents = nullptr;
+        tr_variant* labels = nullptr;
+        auto sv = std::string_view{};
+        if (tr_variantFromBuf(&top, TR_VARIANT_PARSE_JSON, json) &&
+            tr_variantDictFindDict(&top, TR_KEY_arguments, &args) &&
+            tr_variantDictFindList(args, TR_KEY_torrents, &torrents) &&
+            tr_variantDictFindList(tr_variantListChild(torrents, 0), TR_KEY_labels, &labels) &&
+            tr_variantGetStrView(tr_variantListChild(labels, 0), &sv))
+        {
+            label = sv;
+        }
+        tr_variantFree(&top);
+        return label;
+    }
+
+    uint16_t port_ = 0;
+    std::string session_id_;
+};
+
+TEST_F(RpcServerTest, bigResponseIsCompressedOnWorkerThread)
+{
+    auto* const tor = zeroTorrentInit();
+    auto label = std::string{};
+    while (std::size(label) < 64 * 1024)
+    {
+        label += "label " + std::to_string(std::size(label)) + ' ';
+    }
+    auto const request = bigRequest(tor, label);
+
+    // bigger than the 1 KiB threshold, so it's compressed on the worker thread
+    auto const response = post(request, true);
+    EXPECT_TRUE(isGzipped(response));
+    EXPECT_LT(std::size(response.body), std::size(label));
+    EXPECT_EQ(label, getLabel(getBody(response)));
+
+    // clients that don't accept gzip get the plain body
+    auto const plain = post(request, false);
+    EXPECT_FALSE(isGzipped(plain));
+    EXPECT_EQ(label, getLabel(getBody(plain)));
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(RpcServerTest, levelZeroTurnsCompressionOff)
+{
+    auto* const tor = zeroTorrentInit();
+    auto const label = std::string(64 * 1024, 'x');
+    auto const request = bigRequest(tor, label);
+
+    tr_rpcSetCompressionLevel(session_->rpc_server_.get(), Z_NO_COMPRESSION);
+    auto const response = post(request, true);
+    EXPECT_FALSE(isGzipped(response));
+    EXPECT_EQ(label, getLabel(getBody(response)));
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(RpcServerTest, serverStopsWhileCompressing)
+{
+    tr_rpcSetCompressionLevel(session_->rpc_server_.get(), Z_BEST_COMPRESSION);
+
+    auto* const tor = zeroTorrentInit();
+    auto label = std::string{};
+    while (std::size(label) < 16 * 1024 * 1024)
+    {
+        label += "label " + std::to_string(std::size(label)) + ' ';
+    }
+    auto const request = bigRequest(tor, label);
+
+    // Turn off the server while the worker thread is compressing the reply.
+    // Freeing the server frees the request with its connection, so the
+    // finished job mustn't try to reply to it
+    auto const sock = sendRequest(request, true);
+    EXPECT_LE(0, sock);
+    tr_wait_msec(100);
+    tr_sessionSetRPCEnabled(session_, false);
+    auto buf = std::array<char, 4096>{};
+    while (recv(sock, std::data(buf), std::size(buf), 0) > 0)
+    {
+    }
+    close(sock);
+
+    // give the job time to finish, then check that the server still works
+    tr_wait_msec(1000);
+    tr_sessionSetRPCEnabled(session_, true);
+    auto response = Response{};
+    EXPECT_TRUE(waitFor(
+        [this, &response]()
+        {
+            response = post(R"({"method":"session-get"})", true);
+            return response.status != 0;
+        },
+        5000));
+    EXPECT_EQ(HTTP_OK, response.status);
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+#endif
+
 } // namespace test
 
 } // namespace libtransmission
@@ -7,9 +7,14 @@
  */
 
 #include "transmission.h"
+#include "crypto-utils.h"
+#include "file.h"
+#include "platform.h"
 #include "session.h"
 #include "session-id.h"
+#include "trevent.h"
 #include "utils.h"
+#include "variant.h"
 #include "version.h"
 
 #include "test-fixtures.h"
@@ -20,6 +25,9 @@
 #include <cstdlib>
 #include <cstring>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 using namespace std::literals;
 
@@ -293,6 +301,143 @@ TEST_F(SessionTest, sessionId)
     tr_free(const_cast<char*>(session_id_str_1));
 }
 
+TEST_F(SessionTest, runInEventThread)
+{
+    auto constexpr NumThreads = size_t{ 4 };
+    auto constexpr NumTasks = size_t{ 10000 };
+
+    struct Task
+    {
+        std::vector<std::pair<size_t, size_t>>* ran;
+        size_t thread;
+        size_t seq;
+    };
+
+    // only touched by the event thread
+    auto ran = std::vector<std::pair<size_t, size_t>>{};
+    auto tasks = std::vector<std::vector<Task>>(NumThreads);
+
+    auto threads = std::vector<std::thread>{};
+    for (size_t i = 0; i < NumThreads; ++i)
+    {
+        tasks[i].reserve(NumTasks);
+        for (size_t j = 0; j < NumTasks; ++j)
+        {
+            tasks[i].push_back({ &ran, i, j });
+        }
+
+        threads.emplace_back(
+            [this, &tasks, i]()
+            {
+                for (auto& task : tasks[i])
+                {
+                    tr_runInEventThread(
+                        session_,
+                        [](void* vtask)
+                        {
+                            auto* const t = static_cast<Task*>(vtask);
+                            t->ran->emplace_back(t->thread, t->seq);
+                        },
+                        &task);
+                }
+            });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    auto stats = tr_event_stats{};
+    auto const test = [this, &stats]()
+    {
+        tr_eventGetStats(session_, &stats);
+        return stats.queue_depth == 0;
+    };
+    EXPECT_TRUE(waitFor(test, 5000));
+
+    // every task ran, and each thread's tasks ran in the order they were posted
+    EXPECT_EQ(NumThreads * NumTasks, std::size(ran));
+    auto next = std::vector<size_t>(NumThreads);
+    for (auto const& [thread, seq] : ran)
+    {
+        EXPECT_EQ(next[thread], seq);
+        next[thread] = seq + 1;
+    }
+
+    EXPECT_LE(NumThreads * NumTasks, stats.tasks_run);
+    EXPECT_LE(1U, stats.wakeups);
+    EXPECT_LE(1U, stats.max_batch);
+}
+
+TEST_F(SessionTest, loadTorrents)
+{
+    // enough torrents to need several batches
+    auto constexpr NumTorrents = size_t{ 600 };
+
+    auto const torrent_dir = std::string{ tr_getTorrentDir(session_) };
+    auto const resume_dir = std::string{ tr_getResumeDir(session_) };
+
+    for (size_t i = 0; i < NumTorrents; ++i)
+    {
+        auto const name = "torrent-" + std::to_string(i);
+        auto const pieces = std::string(20, char(i));
+
+        auto top = tr_variant{};
+        tr_variantInitDict(&top, 1);
+        auto* const info = tr_variantDictAddDict(&top, TR_KEY_info, 4);
+        tr_variantDictAddInt(info, TR_KEY_length, 1024);
+        tr_variantDictAddStr(info, TR_KEY_name, name);
+        tr_variantDictAddInt(info, TR_KEY_piece_length, 16384);
+        tr_variantDictAddRaw(info, TR_KEY_pieces, std::data(pieces), std::size(pieces));
+        auto const hash_string = tr_sha1_to_string(*tr_sha1(tr_variantToStr(info, TR_VARIANT_FMT_BENC)));
+        EXPECT_EQ(0, tr_variantToFile(&top, TR_VARIANT_FMT_BENC, tr_strvPath(torrent_dir, hash_string + ".torrent")));
+        tr_variantFree(&top);
+
+        // give every other torrent a resume file
+        if (i % 2 == 0)
+        {
+            tr_variantInitDict(&top, 1);
+            tr_variantDictAddInt(&top, TR_KEY_added_date, 1000 + i);
+            EXPECT_EQ(0, tr_variantToFile(&top, TR_VARIANT_FMT_BENC, tr_strvPath(resume_dir, hash_string + ".resume")));
+            tr_variantFree(&top);
+        }
+    }
+
+    // these should be skipped
+    createFileWithContents(tr_strvPath(torrent_dir, "not-a-torrent.torrent"), "garbage");
+    createFileWithContents(tr_strvPath(torrent_dir, "not-a-torrent.txt"), "garbage");
+
+    auto* const ctor = tr_ctorNew(session_);
+    tr_ctorSetPaused(ctor, TR_FORCE, true);
+    auto n = int{};
+    auto* const torrents = tr_sessionLoadTorrents(session_, ctor, &n);
+    tr_ctorFree(ctor);
+
+    EXPECT_EQ(NumTorrents, size_t(n));
+    EXPECT_EQ(NumTorrents, size_t(tr_sessionCountTorrents(session_)));
+
+    auto names = std::vector<std::string>{};
+    for (int i = 0; i < n; ++i)
+    {
+        auto* const tor = torrents[i];
+        auto const name = std::string{ tr_torrentName(tor) };
+        names.push_back(name);
+
+        // the preloaded resume files were used
+        auto const idx = std::stoul(name.substr(std::size("torrent-"sv)));
+        if (idx % 2 == 0)
+        {
+            EXPECT_EQ(time_t(1000 + idx), tr_torrentStat(tor)->addedDate);
+        }
+    }
+
+    std::sort(std::begin(names), std::end(names));
+    EXPECT_EQ(std::end(names), std::unique(std::begin(names), std::end(names)));
+
+    tr_free(torrents);
+}
+
 } // namespace test
 
 } // namespace libtransmission
@@ -0,0 +1,77 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "crypto-utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Measures piece hashing throughput, one piece at a time vs. tr_sha1_batch().
+// usage: libtransmission-sha1-benchmark [piece-size-KiB] [pieces-per-batch] [MiB-to-hash]
+// Set TR_SHA1_BATCH_IMPL=avx2 or TR_SHA1_BATCH_IMPL=backend to force a slower implementation.
+int main(int argc, char** argv)
+{
+    auto const piece_size = size_t(argc > 1 ? atoi(argv[1]) : 256) * 1024;
+    auto const batch_size = size_t(argc > 2 ? atoi(argv[2]) : 8);
+    auto const total_size = size_t(argc > 3 ? atoi(argv[3]) : 1024) * 1024 * 1024;
+    if (piece_size == 0 || batch_size == 0)
+    {
+        return 1;
+    }
+
+    auto pieces = std::vector<std::string>(batch_size, std::string(piece_size, '\0'));
+    auto ptrs = std::vector<void const*>{};
+    auto lengths = std::vector<size_t>{};
+    for (auto& piece : pieces)
+    {
+        tr_rand_buffer(std::data(piece), std::size(piece));
+        ptrs.push_back(std::data(piece));
+        lengths.push_back(std::size(piece));
+    }
+
+    auto digests = std::vector<tr_sha1_digest_t>(batch_size);
+    auto const n_rounds = std::max(size_t{ 1 }, total_size / (piece_size * batch_size));
+    auto const n_bytes = double(n_rounds * piece_size * batch_size);
+
+    auto const run = [&](char const* name, auto hash_batch)
+    {
+        auto const begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < n_rounds; ++i)
+        {
+            hash_batch();
+        }
+
+        auto const secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        printf("%-12s %8.1f MiB/s\n", name, n_bytes / secs / (1024 * 1024));
+    };
+
+    printf(
+        "hashing %zu MiB in batches of %zu %zu KiB pieces\n",
+        size_t(n_bytes) / (1024 * 1024),
+        batch_size,
+        piece_size / 1024);
+
+    run("tr_sha1",
+        [&]()
+        {
+            for (size_t i = 0; i < batch_size; ++i)
+            {
+                digests[i] = *tr_sha1(pieces[i]);
+            }
+        });
+
+    auto const batch_name = "batch/" + std::string{ tr_sha1_batch_impl() };
+    run(batch_name.c_str(), [&]() { tr_sha1_batch(batch_size, std::data(ptrs), std::data(lengths), std::data(digests)); });
+
+    return 0;
+}
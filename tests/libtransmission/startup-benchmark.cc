@@ -0,0 +1,229 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "crypto-utils.h"
+#include "file.h"
+#include "platform.h"
+#include "torrent.h"
+#include "trevent.h"
+#include "utils.h"
+#include "variant.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+auto constexpr PieceSize = int64_t{ 256 * 1024 };
+
+// Writes a .torrent file and a .resume file for a fake torrent
+void createTorrent(std::string const& config_dir, size_t idx, size_t n_files, int64_t total_size)
+{
+    auto const name = "startup-benchmark-" + std::to_string(idx);
+    auto const n_pieces = size_t((total_size + PieceSize - 1) / PieceSize);
+    auto pieces = std::string(n_pieces * SHA_DIGEST_LENGTH, '\0');
+    tr_rand_buffer(std::data(pieces), std::size(pieces));
+
+    auto top = tr_variant{};
+    tr_variantInitDict(&top, 3);
+    tr_variantDictAddStr(&top, TR_KEY_announce, "http://tracker.example.com/announce");
+    tr_variantDictAddStr(&top, TR_KEY_comment, "startup benchmark");
+    auto* const info = tr_variantDictAddDict(&top, TR_KEY_info, 4);
+    tr_variantDictAddStr(info, TR_KEY_name, name);
+    tr_variantDictAddInt(info, TR_KEY_piece_length, PieceSize);
+    tr_variantDictAddRaw(info, TR_KEY_pieces, std::data(pieces), std::size(pieces));
+    if (n_files <= 1)
+    {
+        tr_variantDictAddInt(info, TR_KEY_length, total_size);
+    }
+    else
+    {
+        auto* const files = tr_variantDictAddList(info, TR_KEY_files, n_files);
+        for (size_t i = 0; i < n_files; ++i)
+        {
+            auto* const file = tr_variantListAddDict(files, 2);
+            tr_variantDictAddInt(file, TR_KEY_length, total_size / n_files + (i == 0 ? total_size % n_files : 0));
+            auto* const path = tr_variantDictAddList(file, TR_KEY_path, 2);
+            tr_variantListAddStr(path, "dir-" + std::to_string(i % 10));
+            tr_variantListAddStr(path, "file-" + std::to_string(i) + ".bin");
+        }
+    }
+
+    auto const hash_string = tr_sha1_to_string(*tr_sha1(tr_variantToStr(info, TR_VARIANT_FMT_BENC)));
+    tr_variantToFile(&top, TR_VARIANT_FMT_BENC, config_dir + "/torrents/" + hash_string + ".torrent");
+    tr_variantFree(&top);
+
+    tr_variantInitDict(&top, 8);
+    tr_variantDictAddInt(&top, TR_KEY_added_date, 1600000000 + idx);
+    tr_variantDictAddStr(&top, TR_KEY_destination, "/tmp/startup-benchmark");
+    tr_variantDictAddInt(&top, TR_KEY_downloaded, 0);
+    tr_variantDictAddInt(&top, TR_KEY_uploaded, 0);
+    tr_variantDictAddInt(&top, TR_KEY_paused, 1);
+    tr_variantDictAddInt(&top, TR_KEY_max_peers, 50);
+    auto* const dnd = tr_variantDictAddList(&top, TR_KEY_dnd, n_files);
+    auto* const priority = tr_variantDictAddList(&top, TR_KEY_priority, n_files);
+    for (size_t i = 0; i < n_files; ++i)
+    {
+        tr_variantListAddInt(dnd, 0);
+        tr_variantListAddInt(priority, 0);
+    }
+    tr_variantToFile(&top, TR_VARIANT_FMT_BENC, config_dir + "/resume/" + hash_string + ".resume");
+    tr_variantFree(&top);
+}
+
+void removeRecursive(std::string const& path)
+{
+    auto info = tr_sys_path_info{};
+    if (tr_sys_path_get_info(path.c_str(), 0, &info, nullptr) && info.type == TR_SYS_PATH_IS_DIRECTORY)
+    {
+        auto children = std::vector<std::string>{};
+        auto* const odir = tr_sys_dir_open(path.c_str(), nullptr);
+        char const* name = nullptr;
+        while ((name = tr_sys_dir_read_name(odir, nullptr)) != nullptr)
+        {
+            if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+            {
+                children.push_back(path + '/' + name);
+            }
+        }
+        tr_sys_dir_close(odir, nullptr);
+
+        for (auto const& child : children)
+        {
+            removeRecursive(child);
+        }
+    }
+
+    tr_sys_path_remove(path.c_str(), nullptr);
+}
+
+tr_session* sessionInit(std::string const& config_dir)
+{
+    auto settings = tr_variant{};
+    tr_variantInitDict(&settings, 0);
+    tr_sessionGetDefaultSettings(&settings);
+    tr_variantDictAddBool(&settings, TR_KEY_dht_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_lpd_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_utp_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_rpc_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_port_forwarding_enabled, false);
+    tr_variantDictAddInt(&settings, TR_KEY_message_level, TR_LOG_ERROR);
+    auto* const session = tr_sessionInit(config_dir.c_str(), false, &settings);
+    tr_variantFree(&settings);
+    return session;
+}
+
+// How startup used to work: each file is parsed and added by the event thread, one at a time.
+int loadTorrentsSerially(tr_session* session, tr_ctor* ctor)
+{
+    struct Data
+    {
+        tr_session* session;
+        tr_ctor* ctor;
+        int n_loaded;
+        std::atomic<bool> done;
+    };
+
+    auto data = Data{ session, ctor, 0, false };
+    tr_runInEventThread(
+        session,
+        [](void* vdata)
+        {
+            auto* const d = static_cast<Data*>(vdata);
+            auto const torrent_dir = std::string{ tr_getTorrentDir(d->session) };
+            auto* const odir = tr_sys_dir_open(torrent_dir.c_str(), nullptr);
+            char const* name = nullptr;
+            while ((name = tr_sys_dir_read_name(odir, nullptr)) != nullptr)
+            {
+                if (tr_str_has_suffix(name, ".torrent"))
+                {
+                    auto const filename = torrent_dir + '/' + name;
+                    tr_ctorSetMetainfoFromFile(d->ctor, filename.c_str(), nullptr);
+                    d->n_loaded += tr_torrentNew(d->ctor, nullptr) != nullptr ? 1 : 0;
+                }
+            }
+            tr_sys_dir_close(odir, nullptr);
+            d->done = true;
+        },
+        &data);
+
+    while (!data.done)
+    {
+        std::this_thread::yield();
+    }
+
+    return data.n_loaded;
+}
+
+} // namespace
+
+// Measures how long a session takes to load the torrents in its config dir.
+// usage: libtransmission-startup-benchmark [torrents] [files-per-torrent] [MiB-per-torrent]
+int main(int argc, char** argv)
+{
+    auto const n_torrents = size_t(argc > 1 ? atoi(argv[1]) : 2000);
+    auto const n_files = size_t(argc > 2 ? atoi(argv[2]) : 20);
+    auto const total_size = int64_t(argc > 3 ? atoi(argv[3]) : 1024) * 1024 * 1024;
+    if (n_files == 0 || total_size <= 0)
+    {
+        return 1;
+    }
+
+    auto config_dir = std::string{ "transmission-startup-benchmark-XXXXXX" };
+    if (!tr_sys_dir_create_temp(std::data(config_dir), nullptr))
+    {
+        return 1;
+    }
+
+    for (auto const* const subdir : { "/torrents", "/resume" })
+    {
+        tr_sys_dir_create((config_dir + subdir).c_str(), TR_SYS_DIR_CREATE_PARENTS, 0700, nullptr);
+    }
+
+    for (size_t i = 0; i < n_torrents; ++i)
+    {
+        createTorrent(config_dir, i, n_files, total_size);
+    }
+
+    printf("%zu torrents with %zu files and %lld MiB each\n", n_torrents, n_files, (long long)(total_size >> 20));
+
+    auto const run = [&config_dir](char const* name, auto load_torrents)
+    {
+        auto* const session = sessionInit(config_dir);
+        auto* const ctor = tr_ctorNew(session);
+        tr_ctorSetPaused(ctor, TR_FORCE, true);
+
+        auto const begin = std::chrono::steady_clock::now();
+        auto const n_loaded = load_torrents(session, ctor);
+        auto const msecs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        printf("%-8s %6d torrents in %8.1f ms (%.1f usec/torrent)\n", name, n_loaded, msecs, msecs * 1000 / n_loaded);
+
+        tr_ctorFree(ctor);
+        tr_sessionClose(session);
+    };
+
+    run("serial", loadTorrentsSerially);
+    run("parallel",
+        [](tr_session* session, tr_ctor* ctor)
+        {
+            auto n = int{};
+            tr_free(tr_sessionLoadTorrents(session, ctor, &n));
+            return n;
+        });
+
+    removeRecursive(config_dir);
+    return 0;
+}
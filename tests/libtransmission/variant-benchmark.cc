@@ -0,0 +1,60 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "quark.h"
+#include "variant.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Measures how long it takes to find a key in dicts of various sizes.
+// usage: libtransmission-variant-benchmark [lookups-per-size]
+int main(int argc, char** argv)
+{
+    auto const n_lookups = size_t(argc > 1 ? atoi(argv[1]) : 10000000);
+
+    auto keys = std::vector<tr_quark>{};
+    for (size_t i = 0; i < 1024; ++i)
+    {
+        keys.push_back(tr_quark_new("variant-benchmark-key-" + std::to_string(i)));
+    }
+
+    for (size_t const n_keys : { 4, 8, 16, 32, 64, 128, 256, 1024 })
+    {
+        auto dict = tr_variant{};
+        tr_variantInitDict(&dict, n_keys);
+        for (size_t i = 0; i < n_keys; ++i)
+        {
+            tr_variantDictAddInt(&dict, keys[i], i);
+        }
+
+        auto const begin = std::chrono::steady_clock::now();
+
+        auto sum = int64_t{};
+        for (size_t i = 0; i < n_lookups; ++i)
+        {
+            auto val = int64_t{};
+            // a stride that's coprime with every dict size, so that all keys get looked up
+            if (tr_variantDictFindInt(&dict, keys[(i * 7919) % n_keys], &val))
+            {
+                sum += val;
+            }
+        }
+
+        auto const nsecs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+        printf("%5zu keys: %6.1f ns/lookup (checksum %lld)\n", n_keys, nsecs / double(n_lookups), (long long)sum);
+
+        tr_variantFree(&dict);
+    }
+
+    return 0;
+}
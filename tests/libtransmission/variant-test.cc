@@ -19,6 +19,7 @@
 #include <cctype> // isspace()
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -297,6 +298,21 @@ TEST_F(VariantTest, bencSortWhenSerializing)
     tr_variantFree(&val);
 }
 
+TEST_F(VariantTest, realFromInplaceString)
+{
+    // reals are bencoded as strings, and an in-place string runs
+    // straight into the next key instead of ending with a '\0'
+    auto constexpr In = "d5:ratio8:2.5000004:modei1ee"sv;
+
+    tr_variant val;
+    EXPECT_TRUE(tr_variantFromBuf(&val, TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE, In));
+    auto d = double{};
+    EXPECT_TRUE(tr_variantDictFindReal(&val, tr_quark_new("ratio"sv), &d));
+    EXPECT_EQ(2.5, d);
+
+    tr_variantFree(&val);
+}
+
 TEST_F(VariantTest, bencMalformedTooManyEndings)
 {
     auto constexpr In = "leee"sv;
@@ -529,3 +545,73 @@ TEST_F(VariantTest, dictFindType)
 
     tr_variantFree(&top);
 }
+
+TEST_F(VariantTest, dictIndex)
+{
+    // enough keys for the dict to be hash indexed
+    auto constexpr NumKeys = size_t{ 1000 };
+
+    auto keys = std::vector<tr_quark>{};
+    for (size_t i = 0; i < NumKeys; ++i)
+    {
+        keys.push_back(tr_quark_new("dict-index-key-" + std::to_string(i)));
+    }
+
+    tr_variant top;
+    tr_variantInitDict(&top, 0);
+    for (size_t i = 0; i < NumKeys; ++i)
+    {
+        tr_variantDictAddInt(&top, keys[i], i);
+    }
+
+    auto key = tr_quark{};
+    auto* child = static_cast<tr_variant*>(nullptr);
+    auto val = int64_t{};
+
+    for (size_t i = 0; i < NumKeys; ++i)
+    {
+        EXPECT_TRUE(tr_variantDictFindInt(&top, keys[i], &val));
+        EXPECT_EQ(int64_t(i), val);
+
+        // the children stay in the order they were added in
+        EXPECT_TRUE(tr_variantDictChild(&top, i, &key, &child));
+        EXPECT_EQ(keys[i], key);
+    }
+
+    EXPECT_EQ(nullptr, tr_variantDictFind(&top, tr_quark_new("dict-index-missing-key"sv)));
+
+    // replacing a value doesn't add a child
+    tr_variantDictAddInt(&top, keys[5], -5);
+    EXPECT_TRUE(tr_variantDictFindInt(&top, keys[5], &val));
+    EXPECT_EQ(-5, val);
+    EXPECT_FALSE(tr_variantDictChild(&top, NumKeys, &key, &child));
+
+    // and nor does replacing it with another type
+    tr_variantDictAddStr(&top, keys[6], "six"sv);
+    auto sv = std::string_view{};
+    EXPECT_TRUE(tr_variantDictFindStrView(&top, keys[6], &sv));
+    EXPECT_EQ("six"sv, sv);
+    EXPECT_FALSE(tr_variantDictChild(&top, NumKeys, &key, &child));
+
+    // remove all but a few keys, which takes the dict back under the index threshold
+    for (size_t i = 0; i < NumKeys; ++i)
+    {
+        if (i % 100 != 1)
+        {
+            EXPECT_TRUE(tr_variantDictRemove(&top, keys[i]));
+        }
+
+        for (auto const j : { size_t{ 1 }, size_t{ 101 }, NumKeys / 2 + 1, NumKeys - 99 })
+        {
+            EXPECT_TRUE(tr_variantDictFindInt(&top, keys[j], &val));
+            EXPECT_EQ(int64_t(j), val);
+        }
+    }
+
+    for (size_t i = 0; i < NumKeys; ++i)
+    {
+        EXPECT_EQ(i % 100 == 1, tr_variantDictFind(&top, keys[i]) != nullptr);
+    }
+
+    tr_variantFree(&top);
+}
@@ -0,0 +1,104 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "torrent.h"
+#include "verify.h"
+
+#include "test-fixtures.h"
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using VerifyTest = SessionTest;
+
+TEST_F(VerifyTest, settings)
+{
+    tr_sessionSetVerifyThreads(session_, 3);
+    EXPECT_EQ(3, tr_sessionGetVerifyThreads(session_));
+    tr_sessionSetVerifyIoLimit_MB(session_, 50);
+    EXPECT_EQ(50, tr_sessionGetVerifyIoLimit_MB(session_));
+
+    auto settings = tr_variant{};
+    tr_variantInitDict(&settings, 0);
+    tr_sessionGetSettings(session_, &settings);
+    auto i = int64_t{};
+    EXPECT_TRUE(tr_variantDictFindInt(&settings, TR_KEY_verify_threads, &i));
+    EXPECT_EQ(3, i);
+    EXPECT_TRUE(tr_variantDictFindInt(&settings, TR_KEY_verify_io_limit_mb, &i));
+    EXPECT_EQ(50, i);
+    tr_variantFree(&settings);
+
+    // zero or fewer threads still leaves one to do the work
+    tr_sessionSetVerifyThreads(session_, 0);
+    EXPECT_EQ(1, tr_sessionGetVerifyThreads(session_));
+    tr_sessionSetVerifyIoLimit_MB(session_, 0);
+}
+
+TEST_F(VerifyTest, manyThreads)
+{
+    // more threads than there are pieces to hand out
+    tr_sessionSetVerifyThreads(session_, 64);
+
+    auto* const tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, false);
+    EXPECT_FALSE(tor->hasPiece(0));
+    for (tr_piece_index_t i = 1, n = tor->pieceCount(); i < n; ++i)
+    {
+        EXPECT_TRUE(tor->hasPiece(i));
+    }
+
+    zeroTorrentPopulate(tor, true);
+    EXPECT_TRUE(tor->hasPiece(0));
+
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(VerifyTest, removeWhileVerifying)
+{
+    // read so slowly that the verify is still running when it's removed
+    tr_sessionSetVerifyThreads(session_, 2);
+    tr_sessionSetVerifyIoLimit_MB(session_, 1);
+
+    auto* const tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+
+    struct Result
+    {
+        bool done = false;
+        bool aborted = false;
+    };
+
+    auto result = Result{};
+    tr_verifyAdd(
+        tor,
+        [](tr_torrent*, bool aborted, void* vresult)
+        {
+            auto* const r = static_cast<Result*>(vresult);
+            r->aborted = aborted;
+            r->done = true;
+        },
+        &result);
+    EXPECT_TRUE(waitFor([tor]() { return tor->verifyState == TR_VERIFY_NOW; }, 2000));
+
+    // tr_verifyRemove() doesn't return until the callback has run
+    tr_verifyRemove(tor);
+    EXPECT_TRUE(result.done);
+    EXPECT_TRUE(result.aborted);
+    EXPECT_EQ(TR_VERIFY_NONE, tor->verifyState);
+
+    tr_sessionSetVerifyIoLimit_MB(session_, 0);
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -0,0 +1,244 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "file.h"
+#include "variant.h"
+#include "web.h"
+
+#include <event2/buffer.h>
+#include <event2/event.h>
+#include <event2/http.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std::literals;
+
+namespace
+{
+
+// A local HTTP server that answers every request with a tiny tracker response
+class HttpStandIn
+{
+public:
+    HttpStandIn()
+        : base_{ event_base_new() }
+        , http_{ evhttp_new(base_) }
+    {
+        evhttp_set_gencb(
+            http_,
+            [](evhttp_request* req, void* /*vself*/)
+            {
+                auto* const body = evbuffer_new();
+                evbuffer_add_printf(body, "d8:intervali1800e5:peers0:e");
+                evhttp_send_reply(req, HTTP_OK, "OK", body);
+                evbuffer_free(body);
+            },
+            this);
+
+        auto* const handle = evhttp_bind_socket_with_handle(http_, "127.0.0.1", 0);
+        auto addr = sockaddr_in{};
+        auto len = socklen_t{ sizeof(addr) };
+        getsockname(evhttp_bound_socket_get_fd(handle), reinterpret_cast<sockaddr*>(&addr), &len);
+        port_ = ntohs(addr.sin_port);
+
+        // libevent isn't set up for threads, so the loop can't be woken
+        // from another one. Have it poll for the stop flag instead
+        stop_timer_ = event_new(
+            base_,
+            -1,
+            EV_PERSIST,
+            [](evutil_socket_t, short, void* vself)
+            {
+                auto* const self = static_cast<HttpStandIn*>(vself);
+                if (self->stopping_)
+                {
+                    event_base_loopbreak(self->base_);
+                }
+            },
+            this);
+        auto const interval = timeval{ 0, 20000 };
+        event_add(stop_timer_, &interval);
+
+        thread_ = std::thread{ [this]() { event_base_dispatch(base_); } };
+    }
+
+    ~HttpStandIn()
+    {
+        stopping_ = true;
+        thread_.join();
+        event_free(stop_timer_);
+        evhttp_free(http_);
+        event_base_free(base_);
+    }
+
+    HttpStandIn(HttpStandIn const&) = delete;
+    HttpStandIn& operator=(HttpStandIn const&) = delete;
+
+    [[nodiscard]] std::string url() const
+    {
+        return "http://127.0.0.1:" + std::to_string(port_) + "/announce";
+    }
+
+private:
+    event_base* const base_;
+    evhttp* const http_;
+    event* stop_timer_ = nullptr;
+    uint16_t port_ = 0;
+    std::atomic<bool> stopping_ = false;
+    std::thread thread_;
+};
+
+void removeRecursive(std::string const& path)
+{
+    auto info = tr_sys_path_info{};
+    if (tr_sys_path_get_info(path.c_str(), 0, &info, nullptr) && info.type == TR_SYS_PATH_IS_DIRECTORY)
+    {
+        auto children = std::vector<std::string>{};
+        auto* const odir = tr_sys_dir_open(path.c_str(), nullptr);
+        char const* name = nullptr;
+        while ((name = tr_sys_dir_read_name(odir, nullptr)) != nullptr)
+        {
+            if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+            {
+                children.push_back(path + '/' + name);
+            }
+        }
+        tr_sys_dir_close(odir, nullptr);
+
+        for (auto const& child : children)
+        {
+            removeRecursive(child);
+        }
+    }
+
+    tr_sys_path_remove(path.c_str(), nullptr);
+}
+
+tr_session* sessionInit(std::string const& config_dir)
+{
+    auto settings = tr_variant{};
+    tr_variantInitDict(&settings, 0);
+    tr_sessionGetDefaultSettings(&settings);
+    tr_variantDictAddBool(&settings, TR_KEY_dht_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_lpd_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_utp_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_rpc_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_port_forwarding_enabled, false);
+    tr_variantDictAddInt(&settings, TR_KEY_message_level, TR_LOG_ERROR);
+    auto* const session = tr_sessionInit(config_dir.c_str(), false, &settings);
+    tr_variantFree(&settings);
+    return session;
+}
+
+// user + system CPU time used by this process so far, in msec
+double cpuMsec()
+{
+#ifndef _WIN32
+    auto usage = rusage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+#else
+    return 0;
+#endif
+}
+
+// Runs one request and returns how long it took for its done func to be called
+double fetchMsec(tr_session* session, std::string const& url)
+{
+    auto done = std::atomic<bool>{ false };
+    auto const begin = std::chrono::steady_clock::now();
+
+    tr_webRun(
+        session,
+        url,
+        [](tr_session* /*session*/,
+           bool /*did_connect*/,
+           bool /*did_timeout*/,
+           long /*response_code*/,
+           std::string_view /*response*/,
+           void* vdone) { *static_cast<std::atomic<bool>*>(vdone) = true; },
+        &done);
+
+    while (!done)
+    {
+        std::this_thread::yield();
+    }
+
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+} // namespace
+
+// Measures how long web requests to a local HTTP server take to complete,
+// and how much CPU the web thread uses while it's waiting for work.
+// usage: libtransmission-web-benchmark [requests] [idle-seconds]
+int main(int argc, char** argv)
+{
+    auto const n_requests = size_t(argc > 1 ? atoi(argv[1]) : 200);
+    auto const idle_secs = argc > 2 ? atoi(argv[2]) : 5;
+    if (n_requests == 0)
+    {
+        return 1;
+    }
+
+    auto config_dir = std::string{ "transmission-web-benchmark-XXXXXX" };
+    if (!tr_sys_dir_create_temp(std::data(config_dir), nullptr))
+    {
+        return 1;
+    }
+
+    auto const server = HttpStandIn{};
+    auto const url = server.url();
+    auto* const session = sessionInit(config_dir);
+
+    // the first request starts the web thread
+    fetchMsec(session, url);
+
+    auto msecs = std::vector<double>{};
+    for (size_t i = 0; i < n_requests; ++i)
+    {
+        msecs.push_back(fetchMsec(session, url));
+    }
+
+    std::sort(std::begin(msecs), std::end(msecs));
+    auto const sum = std::accumulate(std::begin(msecs), std::end(msecs), 0.0);
+    printf(
+        "%zu requests: mean %.2f ms, median %.2f ms, p99 %.2f ms, max %.2f ms\n",
+        n_requests,
+        sum / double(n_requests),
+        msecs[n_requests / 2],
+        msecs[std::min(n_requests - 1, n_requests * 99 / 100)],
+        msecs.back());
+
+    // nothing to do now, so any CPU used is from polling
+    auto const cpu_before = cpuMsec();
+    std::this_thread::sleep_for(std::chrono::seconds{ idle_secs });
+    auto const cpu_after = cpuMsec();
+    printf("idle for %d s: %.1f ms of CPU\n", idle_secs, cpu_after - cpu_before);
+
+    tr_sessionClose(session);
+    removeRecursive(config_dir);
+    return 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "crypto-utils.h"
+#include "torrent.h"
+#include "variant.h"
+
+#include "test-fixtures.h"
+
+#include <event2/buffer.h>
+#include <event2/event.h>
+#include <event2/http.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std::literals;
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+// A local HTTP server that serves files, and ranges of them, from memory
+class WebseedServer
+{
+public:
+    explicit WebseedServer(std::map<std::string, std::string> files)
+        : files_{ std::move(files) }
+        , base_{ event_base_new() }
+        , http_{ evhttp_new(base_) }
+    {
+        evhttp_set_gencb(
+            http_,
+            [](evhttp_request* req, void* vself) { static_cast<WebseedServer*>(vself)->onRequest(req); },
+            this);
+
+        auto* const handle = evhttp_bind_socket_with_handle(http_, "127.0.0.1", 0);
+        auto addr = sockaddr_in{};
+        auto len = socklen_t{ sizeof(addr) };
+        getsockname(evhttp_bound_socket_get_fd(handle), reinterpret_cast<sockaddr*>(&addr), &len);
+        port_ = ntohs(addr.sin_port);
+
+        // libevent isn't set up for threads, so the loop can't be woken
+        // from another one. Have it poll for the stop flag instead
+        stop_timer_ = event_new(
+            base_,
+            -1,
+            EV_PERSIST,
+            [](evutil_socket_t, short, void* vself)
+            {
+                auto* const self = static_cast<WebseedServer*>(vself);
+                if (self->stopping_)
+                {
+                    event_base_loopbreak(self->base_);
+                }
+            },
+            this);
+        auto const interval = timeval{ 0, 20000 };
+        event_add(stop_timer_, &interval);
+
+        thread_ = std::thread{ [this]() { event_base_dispatch(base_); } };
+    }
+
+    ~WebseedServer()
+    {
+        stopping_ = true;
+        thread_.join();
+        event_free(stop_timer_);
+        evhttp_free(http_);
+        event_base_free(base_);
+    }
+
+    WebseedServer(WebseedServer const&) = delete;
+    WebseedServer& operator=(WebseedServer const&) = delete;
+
+    [[nodiscard]] std::string url() const
+    {
+        return "http://127.0.0.1:" + std::to_string(port_) + "/";
+    }
+
+    [[nodiscard]] size_t requestCount() const
+    {
+        return n_requests_;
+    }
+
+    [[nodiscard]] size_t connectionCount() const
+    {
+        auto const lock = std::lock_guard{ mutex_ };
+        return std::size(client_ports_);
+    }
+
+private:
+    void onRequest(evhttp_request* req)
+    {
+        ++n_requests_;
+
+        // each TCP connection comes from its own client port
+        char* address = nullptr;
+        auto port = ev_uint16_t{};
+        evhttp_connection_get_peer(evhttp_request_get_connection(req), &address, &port);
+        {
+            auto const lock = std::lock_guard{ mutex_ };
+            client_ports_.insert(port);
+        }
+
+        auto const it = files_.find(evhttp_request_get_uri(req));
+        if (it == std::end(files_))
+        {
+            evhttp_send_error(req, HTTP_NOTFOUND, nullptr);
+            return;
+        }
+
+        auto const& contents = it->second;
+        auto first = uint64_t{};
+        auto last = uint64_t{};
+        auto const* const range = evhttp_find_header(evhttp_request_get_input_headers(req), "Range");
+        if (range == nullptr || sscanf(range, "bytes=%" SCNu64 "-%" SCNu64, &first, &last) != 2 || first > last ||
+            last >= std::size(contents))
+        {
+            evhttp_send_error(req, 416, nullptr);
+            return;
+        }
+
+        auto content_range = "bytes " + std::to_string(first) + '-' + std::to_string(last) + '/' +
+            std::to_string(std::size(contents));
+        evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Range", content_range.c_str());
+
+        auto* const body = evbuffer_new();
+        evbuffer_add(body, std::data(contents) + first, last + 1 - first);
+        evhttp_send_reply(req, 206, "Partial Content", body);
+        evbuffer_free(body);
+    }
+
+    std::map<std::string, std::string> const files_;
+    event_base* const base_;
+    evhttp* const http_;
+    event* stop_timer_ = nullptr;
+    uint16_t port_ = 0;
+    std::atomic<bool> stopping_ = false;
+    std::thread thread_;
+
+    std::atomic<size_t> n_requests_ = {};
+    mutable std::mutex mutex_;
+    std::set<ev_uint16_t> client_ports_;
+};
+
+class WebseedTest : public SessionTest
+{
+protected:
+    static auto constexpr MaxConnections = 2;
+    static auto constexpr PieceSize = uint32_t{ 256 * 1024 };
+
+    // Builds the metainfo for a multi-file torrent whose contents are `files`.
+    // The file sizes don't line up with the pieces, so some of the range
+    // requests have to be split across files
+    static std::string makeMetainfo(std::string const& name, std::vector<std::string> const& files, std::string const& url)
+    {
+        auto contents = std::string{};
+        for (auto const& file : files)
+        {
+            contents += file;
+        }
+
+        auto pieces = std::string{};
+        for (size_t offset = 0; offset < std::size(contents); offset += PieceSize)
+        {
+            auto const digest = *tr_sha1(std::string_view{ contents }.substr(offset, PieceSize));
+            pieces.append(reinterpret_cast<char const*>(std::data(digest)), std::size(digest));
+        }
+
+        auto top = tr_variant{};
+        tr_variantInitDict(&top, 2);
+        tr_variantDictAddStr(&top, TR_KEY_url_list, url);
+        auto* const info = tr_variantDictAddDict(&top, TR_KEY_info, 4);
+        tr_variantDictAddStr(info, TR_KEY_name, name);
+        tr_variantDictAddInt(info, TR_KEY_piece_length, PieceSize);
+        tr_variantDictAddRaw(info, TR_KEY_pieces, std::data(pieces), std::size(pieces));
+        auto* const file_list = tr_variantDictAddList(info, TR_KEY_files, std::size(files));
+        for (size_t i = 0; i < std::size(files); ++i)
+        {
+            auto* const file = tr_variantListAddDict(file_list, 2);
+            tr_variantDictAddInt(file, TR_KEY_length, std::size(files[i]));
+            auto* const path = tr_variantDictAddList(file, TR_KEY_path, 1);
+            tr_variantListAddStr(path, "file-" + std::to_string(i) + ".bin");
+        }
+
+        auto metainfo = tr_variantToStr(&top, TR_VARIANT_FMT_BENC);
+        tr_variantFree(&top);
+        return metainfo;
+    }
+
+    void SetUp() override
+    {
+        tr_variantDictAddInt(settings(), TR_KEY_webseed_connections, MaxConnections);
+
+        SessionTest::SetUp();
+    }
+};
+
+TEST_F(WebseedTest, downloadsFromLocalServer)
+{
+    auto const name = "webseed-test"s;
+    auto files = std::vector<std::string>{};
+    for (auto const size : { 1000000, 1, 2 * 1024 * 1024 + 123 })
+    {
+        auto& file = files.emplace_back(size, '\0');
+        tr_rand_buffer(std::data(file), std::size(file));
+    }
+
+    auto served = std::map<std::string, std::string>{};
+    for (size_t i = 0; i < std::size(files); ++i)
+    {
+        served.try_emplace("/" + name + "/file-" + std::to_string(i) + ".bin", files[i]);
+    }
+    auto const server = WebseedServer{ served };
+
+    // create the torrent and let it download from the webseed
+    auto const metainfo = makeMetainfo(name, files, server.url());
+    auto* const ctor = tr_ctorNew(session_);
+    tr_error* error = nullptr;
+    EXPECT_TRUE(tr_ctorSetMetainfo(ctor, std::data(metainfo), std::size(metainfo), &error));
+    EXPECT_EQ(nullptr, error);
+    tr_ctorSetPaused(ctor, TR_FORCE, false);
+    auto* const tor = tr_torrentNew(ctor, nullptr);
+    tr_ctorFree(ctor);
+    ASSERT_NE(nullptr, tor);
+    EXPECT_EQ(1U, tor->webseedCount());
+
+    auto test = [tor]()
+    {
+        return tr_torrentStat(tor)->leftUntilDone == 0;
+    };
+    EXPECT_TRUE(waitFor(test, 30000));
+
+    auto const* const st = tr_torrentStat(tor);
+    EXPECT_EQ(tor->totalSize(), st->haveValid);
+    EXPECT_EQ(0U, st->corruptEver);
+
+    // the ranges quickly grow to a whole piece, so there's about one request
+    // per piece plus one for each file boundary that a request runs across
+    auto const n_blocks = tor->blockCount();
+    EXPECT_LT(server.requestCount(), n_blocks / 4);
+
+    // the requests ran in parallel over kept-alive connections
+    EXPECT_LE(server.connectionCount(), size_t{ MaxConnections });
+    EXPECT_LT(server.connectionCount(), server.requestCount());
+
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+} // namespace test
+
+} // namespace libtransmission